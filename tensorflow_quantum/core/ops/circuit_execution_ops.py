@@ -82,6 +82,11 @@ def get_expectation_op(
             `cirq.DensityMatrixSimulator` or any
             `cirq.sim.simulator.SimulatesExpectationValues`. If not provided the
             default C++ analytical expectation calculation op is returned.
+            The string 'pauli_propagation' returns the C++ op that propagates
+            each operator backwards through the circuit instead of
+            simulating states, which scales to large near-Clifford circuits.
+            It is differentiated with the `tfq.differentiators.ParameterShift`
+            or finite difference differentiators.
         quantum_concurrent: Optional Python `bool`. True indicates that the
             returned op should not block graph level parallelism on itself when
             executing. False indicates that graph level parallelism on itself
@@ -120,16 +125,26 @@ def get_expectation_op(
     _check_quantum_concurrent(quantum_concurrent)
 
     op = None
+    cpp_backend = backend is None
     if backend is None:
         op = TFQStateVectorSimulator.expectation
 
+    if isinstance(backend, str) and backend == 'pauli_propagation':
+        cpp_backend = True
+        op = lambda programs, symbol_names, symbol_values, pauli_sums: \
+            tfq_simulate_ops.tfq_simulate_expectation(
+                programs, symbol_names, symbol_values, pauli_sums,
+                backend='pauli_propagation')
+
     # TODO(zaqqwerty): remove DM check after cirq #3964
     if isinstance(backend, (cirq.sim.simulator.SimulatesExpectationValues,
                             cirq.DensityMatrixSimulator)):
         op = cirq_ops._get_cirq_analytical_expectation(backend)
 
     if op is not None:
-        if quantum_concurrent is True:
+        # The C++ simulators are scheduled by a process wide scheduler with
+        # its own memory budget and never need to be serialized here.
+        if quantum_concurrent is True or cpp_backend:
             # Return an op that does not block graph level parallelism.
             return lambda programs, symbol_names, symbol_values, pauli_sums: \
                 op(programs, symbol_names, symbol_values, pauli_sums)
@@ -226,7 +241,9 @@ def get_sampling_op(
         op = cirq_ops._get_cirq_samples(backend)
 
     if op is not None:
-        if quantum_concurrent is True:
+        # The C++ simulators are scheduled by a process wide scheduler with
+        # its own memory budget and never need to be serialized here.
+        if quantum_concurrent is True or backend is None:
             # Return an op that does not block graph level parallelism.
             return lambda programs, symbol_names, symbol_values, num_samples: \
                 tfq_utility_ops.padded_to_ragged(
@@ -315,7 +332,9 @@ def get_state_op(
         op = cirq_ops._get_cirq_simulate_state(backend)
 
     if op is not None:
-        if quantum_concurrent is True:
+        # The C++ simulators are scheduled by a process wide scheduler with
+        # its own memory budget and never need to be serialized here.
+        if quantum_concurrent is True or backend is None:
             # Return an op that does not block graph level parallelism.
             return lambda programs, symbol_names, symbol_values: \
                 tfq_utility_ops.padded_to_ragged(
@@ -426,7 +445,9 @@ def get_sampled_expectation_op(
         op = cirq_ops._get_cirq_sampled_expectation(backend)
 
     if op is not None:
-        if quantum_concurrent is True:
+        # The C++ simulators are scheduled by a process wide scheduler with
+        # its own memory budget and never need to be serialized here.
+        if quantum_concurrent is True or backend is None:
             # Return an op that does not block graph level parallelism.
             return lambda programs, symbol_names, symbol_values, pauli_sums, \
                 num_samples: op(programs,
@@ -14,7 +14,11 @@
 # =============================================================================
 """Module for tfq.core.ops.noise.*"""
 
+from tensorflow_quantum.core.ops.noise.noisy_adj_grad_op import \
+adjoint_gradient
 from tensorflow_quantum.core.ops.noise.noisy_expectation_op import expectation
 from tensorflow_quantum.core.ops.noise.noisy_sampled_expectation_op import \
 sampled_expectation
 from tensorflow_quantum.core.ops.noise.noisy_samples_op import samples
+from tensorflow_quantum.core.ops.noise.readout_error_op import (
+    readout_error, readout_mitigated_expectation)
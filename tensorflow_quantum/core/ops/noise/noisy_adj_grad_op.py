@@ -0,0 +1,76 @@
+# Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+"""Module for the exact noisy adjoint gradient op."""
+import os
+import tensorflow as tf
+from tensorflow_quantum.core.ops.load_module import load_module
+
+NOISY_OP_MODULE = load_module(os.path.join("noise", "_tfq_noise_ops.so"))
+
+
+def adjoint_gradient(programs,
+                     symbol_names,
+                     symbol_values,
+                     pauli_sums,
+                     prev_grad,
+                     noise_model=None):
+    """Calculate exact gradients of noisy expectation values.
+
+    The density matrix of each circuit is simulated once forwards and the
+    weighted operators are propagated once backwards through the adjoints
+    of its gates and channels, like the adjoint method for pure states. This
+    gives the exact gradient of the noisy expectation value that
+    `tfq.noise.expectation` estimates, with no trajectories and no parameter
+    shifts. Density matrices of n qubits take as much memory as state
+    vectors of 2n qubits, so circuits are limited to 12 qubits.
+
+
+    >>> qubit = cirq.GridQubit(0, 0)
+    >>> circuit = cirq.Circuit(cirq.X(qubit)**sympy.Symbol('alpha'),
+    ...                        cirq.depolarize(0.1)(qubit))
+    >>> grads = tfq.noise.adjoint_gradient(
+    ...     tfq.convert_to_tensor([circuit]), ['alpha'], [[0.5]],
+    ...     tfq.convert_to_tensor([[cirq.Z(qubit)]]), [[1.0]])
+
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        pauli_sums: `tf.Tensor` of strings with shape [batch_size, n_ops]
+            containing the string representation of the operators that will
+            be used on all of the circuits in the expectation calculations.
+        prev_grad: `tf.Tensor` of real numbers with shape [batch_size, n_ops]
+            backprop of values from downstream in the compute graph.
+        noise_model: Optional `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits, 4] adding noise to `programs` while
+            they are parsed, as in `tfq.noise.expectation`.
+    Returns:
+        `tf.Tensor` with shape [batch_size, n_params] that holds the gradient
+            of the noisy expectation values with respect to the symbols,
+            weighted by `prev_grad`.
+    """
+    return NOISY_OP_MODULE.tfq_noisy_adjoint_gradient(
+        programs, symbol_names, tf.cast(symbol_values, tf.float32), pauli_sums,
+        tf.cast(prev_grad, tf.float32),
+        tf.zeros((0, 0, 4))
+        if noise_model is None else tf.cast(noise_model, tf.float32))
@@ -0,0 +1,178 @@
+# Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+"""Tests for the noisy adjoint gradient op."""
+# Remove PYTHONPATH collisions for protobuf.
+# pylint: disable=wrong-import-position
+import sys
+
+NEW_PATH = [x for x in sys.path if 'com_google_protobuf' not in x]
+sys.path = NEW_PATH
+# pylint: enable=wrong-import-position
+
+import numpy as np
+import tensorflow as tf
+import sympy
+import cirq
+
+from tensorflow_quantum.core.ops import batch_util
+from tensorflow_quantum.core.ops.noise import noisy_adj_grad_op
+from tensorflow_quantum.python import util
+
+
+def _finite_difference(circuits, symbol_names, symbol_values, pauli_sums,
+                       prev_grad, eps=1e-3):
+    """Central differences of exact density matrix expectations."""
+    sim = cirq.DensityMatrixSimulator()
+    grads = np.zeros(symbol_values.shape)
+    for k in range(len(symbol_names)):
+        shifted = []
+        for sign in [1, -1]:
+            values = np.array(symbol_values)
+            values[:, k] += sign * eps
+            resolvers = [
+                cirq.ParamResolver(dict(zip(symbol_names, row)))
+                for row in values
+            ]
+            shifted.append(
+                batch_util.batch_calculate_expectation(
+                    circuits, resolvers, pauli_sums, sim))
+        grads[:, k] = np.sum((shifted[0] - shifted[1]) / (2 * eps) *
+                             prev_grad,
+                             axis=1)
+    return grads
+
+
+class NoisyAdjointGradientTest(tf.test.TestCase):
+    """Tests tfq_noisy_adjoint_gradient."""
+
+    def test_noisy_adjoint_gradient(self):
+        """Gradients match finite differences of exact noisy expectations."""
+        qubits = cirq.GridQubit.rect(1, 3)
+        symbol_names = ['alpha', 'beta', 'gamma']
+        alpha, beta, gamma = [sympy.Symbol(s) for s in symbol_names]
+        circuit = cirq.Circuit(
+            cirq.H(qubits[0]),
+            cirq.X(qubits[1])**alpha,
+            cirq.depolarize(0.05)(qubits[0]),
+            cirq.CNOT(qubits[0], qubits[1]),
+            cirq.amplitude_damp(0.1)(qubits[1]),
+            cirq.ZZPowGate(exponent=beta).on(qubits[1], qubits[2]),
+            cirq.Y(qubits[2])**gamma,
+            cirq.phase_damp(0.2)(qubits[2]),
+            cirq.PhasedXPowGate(phase_exponent=alpha).on(qubits[0]),
+            cirq.bit_flip(0.1)(qubits[0]),
+        )
+        symbol_values = np.array([[0.3, 0.8, -0.4], [1.2, -0.5, 0.7]])
+        pauli_sums = [[
+            cirq.Z(qubits[0]) * cirq.X(qubits[1]),
+            cirq.Y(qubits[2]) + 0.5 * cirq.Z(qubits[1])
+        ]] * 2
+        prev_grad = np.array([[1.0, -0.5], [0.3, 2.0]])
+
+        grads = noisy_adj_grad_op.adjoint_gradient(
+            util.convert_to_tensor([circuit, circuit]), symbol_names,
+            symbol_values, util.convert_to_tensor(pauli_sums), prev_grad)
+        expected = _finite_difference([circuit, circuit], symbol_names,
+                                      symbol_values, pauli_sums, prev_grad)
+        self.assertAllClose(expected, grads, atol=1e-3)
+
+    def test_noise_model(self):
+        """Injected noise is differentiated like explicit channels."""
+        qubits = cirq.LineQubit.range(2)
+        circuit = cirq.Circuit(
+            cirq.X(qubits[0])**sympy.Symbol('alpha'),
+            cirq.CNOT(qubits[0], qubits[1]))
+        # [1q depolarize, multi qubit depolarize, amplitude, phase damping]
+        rates = [[0.05, 0.03, 0.0, 0.0], [0.0, 0.04, 0.0, 0.0]]
+        explicit = cirq.Circuit(
+            cirq.X(qubits[0])**sympy.Symbol('alpha'),
+            cirq.depolarize(0.05)(qubits[0]),
+            cirq.CNOT(qubits[0], qubits[1]),
+            cirq.depolarize(0.03)(qubits[0]),
+            cirq.depolarize(0.04)(qubits[1]))
+        pauli_sums = [[cirq.Z(qubits[0]) * cirq.Z(qubits[1])]]
+
+        grads = noisy_adj_grad_op.adjoint_gradient(
+            util.convert_to_tensor([circuit]), ['alpha'], [[0.4]],
+            util.convert_to_tensor(pauli_sums), [[1.0]],
+            noise_model=[rates])
+        expected = _finite_difference([explicit], ['alpha'],
+                                      np.array([[0.4]]), pauli_sums,
+                                      np.array([[1.0]]))
+        self.assertAllClose(expected, grads, atol=1e-3)
+
+    def test_mixed_qubit_counts(self):
+        """Circuits on fewer qubits than earlier ones in the batch."""
+        qubits = cirq.GridQubit.rect(1, 3)
+        symbol_names = ['alpha', 'beta']
+        alpha, beta = [sympy.Symbol(s) for s in symbol_names]
+        circuits = [
+            cirq.Circuit(
+                cirq.H(qubits[0]),
+                cirq.X(qubits[1])**alpha,
+                cirq.CNOT(qubits[1], qubits[2]),
+                cirq.depolarize(0.05)(qubits[2]),
+                cirq.Y(qubits[2])**beta),
+            cirq.Circuit(cirq.X(qubits[0])**alpha,
+                         cirq.amplitude_damp(0.1)(qubits[0]),
+                         cirq.Y(qubits[0])**beta),
+            cirq.Circuit(cirq.Y(qubits[0])**beta,
+                         cirq.CZ(qubits[0], qubits[1])**alpha,
+                         cirq.bit_flip(0.1)(qubits[1]),
+                         cirq.X(qubits[1])**alpha),
+        ]
+        symbol_values = np.array([[0.3, 0.8], [1.2, -0.5], [-0.4, 0.6]])
+        pauli_sums = [
+            [cirq.Z(qubits[0]) * cirq.Z(qubits[2])],
+            [cirq.Z(qubits[0])],
+            [cirq.X(qubits[0]) * cirq.Z(qubits[1])],
+        ]
+        prev_grad = np.array([[1.0], [-0.5], [2.0]])
+
+        grads = noisy_adj_grad_op.adjoint_gradient(
+            util.convert_to_tensor(circuits), symbol_names, symbol_values,
+            util.convert_to_tensor(pauli_sums), prev_grad)
+        expected = _finite_difference(circuits, symbol_names, symbol_values,
+                                      pauli_sums, prev_grad)
+        self.assertAllClose(expected, grads, atol=1e-3)
+
+    def test_noisy_adjoint_gradient_inputs(self):
+        """Make sure the op fails gracefully on bad inputs."""
+        qubits = cirq.GridQubit.rect(1, 13)
+        circuit = cirq.Circuit(cirq.X.on_each(*qubits))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'at most 12 qubits'):
+            noisy_adj_grad_op.adjoint_gradient(
+                util.convert_to_tensor([circuit]), [], [[]],
+                util.convert_to_tensor([[cirq.Z(qubits[0])]]), [[1.0]])
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'gradients and pauli sum'):
+            noisy_adj_grad_op.adjoint_gradient(
+                util.convert_to_tensor([cirq.Circuit(cirq.X(qubits[0]))]),
+                [], [[]], util.convert_to_tensor([[cirq.Z(qubits[0])]]),
+                [[1.0, 1.0]])
+
+    def test_empty_circuit(self):
+        """Empty circuits have zero gradients."""
+        empty_paulis = tf.convert_to_tensor([[]], dtype=tf.dtypes.string)
+        grads = noisy_adj_grad_op.adjoint_gradient(
+            util.convert_to_tensor([cirq.Circuit()]), ['alpha'], [[1.0]],
+            empty_paulis, [[]])
+        self.assertAllClose(grads, [[0.0]])
+
+
+if __name__ == "__main__":
+    tf.test.main()
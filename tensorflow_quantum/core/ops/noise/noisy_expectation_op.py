@@ -20,7 +20,15 @@ from tensorflow_quantum.core.ops.load_module import load_module
 NOISY_OP_MODULE = load_module(os.path.join("noise", "_tfq_noise_ops.so"))
 
 
-def expectation(programs, symbol_names, symbol_values, pauli_sums, num_samples):
+def expectation(programs,
+                symbol_names,
+                symbol_values,
+                pauli_sums,
+                num_samples,
+                seed=None,
+                noise_model=None,
+                backend='trajectories',
+                truncation_threshold=1e-6):
     """Calculate the analytic expectation values using monte-carlo trajectories.
 
     Simulate the final state of `programs` given `symbol_values` are placed
@@ -33,6 +41,17 @@ def expectation(programs, symbol_names, symbol_values, pauli_sums, num_samples):
     calculation done using monte carlo state vector simulation to account
     for noisy operations in the given circuits.
 
+    The trajectory in which every channel picks its most likely operator
+    (usually "no error") is simulated exactly once and weighted by its
+    probability. All `num_samples` trajectories are then drawn conditioned
+    on at least one error, so weak noise needs far fewer samples for the
+    same precision, and circuits without noise are computed exactly.
+
+    Gates and channels outside the backward light cone of `pauli_sums` can
+    not change the result, so they are dropped along with the qubits they
+    leave idle before simulating. Idle qubits with damping or other noise
+    cost nothing unless the operators act on them.
+
 
     >>> # Prepare some inputs.
     >>> qubit = cirq.GridQubit(0, 0)
@@ -83,11 +102,33 @@ def expectation(programs, symbol_names, symbol_values, pauli_sums, num_samples):
         num_samples: `tf.Tensor` with `num_samples[i][j]` is equal to the
             number of times `programs[i]` will be simulated to estimate
             `pauli_sums[i][j]`. Therefore, `num_samples` must have the same
-            shape as `pauli_sums`. Note: internally this quantity can get
-            rounded up to the nearest multiple of the number of available
-            threads to TensorFlow. For best performance ensure that the
-            quantities in `num_samples` are a multiple of the number of
-            available threads.
+            shape as `pauli_sums`.
+        seed: Optional nonzero Python integer. Every trajectory draws its
+            randomness from a stream keyed on `seed`, the circuit index and
+            the trajectory index, so a fixed seed gives bitwise identical
+            results regardless of the number of threads. If `None`, a new
+            seed is drawn on every call.
+        noise_model: Optional `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits, 4] adding noise to `programs` while
+            they are parsed, so that circuits need no explicit channels and
+            noise can be swept without serializing them again.
+            `noise_model[i][k]` holds the rates for the k-th qubit of
+            `programs[i]` (in sorted order): the depolarizing probability
+            after each single qubit gate on it, the depolarizing
+            probability after each multi qubit gate on it, and the
+            amplitude and phase damping applied to it after every moment.
+            Zero rates add no channels.
+        backend: Python `str`, either 'trajectories' (default) to average
+            `num_samples` sampled trajectories, or 'pauli_propagation' to
+            propagate each operator backwards through the circuit gates and
+            channels as a sum of Pauli strings. The latter is exact and
+            ignores `num_samples`, but only supports Pauli channels
+            (depolarizing, asymmetric depolarizing, bit flip and phase
+            flip) and unitary gates on at most four qubits.
+        truncation_threshold: Python `float`. With the 'pauli_propagation'
+            backend, Pauli strings whose coefficient magnitude falls below
+            this value are dropped after every gate and channel. 0 keeps
+            every string.
     Returns:
         `tf.Tensor` with shape [batch_size, n_ops] that holds the
             expectation value for each circuit with each op applied to it
@@ -95,4 +136,9 @@ def expectation(programs, symbol_names, symbol_values, pauli_sums, num_samples):
     """
     return NOISY_OP_MODULE.tfq_noisy_expectation(
         programs, symbol_names, tf.cast(symbol_values, tf.float32), pauli_sums,
-        tf.cast(num_samples, dtype=tf.int32))
+        tf.cast(num_samples, dtype=tf.int32),
+        tf.zeros((0, 0, 4))
+        if noise_model is None else tf.cast(noise_model, tf.float32),
+        seed=0 if seed is None else seed,
+        backend=backend,
+        truncation_threshold=truncation_threshold)
@@ -311,6 +311,197 @@ class NoisyExpectationCalculationTest(tf.test.TestCase, parameterized.TestCase):
 
         self.assertAllClose(cirq_exps, op_exps, atol=5e-2, rtol=5e-2)
 
+    @parameterized.parameters([{
+        'channel': cirq.depolarize(1e-3)
+    }, {
+        'channel': cirq.amplitude_damp(1e-3)
+    }])
+    def test_weak_noise_few_samples(self, channel):
+        """Weak noise is resolved with a handful of trajectories."""
+        symbol_names = []
+        batch_size = 5
+        n_qubits = 6
+        qubits = cirq.LineQubit.range(n_qubits)
+
+        circuit_batch, resolver_batch = \
+            util.random_circuit_resolver_batch(
+                qubits, batch_size, include_channels=False)
+
+        for i in range(batch_size):
+            circuit_batch[i] = circuit_batch[i] + channel.on_each(*qubits)
+
+        symbol_values_array = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+
+        pauli_sums1 = util.random_pauli_sums(qubits, 3, batch_size)
+        pauli_sums2 = util.random_pauli_sums(qubits, 3, batch_size)
+        batch_pauli_sums = [[x, y] for x, y in zip(pauli_sums1, pauli_sums2)]
+        num_samples = [[10] * 2] * batch_size
+
+        op_exps = noisy_expectation_op.expectation(
+            util.convert_to_tensor(circuit_batch),
+            symbol_names, symbol_values_array,
+            util.convert_to_tensor(batch_pauli_sums), num_samples)
+
+        cirq_exps = batch_util.batch_calculate_expectation(
+            circuit_batch, resolver_batch, batch_pauli_sums,
+            cirq.DensityMatrixSimulator())
+
+        self.assertAllClose(cirq_exps, op_exps, atol=5e-3, rtol=5e-3)
+
+    def test_noise_model(self):
+        """A noise model matches the same channels written out in cirq."""
+        qubits = cirq.LineQubit.range(2)
+        circuit = cirq.Circuit(cirq.H(qubits[0]),
+                               cirq.CNOT(qubits[0], qubits[1]))
+        # [1q depolarize, multi qubit depolarize, amplitude, phase damping]
+        rates = [[0.05, 0.03, 0.02, 0.01], [0.0, 0.04, 0.03, 0.0]]
+
+        explicit = cirq.Circuit()
+        for moment in circuit:
+            explicit.append(moment)
+            for op in moment:
+                rate = 0 if len(op.qubits) == 1 else 1
+                explicit.append(
+                    cirq.depolarize(rates[qubits.index(q)][rate])(q)
+                    for q in op.qubits
+                    if rates[qubits.index(q)][rate] > 0)
+            for k, q in enumerate(qubits):
+                if rates[k][2] > 0:
+                    explicit.append(cirq.amplitude_damp(rates[k][2])(q))
+                if rates[k][3] > 0:
+                    explicit.append(cirq.phase_damp(rates[k][3])(q))
+
+        pauli_sums = [[cirq.Z(qubits[0]) * cirq.Z(qubits[1]),
+                       cirq.X(qubits[0]) * cirq.X(qubits[1])]]
+        op_exps = noisy_expectation_op.expectation(
+            util.convert_to_tensor([circuit]), [],
+            np.zeros((1, 0)),
+            util.convert_to_tensor(pauli_sums), [[10000, 10000]],
+            noise_model=[rates])
+
+        cirq_exps = batch_util.batch_calculate_expectation(
+            [explicit], [cirq.ParamResolver({})], pauli_sums,
+            cirq.DensityMatrixSimulator())
+
+        self.assertAllClose(cirq_exps, op_exps, atol=5e-2, rtol=5e-2)
+
+    def test_light_cone(self):
+        """Idle noisy qubits outside the light cone are not simulated."""
+        # 40 qubits would not fit in memory, the light cone of the
+        # operators only holds the first two.
+        qubits = cirq.GridQubit.rect(1, 40)
+
+        def noisy_bell(qubits):
+            return cirq.Circuit(cirq.H(qubits[0]),
+                                cirq.CNOT(qubits[0], qubits[1]),
+                                cirq.depolarize(0.1)(qubits[1]),
+                                cirq.amplitude_damp(0.1).on_each(*qubits))
+
+        circuit = noisy_bell(qubits)
+        pauli_sums = [[
+            cirq.Z(qubits[0]) * cirq.Z(qubits[1]),
+            cirq.X(qubits[0]) * cirq.X(qubits[1])
+        ]]
+        op_exps = noisy_expectation_op.expectation(
+            util.convert_to_tensor([circuit]), [],
+            np.zeros((1, 0)),
+            util.convert_to_tensor(pauli_sums), [[2000, 2000]])
+
+        cirq_exps = batch_util.batch_calculate_expectation(
+            [noisy_bell(qubits[:2])], [cirq.ParamResolver({})], pauli_sums,
+            cirq.DensityMatrixSimulator())
+        self.assertAllClose(cirq_exps, op_exps, atol=5e-2, rtol=5e-2)
+
+    def test_identity_observable(self):
+        """Constant operators on nonempty circuits give their constant."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        circuit = cirq.Circuit(cirq.H(qubits[0]),
+                               cirq.CNOT(qubits[0], qubits[1]),
+                               cirq.depolarize(0.1)(qubits[1]))
+        pauli_sums = util.convert_to_tensor(
+            [[2.0 * cirq.PauliString(), cirq.Z(qubits[0])],
+             [2.0 * cirq.PauliString(), cirq.Z(qubits[0])]])
+        programs = util.convert_to_tensor([circuit, cirq.Circuit()])
+        for backend in ['trajectories', 'pauli_propagation']:
+            op_exps = noisy_expectation_op.expectation(programs, [],
+                                                       np.zeros((2, 0)),
+                                                       pauli_sums,
+                                                       [[100, 100]] * 2,
+                                                       backend=backend)
+            self.assertAllClose(op_exps[0][0], 2.0)
+            self.assertAllClose(op_exps[1], [-2.0, -2.0])
+
+    def test_seed_reproducible(self):
+        """A fixed seed gives identical results on every call."""
+        symbol_names = []
+        batch_size = 3
+        qubits = cirq.LineQubit.range(4)
+
+        circuit_batch, resolver_batch = \
+            util.random_circuit_resolver_batch(
+                qubits, batch_size, include_channels=True)
+
+        symbol_values_array = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+
+        pauli_sums = util.random_pauli_sums(qubits, 3, batch_size)
+        batch_pauli_sums = [[x] for x in pauli_sums]
+        num_samples = [[100]] * batch_size
+
+        def run(seed):
+            return noisy_expectation_op.expectation(
+                util.convert_to_tensor(circuit_batch),
+                symbol_names,
+                symbol_values_array,
+                util.convert_to_tensor(batch_pauli_sums),
+                num_samples,
+                seed=seed)
+
+        self.assertAllEqual(run(1234), run(1234))
+
+    def test_pauli_propagation(self):
+        """Pauli propagation is exact for Pauli channels."""
+        qubits = cirq.GridQubit.rect(1, 3)
+        circuit = cirq.Circuit(
+            cirq.H(qubits[0]), cirq.CNOT(qubits[0], qubits[1]),
+            cirq.depolarize(0.05)(qubits[0]),
+            cirq.bit_flip(0.1)(qubits[1]),
+            cirq.Y(qubits[2])**0.3,
+            cirq.asymmetric_depolarize(0.01, 0.02, 0.03)(qubits[2]),
+            cirq.CZ(qubits[1], qubits[2])**0.5,
+            cirq.phase_flip(0.2)(qubits[1]))
+        pauli_sums = [[
+            cirq.Z(qubits[0]) * cirq.Z(qubits[1]),
+            cirq.X(qubits[0]) * cirq.X(qubits[1]) * cirq.Z(qubits[2]),
+            cirq.X(qubits[2]) + 0.5 * cirq.Z(qubits[2])
+        ]]
+        op_exps = noisy_expectation_op.expectation(
+            util.convert_to_tensor([circuit]), [],
+            np.zeros((1, 0)),
+            util.convert_to_tensor(pauli_sums), [[1, 1, 1]],
+            backend='pauli_propagation',
+            truncation_threshold=0.0)
+
+        cirq_exps = batch_util.batch_calculate_expectation(
+            [circuit], [cirq.ParamResolver({})], pauli_sums,
+            cirq.DensityMatrixSimulator())
+        self.assertAllClose(cirq_exps, op_exps, atol=1e-5)
+
+        damped = cirq.Circuit(cirq.H(qubits[0]),
+                              cirq.amplitude_damp(0.1)(qubits[0]))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'only supports Pauli channels'):
+            noisy_expectation_op.expectation(
+                util.convert_to_tensor([damped]), [],
+                np.zeros((1, 0)),
+                util.convert_to_tensor([[cirq.Z(qubits[0])]]), [[1]],
+                backend='pauli_propagation')
+
     def test_correctness_empty(self):
         """Test the expectation for empty circuits."""
         empty_circuit = util.convert_to_tensor([cirq.Circuit()])
@@ -334,11 +525,14 @@ class NoisyExpectationCalculationTest(tf.test.TestCase, parameterized.TestCase):
         empty_paulis = tf.raw_ops.Empty(shape=(0, 0), dtype=tf.string)
         empty_n_samples = tf.raw_ops.Empty(shape=(0, 0), dtype=tf.int32)
 
-        out = noisy_expectation_op.expectation(empty_circuit, empty_symbols,
-                                               empty_values, empty_paulis,
-                                               empty_n_samples)
-
-        self.assertShapeEqual(np.zeros((0, 0)), out)
+        for backend in ['trajectories', 'pauli_propagation']:
+            out = noisy_expectation_op.expectation(empty_circuit,
+                                                   empty_symbols,
+                                                   empty_values,
+                                                   empty_paulis,
+                                                   empty_n_samples,
+                                                   backend=backend)
+            self.assertShapeEqual(np.zeros((0, 0)), out)
 
 
 if __name__ == "__main__":
@@ -20,8 +20,12 @@ from tensorflow_quantum.core.ops.load_module import load_module
 NOISY_OP_MODULE = load_module(os.path.join("noise", "_tfq_noise_ops.so"))
 
 
-def sampled_expectation(programs, symbol_names, symbol_values, pauli_sums,
-                        num_samples):
+def sampled_expectation(programs,
+                        symbol_names,
+                        symbol_values,
+                        pauli_sums,
+                        num_samples,
+                        noise_model=None):
     """Estimates (via sampling) expectation values using monte-carlo simulation.
 
     Simulate the final state of `programs` given `symbol_values` are placed
@@ -32,6 +36,10 @@ def sampled_expectation(programs, symbol_names, symbol_values, pauli_sums,
     calculated after each run. Once all the runs are finished, these quantities
     are averaged together.
 
+    Gates and channels outside the backward light cone of `pauli_sums` can
+    not change the result, so they are dropped along with the qubits they
+    leave idle before simulating.
+
 
     >>> # Prepare some inputs.
     >>> qubit = cirq.GridQubit(0, 0)
@@ -87,6 +95,16 @@ def sampled_expectation(programs, symbol_names, symbol_values, pauli_sums,
             threads to TensorFlow. For best performance ensure that the
             quantities in `num_samples` are a multiple of the number of
             available threads.
+        noise_model: Optional `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits, 4] adding noise to `programs` while
+            they are parsed, so that circuits need no explicit channels and
+            noise can be swept without serializing them again.
+            `noise_model[i][k]` holds the rates for the k-th qubit of
+            `programs[i]` (in sorted order): the depolarizing probability
+            after each single qubit gate on it, the depolarizing
+            probability after each multi qubit gate on it, and the
+            amplitude and phase damping applied to it after every moment.
+            Zero rates add no channels.
     Returns:
         `tf.Tensor` with shape [batch_size, n_ops] that holds the
             expectation value for each circuit with each op applied to it
@@ -94,4 +112,6 @@ def sampled_expectation(programs, symbol_names, symbol_values, pauli_sums,
     """
     return NOISY_OP_MODULE.tfq_noisy_sampled_expectation(
         programs, symbol_names, tf.cast(symbol_values, tf.float32), pauli_sums,
-        tf.cast(num_samples, dtype=tf.int32))
+        tf.cast(num_samples, dtype=tf.int32),
+        tf.zeros((0, 0, 4))
+        if noise_model is None else tf.cast(noise_model, tf.float32))
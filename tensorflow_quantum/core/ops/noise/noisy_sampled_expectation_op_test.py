@@ -311,6 +311,19 @@ class NoisyExpectationCalculationTest(tf.test.TestCase, parameterized.TestCase):
 
         self.assertAllClose(cirq_exps, op_exps, atol=0.35, rtol=0.35)
 
+    def test_identity_observable(self):
+        """Constant operators on nonempty circuits give their constant."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        circuit = cirq.Circuit(cirq.H(qubits[0]),
+                               cirq.CNOT(qubits[0], qubits[1]),
+                               cirq.depolarize(0.1)(qubits[1]))
+        pauli_sums = util.convert_to_tensor([[2.0 * cirq.PauliString()],
+                                             [2.0 * cirq.PauliString()]])
+        op_exps = noisy_sampled_expectation_op.sampled_expectation(
+            util.convert_to_tensor([circuit, cirq.Circuit()]), [],
+            np.zeros((2, 0)), pauli_sums, [[100], [100]])
+        self.assertAllClose(op_exps, [[2.0], [-2.0]])
+
     def test_correctness_empty(self):
         """Test the expectation for empty circuits."""
         empty_circuit = util.convert_to_tensor([cirq.Circuit()])
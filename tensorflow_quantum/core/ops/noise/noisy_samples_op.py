@@ -17,11 +17,19 @@ import os
 import tensorflow as tf
 from tensorflow_quantum.core.ops import tfq_utility_ops
 from tensorflow_quantum.core.ops.load_module import load_module
+from tensorflow_quantum.core.ops.noise import readout_error_op
 
 NOISY_OP_MODULE = load_module(os.path.join("noise", "_tfq_noise_ops.so"))
 
 
-def samples(programs, symbol_names, symbol_values, num_samples):
+def samples(programs,
+            symbol_names,
+            symbol_values,
+            num_samples,
+            shots_per_trajectory=1,
+            readout_p0to1=None,
+            readout_p1to0=None,
+            noise_model=None):
     """Generate samples using the C++ noisy trajectory simulator.
 
     Simulate the final state of `programs` given `symbol_values` are placed
@@ -29,6 +37,11 @@ def samples(programs, symbol_names, symbol_values, num_samples):
     Channels in this simulation will be "tossed" to a certain realization
     during simulation. After each simulation is a run a single bitstring
     will be drawn. These simulations are repeated `num_samples` times.
+    With `shots_per_trajectory` above one, several bitstrings are drawn from
+    every simulated trajectory instead, so far fewer simulations are needed.
+    Readout errors given by `readout_p0to1` and `readout_p1to0` are applied
+    to the bitstrings afterwards (see `readout_error`), which is much
+    cheaper than adding bit flip channels before measurement.
 
 
     >>> # Sample a noisy circuit with C++.
@@ -62,10 +75,45 @@ def samples(programs, symbol_names, symbol_values, num_samples):
             dictated by `symbol_names`.
         num_samples: `tf.Tensor` with one element indicating the number of
             samples to draw for all circuits in the batch.
+        shots_per_trajectory: Python `int` giving the number of samples
+            drawn from each trajectory. Each sample still follows the noisy
+            output distribution exactly, but samples from the same
+            trajectory are correlated. 0 picks a value for every circuit
+            from the expected number of errors per trajectory, so that
+            weakly noisy circuits need only a few hundred trajectories.
+        readout_p0to1: Optional `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits] holding the probability of reading
+            each qubit's 0 as 1. Columns follow the padded samples, so a
+            circuit with fewer qubits uses the last columns of its row.
+        readout_p1to0: Optional `tf.Tensor` like `readout_p0to1` holding
+            the probability of reading a 1 as 0. Must be given together
+            with `readout_p0to1`.
+        noise_model: Optional `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits, 4] adding noise to `programs` while
+            they are parsed, so that circuits need no explicit channels and
+            noise can be swept without serializing them again.
+            `noise_model[i][k]` holds the rates for the k-th qubit of
+            `programs[i]` (in sorted order): the depolarizing probability
+            after each single qubit gate on it, the depolarizing
+            probability after each multi qubit gate on it, and the
+            amplitude and phase damping applied to it after every moment.
+            Zero rates add no channels.
     Returns:
         A `tf.Tensor` containing the samples taken from each circuit in
         `programs`.
     """
     padded_samples = NOISY_OP_MODULE.tfq_noisy_samples(
-        programs, symbol_names, tf.cast(symbol_values, tf.float32), num_samples)
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        num_samples,
+        tf.zeros((0, 0, 4))
+        if noise_model is None else tf.cast(noise_model, tf.float32),
+        shots_per_trajectory=shots_per_trajectory)
+    if (readout_p0to1 is None) != (readout_p1to0 is None):
+        raise ValueError("readout_p0to1 and readout_p1to0 must be given "
+                         "together.")
+    if readout_p0to1 is not None:
+        padded_samples = readout_error_op.readout_error(
+            padded_samples, readout_p0to1, readout_p1to0)
     return tfq_utility_ops.padded_to_ragged(padded_samples)
\ No newline at end of file
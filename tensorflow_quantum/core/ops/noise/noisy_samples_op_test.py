@@ -236,6 +236,70 @@ class NoisySamplingTest(tf.test.TestCase, parameterized.TestCase):
         for a, b in zip(op_hists, cirq_hists):
             self.assertLess(stats.entropy(a + 1e-8, b + 1e-8), 0.15)
 
+    @parameterized.parameters([{
+        'shots_per_trajectory': x
+    } for x in [0, 10]])
+    def test_shots_per_trajectory(self, shots_per_trajectory):
+        """Test that reusing trajectories keeps the sample distribution."""
+        symbol_names = ['alpha', 'beta']
+        batch_size = 3
+        n_qubits = 4
+        qubits = cirq.LineQubit.range(n_qubits)
+
+        circuit_batch, resolver_batch = \
+            util.random_symbol_circuit_resolver_batch(
+                qubits, symbol_names, batch_size, include_channels=True)
+
+        symbol_values_array = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+
+        n_samples = 10000
+        op_samples = noisy_samples_op.samples(
+            util.convert_to_tensor(circuit_batch),
+            symbol_names,
+            symbol_values_array, [n_samples],
+            shots_per_trajectory=shots_per_trajectory).to_list()
+        op_hists = self._compute_hists(op_samples, n_qubits)
+
+        cirq_samples = batch_util.batch_sample(circuit_batch, resolver_batch,
+                                               n_samples,
+                                               cirq.DensityMatrixSimulator())
+        cirq_hists = self._compute_hists(cirq_samples, n_qubits)
+
+        for a, b in zip(op_hists, cirq_hists):
+            self.assertLess(stats.entropy(a + 1e-8, b + 1e-8), 1.5)
+
+    def test_shots_per_trajectory_noiseless(self):
+        """Test that noiseless circuits are sampled from one trajectory."""
+        qubits = cirq.LineQubit.range(2)
+        circuit = cirq.Circuit(cirq.X(qubits[0]), cirq.I(qubits[1]))
+        out = noisy_samples_op.samples(util.convert_to_tensor([circuit]), [],
+                                       [[]], [100],
+                                       shots_per_trajectory=0).to_tensor()
+        self.assertAllEqual(out, np.tile([[[1, 0]]], (1, 100, 1)))
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'shots_per_trajectory must be'):
+            noisy_samples_op.samples(util.convert_to_tensor([circuit]), [],
+                                     [[]], [100],
+                                     shots_per_trajectory=-1)
+
+    def test_shots_per_trajectory_unordered(self):
+        """Test that shots of one trajectory are not written in order."""
+        qubits = cirq.LineQubit.range(2)
+        circuit = cirq.Circuit(cirq.H.on_each(*qubits))
+        for batch_size in [1, 2]:
+            out = noisy_samples_op.samples(
+                util.convert_to_tensor([circuit] * batch_size), [],
+                [[]] * batch_size, [1000],
+                shots_per_trajectory=0).to_tensor().numpy()
+            for rows in out:
+                values = rows[:, 0] * 2 + rows[:, 1]
+                # Independent uniform shots decrease 3 / 8 of the time.
+                self.assertGreater(np.sum(values[1:] < values[:-1]), 250)
+
     def test_correct_padding(self):
         """Test the variable sized circuits are properly padded."""
         symbol_names = []
@@ -296,5 +360,29 @@ class NoisySamplingTest(tf.test.TestCase, parameterized.TestCase):
         self.assertShapeEqual(np.zeros((0, 0, 0)), out.to_tensor())
 
 
+    def test_readout_error(self):
+        """Readout errors are applied to the padded samples."""
+        qubits = cirq.LineQubit.range(2)
+        circuit_batch = [
+            cirq.Circuit(cirq.X(qubits[0])),
+            cirq.Circuit(cirq.X(qubits[0]), cirq.I(qubits[1]))
+        ]
+        # Every 1 is read as 0 and the second qubit is never misread.
+        p0to1 = [[0.0, 0.0], [0.0, 0.0]]
+        p1to0 = [[1.0, 1.0], [1.0, 1.0]]
+        out = noisy_samples_op.samples(util.convert_to_tensor(circuit_batch),
+                                       [],
+                                       np.zeros((2, 0)), [100],
+                                       readout_p0to1=p0to1,
+                                       readout_p1to0=p1to0)
+        self.assertAllEqual(out.to_list(),
+                            [[[0]] * 100, [[0, 0]] * 100])
+
+        with self.assertRaisesRegex(ValueError, 'given together'):
+            noisy_samples_op.samples(util.convert_to_tensor(circuit_batch),
+                                     [],
+                                     np.zeros((2, 0)), [100],
+                                     readout_p0to1=p0to1)
+
 if __name__ == "__main__":
     tf.test.main()
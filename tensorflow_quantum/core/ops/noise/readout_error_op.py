@@ -0,0 +1,103 @@
+# Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+"""Module for readout error and readout mitigation ops."""
+import os
+import tensorflow as tf
+from tensorflow_quantum.core.ops.load_module import load_module
+
+NOISY_OP_MODULE = load_module(os.path.join("noise", "_tfq_noise_ops.so"))
+
+
+def readout_error(samples, p0to1, p1to0, seed=None):
+    """Apply independent per qubit readout errors to padded samples.
+
+    Readout errors are applied to the bitstrings after sampling rather than
+    simulated as bit flip channels, so they add no trajectories and cost
+    next to nothing. Each 0 in column `k` of `samples[i]` is read as 1 with
+    probability `p0to1[i][k]` and each 1 is read as 0 with probability
+    `p1to0[i][k]`. Padding entries (-2) are left untouched.
+
+
+    >>> qubits = cirq.GridQubit.rect(1, 2)
+    >>> circuit = tfq.convert_to_tensor([cirq.Circuit(cirq.X(qubits[0]))])
+    >>> samples = tfq.core.ops.tfq_simulate_ops.tfq_simulate_samples(
+    ...     circuit, [], [[]], [1000])
+    >>> noisy = tfq.noise.readout_error(samples, [[0.01, 0.01]],
+    ...                                 [[0.05, 0.05]])
+
+
+    Args:
+        samples: `tf.Tensor` of `int8` with shape
+            [batch_size, n_samples, max_n_qubits] as output by
+            `tfq_simulate_samples` or the raw `tfq_noisy_samples` op, with
+            -2 padding.
+        p0to1: `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits] holding the probability of reading
+            a 0 as 1 in each column of `samples`.
+        p1to0: `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits] holding the probability of reading
+            a 1 as 0 in each column of `samples`.
+        seed: Optional nonzero Python integer. A fixed seed gives identical
+            flips on every call. If `None`, a new seed is drawn on every
+            call.
+    Returns:
+        `tf.Tensor` with the same shape and padding as `samples` holding the
+        samples after readout.
+    """
+    return NOISY_OP_MODULE.tfq_readout_error(tf.cast(samples, tf.int8),
+                                             tf.cast(p0to1, tf.float32),
+                                             tf.cast(p1to0, tf.float32),
+                                             seed=0 if seed is None else seed)
+
+
+def readout_mitigated_expectation(programs, samples, pauli_sums, p0to1,
+                                  p1to0):
+    """Estimate Z string expectations from samples with readout mitigation.
+
+    Readout errors are assumed independent between qubits (tensored). A
+    shot reading 0 or 1 on a qubit is then replaced by the single shot
+    estimate of the noiseless <Z> obtained by inverting that qubit's 2x2
+    confusion matrix, and the estimates are multiplied over the qubits of
+    each term. The average over shots is an unbiased estimate of the
+    noiseless expectation, at the cost of a larger variance.
+
+    Only terms made of Z operators are supported. To mitigate other terms
+    rotate `programs` into their measurement basis before sampling.
+
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits that were sampled.
+            Only used to resolve the qubits of `pauli_sums`.
+        samples: `tf.Tensor` of `int8` with shape
+            [batch_size, n_samples, max_n_qubits] holding the padded samples
+            of `programs`, e.g. the output of `readout_error`.
+        pauli_sums: `tf.Tensor` of strings with shape [batch_size, n_ops]
+            containing the string representation of the Z only operators to
+            estimate.
+        p0to1: `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits] holding the probability of reading
+            a 0 as 1 in each column of `samples`.
+        p1to0: `tf.Tensor` of real numbers with shape
+            [batch_size, max_n_qubits] holding the probability of reading
+            a 1 as 0 in each column of `samples`. `p0to1 + p1to0` must be
+            below 1 on every measured qubit.
+    Returns:
+        `tf.Tensor` with shape [batch_size, n_ops] holding the mitigated
+        expectation values.
+    """
+    return NOISY_OP_MODULE.tfq_readout_mitigated_expectation(
+        programs, tf.cast(samples, tf.int8), pauli_sums,
+        tf.cast(p0to1, tf.float32), tf.cast(p1to0, tf.float32))
@@ -0,0 +1,120 @@
+# Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+"""Tests for the readout error and readout mitigation ops."""
+# Remove PYTHONPATH collisions for protobuf.
+# pylint: disable=wrong-import-position
+import sys
+
+NEW_PATH = [x for x in sys.path if 'com_google_protobuf' not in x]
+sys.path = NEW_PATH
+# pylint: enable=wrong-import-position
+
+import numpy as np
+import tensorflow as tf
+import cirq
+
+from tensorflow_quantum.core.ops.noise import readout_error_op
+from tensorflow_quantum.python import util
+
+
+class ReadoutErrorTest(tf.test.TestCase):
+    """Tests readout_error and readout_mitigated_expectation."""
+
+    def test_readout_error_inputs(self):
+        """Make sure readout_error fails gracefully on bad inputs."""
+        samples = np.zeros((2, 10, 3), dtype=np.int8)
+        probs = np.full((2, 3), 0.1)
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'must have shape'):
+            readout_error_op.readout_error(samples, probs[:1], probs)
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'must hold probabilities'):
+            readout_error_op.readout_error(samples, probs, probs + 1.0)
+
+    def test_readout_error_rates(self):
+        """Flip rates follow p0to1 and p1to0 and padding is kept."""
+        n_samples = 5000
+        samples = np.zeros((1, n_samples, 3), dtype=np.int8)
+        samples[:, :, 0] = -2
+        samples[:, n_samples // 2:, 2] = 1
+        p0to1 = np.array([[0.5, 0.1, 0.2]])
+        p1to0 = np.array([[0.5, 0.0, 0.3]])
+
+        noisy = readout_error_op.readout_error(samples, p0to1, p1to0,
+                                               seed=1234).numpy()
+
+        self.assertAllEqual(noisy[:, :, 0], samples[:, :, 0])
+        self.assertAllClose(np.mean(noisy[0, :, 1]), 0.1, atol=0.02)
+        self.assertAllClose(np.mean(noisy[0, :n_samples // 2, 2]),
+                            0.2,
+                            atol=0.03)
+        self.assertAllClose(np.mean(noisy[0, n_samples // 2:, 2]),
+                            0.7,
+                            atol=0.03)
+
+        # A fixed seed flips the same shots.
+        again = readout_error_op.readout_error(samples, p0to1, p1to0,
+                                               seed=1234).numpy()
+        self.assertAllEqual(noisy, again)
+
+    def test_mitigated_expectation(self):
+        """Mitigation removes the readout bias of Z strings."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        circuit = cirq.Circuit(cirq.X(qubits[0]))
+        ops = [[
+            cirq.Z(qubits[0]),
+            cirq.Z(qubits[1]), 2.0 * cirq.Z(qubits[0]) * cirq.Z(qubits[1])
+        ]]
+        n_samples = 20000
+        samples = np.zeros((1, n_samples, 2), dtype=np.int8)
+        samples[:, :, 0] = 1
+        p0to1 = np.array([[0.05, 0.1]])
+        p1to0 = np.array([[0.2, 0.05]])
+        noisy = readout_error_op.readout_error(samples, p0to1, p1to0, seed=7)
+
+        mitigated = readout_error_op.readout_mitigated_expectation(
+            util.convert_to_tensor([circuit]), noisy,
+            util.convert_to_tensor(ops), p0to1, p1to0)
+        self.assertAllClose(mitigated, [[-1.0, 1.0, -2.0]], atol=0.05)
+
+        # Without readout errors the estimate is the plain sample mean.
+        exact = readout_error_op.readout_mitigated_expectation(
+            util.convert_to_tensor([circuit]), samples,
+            util.convert_to_tensor(ops), np.zeros((1, 2)), np.zeros((1, 2)))
+        self.assertAllClose(exact, [[-1.0, 1.0, -2.0]])
+
+    def test_mitigated_expectation_inputs(self):
+        """Make sure mitigation fails gracefully on unsupported input."""
+        qubit = cirq.GridQubit(0, 0)
+        circuit = util.convert_to_tensor([cirq.Circuit(cirq.X(qubit))])
+        samples = np.ones((1, 10, 1), dtype=np.int8)
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'only supports Z'):
+            readout_error_op.readout_mitigated_expectation(
+                circuit, samples, util.convert_to_tensor([[cirq.X(qubit)]]),
+                [[0.1]], [[0.1]])
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'cannot be inverted'):
+            readout_error_op.readout_mitigated_expectation(
+                circuit, samples, util.convert_to_tensor([[cirq.Z(qubit)]]),
+                [[0.5]], [[0.5]])
+
+
+if __name__ == "__main__":
+    tf.test.main()
@@ -0,0 +1,436 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <memory>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/seqfor.h"
+#include "../qsim/lib/simmux.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/adj_util.h"
+#include "tensorflow_quantum/core/src/density_matrix.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+
+namespace tfq {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::Program;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::Circuit<QsimGate> QsimCircuit;
+typedef qsim::NoisyCircuit<QsimGate> NoisyQsimCircuit;
+
+// Density matrices of n qubits are simulated as 2n qubit state vectors and
+// every worker holds several of them.
+static const int kMaxNoisyAdjointQubits = 12;
+
+class TfqNoisyAdjointGradientOp : public tensorflow::OpKernel {
+ public:
+  explicit TfqNoisyAdjointGradientOp(
+      tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    // TODO (mbbrough): add more dimension checks for other inputs here.
+    const int num_inputs = context->num_inputs();
+    OP_REQUIRES(context, num_inputs == 6,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Expected 6 inputs, got ", num_inputs, " inputs.")));
+
+    // Create the output Tensor.
+    const int output_dim_batch_size = context->input(2).dim_size(0);
+    const int output_dim_param_size = context->input(2).dim_size(1);
+    tensorflow::TensorShape output_shape;
+    output_shape.AddDim(output_dim_batch_size);
+    output_shape.AddDim(output_dim_param_size);
+
+    tensorflow::Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+    auto output_tensor = output->matrix<float>();
+
+    // Parse program protos.
+    std::vector<Program> programs;
+    std::vector<int> num_qubits;
+    std::vector<std::vector<PauliSum>> pauli_sums;
+    OP_REQUIRES_OK(context, GetProgramsAndNumQubits(context, &programs,
+                                                    &num_qubits, &pauli_sums));
+
+    std::vector<SymbolMap> maps;
+    OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
+
+    OP_REQUIRES(context, programs.size() == maps.size(),
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Number of circuits and symbol_values do not match. Got ",
+                    programs.size(), " circuits and ", maps.size(),
+                    " symbol values.")));
+
+    int max_num_qubits = 0;
+    for (const int num : num_qubits) {
+      max_num_qubits = std::max(max_num_qubits, num);
+    }
+    OP_REQUIRES(context, max_num_qubits <= kMaxNoisyAdjointQubits,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Noisy adjoint gradients support circuits of at most ",
+                    kMaxNoisyAdjointQubits, " qubits. Got ", max_num_qubits,
+                    " qubits.")));
+
+    std::vector<NoiseModel> noise_models;
+    OP_REQUIRES_OK(context,
+                   GetNoiseModels(context, num_qubits, &noise_models));
+
+    // Construct qsim circuits.
+    std::vector<NoisyQsimCircuit> qsim_circuits(programs.size(),
+                                                NoisyQsimCircuit());
+
+    // track metadata.
+    std::vector<std::vector<tfq::GateMetaData>> gate_meta(
+        programs.size(), std::vector<tfq::GateMetaData>({}));
+
+    // track gradients
+    std::vector<std::vector<GradientOfGate>> gradient_gates(
+        programs.size(), std::vector<GradientOfGate>({}));
+
+    Status parse_status = ::tensorflow::Status();
+    auto p_lock = tensorflow::mutex();
+    auto construct_f = [&](int start, int end) {
+      for (int i = start; i < end; i++) {
+        Status local = NoisyQsimCircuitFromProgram(
+            programs[i], maps[i], num_qubits[i], false, &qsim_circuits[i],
+            &noise_models[i], &gate_meta[i]);
+        NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
+
+        // The gates alone, so that gradient_gates index gate_meta. The
+        // partial fuses are not needed since channels are applied one at a
+        // time.
+        QsimCircuit gates;
+        gates.num_qubits = num_qubits[i];
+        for (const auto& meta : gate_meta[i]) {
+          const QsimChannel& channel = qsim_circuits[i].channels[meta.index];
+          gates.gates.push_back(channel[0].ops[0]);
+        }
+        std::vector<std::vector<qsim::GateFused<QsimGate>>> unused;
+        CreateGradientCircuit(gates, gate_meta[i], &unused,
+                              &gradient_gates[i]);
+      }
+    };
+
+    const int num_cycles = 1000;
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        programs.size(), num_cycles, construct_f);
+    OP_REQUIRES_OK(context, parse_status);
+
+    // Get downstream gradients.
+    std::vector<std::vector<float>> downstream_grads;
+    OP_REQUIRES_OK(context, GetPrevGrads(context, &downstream_grads));
+
+    OP_REQUIRES(context, downstream_grads.size() == programs.size(),
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Number of gradients and circuits do not match. Got ",
+                    downstream_grads.size(), " gradients and ",
+                    programs.size(), " circuits.")));
+
+    OP_REQUIRES(
+        context, context->input(4).dim_size(1) == context->input(3).dim_size(1),
+        tensorflow::errors::InvalidArgument(absl::StrCat(
+            "Number of gradients and pauli sum dimension do not match. Got ",
+            context->input(4).dim_size(1), " gradient entries and ",
+            context->input(3).dim_size(1), " paulis per circuit.")));
+
+    output_tensor.setZero();
+
+    // Each density matrix takes as much memory as a state vector of twice
+    // the qubits, and every circuit needs four of them plus its
+    // checkpoints.
+    if (2 * max_num_qubits >= 20 || programs.size() == 1) {
+      ComputeLarge(num_qubits, qsim_circuits, maps, gate_meta, gradient_gates,
+                   pauli_sums, downstream_grads, context, &output_tensor);
+    } else {
+      ComputeSmall(num_qubits, max_num_qubits, qsim_circuits, maps, gate_meta,
+                   gradient_gates, pauli_sums, downstream_grads, context,
+                   &output_tensor);
+    }
+  }
+
+ private:
+  // Adds the gradient of circuit i to row i of output_tensor with one
+  // forward sweep of rho = E(|0><0|) and one reverse sweep of
+  // lambda = E^dagger(sum_j downstream_grads[i][j] * pauli_sums[i][j]).
+  // Noise channels can not be undone on rho, so rho is checkpointed before
+  // the last gradient gate of every run of gates between two noise
+  // channels and recovered from there by undoing gates.
+  template <typename SimT, typename StateSpaceT, typename StateT>
+  void ComputeGradient(
+      const int i, const int nq, const NoisyQsimCircuit& ncircuit,
+      const SymbolMap& map, const std::vector<tfq::GateMetaData>& gate_meta,
+      const std::vector<GradientOfGate>& gradient_gates,
+      const std::vector<PauliSum>& pauli_sums,
+      const std::vector<float>& downstream_grads, const SimT& sim,
+      const StateSpaceT& ss, StateT& rho, StateT& lambda, StateT& scratch,
+      StateT& sum, tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    const int num_channels = ncircuit.channels.size();
+
+    // gradient_gates entry of every channel, or -1.
+    std::vector<int> grad_at(num_channels, -1);
+    for (size_t g = 0; g < gradient_gates.size(); g++) {
+      grad_at[gate_meta[gradient_gates[g].index].index] = g;
+    }
+
+    std::vector<int> checkpoint_at(num_channels, -1);
+    int num_checkpoints = 0;
+    bool needs_checkpoint = true;
+    for (int c = num_channels - 1; c >= 0; c--) {
+      if (!IsGateChannel(ncircuit.channels[c])) {
+        needs_checkpoint = true;
+      } else if (grad_at[c] >= 0 && needs_checkpoint) {
+        checkpoint_at[c] = num_checkpoints++;
+        needs_checkpoint = false;
+      }
+    }
+    std::vector<StateT> checkpoints;
+    checkpoints.reserve(num_checkpoints);
+    for (int k = 0; k < num_checkpoints; k++) {
+      checkpoints.push_back(ss.Create(2 * nq));
+    }
+
+    ss.SetStateZero(rho);
+    for (int c = 0; c < num_channels; c++) {
+      if (checkpoint_at[c] >= 0) {
+        ss.Copy(rho, checkpoints[checkpoint_at[c]]);
+      }
+      ApplyDensityMatrixChannel(sim, ss, ncircuit.channels[c], false, rho,
+                                scratch, sum);
+    }
+
+    // lambda = vec(sum_j downstream_grads[j] * pauli_sums[j]).
+    SetDensityMatrixIdentity(ss, scratch);
+    [[maybe_unused]] Status unused = AccumulateOperators(
+        pauli_sums, downstream_grads, sim, ss, scratch, sum, lambda);
+
+    // When rho_valid is true, rho holds the state right before the last
+    // channel visited.
+    bool rho_valid = false;
+    for (int c = num_channels - 1; c >= 0; c--) {
+      const QsimChannel& channel = ncircuit.channels[c];
+      if (checkpoint_at[c] >= 0) {
+        ss.Copy(checkpoints[checkpoint_at[c]], rho);
+        rho_valid = true;
+      } else if (!IsGateChannel(channel)) {
+        rho_valid = false;
+      } else if (rho_valid) {
+        ApplyDensityMatrixChannel(sim, ss, channel, true, rho, scratch, sum);
+      }
+
+      if (grad_at[c] >= 0) {
+        // rho is the state before the gate and lambda the observable after
+        // it, so d<O>/dtheta = 2 Re Tr(lambda dU rho U^dagger).
+        const QsimGate& cur_gate = channel[0].ops[0];
+        const GradientOfGate& grad = gradient_gates[grad_at[c]];
+        const QsimGate column = DensityMatrixGate(cur_gate, nq, false, false);
+
+        // if applicable compute control qubit mask and control value bits
+        // on the row qubits.
+        uint64_t mask = 0;
+        uint64_t cbits = 0;
+        for (size_t k = 0; k < cur_gate.controlled_by.size(); k++) {
+          uint64_t control_loc = cur_gate.controlled_by[k] + nq;
+          mask |= uint64_t{1} << control_loc;
+          cbits |= ((cur_gate.cmask >> k) & 1) << control_loc;
+        }
+
+        for (size_t k = 0; k < grad.grad_gates.size(); k++) {
+          ss.Copy(rho, scratch);
+          if (!cur_gate.controlled_by.empty()) {
+            // Gradient of controlled gates puts zeros on diagonal which is
+            // the same as collapsing the rows and then applying the
+            // non-controlled version of the gradient gate.
+            ss.BulkSetAmpl(scratch, mask, cbits, 0, 0, true);
+          }
+          qsim::ApplyGate(
+              sim, DensityMatrixGate(grad.grad_gates[k], nq, true, false),
+              scratch);
+          qsim::ApplyGate(sim, column, scratch);
+
+          // don't need not-found check since this is done upstream already.
+          const auto it = map.find(grad.params[k]);
+          const int loc = it->second.first;
+          (*output_tensor)(i, loc) += ss.RealInnerProduct(lambda, scratch) +
+                                      ss.RealInnerProduct(scratch, lambda);
+        }
+      }
+
+      ApplyDensityMatrixChannel(sim, ss, channel, true, lambda, scratch, sum);
+    }
+  }
+
+  void ComputeSmall(
+      const std::vector<int>& num_qubits, const int max_num_qubits,
+      const std::vector<NoisyQsimCircuit>& qsim_circuits,
+      const std::vector<SymbolMap>& maps,
+      const std::vector<std::vector<tfq::GateMetaData>>& gate_meta,
+      const std::vector<std::vector<tfq::GradientOfGate>>& gradient_gates,
+      const std::vector<std::vector<PauliSum>>& pauli_sums,
+      const std::vector<std::vector<float>>& downstream_grads,
+      tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    // Instantiate qsim objects.
+    const auto tfq_for = qsim::SequentialFor(1);
+    using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    auto DoWork = [&](int start, int end) {
+      // Begin simulation. The density matrices must match the number of
+      // qubits of each circuit exactly, since rows and columns are split
+      // at half of their qubits.
+      int state_nq = 1;
+      Simulator sim = Simulator(tfq_for);
+      StateSpace ss = StateSpace(tfq_for);
+      auto rho = ss.Create(2 * state_nq);
+      auto lambda = ss.Create(2 * state_nq);
+      auto scratch = ss.Create(2 * state_nq);
+      auto sum = ss.Create(2 * state_nq);
+
+      for (int i = start; i < end; i++) {
+        int nq = num_qubits[i];
+
+        // (#679) Just ignore empty program
+        if (qsim_circuits[i].channels.size() == 0) {
+          continue;
+        }
+
+        if (nq != state_nq) {
+          state_nq = nq;
+          rho = ss.Create(2 * state_nq);
+          lambda = ss.Create(2 * state_nq);
+          scratch = ss.Create(2 * state_nq);
+          sum = ss.Create(2 * state_nq);
+        }
+
+        ComputeGradient(i, nq, qsim_circuits[i], maps[i], gate_meta[i],
+                        gradient_gates[i], pauli_sums[i], downstream_grads[i],
+                        sim, ss, rho, lambda, scratch, sum, output_tensor);
+      }
+    };
+
+    const int64_t num_cycles =
+        200 * (int64_t(1) << static_cast<int64_t>(2 * max_num_qubits));
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        qsim_circuits.size(), num_cycles, DoWork);
+  }
+
+  void ComputeLarge(
+      const std::vector<int>& num_qubits,
+      const std::vector<NoisyQsimCircuit>& qsim_circuits,
+      const std::vector<SymbolMap>& maps,
+      const std::vector<std::vector<tfq::GateMetaData>>& gate_meta,
+      const std::vector<std::vector<tfq::GradientOfGate>>& gradient_gates,
+      const std::vector<std::vector<PauliSum>>& pauli_sums,
+      const std::vector<std::vector<float>>& downstream_grads,
+      tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    // Instantiate qsim objects.
+    const auto tfq_for = tfq::QsimFor(context);
+    using Simulator = qsim::Simulator<const tfq::QsimFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    // Begin simulation. The density matrices must match the number of
+    // qubits of each circuit exactly, since rows and columns are split at
+    // half of their qubits.
+    int state_nq = 1;
+    Simulator sim = Simulator(tfq_for);
+    StateSpace ss = StateSpace(tfq_for);
+    auto rho = ss.Create(2 * state_nq);
+    auto lambda = ss.Create(2 * state_nq);
+    auto scratch = ss.Create(2 * state_nq);
+    auto sum = ss.Create(2 * state_nq);
+
+    for (size_t i = 0; i < qsim_circuits.size(); i++) {
+      int nq = num_qubits[i];
+
+      // (#679) Just ignore empty program
+      if (qsim_circuits[i].channels.size() == 0) {
+        continue;
+      }
+
+      if (nq != state_nq) {
+        state_nq = nq;
+        rho = ss.Create(2 * state_nq);
+        lambda = ss.Create(2 * state_nq);
+        scratch = ss.Create(2 * state_nq);
+        sum = ss.Create(2 * state_nq);
+      }
+
+      ComputeGradient(i, nq, qsim_circuits[i], maps[i], gate_meta[i],
+                      gradient_gates[i], pauli_sums[i], downstream_grads[i],
+                      sim, ss, rho, lambda, scratch, sum, output_tensor);
+    }
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqNoisyAdjointGradient").Device(tensorflow::DEVICE_CPU),
+    TfqNoisyAdjointGradientOp);
+
+REGISTER_OP("TfqNoisyAdjointGradient")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("pauli_sums: string")
+    .Input("downstream_grads: float")
+    .Input("noise_model: float")
+    .Output("grads: float")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle pauli_sums_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &pauli_sums_shape));
+
+      tensorflow::shape_inference::ShapeHandle downstream_grads_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &downstream_grads_shape));
+
+      tensorflow::shape_inference::ShapeHandle noise_model_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 3, &noise_model_shape));
+
+      tensorflow::shape_inference::DimensionHandle output_rows =
+          c->Dim(symbol_values_shape, 0);
+      tensorflow::shape_inference::DimensionHandle output_cols =
+          c->Dim(symbol_names_shape, 0);
+      c->set_output(0, c->Matrix(output_rows, output_cols));
+
+      return ::tensorflow::Status();
+    });
+
+}  // namespace tfq
@@ -15,17 +15,16 @@ limitations under the License.
 
 #include <memory>
 #include <random>
+#include <string>
 #include <vector>
 
 #include "../qsim/lib/channel.h"
 #include "../qsim/lib/channels_cirq.h"
 #include "../qsim/lib/circuit.h"
 #include "../qsim/lib/circuit_noisy.h"
-#include "../qsim/lib/fuser_mqubit.h"
 #include "../qsim/lib/gate_appl.h"
 #include "../qsim/lib/gates_cirq.h"
 #include "../qsim/lib/io.h"
-#include "../qsim/lib/qtrajectory.h"
 #include "../qsim/lib/seqfor.h"
 #include "../qsim/lib/simmux.h"
 #include "tensorflow/core/framework/op_kernel.h"
@@ -34,13 +33,16 @@ limitations under the License.
 #include "tensorflow/core/lib/core/error_codes.pb.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/random/philox_random.h"
 #include "tensorflow/core/lib/random/random.h"
-#include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/platform/mutex.h"
-#include "tensorflow/core/util/guarded_philox_random.h"
 #include "tensorflow_quantum/core/ops/parse_context.h"
 #include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/light_cone.h"
+#include "tensorflow_quantum/core/src/noisy_trajectory.h"
+#include "tensorflow_quantum/core/src/pauli_propagation.h"
+#include "tensorflow_quantum/core/src/trajectory_batch.h"
 #include "tensorflow_quantum/core/src/util_qsim.h"
 
 namespace tfq {
@@ -53,17 +55,48 @@ typedef qsim::Cirq::GateCirq<float> QsimGate;
 typedef qsim::Circuit<QsimGate> QsimCircuit;
 typedef qsim::NoisyCircuit<QsimGate> NoisyQsimCircuit;
 
+// Seed of trajectory `trajectory` of circuit `circuit`. Every trajectory
+// draws from its own Philox stream, so results do not depend on how the
+// trajectories are split across threads.
+static uint64_t TrajectorySeed(const uint64_t base, const int circuit,
+                               const int trajectory) {
+  tensorflow::random::PhiloxRandom::ResultType counter;
+  counter[0] = static_cast<uint32_t>(trajectory);
+  counter[1] = static_cast<uint32_t>(circuit);
+  counter[2] = 0;
+  counter[3] = 0;
+  tensorflow::random::PhiloxRandom::Key key;
+  key[0] = static_cast<uint32_t>(base);
+  key[1] = static_cast<uint32_t>(base >> 32);
+  tensorflow::random::PhiloxRandom gen(counter, key);
+  const auto sample = gen();
+  return (static_cast<uint64_t>(sample[0]) << 32) | sample[1];
+}
+
 class TfqNoisyExpectationOp : public tensorflow::OpKernel {
  public:
   explicit TfqNoisyExpectationOp(tensorflow::OpKernelConstruction* context)
-      : OpKernel(context) {}
+      : OpKernel(context) {
+    tensorflow::int64 seed;
+    OP_REQUIRES_OK(context, context->GetAttr("seed", &seed));
+    seed_ = static_cast<uint64_t>(seed);
+    std::string backend;
+    OP_REQUIRES_OK(context, context->GetAttr("backend", &backend));
+    pauli_propagation_ = backend == "pauli_propagation";
+    OP_REQUIRES_OK(context, context->GetAttr("truncation_threshold",
+                                             &truncation_threshold_));
+    OP_REQUIRES(context, truncation_threshold_ >= 0.0,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "truncation_threshold must be non-negative. Got ",
+                    truncation_threshold_, ".")));
+  }
 
   void Compute(tensorflow::OpKernelContext* context) override {
     // TODO (mbbrough): add more dimension checks for other inputs here.
     const int num_inputs = context->num_inputs();
-    OP_REQUIRES(context, num_inputs == 5,
+    OP_REQUIRES(context, num_inputs == 6,
                 tensorflow::errors::InvalidArgument(absl::StrCat(
-                    "Expected 5 inputs, got ", num_inputs, " inputs.")));
+                    "Expected 6 inputs, got ", num_inputs, " inputs.")));
 
     // Create the output Tensor.
     const int output_dim_batch_size = context->input(0).dim_size(0);
@@ -107,17 +140,31 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
             context->input(4).dim_size(1), " lists of sample sizes and ",
             context->input(3).dim_size(1), " lists of pauli sums.")));
 
+    std::vector<NoiseModel> noise_models;
+    OP_REQUIRES_OK(context,
+                   GetNoiseModels(context, num_qubits, &noise_models));
+
     // Construct qsim circuits.
     std::vector<NoisyQsimCircuit> qsim_circuits(programs.size(),
                                                 NoisyQsimCircuit());
+    std::vector<FusedNoisyCircuit> fused_circuits(programs.size());
 
     Status parse_status = ::tensorflow::Status();
     auto p_lock = tensorflow::mutex();
     auto construct_f = [&](int start, int end) {
       for (int i = start; i < end; i++) {
         Status local = NoisyQsimCircuitFromProgram(
-            programs[i], maps[i], num_qubits[i], false, &qsim_circuits[i]);
+            programs[i], maps[i], num_qubits[i], false, &qsim_circuits[i],
+            &noise_models[i]);
         NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
+        // Only the qubits and channels in the light cone of the operators
+        // are simulated. At least one qubit is kept, so num_qubits stays
+        // zero only for empty programs.
+        PruneToLightCone(&pauli_sums[i], &qsim_circuits[i]);
+        num_qubits[i] = qsim_circuits[i].num_qubits;
+        if (!pauli_propagation_) {
+          FuseNoisyCircuit(qsim_circuits[i], &fused_circuits[i]);
+        }
       }
     };
 
@@ -126,6 +173,13 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
         programs.size(), num_cycles, construct_f);
     OP_REQUIRES_OK(context, parse_status);
 
+    if (pauli_propagation_) {
+      // Pauli channels are applied exactly, so num_samples is not used.
+      ComputePauliPropagation(num_qubits, qsim_circuits, pauli_sums, context,
+                              &output_tensor);
+      return;
+    }
+
     int max_num_qubits = 0;
     for (const int num : num_qubits) {
       max_num_qubits = std::max(max_num_qubits, num);
@@ -136,24 +190,75 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
     // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
     // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
     // ...
+    // A zero seed draws a fresh base seed on every call.
+    const uint64_t seed = seed_ == 0 ? tensorflow::random::New64() : seed_;
+
     if (max_num_qubits >= 26) {
       // If the number of qubits is lager than 24, we switch to an
       // alternate parallelization scheme with runtime:
       // O(n_circuits * max_j(num_samples[i])) with parallelization being
       // multiple threads per wavefunction.
-      ComputeLarge(num_qubits, qsim_circuits, pauli_sums, num_samples, context,
-                   &output_tensor);
+      ComputeLarge(num_qubits, seed, qsim_circuits, fused_circuits,
+                   pauli_sums, num_samples, context, &output_tensor);
     } else {
       // Runtime: O(n_circuits * max_j(num_samples[i])) with parallelization
       // being done over number of trials.
-      ComputeSmall(num_qubits, max_num_qubits, qsim_circuits, pauli_sums,
-                   num_samples, context, &output_tensor);
+      ComputeSmall(num_qubits, max_num_qubits, seed, qsim_circuits,
+                   fused_circuits, pauli_sums, num_samples, context,
+                   &output_tensor);
     }
   }
 
  private:
-  void ComputeLarge(const std::vector<int>& num_qubits,
+  void ComputePauliPropagation(
+      const std::vector<int>& num_qubits,
+      const std::vector<NoisyQsimCircuit>& qsim_circuits,
+      const std::vector<std::vector<PauliSum>>& pauli_sums,
+      tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    const int output_dim_op_size = output_tensor->dimension(1);
+
+    Status compute_status = ::tensorflow::Status();
+    auto c_lock = tensorflow::mutex();
+    auto DoWork = [&](int start, int end) {
+      for (int i = start; i < end; i++) {
+        const int cur_batch_index = i / output_dim_op_size;
+        const int cur_op_index = i % output_dim_op_size;
+
+        // (#679) Just ignore empty program
+        if (num_qubits[cur_batch_index] == 0) {
+          (*output_tensor)(cur_batch_index, cur_op_index) = -2.0;
+          continue;
+        }
+
+        float exp_v = 0.0;
+        NESTED_FN_STATUS_SYNC(
+            compute_status,
+            ComputeNoisyExpectationPauliPropagation(
+                qsim_circuits[cur_batch_index],
+                pauli_sums[cur_batch_index][cur_op_index],
+                truncation_threshold_, &exp_v),
+            c_lock);
+        (*output_tensor)(cur_batch_index, cur_op_index) = exp_v;
+      }
+    };
+
+    // The number of strings is unknown ahead of time, so only the channel
+    // count of the noisiest circuit informs the cost estimate.
+    int64_t max_channels = 1;
+    for (const NoisyQsimCircuit& ncircuit : qsim_circuits) {
+      max_channels = std::max(max_channels,
+                              static_cast<int64_t>(ncircuit.channels.size()));
+    }
+    const int64_t num_cycles = 10000 * max_channels;
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        qsim_circuits.size() * output_dim_op_size, num_cycles, DoWork);
+    OP_REQUIRES_OK(context, compute_status);
+  }
+
+  void ComputeLarge(const std::vector<int>& num_qubits, const uint64_t seed,
                     const std::vector<NoisyQsimCircuit>& ncircuits,
+                    const std::vector<FusedNoisyCircuit>& fcircuits,
                     const std::vector<std::vector<PauliSum>>& pauli_sums,
                     const std::vector<std::vector<int>>& num_samples,
                     tensorflow::OpKernelContext* context,
@@ -162,9 +267,6 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
     const auto tfq_for = tfq::QsimFor(context);
     using Simulator = qsim::Simulator<const tfq::QsimFor&>;
     using StateSpace = Simulator::StateSpace;
-    using QTSimulator =
-        qsim::QuantumTrajectorySimulator<qsim::IO, QsimGate,
-                                         qsim::MultiQubitGateFuser, Simulator>;
 
     // Begin simulation.
     int largest_nq = 1;
@@ -173,18 +275,6 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
     auto sv = ss.Create(largest_nq);
     auto scratch = ss.Create(largest_nq);
 
-    tensorflow::GuardedPhiloxRandom random_gen;
-    int max_n_shots = 1;
-    for (size_t i = 0; i < num_samples.size(); i++) {
-      for (size_t j = 0; j < num_samples[i].size(); j++) {
-        max_n_shots = std::max(max_n_shots, num_samples[i][j]);
-      }
-    }
-    random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
-    auto local_gen =
-        random_gen.ReserveSamples128(ncircuits.size() * max_n_shots + 1);
-    tensorflow::random::SimplePhilox rand_source(&local_gen);
-
     // Simulate programs one by one. Parallelizing over state vectors
     // we no longer parallelize over circuits. Each time we encounter a
     // a larger circuit we will grow the Statevector as necessary.
@@ -192,7 +282,7 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
       int nq = num_qubits[i];
 
       // (#679) Just ignore empty program
-      if (ncircuits[i].channels.size() == 0) {
+      if (nq == 0) {
         for (size_t j = 0; j < pauli_sums[i].size(); j++) {
           (*output_tensor)(i, j) = -2.0;
         }
@@ -204,20 +294,35 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
         sv = ss.Create(largest_nq);
         scratch = ss.Create(largest_nq);
       }
-      QTSimulator::Parameter param;
-      param.collect_kop_stat = false;
-      param.collect_mea_stat = false;
-      param.normalize_before_mea_gates = true;
-      QTSimulator::Stat unused_stats;
+      // Weight the exact error free trajectory by its probability and
+      // spend all samples on trajectories with at least one error.
+      ErrorFreeStratum stratum;
+      RunErrorFreeTrajectory(fcircuits[i], sim, ss, sv, scratch, &stratum);
+      const double total = stratum.probability + stratum.ErrorProbability();
+      const double error_weight = stratum.ErrorProbability() / total;
+      std::vector<double> error_free(pauli_sums[i].size(), 0.0);
+      for (size_t j = 0; j < pauli_sums[i].size(); j++) {
+        float exp_v = 0.0;
+        OP_REQUIRES_OK(context,
+                       ComputeExpectationQsim(pauli_sums[i][j], sim, ss, sv,
+                                              scratch, &exp_v));
+        error_free[j] = stratum.probability / total * exp_v;
+      }
+      if (error_weight <= 0.0) {
+        for (size_t j = 0; j < pauli_sums[i].size(); j++) {
+          (*output_tensor)(i, j) = static_cast<float>(error_free[j]);
+        }
+        continue;
+      }
+
       // Track op-wise stats.
       std::vector<int> run_samples(num_samples[i].size(), 0);
       std::vector<double> rolling_sums(num_samples[i].size(), 0.0);
 
-      while (1) {
-        ss.SetStateZero(sv);
-
-        QTSimulator::RunOnce(param, ncircuits[i], rand_source.Rand64(), ss, sim,
-                             sv, unused_stats);
+      for (int n = 0;; n++) {
+        RunErroneousTrajectory(fcircuits[i], stratum,
+                               TrajectorySeed(seed, i, n), sim, ss, sv,
+                               scratch);
 
         // Use this trajectory as a source for all expectation calculations.
         for (size_t j = 0; j < pauli_sums[i].size(); j++) {
@@ -241,7 +346,8 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
         if (break_loop) {
           for (size_t j = 0; j < num_samples[i].size(); j++) {
             rolling_sums[j] /= num_samples[i][j];
-            (*output_tensor)(i, j) = static_cast<float>(rolling_sums[j]);
+            (*output_tensor)(i, j) = static_cast<float>(
+                error_free[j] + error_weight * rolling_sums[j]);
           }
           break;
         }
@@ -250,96 +356,150 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
   }
 
   void ComputeSmall(const std::vector<int>& num_qubits,
-                    const int max_num_qubits,
+                    const int max_num_qubits, const uint64_t seed,
                     const std::vector<NoisyQsimCircuit>& ncircuits,
+                    const std::vector<FusedNoisyCircuit>& fcircuits,
                     const std::vector<std::vector<PauliSum>>& pauli_sums,
                     const std::vector<std::vector<int>>& num_samples,
                     tensorflow::OpKernelContext* context,
                     tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
     using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
     using StateSpace = Simulator::StateSpace;
-    using QTSimulator =
-        qsim::QuantumTrajectorySimulator<qsim::IO, QsimGate,
-                                         qsim::MultiQubitGateFuser, Simulator>;
-
-    const int output_dim_batch_size = output_tensor->dimension(0);
-    std::vector<tensorflow::mutex> batch_locks(output_dim_batch_size,
-                                               tensorflow::mutex());
-
-    const int num_threads = context->device()
-                                ->tensorflow_cpu_worker_threads()
-                                ->workers->NumThreads();
-
-    // [num_threads, batch_size].
-    std::vector<std::vector<int>> rep_offsets(
-        num_threads, std::vector<int>(output_dim_batch_size, 0));
-
-    BalanceTrajectory(num_samples, num_threads, &rep_offsets);
 
     output_tensor->setZero();
 
-    tensorflow::GuardedPhiloxRandom random_gen;
-    int max_n_shots = 1;
-    for (size_t i = 0; i < num_samples.size(); i++) {
-      for (size_t j = 0; j < num_samples[i].size(); j++) {
-        max_n_shots = std::max(max_n_shots, num_samples[i][j]);
-      }
-    }
-    random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
+    // Simulate the error free trajectory of every circuit once and write its
+    // weighted contribution to the output. The chunks below then only
+    // sample trajectories with at least one error.
+    std::vector<ErrorFreeStratum> strata(ncircuits.size());
+    std::vector<double> error_weights(ncircuits.size(), 1.0);
 
     Status compute_status = ::tensorflow::Status();
     auto c_lock = tensorflow::mutex();
-    auto DoWork = [&](int start, int end) {
-      // Begin simulation.
+    auto StratifyWork = [&](int start, int end) {
       const auto tfq_for = qsim::SequentialFor(1);
       int largest_nq = 1;
       Simulator sim = Simulator(tfq_for);
       StateSpace ss = StateSpace(tfq_for);
       auto sv = ss.Create(largest_nq);
       auto scratch = ss.Create(largest_nq);
-
-      int n_rand = ncircuits.size() * max_n_shots + 1;
-      n_rand = (n_rand + num_threads) / num_threads;
-      auto local_gen =
-          random_gen.ReserveSamples128(ncircuits.size() * max_n_shots + 1);
-      tensorflow::random::SimplePhilox rand_source(&local_gen);
-
-      for (size_t i = 0; i < ncircuits.size(); i++) {
+      for (int i = start; i < end; i++) {
         int nq = num_qubits[i];
-        int rep_offset = rep_offsets[start][i];
-
         // (#679) Just ignore empty program
-        if (ncircuits[i].channels.size() == 0) {
+        if (nq == 0) {
           for (size_t j = 0; j < pauli_sums[i].size(); j++) {
             (*output_tensor)(i, j) = -2.0;
           }
           continue;
         }
-
         if (nq > largest_nq) {
           largest_nq = nq;
           sv = ss.Create(largest_nq);
           scratch = ss.Create(largest_nq);
         }
-        QTSimulator::Parameter param;
-        param.collect_kop_stat = false;
-        param.collect_mea_stat = false;
-        param.normalize_before_mea_gates = true;
-        QTSimulator::Stat unused_stats;
-        // Track op-wise stats.
-        std::vector<int> run_samples(num_samples[i].size(), 0);
-        std::vector<double> rolling_sums(num_samples[i].size(), 0.0);
+        RunErrorFreeTrajectory(fcircuits[i], sim, ss, sv, scratch, &strata[i]);
+        const double total =
+            strata[i].probability + strata[i].ErrorProbability();
+        error_weights[i] = strata[i].ErrorProbability() / total;
+        for (size_t j = 0; j < pauli_sums[i].size(); j++) {
+          float exp_v = 0.0;
+          NESTED_FN_STATUS_SYNC(
+              compute_status,
+              ComputeExpectationQsim(pauli_sums[i][j], sim, ss, sv, scratch,
+                                     &exp_v),
+              c_lock);
+          (*output_tensor)(i, j) =
+              static_cast<float>(strata[i].probability / total * exp_v);
+        }
+      }
+    };
+    const int64_t stratify_cost = int64_t(1) << max_num_qubits;
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        ncircuits.size(), stratify_cost, StratifyWork);
+    OP_REQUIRES_OK(context, compute_status);
 
-        while (1) {
-          ss.SetStateZero(sv);
+    // Split the trajectories of every circuit into fixed chunks. Chunks do
+    // not depend on the number of threads, every trajectory draws from its
+    // own counter based stream and the chunk sums are reduced in order, so
+    // the result only depends on the seed.
+    struct Chunk {
+      int circuit;
+      int first;
+      int size;
+    };
+    std::vector<Chunk> chunks;
+    for (size_t i = 0; i < ncircuits.size(); i++) {
+      if (num_qubits[i] == 0 || error_weights[i] <= 0.0) {
+        continue;
+      }
+      int max_samples = 0;
+      for (const int n : num_samples[i]) {
+        max_samples = std::max(max_samples, n);
+      }
+      for (int first = 0; first < max_samples;
+           first += kTrajectoryBatchSize) {
+        chunks.push_back({static_cast<int>(i), first,
+                          std::min(kTrajectoryBatchSize, max_samples - first)});
+      }
+    }
+    // [chunk, op] sums of the trajectory expectations.
+    std::vector<std::vector<double>> chunk_sums(chunks.size());
 
-          QTSimulator::RunOnce(param, ncircuits[i], rand_source.Rand64(), ss,
-                               sim, sv, unused_stats);
+    auto DoWork = [&](int start, int end) {
+      // Begin simulation.
+      const auto tfq_for = qsim::SequentialFor(1);
+      int largest_nq = 1;
+      Simulator sim = Simulator(tfq_for);
+      StateSpace ss = StateSpace(tfq_for);
+      auto sv = ss.Create(largest_nq);
+      auto scratch = ss.Create(largest_nq);
+      TrajectoryBatch batch, batch_scratch;
+      std::vector<double> lane_values;
+
+      for (int c = start; c < end; c++) {
+        const int i = chunks[c].circuit;
+        const int nq = num_qubits[i];
+        std::vector<double>& sums = chunk_sums[c];
+        sums.assign(pauli_sums[i].size(), 0.0);
+
+        if (nq <= kMaxTrajectoryBatchQubits) {
+          // Small states are too short to keep the vector units busy, so
+          // the whole chunk is simulated as one batch.
+          batch.Resize(nq, chunks[c].size);
+          RunTrajectoryBatch(fcircuits[i], &strata[i],
+                             TrajectorySeed(seed, i, chunks[c].first), &batch,
+                             &batch_scratch);
+          for (size_t j = 0; j < pauli_sums[i].size(); j++) {
+            const int used =
+                std::min(chunks[c].size, num_samples[i][j] - chunks[c].first);
+            if (used <= 0) {
+              continue;
+            }
+            lane_values.assign(chunks[c].size, 0.0);
+            Status local = ComputeBatchedExpectation(
+                pauli_sums[i][j], batch, &batch_scratch, &lane_values);
+            NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+            for (int t = 0; t < used; t++) {
+              sums[j] += lane_values[t];
+            }
+          }
+          continue;
+        }
+
+        if (nq > largest_nq) {
+          largest_nq = nq;
+          sv = ss.Create(largest_nq);
+          scratch = ss.Create(largest_nq);
+        }
+        for (int n = chunks[c].first; n < chunks[c].first + chunks[c].size;
+             n++) {
+          RunErroneousTrajectory(fcircuits[i], strata[i],
+                                 TrajectorySeed(seed, i, n), sim, ss, sv,
+                                 scratch);
 
           // Compute expectations across all ops using this trajectory.
           for (size_t j = 0; j < pauli_sums[i].size(); j++) {
-            int p_reps = (num_samples[i][j] + num_threads - 1) / num_threads;
-            if (run_samples[j] >= p_reps + rep_offset) {
+            if (n >= num_samples[i][j]) {
               continue;
             }
             float exp_v = 0.0;
@@ -348,41 +508,42 @@ class TfqNoisyExpectationOp : public tensorflow::OpKernel {
                 ComputeExpectationQsim(pauli_sums[i][j], sim, ss, sv, scratch,
                                        &exp_v),
                 c_lock);
-            rolling_sums[j] += static_cast<double>(exp_v);
-            run_samples[j]++;
-          }
-
-          // Check if we have run enough trajectories for all ops.
-          bool break_loop = true;
-          for (size_t j = 0; j < num_samples[i].size(); j++) {
-            int p_reps = (num_samples[i][j] + num_threads - 1) / num_threads;
-            if (run_samples[j] < p_reps + rep_offset) {
-              break_loop = false;
-              break;
-            }
-          }
-          if (break_loop) {
-            // Lock writing to this batch index in output_tensor.
-            batch_locks[i].lock();
-            for (size_t j = 0; j < num_samples[i].size(); j++) {
-              rolling_sums[j] /= num_samples[i][j];
-              (*output_tensor)(i, j) += static_cast<float>(rolling_sums[j]);
-            }
-            batch_locks[i].unlock();
-            break;
+            sums[j] += static_cast<double>(exp_v);
           }
         }
       }
     };
 
-    // block_size = 1.
-    tensorflow::thread::ThreadPool::SchedulingParams scheduling_params(
-        tensorflow::thread::ThreadPool::SchedulingStrategy::kFixedBlockSize,
-        absl::nullopt, 1);
+    const int64_t chunk_cost = int64_t(kTrajectoryBatchSize) << max_num_qubits;
     context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-        num_threads, scheduling_params, DoWork);
+        chunks.size(), chunk_cost, DoWork);
     OP_REQUIRES_OK(context, compute_status);
+
+    // Reduce the chunk sums in order.
+    std::vector<std::vector<double>> rolling_sums(ncircuits.size());
+    for (size_t c = 0; c < chunks.size(); c++) {
+      auto& sums = rolling_sums[chunks[c].circuit];
+      sums.resize(chunk_sums[c].size(), 0.0);
+      for (size_t j = 0; j < sums.size(); j++) {
+        sums[j] += chunk_sums[c][j];
+      }
+    }
+    for (size_t i = 0; i < ncircuits.size(); i++) {
+      for (size_t j = 0; j < rolling_sums[i].size(); j++) {
+        (*output_tensor)(i, j) += static_cast<float>(
+            error_weights[i] * rolling_sums[i][j] / num_samples[i][j]);
+      }
+    }
   }
+
+  uint64_t seed_;
+
+  // When true, observables are propagated backwards through the gates and
+  // Pauli channels of the circuits instead of sampling trajectories,
+  // dropping Pauli strings whose coefficient falls below
+  // truncation_threshold_.
+  bool pauli_propagation_;
+  float truncation_threshold_;
 };
 
 REGISTER_KERNEL_BUILDER(
@@ -395,7 +556,11 @@ REGISTER_OP("TfqNoisyExpectation")
     .Input("symbol_values: float")
     .Input("pauli_sums: string")
     .Input("num_samples: int32")
+    .Input("noise_model: float")
     .Output("expectations: float")
+    .Attr("seed: int = 0")
+    .Attr("backend: {'trajectories', 'pauli_propagation'} = 'trajectories'")
+    .Attr("truncation_threshold: float = 1e-6")
     .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
       tensorflow::shape_inference::ShapeHandle programs_shape;
       TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
@@ -412,6 +577,9 @@ REGISTER_OP("TfqNoisyExpectation")
       tensorflow::shape_inference::ShapeHandle num_samples_shape;
       TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &num_samples_shape));
 
+      tensorflow::shape_inference::ShapeHandle noise_model_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 3, &noise_model_shape));
+
       tensorflow::shape_inference::DimensionHandle output_rows =
           c->Dim(programs_shape, 0);
       tensorflow::shape_inference::DimensionHandle output_cols =
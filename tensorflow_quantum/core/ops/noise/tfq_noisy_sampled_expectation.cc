@@ -21,11 +21,9 @@ limitations under the License.
 #include "../qsim/lib/channels_cirq.h"
 #include "../qsim/lib/circuit.h"
 #include "../qsim/lib/circuit_noisy.h"
-#include "../qsim/lib/fuser_mqubit.h"
 #include "../qsim/lib/gate_appl.h"
 #include "../qsim/lib/gates_cirq.h"
 #include "../qsim/lib/io.h"
-#include "../qsim/lib/qtrajectory.h"
 #include "../qsim/lib/seqfor.h"
 #include "../qsim/lib/simmux.h"
 #include "tensorflow/core/framework/op_kernel.h"
@@ -41,6 +39,8 @@ limitations under the License.
 #include "tensorflow_quantum/core/ops/parse_context.h"
 #include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/light_cone.h"
+#include "tensorflow_quantum/core/src/noisy_trajectory.h"
 #include "tensorflow_quantum/core/src/util_qsim.h"
 
 namespace tfq {
@@ -62,9 +62,9 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
   void Compute(tensorflow::OpKernelContext* context) override {
     // TODO (mbbrough): add more dimension checks for other inputs here.
     const int num_inputs = context->num_inputs();
-    OP_REQUIRES(context, num_inputs == 5,
+    OP_REQUIRES(context, num_inputs == 6,
                 tensorflow::errors::InvalidArgument(absl::StrCat(
-                    "Expected 5 inputs, got ", num_inputs, " inputs.")));
+                    "Expected 6 inputs, got ", num_inputs, " inputs.")));
 
     // Create the output Tensor.
     const int output_dim_batch_size = context->input(0).dim_size(0);
@@ -108,17 +108,29 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
             context->input(4).dim_size(1), " lists of sample sizes and ",
             context->input(3).dim_size(1), " lists of pauli sums.")));
 
+    std::vector<NoiseModel> noise_models;
+    OP_REQUIRES_OK(context,
+                   GetNoiseModels(context, num_qubits, &noise_models));
+
     // Construct qsim circuits.
     std::vector<NoisyQsimCircuit> qsim_circuits(programs.size(),
                                                 NoisyQsimCircuit());
+    std::vector<FusedNoisyCircuit> fused_circuits(programs.size());
 
     Status parse_status = ::tensorflow::Status();
     auto p_lock = tensorflow::mutex();
     auto construct_f = [&](int start, int end) {
       for (int i = start; i < end; i++) {
         Status local = NoisyQsimCircuitFromProgram(
-            programs[i], maps[i], num_qubits[i], false, &qsim_circuits[i]);
+            programs[i], maps[i], num_qubits[i], false, &qsim_circuits[i],
+            &noise_models[i]);
         NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
+        // Only the qubits and channels in the light cone of the operators
+        // are simulated. At least one qubit is kept, so num_qubits stays
+        // zero only for empty programs.
+        PruneToLightCone(&pauli_sums[i], &qsim_circuits[i]);
+        num_qubits[i] = qsim_circuits[i].num_qubits;
+        FuseNoisyCircuit(qsim_circuits[i], &fused_circuits[i]);
       }
     };
 
@@ -142,19 +154,20 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
       // alternate parallelization scheme with runtime:
       // O(n_circuits * max_j(num_samples[i])) with parallelization being
       // multiple threads per wavefunction.
-      ComputeLarge(num_qubits, qsim_circuits, pauli_sums, num_samples, context,
-                   &output_tensor);
+      ComputeLarge(num_qubits, qsim_circuits, fused_circuits, pauli_sums,
+                   num_samples, context, &output_tensor);
     } else {
       // Runtime: O(n_circuits * max_j(num_samples[i])) with parallelization
       // being done over number of trials.
-      ComputeSmall(num_qubits, max_num_qubits, qsim_circuits, pauli_sums,
-                   num_samples, context, &output_tensor);
+      ComputeSmall(num_qubits, max_num_qubits, qsim_circuits, fused_circuits,
+                   pauli_sums, num_samples, context, &output_tensor);
     }
   }
 
  private:
   void ComputeLarge(const std::vector<int>& num_qubits,
                     const std::vector<NoisyQsimCircuit>& ncircuits,
+                    const std::vector<FusedNoisyCircuit>& fcircuits,
                     const std::vector<std::vector<PauliSum>>& pauli_sums,
                     const std::vector<std::vector<int>>& num_samples,
                     tensorflow::OpKernelContext* context,
@@ -163,9 +176,6 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
     const auto tfq_for = tfq::QsimFor(context);
     using Simulator = qsim::Simulator<const tfq::QsimFor&>;
     using StateSpace = Simulator::StateSpace;
-    using QTSimulator =
-        qsim::QuantumTrajectorySimulator<qsim::IO, QsimGate,
-                                         qsim::MultiQubitGateFuser, Simulator>;
 
     // Begin simulation.
     int largest_nq = 1;
@@ -196,7 +206,7 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
       int nq = num_qubits[i];
 
       // (#679) Just ignore empty program
-      if (ncircuits[i].channels.empty()) {
+      if (nq == 0) {
         for (size_t j = 0; j < pauli_sums[i].size(); j++) {
           (*output_tensor)(i, j) = -2.0;
         }
@@ -208,20 +218,12 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
         sv = ss.Create(largest_nq);
         scratch = ss.Create(largest_nq);
       }
-      QTSimulator::Parameter param;
-      param.collect_kop_stat = false;
-      param.collect_mea_stat = false;
-      param.normalize_before_mea_gates = true;
-      QTSimulator::Stat unused_stats;
       // Track op-wise stats.
       std::vector<int> run_samples(num_samples[i].size(), 0);
       std::vector<double> rolling_sums(num_samples[i].size(), 0.0);
 
       while (1) {
-        ss.SetStateZero(sv);
-
-        QTSimulator::RunOnce(param, ncircuits[i], rand_source.Rand64(), ss, sim,
-                             sv, unused_stats);
+        RunTrajectory(fcircuits[i], rand_source.Rand64(), sim, ss, sv, scratch);
 
         // Use this trajectory as a source for all expectation calculations.
         for (size_t j = 0; j < pauli_sums[i].size(); j++) {
@@ -256,15 +258,13 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
   void ComputeSmall(const std::vector<int>& num_qubits,
                     const int max_num_qubits,
                     const std::vector<NoisyQsimCircuit>& ncircuits,
+                    const std::vector<FusedNoisyCircuit>& fcircuits,
                     const std::vector<std::vector<PauliSum>>& pauli_sums,
                     const std::vector<std::vector<int>>& num_samples,
                     tensorflow::OpKernelContext* context,
                     tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
     using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
     using StateSpace = Simulator::StateSpace;
-    using QTSimulator =
-        qsim::QuantumTrajectorySimulator<qsim::IO, QsimGate,
-                                         qsim::MultiQubitGateFuser, Simulator>;
 
     const int output_dim_batch_size = output_tensor->dimension(0);
     std::vector<tensorflow::mutex> batch_locks(output_dim_batch_size,
@@ -315,7 +315,7 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
         int rep_offset = rep_offsets[start][i];
 
         // (#679) Just ignore empty program
-        if (ncircuits[i].channels.empty()) {
+        if (nq == 0) {
           for (size_t j = 0; j < pauli_sums[i].size(); j++) {
             (*output_tensor)(i, j) = -2.0;
           }
@@ -327,20 +327,13 @@ class TfqNoisySampledExpectationOp : public tensorflow::OpKernel {
           sv = ss.Create(largest_nq);
           scratch = ss.Create(largest_nq);
         }
-        QTSimulator::Parameter param;
-        param.collect_kop_stat = false;
-        param.collect_mea_stat = false;
-        param.normalize_before_mea_gates = true;
-        QTSimulator::Stat unused_stats;
         // Track op-wise stats.
         std::vector<int> run_samples(num_samples[i].size(), 0);
         std::vector<double> rolling_sums(num_samples[i].size(), 0.0);
 
         while (1) {
-          ss.SetStateZero(sv);
-
-          QTSimulator::RunOnce(param, ncircuits[i], rand_source.Rand64(), ss,
-                               sim, sv, unused_stats);
+          RunTrajectory(fcircuits[i], rand_source.Rand64(), sim, ss, sv,
+                        scratch);
 
           // Compute expectations across all ops using this trajectory.
           for (size_t j = 0; j < pauli_sums[i].size(); j++) {
@@ -401,6 +394,7 @@ REGISTER_OP("TfqNoisySampledExpectation")
     .Input("symbol_values: float")
     .Input("pauli_sums: string")
     .Input("num_samples: int32")
+    .Input("noise_model: float")
     .Output("expectations: float")
     .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
       tensorflow::shape_inference::ShapeHandle programs_shape;
@@ -418,6 +412,9 @@ REGISTER_OP("TfqNoisySampledExpectation")
       tensorflow::shape_inference::ShapeHandle num_samples_shape;
       TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &num_samples_shape));
 
+      tensorflow::shape_inference::ShapeHandle noise_model_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 3, &noise_model_shape));
+
       tensorflow::shape_inference::DimensionHandle output_rows =
           c->Dim(programs_shape, 0);
       tensorflow::shape_inference::DimensionHandle output_cols =
@@ -16,16 +16,16 @@ limitations under the License.
 #include <stdlib.h>
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "../qsim/lib/channel.h"
 #include "../qsim/lib/channels_cirq.h"
 #include "../qsim/lib/circuit.h"
 #include "../qsim/lib/circuit_noisy.h"
-#include "../qsim/lib/fuser_mqubit.h"
 #include "../qsim/lib/gate_appl.h"
 #include "../qsim/lib/gates_cirq.h"
 #include "../qsim/lib/io.h"
-#include "../qsim/lib/qtrajectory.h"
 #include "../qsim/lib/seqfor.h"
 #include "../qsim/lib/simmux.h"
 #include "tensorflow/core/framework/op_kernel.h"
@@ -34,12 +34,14 @@ limitations under the License.
 #include "tensorflow/core/lib/core/error_codes.pb.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/random/philox_random.h"
 #include "tensorflow/core/lib/random/random.h"
 #include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/util/guarded_philox_random.h"
 #include "tensorflow_quantum/core/ops/parse_context.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
 #include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
+#include "tensorflow_quantum/core/src/noisy_trajectory.h"
 #include "tensorflow_quantum/core/src/util_qsim.h"
 
 namespace tfq {
@@ -54,11 +56,18 @@ typedef qsim::NoisyCircuit<QsimGate> NoisyQsimCircuit;
 class TfqNoisySamplesOp : public tensorflow::OpKernel {
  public:
   explicit TfqNoisySamplesOp(tensorflow::OpKernelConstruction* context)
-      : OpKernel(context) {}
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("shots_per_trajectory",
+                                             &shots_per_trajectory_));
+    OP_REQUIRES(context, shots_per_trajectory_ >= 0,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "shots_per_trajectory must be non-negative. Got ",
+                    shots_per_trajectory_, ".")));
+  }
 
   void Compute(tensorflow::OpKernelContext* context) override {
     // TODO (mbbrough): add more dimension checks for other inputs here.
-    DCHECK_EQ(4, context->num_inputs());
+    DCHECK_EQ(5, context->num_inputs());
 
     // Parse to Program Proto and num_qubits.
     std::vector<Program> programs;
@@ -78,17 +87,27 @@ class TfqNoisySamplesOp : public tensorflow::OpKernel {
     int num_samples = 0;
     OP_REQUIRES_OK(context, GetIndividualSample(context, &num_samples));
 
+    std::vector<NoiseModel> noise_models;
+    OP_REQUIRES_OK(context,
+                   GetNoiseModels(context, num_qubits, &noise_models));
+
     // Construct qsim circuits.
     std::vector<NoisyQsimCircuit> qsim_circuits(programs.size(),
                                                 NoisyQsimCircuit());
+    std::vector<FusedNoisyCircuit> fused_circuits(programs.size());
 
     Status parse_status = ::tensorflow::Status();
     auto p_lock = tensorflow::mutex();
     auto construct_f = [&](int start, int end) {
       for (int i = start; i < end; i++) {
-        auto r = NoisyQsimCircuitFromProgram(
-            programs[i], maps[i], num_qubits[i], true, &qsim_circuits[i]);
+        // Shots are drawn from the final trajectory states, so no terminal
+        // measurement is added.
+        auto r = NoisyQsimCircuitFromProgram(programs[i], maps[i],
+                                             num_qubits[i], false,
+                                             &qsim_circuits[i],
+                                             &noise_models[i]);
         NESTED_FN_STATUS_SYNC(parse_status, r, p_lock);
+        FuseNoisyCircuit(qsim_circuits[i], &fused_circuits[i]);
       }
     };
 
@@ -116,85 +135,128 @@ class TfqNoisySamplesOp : public tensorflow::OpKernel {
       return;  // bug in qsim dependency we can't control.
     }
 
+    std::vector<int> shots_per_trajectory(qsim_circuits.size(),
+                                          shots_per_trajectory_);
+    if (shots_per_trajectory_ == 0) {
+      for (size_t i = 0; i < qsim_circuits.size(); i++) {
+        shots_per_trajectory[i] =
+            AutoShotsPerTrajectory(qsim_circuits[i], num_samples);
+      }
+    }
+
     // Cross reference with standard google cloud compute instances
     // Memory ~= 2 * num_threads * (2 * 64 * 2 ** num_qubits in circuits)
     // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
     // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
     // ...
     if (max_num_qubits >= 26) {
-      ComputeLarge(num_qubits, max_num_qubits, num_samples, qsim_circuits,
-                   context, &output_tensor);
+      ComputeLarge(num_qubits, max_num_qubits, num_samples,
+                   shots_per_trajectory, fused_circuits, context,
+                   &output_tensor);
     } else {
-      ComputeSmall(num_qubits, max_num_qubits, num_samples, qsim_circuits,
-                   context, &output_tensor);
+      ComputeSmall(num_qubits, max_num_qubits, num_samples,
+                   shots_per_trajectory, fused_circuits, context,
+                   &output_tensor);
     }
   }
 
  private:
+  // Number of shots drawn from each trajectory state, 0 to choose it per
+  // circuit from the strength of its noise.
+  int shots_per_trajectory_;
+
+  // Writes the nq bit sample into row j of circuit i, padding the qubits
+  // past nq with -2.
+  static void WriteSample(
+      const int i, const int j, const int nq, const int max_num_qubits,
+      const uint64_t sample,
+      tensorflow::TTypes<int8_t, 3>::Tensor* output_tensor) {
+    uint64_t q_ind = 0;
+    uint64_t mask = 1;
+    bool val = 0;
+    while (q_ind < nq) {
+      val = sample & mask;
+      (*output_tensor)(
+          i, j, static_cast<ptrdiff_t>(max_num_qubits - q_ind - 1)) = val;
+      q_ind++;
+      mask <<= 1;
+    }
+    while (q_ind < max_num_qubits) {
+      (*output_tensor)(
+          i, j, static_cast<ptrdiff_t>(max_num_qubits - q_ind - 1)) = -2;
+      q_ind++;
+    }
+  }
+
+  // ss.Sample returns the shots of a trajectory in sorted order. Shuffles
+  // them with a generator of their own, seeded from the op's random source,
+  // so that every row of the output is an independent shot.
+  static void ShuffleSamples(const uint64_t seed,
+                             std::vector<uint64_t>* samples) {
+    tensorflow::random::PhiloxRandom philox(seed);
+    tensorflow::random::SimplePhilox shuffle_source(&philox);
+    for (size_t k = samples->size(); k > 1; k--) {
+      std::swap((*samples)[k - 1], (*samples)[shuffle_source.Uniform(k)]);
+    }
+  }
+
   void ComputeLarge(const std::vector<int>& num_qubits,
                     const int max_num_qubits, const int num_samples,
-                    const std::vector<NoisyQsimCircuit>& ncircuits,
+                    const std::vector<int>& shots_per_trajectory,
+                    const std::vector<FusedNoisyCircuit>& fcircuits,
                     tensorflow::OpKernelContext* context,
                     tensorflow::TTypes<int8_t, 3>::Tensor* output_tensor) {
     // Instantiate qsim objects.
     const auto tfq_for = tfq::QsimFor(context);
     using Simulator = qsim::Simulator<const tfq::QsimFor&>;
     using StateSpace = Simulator::StateSpace;
-    using QTSimulator =
-        qsim::QuantumTrajectorySimulator<qsim::IO, QsimGate,
-                                         qsim::MultiQubitGateFuser, Simulator>;
 
     // Begin simulation.
     int largest_nq = 1;
     Simulator sim = Simulator(tfq_for);
     StateSpace ss = StateSpace(tfq_for);
     auto sv = ss.Create(largest_nq);
+    auto scratch = ss.Create(largest_nq);
 
     tensorflow::GuardedPhiloxRandom random_gen;
     random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
+    // Every trajectory takes 5 samples: 2 for the trajectory, 1 to sample
+    // its shots and 2 to shuffle them.
     auto local_gen =
-        random_gen.ReserveSamples32(2 * num_samples * ncircuits.size() + 2);
+        random_gen.ReserveSamples32(5 * num_samples * fcircuits.size() + 2);
     tensorflow::random::SimplePhilox rand_source(&local_gen);
 
     // Simulate programs one by one. Parallelizing over state vectors
     // we no longer parallelize over circuits. Each time we encounter a
     // a larger circuit we will grow the Statevector as nescessary.
-    for (size_t i = 0; i < ncircuits.size(); i++) {
+    for (size_t i = 0; i < fcircuits.size(); i++) {
       int nq = num_qubits[i];
 
       if (nq > largest_nq) {
         // need to switch to larger statespace.
         largest_nq = nq;
         sv = ss.Create(largest_nq);
+        scratch = ss.Create(largest_nq);
       }
 
-      QTSimulator::Parameter param;
-      param.collect_kop_stat = false;
-      param.collect_mea_stat = true;
-      param.normalize_before_mea_gates = true;
-
-      // Track op-wise stats.
-      QTSimulator::Stat gathered_samples;
-
-      for (int j = 0; j < num_samples; j++) {
-        ss.SetStateZero(sv);
-
-        QTSimulator::RunOnce(param, ncircuits[i], rand_source.Rand64(), ss, sim,
-                             sv, gathered_samples);
-        uint64_t q_ind = 0;
-        uint64_t mask = 1;
-        bool val = 0;
-        while (q_ind < nq) {
-          val = gathered_samples.samples[0] & mask;
-          (*output_tensor)(
-              i, j, static_cast<ptrdiff_t>(max_num_qubits - q_ind - 1)) = val;
-          q_ind++;
-          mask <<= 1;
+      if (nq == 0) {
+        for (int j = 0; j < num_samples; j++) {
+          WriteSample(i, j, nq, max_num_qubits, 0, output_tensor);
         }
-        while (q_ind < max_num_qubits) {
-          (*output_tensor)(
-              i, j, static_cast<ptrdiff_t>(max_num_qubits - q_ind - 1)) = -2;
-          q_ind++;
+        continue;
+      }
+
+      // Draw up to shots_per_trajectory[i] shots from each trajectory.
+      int j = 0;
+      while (j < num_samples) {
+        RunTrajectory(fcircuits[i], rand_source.Rand64(), sim, ss, sv, scratch);
+        const int num_shots =
+            std::min(shots_per_trajectory[i], num_samples - j);
+        auto samples = ss.Sample(sv, num_shots, rand_source.Rand32());
+        ShuffleSamples(rand_source.Rand64(), &samples);
+        for (const uint64_t sample : samples) {
+          WriteSample(i, j, nq, max_num_qubits, sample, output_tensor);
+          j++;
         }
       }
     }
@@ -202,14 +264,12 @@ class TfqNoisySamplesOp : public tensorflow::OpKernel {
 
   void ComputeSmall(const std::vector<int>& num_qubits,
                     const int max_num_qubits, const int num_samples,
-                    const std::vector<NoisyQsimCircuit>& ncircuits,
+                    const std::vector<int>& shots_per_trajectory,
+                    const std::vector<FusedNoisyCircuit>& fcircuits,
                     tensorflow::OpKernelContext* context,
                     tensorflow::TTypes<int8_t, 3>::Tensor* output_tensor) {
     using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
     using StateSpace = Simulator::StateSpace;
-    using QTSimulator =
-        qsim::QuantumTrajectorySimulator<qsim::IO, QsimGate,
-                                         qsim::MultiQubitGateFuser, Simulator>;
 
     const int output_dim_batch_size = output_tensor->dimension(0);
     const int num_threads = context->device()
@@ -245,14 +305,15 @@ class TfqNoisySamplesOp : public tensorflow::OpKernel {
       Simulator sim = Simulator(tfq_for);
       StateSpace ss = StateSpace(tfq_for);
       auto sv = ss.Create(largest_nq);
+      auto scratch = ss.Create(largest_nq);
 
       int needed_random =
-          4 * (num_samples * ncircuits.size() + num_threads) / num_threads;
-      needed_random += 4;
+          6 * (num_samples * fcircuits.size() + num_threads) / num_threads;
+      needed_random += 6;
       auto local_gen = random_gen.ReserveSamples32(needed_random);
       tensorflow::random::SimplePhilox rand_source(&local_gen);
 
-      for (size_t i = 0; i < ncircuits.size(); i++) {
+      for (size_t i = 0; i < fcircuits.size(); i++) {
         int nq = num_qubits[i];
         int j = start > 0 ? offset_prefix_sum[start - 1][i] : 0;
         int needed_samples = offset_prefix_sum[start][i] - j;
@@ -263,44 +324,30 @@ class TfqNoisySamplesOp : public tensorflow::OpKernel {
         if (nq > largest_nq) {
           largest_nq = nq;
           sv = ss.Create(largest_nq);
+          scratch = ss.Create(largest_nq);
         }
-        QTSimulator::Parameter param;
-        param.collect_kop_stat = false;
-        param.collect_mea_stat = true;
-        param.normalize_before_mea_gates = true;
-
-        // Track op-wise stats.
-        QTSimulator::Stat gathered_samples;
-        int run_samples = 0;
-
-        while (1) {
-          ss.SetStateZero(sv);
-          QTSimulator::RunOnce(param, ncircuits[i], rand_source.Rand64(), ss,
-                               sim, sv, gathered_samples);
-
-          uint64_t q_ind = 0;
-          uint64_t mask = 1;
-          bool val = 0;
-          while (q_ind < nq) {
-            val = gathered_samples.samples[0] & mask;
-            (*output_tensor)(
-                i, j, static_cast<ptrdiff_t>(max_num_qubits - q_ind - 1)) = val;
-            q_ind++;
-            mask <<= 1;
-          }
-          while (q_ind < max_num_qubits) {
-            (*output_tensor)(
-                i, j, static_cast<ptrdiff_t>(max_num_qubits - q_ind - 1)) = -2;
-            q_ind++;
+        if (nq == 0) {
+          for (int k = 0; k < needed_samples; k++) {
+            WriteSample(i, j + k, nq, max_num_qubits, 0, output_tensor);
           }
+          continue;
+        }
 
-          j++;
-          run_samples++;
+        int run_samples = 0;
 
-          // Check if we have gathered enough samples.
-          if (run_samples >= needed_samples) {
-            break;
+        // Draw up to shots_per_trajectory[i] shots from each trajectory.
+        while (run_samples < needed_samples) {
+          RunTrajectory(fcircuits[i], rand_source.Rand64(), sim, ss, sv,
+                        scratch);
+          const int num_shots =
+              std::min(shots_per_trajectory[i], needed_samples - run_samples);
+          auto samples = ss.Sample(sv, num_shots, rand_source.Rand32());
+          ShuffleSamples(rand_source.Rand64(), &samples);
+          for (const uint64_t sample : samples) {
+            WriteSample(i, j, nq, max_num_qubits, sample, output_tensor);
+            j++;
           }
+          run_samples += num_shots;
         }
       }
     };
@@ -322,7 +369,9 @@ REGISTER_OP("TfqNoisySamples")
     .Input("symbol_names: string")
     .Input("symbol_values: float")
     .Input("num_samples: int32")
+    .Input("noise_model: float")
     .Output("samples: int8")
+    .Attr("shots_per_trajectory: int = 1")
     .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
       tensorflow::shape_inference::ShapeHandle programs_shape;
       TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
@@ -336,6 +385,9 @@ REGISTER_OP("TfqNoisySamples")
       tensorflow::shape_inference::ShapeHandle num_samples_shape;
       TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &num_samples_shape));
 
+      tensorflow::shape_inference::ShapeHandle noise_model_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 3, &noise_model_shape));
+
       // [batch_size, n_samples, largest_n_qubits]
       c->set_output(
           0, c->MakeShape(
@@ -0,0 +1,390 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/random/philox_random.h"
+#include "tensorflow/core/lib/random/random.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/readout_error.h"
+
+namespace tfq {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::Program;
+
+namespace {
+
+// Uniform 32 bit values from the Philox stream of one word of shots, so
+// every word is flipped the same way however the work is split.
+class ReadoutStream {
+ public:
+  ReadoutStream(const uint64_t seed, const int circuit, const int column,
+                const int word) {
+    tensorflow::random::PhiloxRandom::ResultType counter;
+    counter[0] = 0;
+    counter[1] = static_cast<uint32_t>(word);
+    counter[2] = static_cast<uint32_t>(column);
+    counter[3] = static_cast<uint32_t>(circuit);
+    tensorflow::random::PhiloxRandom::Key key;
+    key[0] = static_cast<uint32_t>(seed);
+    key[1] = static_cast<uint32_t>(seed >> 32);
+    gen_ = tensorflow::random::PhiloxRandom(counter, key);
+  }
+
+  uint32_t operator()() {
+    if (used_ == tensorflow::random::PhiloxRandom::kResultElementCount) {
+      sample_ = gen_();
+      used_ = 0;
+    }
+    return sample_[used_++];
+  }
+
+ private:
+  tensorflow::random::PhiloxRandom gen_;
+  tensorflow::random::PhiloxRandom::ResultType sample_;
+  int used_ = tensorflow::random::PhiloxRandom::kResultElementCount;
+};
+
+// Checks that p is a [batch_size, num_columns] matrix of probabilities.
+Status CheckReadoutProbabilities(const tensorflow::Tensor& p,
+                                 const std::string& name,
+                                 const int batch_size, const int num_columns) {
+  if (p.dims() != 2 || p.dim_size(0) != batch_size ||
+      p.dim_size(1) != num_columns) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat(name, " must have shape [", batch_size, ", ",
+                               num_columns, "]. Got ",
+                               p.shape().DebugString(), "."));
+  }
+  const auto values = p.matrix<float>();
+  for (int i = 0; i < batch_size; i++) {
+    for (int k = 0; k < num_columns; k++) {
+      if (!(values(i, k) >= 0.0f && values(i, k) <= 1.0f)) {
+        return Status(static_cast<tensorflow::error::Code>(
+                          absl::StatusCode::kInvalidArgument),
+                      absl::StrCat(name, " must hold probabilities. Got ",
+                                   values(i, k), " at [", i, ", ", k, "]."));
+      }
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+}  // namespace
+
+class TfqReadoutErrorOp : public tensorflow::OpKernel {
+ public:
+  explicit TfqReadoutErrorOp(tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {
+    tensorflow::int64 seed;
+    OP_REQUIRES_OK(context, context->GetAttr("seed", &seed));
+    seed_ = static_cast<uint64_t>(seed);
+  }
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    DCHECK_EQ(3, context->num_inputs());
+
+    const tensorflow::Tensor& samples = context->input(0);
+    OP_REQUIRES(context, samples.dims() == 3,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "samples must be rank 3. Got rank ", samples.dims(), ".")));
+    const int batch_size = samples.dim_size(0);
+    const int num_samples = samples.dim_size(1);
+    const int num_columns = samples.dim_size(2);
+    OP_REQUIRES_OK(context,
+                   CheckReadoutProbabilities(context->input(1), "p0to1",
+                                             batch_size, num_columns));
+    OP_REQUIRES_OK(context,
+                   CheckReadoutProbabilities(context->input(2), "p1to0",
+                                             batch_size, num_columns));
+
+    tensorflow::Tensor* output = nullptr;
+    OP_REQUIRES_OK(context,
+                   context->allocate_output(0, samples.shape(), &output));
+    auto output_tensor = output->tensor<int8_t, 3>();
+    const auto samples_tensor = samples.tensor<int8_t, 3>();
+    const auto p0to1 = context->input(1).matrix<float>();
+    const auto p1to0 = context->input(2).matrix<float>();
+
+    // A zero seed draws a fresh base seed on every call.
+    const uint64_t seed = seed_ == 0 ? tensorflow::random::New64() : seed_;
+
+    // Every (circuit, column) pair is independent. Its shots are packed 64
+    // to a word together with a mask of the entries that are not padding.
+    auto DoWork = [&](int start, int end) {
+      for (int c = start; c < end; c++) {
+        const int i = c / num_columns;
+        const int k = c % num_columns;
+        const uint64_t threshold0 = ReadoutThreshold(p0to1(i, k));
+        const uint64_t threshold1 = ReadoutThreshold(p1to0(i, k));
+        for (int w = 0; w * 64 < num_samples; w++) {
+          const int first = w * 64;
+          const int count = std::min(64, num_samples - first);
+          uint64_t bits = 0;
+          uint64_t valid = 0;
+          for (int b = 0; b < count; b++) {
+            const int8_t v = samples_tensor(i, first + b, k);
+            bits |= uint64_t(v == 1) << b;
+            valid |= uint64_t(v == 0 || v == 1) << b;
+          }
+          ReadoutStream next(seed, i, k, w);
+          const uint64_t flips0 = BernoulliMask(threshold0, next);
+          const uint64_t flips1 = BernoulliMask(threshold1, next);
+          const uint64_t noisy =
+              ApplyReadoutFlips(bits, flips0 & valid, flips1 & valid);
+          for (int b = 0; b < count; b++) {
+            output_tensor(i, first + b, k) =
+                (valid >> b) & 1 ? static_cast<int8_t>((noisy >> b) & 1)
+                                 : samples_tensor(i, first + b, k);
+          }
+        }
+      }
+    };
+
+    const int64_t cost_per_column = num_samples;
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        batch_size * num_columns, cost_per_column, DoWork);
+  }
+
+ private:
+  uint64_t seed_;
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqReadoutError").Device(tensorflow::DEVICE_CPU),
+    TfqReadoutErrorOp);
+
+REGISTER_OP("TfqReadoutError")
+    .Input("samples: int8")
+    .Input("p0to1: float")
+    .Input("p1to0: float")
+    .Output("noisy_samples: int8")
+    .Attr("seed: int = 0")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle samples_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &samples_shape));
+
+      tensorflow::shape_inference::ShapeHandle p0to1_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 2, &p0to1_shape));
+
+      tensorflow::shape_inference::ShapeHandle p1to0_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &p1to0_shape));
+
+      c->set_output(0, samples_shape);
+
+      return ::tensorflow::Status();
+    });
+
+class TfqReadoutMitigatedExpectationOp : public tensorflow::OpKernel {
+ public:
+  explicit TfqReadoutMitigatedExpectationOp(
+      tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    DCHECK_EQ(5, context->num_inputs());
+
+    std::vector<Program> programs;
+    std::vector<int> num_qubits;
+    std::vector<std::vector<PauliSum>> pauli_sums;
+    OP_REQUIRES_OK(context, GetProgramsAndNumQubits(context, &programs,
+                                                    &num_qubits, &pauli_sums));
+
+    const tensorflow::Tensor& samples = context->input(1);
+    OP_REQUIRES(context, samples.dims() == 3,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "samples must be rank 3. Got rank ", samples.dims(), ".")));
+    OP_REQUIRES(context, samples.dim_size(0) == programs.size(),
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Number of circuits and samples do not match. Got ",
+                    programs.size(), " circuits and ", samples.dim_size(0),
+                    " batches of samples.")));
+    const int batch_size = programs.size();
+    const int num_samples = samples.dim_size(1);
+    const int num_columns = samples.dim_size(2);
+    for (int i = 0; i < batch_size; i++) {
+      OP_REQUIRES(context, num_qubits[i] <= num_columns,
+                  tensorflow::errors::InvalidArgument(absl::StrCat(
+                      "Circuit ", i, " has ", num_qubits[i],
+                      " qubits but samples only have ", num_columns,
+                      " columns.")));
+    }
+    OP_REQUIRES_OK(context,
+                   CheckReadoutProbabilities(context->input(3), "p0to1",
+                                             batch_size, num_columns));
+    OP_REQUIRES_OK(context,
+                   CheckReadoutProbabilities(context->input(4), "p1to0",
+                                             batch_size, num_columns));
+    const auto samples_tensor = samples.tensor<int8_t, 3>();
+    const auto p0to1 = context->input(3).matrix<float>();
+    const auto p1to0 = context->input(4).matrix<float>();
+
+    const int output_dim_op_size = context->input(2).dim_size(1);
+    tensorflow::TensorShape output_shape;
+    output_shape.AddDim(batch_size);
+    output_shape.AddDim(output_dim_op_size);
+
+    tensorflow::Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+    auto output_tensor = output->matrix<float>();
+
+    Status compute_status = ::tensorflow::Status();
+    auto c_lock = tensorflow::mutex();
+    auto DoWork = [&](int start, int end) {
+      std::vector<int> columns;
+      std::vector<MitigatedZ> z_values;
+      for (int i = start; i < end; i++) {
+        // (#679) Just ignore empty program
+        if (programs[i].circuit().moments_size() == 0) {
+          for (int j = 0; j < output_dim_op_size; j++) {
+            output_tensor(i, j) = -2.0;
+          }
+          continue;
+        }
+        // Qubit l of the circuit is read out in column
+        // num_columns - num_qubits[i] + l of the padded samples.
+        const int offset = num_columns - num_qubits[i];
+        for (int j = 0; j < output_dim_op_size; j++) {
+          double expectation = 0.0;
+          for (const auto& term : pauli_sums[i][j].terms()) {
+            if (term.paulis_size() == 0) {
+              expectation += term.coefficient_real();
+              continue;
+            }
+            columns.clear();
+            z_values.clear();
+            for (const auto& pair : term.paulis()) {
+              if (pair.pauli_type() != "Z") {
+                NESTED_FN_STATUS_SYNC(
+                    compute_status,
+                    Status(static_cast<tensorflow::error::Code>(
+                               absl::StatusCode::kInvalidArgument),
+                           absl::StrCat("Readout mitigation only supports Z "
+                                        "terms. Got ",
+                                        pair.pauli_type(),
+                                        ". Rotate the circuit into the "
+                                        "measurement basis instead.")),
+                    c_lock);
+              }
+              int location;
+              // GridQubit id should be parsed down to integer at this
+              // upstream so it is safe to just use atoi.
+              (void)absl::SimpleAtoi(pair.qubit_id(), &location);
+              const int k = offset + location;
+              const double det = 1.0 - p0to1(i, k) - p1to0(i, k);
+              if (det <= 0.0) {
+                NESTED_FN_STATUS_SYNC(
+                    compute_status,
+                    Status(static_cast<tensorflow::error::Code>(
+                               absl::StatusCode::kInvalidArgument),
+                           absl::StrCat("Readout errors of circuit ", i,
+                                        " on column ", k,
+                                        " cannot be inverted: p0to1 + "
+                                        "p1to0 must be below 1.")),
+                    c_lock);
+              }
+              columns.push_back(k);
+              z_values.push_back(MitigatedZValues(p0to1(i, k), p1to0(i, k)));
+            }
+
+            double term_total = 0.0;
+            for (int s = 0; s < num_samples; s++) {
+              double product = 1.0;
+              for (size_t q = 0; q < columns.size(); q++) {
+                const int8_t v = samples_tensor(i, s, columns[q]);
+                if (v != 0 && v != 1) {
+                  NESTED_FN_STATUS_SYNC(
+                      compute_status,
+                      Status(static_cast<tensorflow::error::Code>(
+                                 absl::StatusCode::kInvalidArgument),
+                             absl::StrCat("Found padding in samples of "
+                                          "circuit ",
+                                          i, " on measured column ",
+                                          columns[q], ".")),
+                      c_lock);
+                }
+                product *= v ? z_values[q].one : z_values[q].zero;
+              }
+              term_total += product;
+            }
+            if (num_samples > 0) {
+              expectation +=
+                  term.coefficient_real() * term_total / num_samples;
+            }
+          }
+          output_tensor(i, j) = static_cast<float>(expectation);
+        }
+      }
+    };
+
+    const int64_t cost_per_circuit =
+        int64_t(num_samples) * std::max(1, output_dim_op_size);
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        batch_size, cost_per_circuit, DoWork);
+    OP_REQUIRES_OK(context, compute_status);
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqReadoutMitigatedExpectation").Device(tensorflow::DEVICE_CPU),
+    TfqReadoutMitigatedExpectationOp);
+
+REGISTER_OP("TfqReadoutMitigatedExpectation")
+    .Input("programs: string")
+    .Input("samples: int8")
+    .Input("pauli_sums: string")
+    .Input("p0to1: float")
+    .Input("p1to0: float")
+    .Output("expectations: float")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle samples_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 3, &samples_shape));
+
+      tensorflow::shape_inference::ShapeHandle pauli_sums_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &pauli_sums_shape));
+
+      tensorflow::shape_inference::ShapeHandle p0to1_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &p0to1_shape));
+
+      tensorflow::shape_inference::ShapeHandle p1to0_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &p1to0_shape));
+
+      tensorflow::shape_inference::DimensionHandle output_rows =
+          c->Dim(programs_shape, 0);
+      tensorflow::shape_inference::DimensionHandle output_cols =
+          c->Dim(pauli_sums_shape, 1);
+      c->set_output(0, c->Matrix(output_rows, output_cols));
+
+      return ::tensorflow::Status();
+    });
+
+}  // namespace tfq
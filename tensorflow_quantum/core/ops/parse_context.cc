@@ -17,9 +17,12 @@ limitations under the License.
 
 #include <google/protobuf/text_format.h>
 
+#include <algorithm>
+#include <complex>
 #include <string>
 #include <vector>
 
+#include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/lib/core/error_codes.pb.h"
@@ -56,6 +59,41 @@ Status ParseProto(const std::string& text, T* proto) {
       "Unparseable proto: " + text);
 }
 
+// Resolves the QubitIds of already parsed programs (and optionally p_sums)
+// in parallel, filling in num_qubits.
+Status ResolveProgramsAndNumQubits(OpKernelContext* context,
+                                   std::vector<Program>* programs,
+                                   std::vector<int>* num_qubits,
+                                   std::vector<std::vector<PauliSum>>* p_sums,
+                                   bool swap_endianness) {
+  Status parse_status = ::tensorflow::Status();
+  auto p_lock = tensorflow::mutex();
+  num_qubits->assign(programs->size(), -1);
+  auto DoWork = [&](int start, int end) {
+    for (int i = start; i < end; i++) {
+      Program& program = (*programs)[i];
+      unsigned int this_num_qubits;
+      Status local;
+      if (p_sums) {
+        local = ResolveQubitIds(&program, &this_num_qubits, &(p_sums->at(i)),
+                                swap_endianness);
+      } else {
+        local = ResolveQubitIds(&program, &this_num_qubits, nullptr,
+                                swap_endianness);
+      }
+      NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
+      (*num_qubits)[i] = this_num_qubits;
+    }
+  };
+
+  // TODO(mbbrough): Determine if this is a good cycle estimate.
+  const int cycle_estimate = 1000;
+  context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+      num_qubits->size(), cycle_estimate, DoWork);
+
+  return parse_status;
+}
+
 }  // namespace
 
 Status ParsePrograms(OpKernelContext* context, const std::string& input_name,
@@ -149,10 +187,13 @@ Status GetProgramsAndProgramsToAppend(
     return status;
   }
 
-  if (programs->size() != programs_to_append->size()) {
+  // A single program to append is broadcast onto every program.
+  if (programs_to_append->size() != 1 &&
+      programs->size() != programs_to_append->size()) {
     return Status(static_cast<tensorflow::error::Code>(
                       absl::StatusCode::kInvalidArgument),
-                  "programs and programs_to_append must have matching sizes.");
+                  "programs and programs_to_append must have matching sizes, "
+                  "or programs_to_append must hold a single program.");
   }
 
   return ::tensorflow::Status();
@@ -186,33 +227,138 @@ Status GetProgramsAndNumQubits(
     }
   }
 
-  // Resolve qubit ID's in parallel.
-  Status parse_status = ::tensorflow::Status();
-  auto p_lock = tensorflow::mutex();
-  num_qubits->assign(programs->size(), -1);
+  return ResolveProgramsAndNumQubits(context, programs, num_qubits, p_sums,
+                                     swap_endianness);
+}
+
+Status GetBroadcastProgramsAndNumQubits(
+    OpKernelContext* context, std::vector<Program>* programs,
+    std::vector<int>* num_qubits,
+    std::vector<std::vector<PauliSum>>* p_sums /*=nullptr*/) {
+  const Tensor* input_programs;
+  Status status = context->input("programs", &input_programs);
+  if (!status.ok()) {
+    return status;
+  }
+  const Tensor* input_values;
+  status = context->input("symbol_values", &input_values);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Only broadcast a single program against many symbol_values rows. In all
+  // other cases defer to the regular (and regularly validated) parsing.
+  if (input_programs->dims() != 1 || input_programs->dim_size(0) != 1 ||
+      input_values->dims() != 2 || input_values->dim_size(0) <= 1) {
+    return GetProgramsAndNumQubits(context, programs, num_qubits, p_sums);
+  }
+  const int batch_size = input_values->dim_size(0);
+
+  status = ParsePrograms(context, "programs", programs);
+  if (!status.ok()) {
+    return status;
+  }
+
+  unsigned int this_num_qubits;
+  if (p_sums) {
+    status = GetPauliSums(context, p_sums);
+    if (!status.ok()) {
+      return status;
+    }
+    if (static_cast<int>(p_sums->size()) != batch_size) {
+      return Status(
+          static_cast<tensorflow::error::Code>(
+              absl::StatusCode::kInvalidArgument),
+          absl::StrCat("Number of symbol_values and PauliSums do not match. ",
+                       "Got ", batch_size, " symbol values and ",
+                       p_sums->size(), " paulisums."));
+    }
+
+    // Every row refers to the same program, so resolve all of the sums
+    // against it in one go.
+    const int op_dim = p_sums->at(0).size();
+    std::vector<PauliSum> flat_sums;
+    flat_sums.reserve(batch_size * op_dim);
+    for (auto& row : *p_sums) {
+      for (auto& sum : row) {
+        flat_sums.push_back(std::move(sum));
+      }
+    }
+    status = ResolveQubitIds(&programs->at(0), &this_num_qubits, &flat_sums);
+    if (!status.ok()) {
+      return status;
+    }
+    for (int i = 0; i < batch_size; i++) {
+      for (int j = 0; j < op_dim; j++) {
+        (*p_sums)[i][j] = std::move(flat_sums[i * op_dim + j]);
+      }
+    }
+  } else {
+    status = ResolveQubitIds(&programs->at(0), &this_num_qubits);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  num_qubits->assign(batch_size, this_num_qubits);
+  return ::tensorflow::Status();
+}
+
+Status GetAppendedProgramsAndNumQubits(
+    OpKernelContext* context, std::vector<Program>* programs,
+    std::vector<int>* num_qubits,
+    std::vector<std::vector<PauliSum>>* p_sums /*=nullptr*/) {
+  // 1. Parse input programs and programs_to_append
+  // 2. Append moments in place (no serialization round trip)
+  // 3. (Optional) Parse input PauliSums
+  // 4. Convert GridQubit locations to integers.
+  std::vector<Program> programs_to_append;
+  Status status =
+      GetProgramsAndProgramsToAppend(context, programs, &programs_to_append);
+  if (!status.ok()) {
+    return status;
+  }
+
+  const bool broadcast = programs_to_append.size() == 1;
   auto DoWork = [&](int start, int end) {
     for (int i = start; i < end; i++) {
-      Program& program = (*programs)[i];
-      unsigned int this_num_qubits;
-      Status local;
-      if (p_sums) {
-        local = ResolveQubitIds(&program, &this_num_qubits, &(p_sums->at(i)),
-                                swap_endianness);
-      } else {
-        local = ResolveQubitIds(&program, &this_num_qubits, nullptr,
-                                swap_endianness);
+      auto* circuit = (*programs)[i].mutable_circuit();
+      if (broadcast) {
+        // The shared program is only read, so every program gets a copy.
+        for (const auto& moment : programs_to_append[0].circuit().moments()) {
+          *circuit->add_moments() = moment;
+        }
+        continue;
+      }
+      for (auto& moment :
+           *programs_to_append[i].mutable_circuit()->mutable_moments()) {
+        circuit->add_moments()->Swap(&moment);
       }
-      NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
-      (*num_qubits)[i] = this_num_qubits;
     }
   };
 
   // TODO(mbbrough): Determine if this is a good cycle estimate.
   const int cycle_estimate = 1000;
   context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-      num_qubits->size(), cycle_estimate, DoWork);
+      programs->size(), cycle_estimate, DoWork);
 
-  return parse_status;
+  if (p_sums) {
+    status = GetPauliSums(context, p_sums);
+    if (!status.ok()) {
+      return status;
+    }
+    if (programs->size() != p_sums->size()) {
+      return Status(
+          static_cast<tensorflow::error::Code>(
+              absl::StatusCode::kInvalidArgument),
+          absl::StrCat("Number of circuits and PauliSums do not match. Got ",
+                       programs->size(), " circuits and ", p_sums->size(),
+                       " paulisums."));
+    }
+  }
+
+  return ResolveProgramsAndNumQubits(context, programs, num_qubits, p_sums,
+                                     /*swap_endianness=*/false);
 }
 
 tensorflow::Status GetProgramsAndNumQubits(
@@ -403,9 +549,9 @@ tensorflow::Status GetNumSamples(
 
 // used by tfq_simulate_samples.
 Status GetIndividualSample(tensorflow::OpKernelContext* context,
-                           int* n_samples) {
+                           int* n_samples, const std::string& input_name) {
   const Tensor* input_num_samples;
-  Status status = context->input("num_samples", &input_num_samples);
+  Status status = context->input(input_name, &input_num_samples);
   if (!status.ok()) {
     return status;
   }
@@ -413,7 +559,7 @@ Status GetIndividualSample(tensorflow::OpKernelContext* context,
   if (input_num_samples->dims() != 1) {
     return Status(static_cast<tensorflow::error::Code>(
                       absl::StatusCode::kInvalidArgument),
-                  absl::StrCat("num_samples must be rank 1. Got rank ",
+                  absl::StrCat(input_name, " must be rank 1. Got rank ",
                                input_num_samples->dims(), "."));
   }
 
@@ -422,7 +568,7 @@ Status GetIndividualSample(tensorflow::OpKernelContext* context,
   if (vector_num_samples.dimension(0) != 1) {
     return Status(static_cast<tensorflow::error::Code>(
                       absl::StatusCode::kInvalidArgument),
-                  absl::StrCat("num_samples must contain 1 element. Got ",
+                  absl::StrCat(input_name, " must contain 1 element. Got ",
                                vector_num_samples.dimension(0), "."));
   }
 
@@ -430,6 +576,235 @@ Status GetIndividualSample(tensorflow::OpKernelContext* context,
   return ::tensorflow::Status();
 }
 
+Status GetQubitSubset(tensorflow::OpKernelContext* context,
+                      const std::vector<int>& num_qubits,
+                      std::vector<int>* qubits) {
+  const Tensor* input_qubits;
+  Status status = context->input("qubits", &input_qubits);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (input_qubits->dims() != 1) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("qubits must be rank 1. Got rank ",
+                               input_qubits->dims(), "."));
+  }
+
+  const auto vector_qubits = input_qubits->vec<int>();
+  qubits->assign(vector_qubits.data(),
+                 vector_qubits.data() + vector_qubits.dimension(0));
+
+  absl::flat_hash_set<int> seen;
+  for (const int q : *qubits) {
+    if (!seen.insert(q).second) {
+      return Status(static_cast<tensorflow::error::Code>(
+                        absl::StatusCode::kInvalidArgument),
+                    absl::StrCat("qubits must not contain duplicates. Got ", q,
+                                 " twice."));
+    }
+  }
+
+  for (size_t i = 0; i < num_qubits.size(); i++) {
+    // (#679) empty programs are padded instead of validated.
+    if (num_qubits[i] == 0) {
+      continue;
+    }
+    for (const int q : *qubits) {
+      if (q < 0 || q >= num_qubits[i]) {
+        return Status(static_cast<tensorflow::error::Code>(
+                          absl::StatusCode::kInvalidArgument),
+                      absl::StrCat("Qubit index ", q,
+                                   " is out of range for circuit ", i,
+                                   " which has ", num_qubits[i], " qubits."));
+      }
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+Status GetNoiseModels(tensorflow::OpKernelContext* context,
+                      const std::vector<int>& num_qubits,
+                      std::vector<NoiseModel>* noise_models) {
+  const Tensor* input_noise_model;
+  Status status = context->input("noise_model", &input_noise_model);
+  if (!status.ok()) {
+    return status;
+  }
+
+  noise_models->assign(num_qubits.size(), NoiseModel());
+  if (input_noise_model->NumElements() == 0) {
+    return ::tensorflow::Status();
+  }
+
+  if (input_noise_model->dims() != 3 ||
+      input_noise_model->dim_size(2) != NoiseModel::kNumRates) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("noise_model must have shape [batch_size, "
+                               "max_num_qubits, ",
+                               NoiseModel::kNumRates, "]. Got ",
+                               input_noise_model->shape().DebugString(), "."));
+  }
+  if (input_noise_model->dim_size(0) !=
+      static_cast<int64_t>(num_qubits.size())) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("Number of circuits and noise models do not "
+                               "match. Got ",
+                               num_qubits.size(), " circuits and ",
+                               input_noise_model->dim_size(0),
+                               " noise models."));
+  }
+
+  const auto rates = input_noise_model->tensor<float, 3>();
+  for (size_t i = 0; i < num_qubits.size(); i++) {
+    if (num_qubits[i] > rates.dimension(1)) {
+      return Status(static_cast<tensorflow::error::Code>(
+                        absl::StatusCode::kInvalidArgument),
+                    absl::StrCat("Circuit ", i, " has ", num_qubits[i],
+                                 " qubits but its noise model only covers ",
+                                 rates.dimension(1), "."));
+    }
+    std::vector<float>& model = (*noise_models)[i].rates;
+    model.reserve(num_qubits[i] * NoiseModel::kNumRates);
+    for (int q = 0; q < num_qubits[i]; q++) {
+      for (int r = 0; r < NoiseModel::kNumRates; r++) {
+        const float rate = rates(i, q, r);
+        if (!(rate >= 0.0f && rate <= 1.0f)) {
+          return Status(static_cast<tensorflow::error::Code>(
+                            absl::StatusCode::kInvalidArgument),
+                        absl::StrCat("noise_model rates must lie in [0, 1]. "
+                                     "Got ",
+                                     rate, " at [", i, ", ", q, ", ", r,
+                                     "]."));
+        }
+        model.push_back(rate);
+      }
+    }
+  }
+
+  return ::tensorflow::Status();
+}
+
+Status GetSparseObservables(
+    tensorflow::OpKernelContext* context, const std::vector<int>& num_qubits,
+    std::vector<std::vector<SparseObservable>>* observables) {
+  const Tensor* input_indices;
+  Status status = context->input("observable_indices", &input_indices);
+  if (!status.ok()) {
+    return status;
+  }
+  const Tensor* input_values;
+  status = context->input("observable_values", &input_values);
+  if (!status.ok()) {
+    return status;
+  }
+  const Tensor* input_shape;
+  status = context->input("observable_shape", &input_shape);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (input_shape->dims() != 1 || input_shape->dim_size(0) != 4) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("observables must be rank 4 with shape "
+                               "[batch_size, n_ops, 2 ** n, 2 ** n]. Got "
+                               "observable_shape with shape ",
+                               input_shape->shape().DebugString(), "."));
+  }
+  const auto shape = input_shape->vec<int64_t>();
+  if (shape(0) != static_cast<int64_t>(num_qubits.size())) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("Number of circuits and observables do not "
+                               "match. Got ",
+                               num_qubits.size(), " circuits and ", shape(0),
+                               " observables."));
+  }
+  if (shape(1) < 0 || shape(2) != shape(3)) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  "observables must be square matrices.");
+  }
+  // Like padded state vectors, the matrices span the states of the largest
+  // circuit in the batch. Entries of smaller circuits are checked below.
+  int max_num_qubits = 0;
+  for (const int num : num_qubits) {
+    max_num_qubits = std::max(max_num_qubits, num);
+  }
+  if (max_num_qubits >= 63 || shape(2) != int64_t(1) << max_num_qubits) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("observables must be 2 ** n by 2 ** n "
+                               "matrices, where n = ",
+                               max_num_qubits,
+                               " is the largest number of qubits in the "
+                               "circuits. Got ",
+                               shape(2), " by ", shape(3), "."));
+  }
+
+  if (input_indices->dims() != 2 || input_indices->dim_size(1) != 4) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("observable_indices must have shape [nnz, 4]. "
+                               "Got ",
+                               input_indices->shape().DebugString(), "."));
+  }
+  if (input_values->dims() != 1 ||
+      input_values->dim_size(0) != input_indices->dim_size(0)) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("observable_values must have shape [nnz]. Got ",
+                               input_values->shape().DebugString(), " for ",
+                               input_indices->dim_size(0), " indices."));
+  }
+
+  // Bucket the entries by (circuit, op) before compressing each matrix.
+  const int batch_size = num_qubits.size();
+  const int num_ops = shape(1);
+  const auto indices = input_indices->matrix<int64_t>();
+  const auto values = input_values->vec<std::complex<float>>();
+  std::vector<std::vector<int64_t>> rows(batch_size * num_ops);
+  std::vector<std::vector<int64_t>> cols(batch_size * num_ops);
+  std::vector<std::vector<std::complex<float>>> entries(batch_size * num_ops);
+  for (int k = 0; k < indices.dimension(0); k++) {
+    const int64_t b = indices(k, 0);
+    const int64_t op = indices(k, 1);
+    if (b < 0 || b >= batch_size || op < 0 || op >= num_ops) {
+      return Status(static_cast<tensorflow::error::Code>(
+                        absl::StatusCode::kInvalidArgument),
+                    absl::StrCat("Observable entry ", k,
+                                 " is out of range of observable_shape."));
+    }
+    const int64_t dim = int64_t(1) << num_qubits[b];
+    const int64_t r = indices(k, 2);
+    const int64_t c = indices(k, 3);
+    if (r < 0 || r >= dim || c < 0 || c >= dim) {
+      return Status(static_cast<tensorflow::error::Code>(
+                        absl::StatusCode::kInvalidArgument),
+                    absl::StrCat("Observable entry (", r, ", ", c,
+                                 ") is out of range for circuit ", b,
+                                 " which has ", num_qubits[b], " qubits."));
+    }
+    rows[b * num_ops + op].push_back(r);
+    cols[b * num_ops + op].push_back(c);
+    entries[b * num_ops + op].push_back(values(k));
+  }
+
+  observables->assign(batch_size, std::vector<SparseObservable>(num_ops));
+  for (int b = 0; b < batch_size; b++) {
+    for (int op = 0; op < num_ops; op++) {
+      const int j = b * num_ops + op;
+      SparseObservableFromCoo(rows[j], cols[j], entries[j],
+                              &(*observables)[b][op]);
+    }
+  }
+  return ::tensorflow::Status();
+}
+
 // used by adj_grad_op.
 tensorflow::Status GetPrevGrads(
     tensorflow::OpKernelContext* context,
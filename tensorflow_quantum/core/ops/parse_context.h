@@ -33,6 +33,8 @@ limitations under the License.
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/noise_model.h"
+#include "tensorflow_quantum/core/src/sparse_observable.h"
 
 namespace tfq {
 
@@ -46,7 +48,9 @@ tensorflow::Status ParsePrograms2D(
     tensorflow::OpKernelContext* context, const std::string& input_name,
     std::vector<std::vector<tfq::proto::Program>>* programs);
 
-// Parses a vector of programs along with another vector of programs to append
+// Parses a vector of programs along with another vector of programs to append.
+// programs_to_append either matches programs in size or holds one program
+// that is appended onto every program.
 tensorflow::Status GetProgramsAndProgramsToAppend(
     tensorflow::OpKernelContext* context,
     std::vector<tfq::proto::Program>* programs,
@@ -67,6 +71,25 @@ tensorflow::Status GetProgramsAndNumQubits(
     std::vector<std::vector<tfq::proto::PauliSum>>* p_sums = nullptr,
     bool swap_endianness = false);
 
+// Same as GetProgramsAndNumQubits, except that a single program may be
+// broadcast against every row of the 'symbol_values' input Tensor. In that
+// case the program is parsed and resolved only once, programs has size 1 and
+// num_qubits (and p_sums) have one entry per row of symbol_values. Callers
+// should then use programs[0] for every row.
+tensorflow::Status GetBroadcastProgramsAndNumQubits(
+    tensorflow::OpKernelContext* context,
+    std::vector<tfq::proto::Program>* programs, std::vector<int>* num_qubits,
+    std::vector<std::vector<tfq::proto::PauliSum>>* p_sums = nullptr);
+
+// Same as GetProgramsAndNumQubits, except that the moments found in the
+// 'programs_to_append' input Tensor are appended onto each program before
+// QubitIds are resolved. This lets a simulation op consume the output of an
+// append without the intermediate serialize and parse round trip.
+tensorflow::Status GetAppendedProgramsAndNumQubits(
+    tensorflow::OpKernelContext* context,
+    std::vector<tfq::proto::Program>* programs, std::vector<int>* num_qubits,
+    std::vector<std::vector<tfq::proto::PauliSum>>* p_sums = nullptr);
+
 // Parses Cirq Program protos out of the 'circuit_specs' input Tensor. Also
 // resolves the QubitIds inside of the Program. This override also parses and
 // resolves other_programs. Ensuring all qubits found in programs[i] are also
@@ -100,9 +123,35 @@ tensorflow::Status GetNumSamples(
     std::vector<std::vector<int>>* parsed_num_samples);
 
 // Parses the 'num_samples' input tensor when it is expected to only
-//   contain one element.
-tensorflow::Status GetIndividualSample(tensorflow::OpKernelContext* context,
-                                       int* n_samples);
+//   contain one element. Ops that call the input something else pass its
+//   name so that errors refer to it.
+tensorflow::Status GetIndividualSample(
+    tensorflow::OpKernelContext* context, int* n_samples,
+    const std::string& input_name = "num_samples");
+
+// Parses the 'qubits' input tensor holding a subset of qubit indices, in the
+// order used by program resolution, and checks it against every circuit.
+// Circuits with zero qubits (empty programs) are not checked.
+tensorflow::Status GetQubitSubset(tensorflow::OpKernelContext* context,
+                                  const std::vector<int>& num_qubits,
+                                  std::vector<int>* qubits);
+
+// Parses a batch of matrix observables given as the 'observable_indices',
+// 'observable_values' and 'observable_shape' components of a SparseTensor
+// with dense shape [batch_size, n_ops, 2 ** n, 2 ** n], where n is the
+// largest entry of num_qubits. Every index of circuit i must lie below
+// 2 ** num_qubits[i].
+tensorflow::Status GetSparseObservables(
+    tensorflow::OpKernelContext* context, const std::vector<int>& num_qubits,
+    std::vector<std::vector<SparseObservable>>* observables);
+
+// Parses the 'noise_model' input tensor of shape
+// [batch_size, max_num_qubits, NoiseModel::kNumRates] into one NoiseModel
+// per circuit. A tensor without elements gives empty models, i.e. no
+// injected noise.
+tensorflow::Status GetNoiseModels(tensorflow::OpKernelContext* context,
+                                  const std::vector<int>& num_qubits,
+                                  std::vector<NoiseModel>* noise_models);
 
 // Parses the downstream gradients tensor. Used by adjoint op.
 tensorflow::Status GetPrevGrads(
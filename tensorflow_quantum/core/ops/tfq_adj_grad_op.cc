@@ -32,6 +32,7 @@ limitations under the License.
 #include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
 #include "tensorflow_quantum/core/src/adj_util.h"
+#include "tensorflow_quantum/core/src/sparse_observable.h"
 #include "tensorflow_quantum/core/src/util_qsim.h"
 
 namespace tfq {
@@ -45,18 +46,21 @@ typedef qsim::Circuit<QsimGate> QsimCircuit;
 
 class TfqAdjointGradientOp : public tensorflow::OpKernel {
  public:
-  explicit TfqAdjointGradientOp(tensorflow::OpKernelConstruction* context)
-      : OpKernel(context) {}
+  explicit TfqAdjointGradientOp(tensorflow::OpKernelConstruction* context,
+                                bool sparse_observables = false)
+      : OpKernel(context), sparse_observables_(sparse_observables) {}
 
   void Compute(tensorflow::OpKernelContext* context) override {
     // TODO (mbbrough): add more dimension checks for other inputs here.
     const int num_inputs = context->num_inputs();
-    OP_REQUIRES(context, num_inputs == 5,
+    const int expected_inputs = sparse_observables_ ? 7 : 5;
+    OP_REQUIRES(context, num_inputs == expected_inputs,
                 tensorflow::errors::InvalidArgument(absl::StrCat(
-                    "Expected 5 inputs, got ", num_inputs, " inputs.")));
+                    "Expected ", expected_inputs, " inputs, got ", num_inputs,
+                    " inputs.")));
 
     // Create the output Tensor.
-    const int output_dim_batch_size = context->input(0).dim_size(0);
+    const int output_dim_batch_size = context->input(2).dim_size(0);
     const int output_dim_param_size = context->input(2).dim_size(1);
     tensorflow::TensorShape output_shape;
     output_shape.AddDim(output_dim_batch_size);
@@ -70,42 +74,56 @@ class TfqAdjointGradientOp : public tensorflow::OpKernel {
     std::vector<Program> programs;
     std::vector<int> num_qubits;
     std::vector<std::vector<PauliSum>> pauli_sums;
-    OP_REQUIRES_OK(context, GetProgramsAndNumQubits(context, &programs,
-                                                    &num_qubits, &pauli_sums));
+    std::vector<std::vector<SparseObservable>> observables;
+    int num_ops = 0;
+    if (sparse_observables_) {
+      OP_REQUIRES_OK(context, GetBroadcastProgramsAndNumQubits(
+                                  context, &programs, &num_qubits));
+      OP_REQUIRES_OK(context,
+                     GetSparseObservables(context, num_qubits, &observables));
+      num_ops = context->input(5).vec<int64_t>()(1);
+    } else {
+      OP_REQUIRES_OK(context, GetBroadcastProgramsAndNumQubits(
+                                  context, &programs, &num_qubits,
+                                  &pauli_sums));
+      num_ops = context->input(3).dim_size(1);
+    }
 
     std::vector<SymbolMap> maps;
     OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
 
-    OP_REQUIRES(context, programs.size() == maps.size(),
+    OP_REQUIRES(context, num_qubits.size() == maps.size(),
                 tensorflow::errors::InvalidArgument(absl::StrCat(
                     "Number of circuits and symbol_values do not match. Got ",
                     programs.size(), " circuits and ", maps.size(),
                     " symbol values.")));
 
     // Construct qsim circuits.
-    std::vector<QsimCircuit> qsim_circuits(programs.size(), QsimCircuit());
+    std::vector<QsimCircuit> qsim_circuits(maps.size(), QsimCircuit());
     std::vector<std::vector<qsim::GateFused<QsimGate>>> full_fuse(
-        programs.size(), std::vector<qsim::GateFused<QsimGate>>({}));
+        maps.size(), std::vector<qsim::GateFused<QsimGate>>({}));
     std::vector<std::vector<std::vector<qsim::GateFused<QsimGate>>>>
         partial_fused_circuits(
-            programs.size(),
+            maps.size(),
             std::vector<std::vector<qsim::GateFused<QsimGate>>>({}));
 
     // track metadata.
     std::vector<std::vector<tfq::GateMetaData>> gate_meta(
-        programs.size(), std::vector<tfq::GateMetaData>({}));
+        maps.size(), std::vector<tfq::GateMetaData>({}));
 
     // track gradients
     std::vector<std::vector<GradientOfGate>> gradient_gates(
-        programs.size(), std::vector<GradientOfGate>({}));
+        maps.size(), std::vector<GradientOfGate>({}));
 
     Status parse_status = ::tensorflow::Status();
     auto p_lock = tensorflow::mutex();
     auto construct_f = [&](int start, int end) {
       for (int i = start; i < end; i++) {
-        Status local = QsimCircuitFromProgram(programs[i], maps[i],
-                                              num_qubits[i], &qsim_circuits[i],
-                                              &full_fuse[i], &gate_meta[i]);
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        Status local = QsimCircuitFromProgram(program, maps[i], num_qubits[i],
+                                              &qsim_circuits[i], &full_fuse[i],
+                                              &gate_meta[i]);
         NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
         CreateGradientCircuit(qsim_circuits[i], gate_meta[i],
                               &partial_fused_circuits[i], &gradient_gates[i]);
@@ -114,25 +132,26 @@ class TfqAdjointGradientOp : public tensorflow::OpKernel {
 
     const int num_cycles = 1000;
     context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-        programs.size(), num_cycles, construct_f);
+        maps.size(), num_cycles, construct_f);
     OP_REQUIRES_OK(context, parse_status);
 
     // Get downstream gradients.
     std::vector<std::vector<float>> downstream_grads;
     OP_REQUIRES_OK(context, GetPrevGrads(context, &downstream_grads));
 
-    OP_REQUIRES(context, downstream_grads.size() == programs.size(),
+    OP_REQUIRES(context, downstream_grads.size() == maps.size(),
                 tensorflow::errors::InvalidArgument(absl::StrCat(
                     "Number of gradients and circuits do not match. Got ",
-                    downstream_grads.size(), " gradients and ", programs.size(),
+                    downstream_grads.size(), " gradients and ", maps.size(),
                     " circuits.")));
 
+    const int grad_input = sparse_observables_ ? 6 : 4;
     OP_REQUIRES(
-        context, context->input(4).dim_size(1) == context->input(3).dim_size(1),
+        context, context->input(grad_input).dim_size(1) == num_ops,
         tensorflow::errors::InvalidArgument(absl::StrCat(
             "Number of gradients and pauli sum dimension do not match. Got ",
-            context->input(4).dim_size(1), " gradient entries and ",
-            context->input(3).dim_size(1), " paulis per circuit.")));
+            context->input(grad_input).dim_size(1), " gradient entries and ",
+            num_ops, " paulis per circuit.")));
 
     int max_num_qubits = 0;
     for (const int num : num_qubits) {
@@ -148,18 +167,66 @@ class TfqAdjointGradientOp : public tensorflow::OpKernel {
     // ...
     // This method creates 3 big state vectors per thread so reducing size
     // here slightly.
-    if (max_num_qubits >= 25 || programs.size() == 1) {
+    if (max_num_qubits >= 25 || maps.size() == 1) {
       ComputeLarge(num_qubits, qsim_circuits, maps, full_fuse,
-                   partial_fused_circuits, pauli_sums, gradient_gates,
-                   downstream_grads, context, &output_tensor);
+                   partial_fused_circuits, pauli_sums, observables,
+                   gradient_gates, downstream_grads, context, &output_tensor);
     } else {
       ComputeSmall(num_qubits, max_num_qubits, qsim_circuits, maps, full_fuse,
-                   partial_fused_circuits, pauli_sums, gradient_gates,
-                   downstream_grads, context, &output_tensor);
+                   partial_fused_circuits, pauli_sums, observables,
+                   gradient_gates, downstream_grads, context, &output_tensor);
     }
   }
 
  private:
+  // When true, observables are sparse matrices given by the
+  // 'observable_indices', 'observable_values' and 'observable_shape' inputs
+  // instead of 'pauli_sums'.
+  const bool sparse_observables_;
+
+  // Writes (sum_j observable_j * downstream_grads[i][j])|psi> onto scratch,
+  // where sv holds |psi>. scratch2 is clobbered. When workers is given, the
+  // rows of sparse observables are split across its threads.
+  template <typename SimT, typename StateSpaceT, typename StateT>
+  void AccumulateObservables(
+      const int i, const std::vector<std::vector<PauliSum>>& pauli_sums,
+      const std::vector<std::vector<SparseObservable>>& observables,
+      const std::vector<std::vector<float>>& downstream_grads, const SimT& sim,
+      const StateSpaceT& ss, StateT& sv, StateT& scratch2, StateT& scratch,
+      tensorflow::thread::ThreadPool* workers = nullptr) {
+    if (sparse_observables_ && workers == nullptr) {
+      // A single sparse product per observable, with no copies of sv.
+      AccumulateSparseOperators(observables[i], downstream_grads[i], ss, sv,
+                                scratch);
+      return;
+    }
+    if (sparse_observables_) {
+      // Every row of scratch is written by exactly one shard, and
+      // ParallelFor returns once every shard is done, which orders the
+      // observables.
+      ss.SetAllZeros(scratch);
+      for (size_t j = 0; j < observables[i].size(); j++) {
+        const SparseObservable& observable = observables[i][j];
+        const float weight = downstream_grads[i][j];
+        if (weight == 0.0) {
+          continue;
+        }
+        auto accumulate_f = [&](int64_t start, int64_t end) {
+          AccumulateSparseOperator(observable, weight, ss, sv, scratch, start,
+                                   end);
+        };
+        // Roughly one cycle per stored entry and per nonzero row.
+        const int64_t num_cycles_row =
+            observable.cols.size() / (observable.NumRows() + 1) + 1;
+        workers->ParallelFor(observable.NumRows(), num_cycles_row,
+                             accumulate_f);
+      }
+      return;
+    }
+    [[maybe_unused]] Status unused = AccumulateOperators(
+        pauli_sums[i], downstream_grads[i], sim, ss, sv, scratch2, scratch);
+  }
+
   void ComputeSmall(
       const std::vector<int>& num_qubits, const int max_num_qubits,
       const std::vector<QsimCircuit>& qsim_circuits,
@@ -168,6 +235,7 @@ class TfqAdjointGradientOp : public tensorflow::OpKernel {
       const std::vector<std::vector<std::vector<qsim::GateFused<QsimGate>>>>&
           partial_fused_circuits,
       const std::vector<std::vector<PauliSum>>& pauli_sums,
+      const std::vector<std::vector<SparseObservable>>& observables,
       const std::vector<std::vector<tfq::GradientOfGate>>& gradient_gates,
       const std::vector<std::vector<float>>& downstream_grads,
       tensorflow::OpKernelContext* context,
@@ -207,10 +275,9 @@ class TfqAdjointGradientOp : public tensorflow::OpKernel {
         }
 
         // sv now contains psi
-        // scratch contains (sum_j paulis_sums[i][j] * downstream_grads[j])|psi>
-        // scratch2 now contains psi as well.
-        [[maybe_unused]] Status unused = AccumulateOperators(
-            pauli_sums[i], downstream_grads[i], sim, ss, sv, scratch2, scratch);
+        // scratch contains (sum_j observables[i][j] * downstream_grads[j])|psi>
+        AccumulateObservables(i, pauli_sums, observables, downstream_grads,
+                              sim, ss, sv, scratch2, scratch);
 
         for (int j = partial_fused_circuits[i].size() - 1; j >= 0; j--) {
           for (int k = partial_fused_circuits[i][j].size() - 1; k >= 0; k--) {
@@ -281,6 +348,7 @@ class TfqAdjointGradientOp : public tensorflow::OpKernel {
       const std::vector<std::vector<std::vector<qsim::GateFused<QsimGate>>>>&
           partial_fused_circuits,
       const std::vector<std::vector<PauliSum>>& pauli_sums,
+      const std::vector<std::vector<SparseObservable>>& observables,
       const std::vector<std::vector<tfq::GradientOfGate>>& gradient_gates,
       const std::vector<std::vector<float>>& downstream_grads,
       tensorflow::OpKernelContext* context,
@@ -320,10 +388,11 @@ class TfqAdjointGradientOp : public tensorflow::OpKernel {
       }
 
       // sv now contains psi
-      // scratch contains (sum_j paulis_sums[i][j] * downstream_grads[j])|psi>
-      // scratch2 now contains psi as well.
-      [[maybe_unused]] Status unused = AccumulateOperators(
-          pauli_sums[i], downstream_grads[i], sim, ss, sv, scratch2, scratch);
+      // scratch contains (sum_j observables[i][j] * downstream_grads[j])|psi>
+      AccumulateObservables(
+          i, pauli_sums, observables, downstream_grads, sim, ss, sv, scratch2,
+          scratch,
+          context->device()->tensorflow_cpu_worker_threads()->workers);
 
       for (int j = partial_fused_circuits[i].size() - 1; j >= 0; j--) {
         for (int k = partial_fused_circuits[i][j].size() - 1; k >= 0; k--) {
@@ -380,10 +449,21 @@ class TfqAdjointGradientOp : public tensorflow::OpKernel {
   }
 };
 
+class TfqAdjointGradientSparseOp : public TfqAdjointGradientOp {
+ public:
+  explicit TfqAdjointGradientSparseOp(
+      tensorflow::OpKernelConstruction* context)
+      : TfqAdjointGradientOp(context, /*sparse_observables=*/true) {}
+};
+
 REGISTER_KERNEL_BUILDER(
     Name("TfqAdjointGradient").Device(tensorflow::DEVICE_CPU),
     TfqAdjointGradientOp);
 
+REGISTER_KERNEL_BUILDER(
+    Name("TfqAdjointGradientSparse").Device(tensorflow::DEVICE_CPU),
+    TfqAdjointGradientSparseOp);
+
 REGISTER_OP("TfqAdjointGradient")
     .Input("programs: string")
     .Input("symbol_names: string")
@@ -408,7 +488,48 @@ REGISTER_OP("TfqAdjointGradient")
       TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &downstream_grads_shape));
 
       tensorflow::shape_inference::DimensionHandle output_rows =
-          c->Dim(programs_shape, 0);
+          c->Dim(symbol_values_shape, 0);
+      tensorflow::shape_inference::DimensionHandle output_cols =
+          c->Dim(symbol_names_shape, 0);
+      c->set_output(0, c->Matrix(output_rows, output_cols));
+
+      return ::tensorflow::Status();
+    });
+
+REGISTER_OP("TfqAdjointGradientSparse")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("observable_indices: int64")
+    .Input("observable_values: complex64")
+    .Input("observable_shape: int64")
+    .Input("downstream_grads: float")
+    .Output("grads: float")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle observable_indices_shape;
+      TF_RETURN_IF_ERROR(
+          c->WithRank(c->input(3), 2, &observable_indices_shape));
+
+      tensorflow::shape_inference::ShapeHandle observable_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &observable_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle observable_shape_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 1, &observable_shape_shape));
+
+      tensorflow::shape_inference::ShapeHandle downstream_grads_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 2, &downstream_grads_shape));
+
+      tensorflow::shape_inference::DimensionHandle output_rows =
+          c->Dim(symbol_values_shape, 0);
       tensorflow::shape_inference::DimensionHandle output_cols =
           c->Dim(symbol_names_shape, 0);
       c->set_output(0, c->Matrix(output_rows, output_cols));
@@ -24,7 +24,9 @@ def tfq_adj_grad(programs, symbol_names, symbol_values, pauli_sums, prev_grad):
 
     Args:
         programs: `tf.Tensor` of strings with shape [batch_size] containing
-            the string representations of the circuits to be executed.
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
         symbol_names: `tf.Tensor` of strings with shape [n_params], which
             is used to specify the order in which the values in
             `symbol_values` should be placed inside of the circuits in
@@ -46,3 +48,39 @@ def tfq_adj_grad(programs, symbol_names, symbol_values, pauli_sums, prev_grad):
     return SIM_OP_MODULE.tfq_adjoint_gradient(
         programs, symbol_names, tf.cast(symbol_values, tf.float32), pauli_sums,
         tf.cast(prev_grad, tf.float32))
+
+
+def tfq_adj_grad_sparse(programs, symbol_names, symbol_values, observables,
+                        prev_grad):
+    """Calculate adjoint gradients of expectation values of sparse observables.
+
+    The gradient counterpart of
+    `tfq_simulate_ops.tfq_simulate_sparse_expectation`.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        observables: `tf.SparseTensor` of complex numbers with dense shape
+            [batch_size, n_ops, 2 ** n, 2 ** n] holding Hermitian matrices,
+            as in `tfq_simulate_sparse_expectation`.
+        prev_grad: `tf.Tensor` of real numbers with shape [batch_size, n_ops]
+            backprop of values from downstream in the compute graph.
+    Returns:
+        `tf.Tensor` with shape [batch_size, n_params] that holds the gradient of
+            expectation value for each circuit with each observable applied to
+            it (after resolving the corresponding parameters in).
+    """
+    return SIM_OP_MODULE.tfq_adjoint_gradient_sparse(
+        programs, symbol_names, tf.cast(symbol_values, tf.float32),
+        observables.indices, tf.cast(observables.values, tf.complex64),
+        observables.dense_shape, tf.cast(prev_grad, tf.float32))
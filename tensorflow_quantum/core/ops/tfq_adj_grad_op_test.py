@@ -195,7 +195,7 @@ class ADJGradTest(tf.test.TestCase, parameterized.TestCase):
                                     expected_regex='do not match'):
             # wrong op size.
             tfq_adj_grad_op.tfq_adj_grad(
-                util.convert_to_tensor([cirq.Circuit()]), symbol_names,
+                util.convert_to_tensor([cirq.Circuit()] * 2), symbol_names,
                 symbol_values_array.astype(np.float64),
                 util.convert_to_tensor([[x] for x in pauli_sums]),
                 tf.convert_to_tensor(upstream_grads))
@@ -262,6 +262,28 @@ class ADJGradTest(tf.test.TestCase, parameterized.TestCase):
         )
         self.assertShapeEqual(np.zeros((0, 0)), out)
 
+    def test_calculate_adj_grad_broadcast(self):
+        """A single program must be broadcast against all symbol values."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        circuit = cirq.Circuit(
+            cirq.X(qubits[0])**sympy.Symbol('alpha'),
+            cirq.Y(qubits[1])**sympy.Symbol('beta'),
+            cirq.CNOT(qubits[0], qubits[1]))
+        symbol_names = ['alpha', 'beta']
+        batch_size = 4
+        symbol_values = np.random.uniform(size=(batch_size, 2))
+        op_batch = util.convert_to_tensor(
+            [[cirq.Z(qubits[0]), cirq.X(qubits[1])]] * batch_size)
+        prev_grads = tf.ones([batch_size, 2])
+
+        broadcast = tfq_adj_grad_op.tfq_adj_grad(
+            util.convert_to_tensor([circuit]), symbol_names,
+            tf.convert_to_tensor(symbol_values), op_batch, prev_grads)
+        tiled = tfq_adj_grad_op.tfq_adj_grad(
+            util.convert_to_tensor([circuit] * batch_size), symbol_names,
+            tf.convert_to_tensor(symbol_values), op_batch, prev_grads)
+        self.assertAllClose(broadcast, tiled, atol=1e-5)
+
     def test_calculate_adj_grad_simple_case(self):
         """Make sure that adjoint gradient works on simple input case."""
         n_qubits = 2
@@ -292,6 +314,38 @@ class ADJGradTest(tf.test.TestCase, parameterized.TestCase):
 
         self.assertAllClose(out, np.array([[-1.18392, 0.43281]]), atol=1e-3)
 
+    def test_calculate_adj_grad_sparse_matches_pauli_sums(self):
+        """Make sure sparse observable gradients match Pauli sum gradients."""
+        n_qubits = 3
+        batch_size = 4
+        symbol_names = ['alpha', 'beta']
+        qubits = cirq.GridQubit.rect(1, n_qubits)
+        circuit_batch, resolver_batch = \
+            util.random_symbol_circuit_resolver_batch(
+                qubits, symbol_names, batch_size)
+        symbol_values_array = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+        pauli_sums = [[x] for x in util.random_pauli_sums(
+            qubits, 3, batch_size)]
+        observables = tf.sparse.from_dense(
+            np.array([[x.matrix(qubits) for x in row] for row in pauli_sums],
+                     dtype=np.complex64))
+        prev_grads = np.random.uniform(size=(batch_size, 1))
+
+        expected = tfq_adj_grad_op.tfq_adj_grad(
+            util.convert_to_tensor(circuit_batch),
+            tf.convert_to_tensor(symbol_names),
+            tf.convert_to_tensor(symbol_values_array),
+            util.convert_to_tensor(pauli_sums), prev_grads)
+        actual = tfq_adj_grad_op.tfq_adj_grad_sparse(
+            util.convert_to_tensor(circuit_batch),
+            tf.convert_to_tensor(symbol_names),
+            tf.convert_to_tensor(symbol_values_array), observables,
+            prev_grads)
+        self.assertAllClose(actual, expected, atol=1e-4)
+
     def test_calculate_adj_grad_simple_case2(self):
         """Make sure the adjoint gradient works on another simple input case."""
         n_qubits = 2
@@ -0,0 +1,218 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/proto/program.pb.h"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::Status;
+using ::tfq::proto::Circuit;
+using ::tfq::proto::Operation;
+using ::tfq::proto::Program;
+
+// Gate codes understood by TfqBuildCircuits. The parameter of every gate is
+// its exponent, so the fixed gates (H, X, CNOT, ...) use a parameter of 1.
+// Must be kept in sync with GATE_CODES in tfq_utility_ops.py.
+struct GateCode {
+  const char* id;
+  int num_qubits;
+};
+
+constexpr GateCode kGateCodes[] = {
+    {"HP", 1},  {"XP", 1},  {"YP", 1},  {"ZP", 1},  {"XXP", 2}, {"YYP", 2},
+    {"ZZP", 2}, {"CZP", 2}, {"CNP", 2}, {"SP", 2},  {"ISP", 2},
+};
+
+constexpr int kNumGateCodes = sizeof(kGateCodes) / sizeof(kGateCodes[0]);
+
+Status InvalidArgument(const std::string& message) {
+  return Status(
+      static_cast<tensorflow::error::Code>(absl::StatusCode::kInvalidArgument),
+      message);
+}
+
+// Builds the Program for one row of the input tensors. Operations are placed
+// in the earliest moment in which all of their qubits are free.
+Status BuildProgram(const int row,
+                    const tensorflow::TTypes<int, 2>::ConstTensor& gate_codes,
+                    const tensorflow::TTypes<int, 3>::ConstTensor& qubits,
+                    const tensorflow::TTypes<float, 2>::ConstTensor& params,
+                    Program* program) {
+  program->mutable_language()->set_gate_set("tfq_gate_set");
+  Circuit* circuit = program->mutable_circuit();
+  circuit->set_scheduling_strategy(Circuit::MOMENT_BY_MOMENT);
+
+  absl::flat_hash_map<int, int> next_free_moment;
+  for (int g = 0; g < gate_codes.dimension(1); g++) {
+    const int code = gate_codes(row, g);
+    if (code == -1) {
+      // padding.
+      continue;
+    }
+    if (code < 0 || code >= kNumGateCodes) {
+      return InvalidArgument(absl::StrCat("Unknown gate code ", code,
+                                          " at position [", row, ", ", g,
+                                          "]."));
+    }
+    const GateCode& gate = kGateCodes[code];
+
+    int moment_index = 0;
+    for (int k = 0; k < gate.num_qubits; k++) {
+      const int q = qubits(row, g, k);
+      if (q < 0) {
+        return InvalidArgument(absl::StrCat(
+            "Invalid qubit index ", q, " for gate ", gate.id, " at position [",
+            row, ", ", g, "]."));
+      }
+      auto it = next_free_moment.find(q);
+      if (it != next_free_moment.end()) {
+        moment_index = std::max(moment_index, it->second);
+      }
+    }
+    if (gate.num_qubits == 2 && qubits(row, g, 0) == qubits(row, g, 1)) {
+      return InvalidArgument(absl::StrCat(
+          "Gate ", gate.id, " at position [", row, ", ", g,
+          "] must act on two distinct qubits."));
+    }
+
+    while (circuit->moments_size() <= moment_index) {
+      circuit->add_moments();
+    }
+    Operation* op = circuit->mutable_moments(moment_index)->add_operations();
+    op->mutable_gate()->set_id(gate.id);
+    auto& args = *op->mutable_args();
+    args["exponent"].mutable_arg_value()->set_float_value(params(row, g));
+    args["exponent_scalar"].mutable_arg_value()->set_float_value(1.0);
+    args["global_shift"].mutable_arg_value()->set_float_value(0.0);
+    args["control_qubits"].mutable_arg_value()->set_string_value("");
+    args["control_values"].mutable_arg_value()->set_string_value("");
+    for (int k = 0; k < gate.num_qubits; k++) {
+      const int q = qubits(row, g, k);
+      op->add_qubits()->set_id(absl::StrCat("0_", q));
+      next_free_moment[q] = moment_index + 1;
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+}  // namespace
+
+class TfqBuildCircuitsOp : public tensorflow::OpKernel {
+ public:
+  explicit TfqBuildCircuitsOp(tensorflow::OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(tensorflow::OpKernelContext* context) override {
+    const int num_inputs = context->num_inputs();
+    OP_REQUIRES(context, num_inputs == 3,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Expected 3 inputs, got ", num_inputs, " inputs.")));
+
+    const tensorflow::Tensor& gate_codes_t = context->input(0);
+    const tensorflow::Tensor& qubits_t = context->input(1);
+    const tensorflow::Tensor& params_t = context->input(2);
+    OP_REQUIRES(context, gate_codes_t.dims() == 2,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "gate_codes must be rank 2. Got rank ", gate_codes_t.dims(),
+                    ".")));
+    OP_REQUIRES(context, qubits_t.dims() == 3,
+                tensorflow::errors::InvalidArgument(
+                    absl::StrCat("qubit_indices must be rank 3. Got rank ",
+                                 qubits_t.dims(), ".")));
+    OP_REQUIRES(context, params_t.dims() == 2,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "params must be rank 2. Got rank ", params_t.dims(), ".")));
+    OP_REQUIRES(
+        context,
+        qubits_t.dim_size(0) == gate_codes_t.dim_size(0) &&
+            qubits_t.dim_size(1) == gate_codes_t.dim_size(1) &&
+            qubits_t.dim_size(2) == 2,
+        tensorflow::errors::InvalidArgument(
+            "qubit_indices must have shape [batch_size, n_gates, 2]."));
+    OP_REQUIRES(context, params_t.shape() == gate_codes_t.shape(),
+                tensorflow::errors::InvalidArgument(
+                    "gate_codes and params must have matching shapes."));
+
+    const auto gate_codes = gate_codes_t.tensor<int, 2>();
+    const auto qubits = qubits_t.tensor<int, 3>();
+    const auto params = params_t.tensor<float, 2>();
+
+    const int batch_size = gate_codes_t.dim_size(0);
+    tensorflow::Tensor* output = nullptr;
+    OP_REQUIRES_OK(context,
+                   context->allocate_output(
+                       0, tensorflow::TensorShape({batch_size}), &output));
+    auto output_tensor = output->flat<tensorflow::tstring>();
+
+    Status build_status = ::tensorflow::Status();
+    auto b_lock = tensorflow::mutex();
+    auto DoWork = [&](int start, int end) {
+      std::string temp;
+      for (int i = start; i < end; i++) {
+        Program program;
+        Status local = BuildProgram(i, gate_codes, qubits, params, &program);
+        NESTED_FN_STATUS_SYNC(build_status, local, b_lock);
+        program.SerializeToString(&temp);
+        output_tensor(i) = temp;
+      }
+    };
+
+    const int num_cycles = 100 * (gate_codes_t.dim_size(1) + 1);
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        batch_size, num_cycles, DoWork);
+    OP_REQUIRES_OK(context, build_status);
+  }
+};
+
+REGISTER_KERNEL_BUILDER(Name("TfqBuildCircuits").Device(tensorflow::DEVICE_CPU),
+                        TfqBuildCircuitsOp);
+
+REGISTER_OP("TfqBuildCircuits")
+    .Input("gate_codes: int32")
+    .Input("qubit_indices: int32")
+    .Input("params: float")
+    .Output("programs: string")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle gate_codes_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 2, &gate_codes_shape));
+
+      tensorflow::shape_inference::ShapeHandle qubit_indices_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 3, &qubit_indices_shape));
+
+      tensorflow::shape_inference::ShapeHandle params_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &params_shape));
+
+      c->set_output(0, c->Vector(c->Dim(gate_codes_shape, 0)));
+
+      return ::tensorflow::Status();
+    });
+
+}  // namespace tfq
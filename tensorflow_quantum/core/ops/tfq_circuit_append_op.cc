@@ -51,13 +51,14 @@ class TfqCircuitAppendOp : public tensorflow::OpKernel {
                                 0, context->input(0).shape(), &output));
     auto output_tensor = output->flat<tensorflow::tstring>();
 
+    const bool broadcast = programs_to_append.size() == 1;
     auto DoWork = [&](int start, int end) {
       std::string temp;
       for (int i = start; i < end; i++) {
-        for (int j = 0; j < programs_to_append.at(i).circuit().moments().size();
-             j++) {
+        const Program &to_append = programs_to_append.at(broadcast ? 0 : i);
+        for (int j = 0; j < to_append.circuit().moments().size(); j++) {
           Moment *new_moment = programs.at(i).mutable_circuit()->add_moments();
-          *new_moment = programs_to_append.at(i).circuit().moments(j);
+          *new_moment = to_append.circuit().moments(j);
         }
         programs.at(i).SerializeToString(&temp);
         output_tensor(i) = temp;
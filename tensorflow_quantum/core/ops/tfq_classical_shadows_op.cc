@@ -0,0 +1,509 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <algorithm>
+#include <bitset>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/seqfor.h"
+#include "../qsim/lib/simmux.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/numbers.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/random/random.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/util/guarded_philox_random.h"
+#include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliQubitPair;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+using ::tfq::proto::Program;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::Circuit<QsimGate> QsimCircuit;
+
+// One randomized Pauli measurement of a state. The measurement basis of
+// every qubit and the measured bits are packed as bitmasks in qsim's
+// (little-endian) qubit order. Qubits in neither x_mask nor y_mask were
+// measured in the Z basis.
+struct ShadowRecord {
+  uint64_t x_mask;
+  uint64_t y_mask;
+  uint64_t bits;
+};
+
+// Takes num_snapshots random Pauli basis measurements of state. Snapshots
+// that drew the same basis share a single basis rotation of the state.
+// scratch is required to have memory initialized, but does not require
+// values in memory to be set.
+template <typename SimT, typename StateSpaceT, typename StateT>
+Status MeasureShadows(const SimT& sim, const StateSpaceT& ss, StateT& state,
+                      StateT& scratch, const int num_qubits,
+                      const int num_snapshots,
+                      tensorflow::random::SimplePhilox& random_source,
+                      std::vector<ShadowRecord>* records) {
+  absl::flat_hash_map<std::pair<uint64_t, uint64_t>, int> basis_counts;
+  for (int k = 0; k < num_snapshots; k++) {
+    uint64_t x_mask = 0;
+    uint64_t y_mask = 0;
+    for (int q = 0; q < num_qubits; q++) {
+      const uint32_t basis = random_source.Uniform(3);
+      if (basis == 0) {
+        x_mask |= uint64_t(1) << q;
+      } else if (basis == 1) {
+        y_mask |= uint64_t(1) << q;
+      }
+    }
+    basis_counts[{x_mask, y_mask}]++;
+  }
+
+  records->clear();
+  records->reserve(num_snapshots);
+  for (const auto& basis_count : basis_counts) {
+    const uint64_t x_mask = basis_count.first.first;
+    const uint64_t y_mask = basis_count.first.second;
+
+    // Rotate a copy of the state so that measuring it in the Z basis
+    // measures every qubit in its drawn basis.
+    PauliTerm term;
+    for (int q = 0; q < num_qubits; q++) {
+      if (((x_mask | y_mask) >> q & 1) == 0) {
+        continue;
+      }
+      PauliQubitPair* pair = term.add_paulis();
+      pair->set_qubit_id(std::to_string(num_qubits - q - 1));
+      pair->set_pauli_type((x_mask >> q & 1) ? "X" : "Y");
+    }
+    QsimCircuit circuit;
+    std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+    Status status = QsimZBasisCircuitFromPauliTerm(term, num_qubits, &circuit,
+                                                   &fused_circuit);
+    if (!status.ok()) {
+      return status;
+    }
+    ss.Copy(state, scratch);
+    for (const qsim::GateFused<QsimGate>& fused_gate : fused_circuit) {
+      qsim::ApplyFusedGate(sim, fused_gate, scratch);
+    }
+
+    std::vector<uint64_t> samples =
+        ss.Sample(scratch, basis_count.second, random_source.Rand32());
+    for (const uint64_t sample : samples) {
+      records->push_back({x_mask, y_mask, sample});
+    }
+  }
+
+  // Records come out grouped by basis, mix them before they are split
+  // into median of means groups.
+  PhiloxBitGenerator gen(&random_source);
+  std::shuffle(records->begin(), records->end(), gen);
+  return ::tensorflow::Status();
+}
+
+// Median of means estimate of <p_sum> from the shadow records. A record
+// contributes 3^|support| * (-1)^parity to a term when it measured every
+// qubit in the support of that term in the term's own basis, and 0
+// otherwise.
+float EstimateFromShadows(const PauliSum& p_sum, const int num_qubits,
+                          const std::vector<ShadowRecord>& records,
+                          const int num_groups) {
+  struct TermMasks {
+    uint64_t support;
+    uint64_t x_mask;
+    uint64_t y_mask;
+    float weight;
+  };
+  std::vector<TermMasks> terms;
+  for (const PauliTerm& term : p_sum.terms()) {
+    TermMasks masks = {0, 0, 0, term.coefficient_real()};
+    for (const PauliQubitPair& pair : term.paulis()) {
+      unsigned int location;
+      // GridQubit id should be parsed down to integer at this upstream
+      //  so it is safe to just use atoi.
+      (void)absl::SimpleAtoi(pair.qubit_id(), &location);
+      const uint64_t bit = uint64_t(1) << (num_qubits - location - 1);
+      masks.support |= bit;
+      if (pair.pauli_type() == "X") {
+        masks.x_mask |= bit;
+      } else if (pair.pauli_type() == "Y") {
+        masks.y_mask |= bit;
+      }
+      masks.weight *= 3.0;
+    }
+    terms.push_back(masks);
+  }
+
+  const int num_records = records.size();
+  const int k = std::min(num_groups, num_records);
+  if (k == 0) {
+    return 0.0;
+  }
+  std::vector<double> means(k, 0.0);
+  for (int g = 0; g < k; g++) {
+    const int begin = static_cast<int64_t>(g) * num_records / k;
+    const int end = static_cast<int64_t>(g + 1) * num_records / k;
+    double total = 0.0;
+    for (int r = begin; r < end; r++) {
+      const ShadowRecord& record = records[r];
+      for (const TermMasks& term : terms) {
+        if ((record.x_mask & term.support) != term.x_mask ||
+            (record.y_mask & term.support) != term.y_mask) {
+          continue;
+        }
+        const int parity =
+            std::bitset<64>(record.bits & term.support).count() & 1;
+        total += parity ? -term.weight : term.weight;
+      }
+    }
+    means[g] = total / (end - begin);
+  }
+
+  std::sort(means.begin(), means.end());
+  if (k % 2 == 1) {
+    return means[k / 2];
+  }
+  return (means[k / 2 - 1] + means[k / 2]) / 2.0;
+}
+
+}  // namespace
+
+class TfqClassicalShadowsOp : public tensorflow::AsyncOpKernel {
+ public:
+  explicit TfqClassicalShadowsOp(tensorflow::OpKernelConstruction* context)
+      : AsyncOpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("share_states", &share_states_));
+    OP_REQUIRES_OK(context, context->GetAttr("num_groups", &num_groups_));
+  }
+
+  void ComputeAsync(tensorflow::OpKernelContext* context,
+                    DoneCallback done) override {
+    // Hand the work to the shared scheduler instead of blocking an inter-op
+    // thread for the whole simulation.
+    SimulationScheduler::Global()->Schedule([this, context, done]() {
+      ComputeOnScheduler(context);
+      done();
+    });
+  }
+
+ private:
+  // When true, final states are shared with sibling ops of the same step
+  // that also set share_states.
+  bool share_states_;
+
+  // Number of groups used in the median of means estimates.
+  int num_groups_;
+
+  void ComputeOnScheduler(tensorflow::OpKernelContext* context) {
+    const int num_inputs = context->num_inputs();
+    OP_REQUIRES(context, num_inputs == 5,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Expected 5 inputs, got ", num_inputs, " inputs.")));
+
+    // Create the output Tensor.
+    const int output_dim_batch_size = context->input(2).dim_size(0);
+    const int output_dim_op_size = context->input(3).dim_size(1);
+    tensorflow::TensorShape output_shape;
+    output_shape.AddDim(output_dim_batch_size);
+    output_shape.AddDim(output_dim_op_size);
+
+    tensorflow::Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+    auto output_tensor = output->matrix<float>();
+
+    std::vector<Program> programs;
+    std::vector<int> num_qubits;
+    std::vector<std::vector<PauliSum>> pauli_sums;
+    OP_REQUIRES_OK(context,
+                   GetBroadcastProgramsAndNumQubits(context, &programs,
+                                                    &num_qubits, &pauli_sums));
+
+    std::vector<SymbolMap> maps;
+    OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
+
+    OP_REQUIRES(context, num_qubits.size() == maps.size(),
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Number of circuits and symbol_values do not match. Got ",
+                    programs.size(), " circuits and ", maps.size(),
+                    " symbol values.")));
+
+    int num_snapshots = 0;
+    OP_REQUIRES_OK(context, GetIndividualSample(context, &num_snapshots,
+                                                "num_snapshots"));
+    OP_REQUIRES(context, num_snapshots >= 0,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "num_snapshots must be non-negative. Got ", num_snapshots,
+                    ".")));
+
+    int max_num_qubits = 0;
+    for (const int num : num_qubits) {
+      max_num_qubits = std::max(max_num_qubits, num);
+    }
+
+    // Share final states with sibling ops simulating the same circuits.
+    StateCache* cache = nullptr;
+    if (share_states_) {
+      OP_REQUIRES_OK(context, GetStepStateCache(context, &cache));
+    }
+    tensorflow::core::ScopedUnref unref_cache(cache);
+    std::vector<uint64_t> keys;
+    if (cache != nullptr) {
+      OP_REQUIRES_OK(context, GetStateCacheKeys(context, &keys));
+    }
+
+    // Cross reference with standard google cloud compute instances
+    // Memory ~= 2 * num_threads * (2 * 64 * 2 ** num_qubits in circuits)
+    // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
+    // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
+    // ...
+    const bool large = max_num_qubits >= 26 || maps.size() == 1;
+
+    // Reserve this op's state vector memory in the shared budget.
+    const int num_workers =
+        large ? 1
+              : context->device()->tensorflow_cpu_worker_threads()->num_threads;
+    SimulationScheduler::ScopedMemory memory(
+        SimulationScheduler::Global(),
+        2 * num_workers * SimulationScheduler::StateBytes(max_num_qubits));
+
+    if (large) {
+      ComputeLarge(programs, maps, num_qubits, pauli_sums, num_snapshots,
+                   cache, keys, context, &output_tensor);
+    } else {
+      ComputeSmall(programs, maps, num_qubits, max_num_qubits, pauli_sums,
+                   num_snapshots, cache, keys, context, &output_tensor);
+    }
+  }
+
+  void ComputeLarge(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
+      const std::vector<int>& num_qubits,
+      const std::vector<std::vector<PauliSum>>& pauli_sums,
+      const int num_snapshots, StateCache* cache,
+      const std::vector<uint64_t>& keys, tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    // Instantiate qsim objects.
+    const auto tfq_for = tfq::QsimFor(context);
+    using Simulator = qsim::Simulator<const tfq::QsimFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    // Begin simulation.
+    int largest_nq = 1;
+    Simulator sim = Simulator(tfq_for);
+    StateSpace ss = StateSpace(tfq_for);
+    auto sv = ss.Create(largest_nq);
+    auto scratch = ss.Create(largest_nq);
+
+    tensorflow::GuardedPhiloxRandom random_gen;
+    random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
+    auto local_gen = random_gen.ReserveSamples32(
+        maps.size() * (num_snapshots + 1) + 1);
+    tensorflow::random::SimplePhilox rand_source(&local_gen);
+
+    std::vector<ShadowRecord> records;
+    for (size_t i = 0; i < maps.size(); i++) {
+      const int nq = num_qubits[i];
+
+      // (#679) Just ignore empty program
+      if (nq == 0) {
+        for (size_t j = 0; j < pauli_sums[i].size(); j++) {
+          (*output_tensor)(i, j) = -2.0;
+        }
+        continue;
+      }
+
+      if (nq > largest_nq) {
+        // need to switch to larger statespace.
+        largest_nq = nq;
+        sv = ss.Create(largest_nq);
+        scratch = ss.Create(largest_nq);
+      }
+      if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+        QsimCircuit qsim_circuit;
+        std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        OP_REQUIRES_OK(context,
+                       QsimCircuitFromProgram(program, maps[i], nq,
+                                              &qsim_circuit, &fused_circuit));
+        ss.SetStateZero(sv);
+        for (size_t j = 0; j < fused_circuit.size(); j++) {
+          qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+        }
+        if (cache != nullptr) {
+          cache->Store(keys[i], nq, ss, sv);
+        }
+      }
+
+      OP_REQUIRES_OK(context,
+                     MeasureShadows(sim, ss, sv, scratch, nq, num_snapshots,
+                                    rand_source, &records));
+      for (size_t j = 0; j < pauli_sums[i].size(); j++) {
+        (*output_tensor)(i, j) =
+            EstimateFromShadows(pauli_sums[i][j], nq, records, num_groups_);
+      }
+    }
+  }
+
+  void ComputeSmall(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
+      const std::vector<int>& num_qubits, const int max_num_qubits,
+      const std::vector<std::vector<PauliSum>>& pauli_sums,
+      const int num_snapshots, StateCache* cache,
+      const std::vector<uint64_t>& keys, tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    const auto tfq_for = qsim::SequentialFor(1);
+    using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    tensorflow::GuardedPhiloxRandom random_gen;
+    random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
+    const int num_threads = context->device()
+                                ->tensorflow_cpu_worker_threads()
+                                ->workers->NumThreads();
+
+    Status compute_status = ::tensorflow::Status();
+    auto c_lock = tensorflow::mutex();
+    auto DoWork = [&](int start, int end) {
+      int largest_nq = 1;
+      Simulator sim = Simulator(tfq_for);
+      StateSpace ss = StateSpace(tfq_for);
+      auto sv = ss.Create(largest_nq);
+      auto scratch = ss.Create(largest_nq);
+
+      int64_t n_random = static_cast<int64_t>(maps.size()) *
+                         (max_num_qubits + 2) * (num_snapshots + 1);
+      n_random /= num_threads;
+      n_random += 1;
+      auto local_gen = random_gen.ReserveSamples32(n_random);
+      tensorflow::random::SimplePhilox rand_source(&local_gen);
+
+      std::vector<ShadowRecord> records;
+      for (int i = start; i < end; i++) {
+        const int nq = num_qubits[i];
+
+        // (#679) Just ignore empty program
+        if (nq == 0) {
+          for (size_t j = 0; j < pauli_sums[i].size(); j++) {
+            (*output_tensor)(i, j) = -2.0;
+          }
+          continue;
+        }
+
+        if (nq > largest_nq) {
+          // need to switch to larger statespace.
+          largest_nq = nq;
+          sv = ss.Create(largest_nq);
+          scratch = ss.Create(largest_nq);
+        }
+        if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+          QsimCircuit qsim_circuit;
+          std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+          const Program& program =
+              programs.size() == 1 ? programs[0] : programs[i];
+          Status local = QsimCircuitFromProgram(program, maps[i], nq,
+                                                &qsim_circuit, &fused_circuit);
+          NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+          ss.SetStateZero(sv);
+          for (size_t j = 0; j < fused_circuit.size(); j++) {
+            qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+          }
+          if (cache != nullptr) {
+            cache->Store(keys[i], nq, ss, sv);
+          }
+        }
+
+        NESTED_FN_STATUS_SYNC(
+            compute_status,
+            MeasureShadows(sim, ss, sv, scratch, nq, num_snapshots,
+                           rand_source, &records),
+            c_lock);
+        for (size_t j = 0; j < pauli_sums[i].size(); j++) {
+          (*output_tensor)(i, j) =
+              EstimateFromShadows(pauli_sums[i][j], nq, records, num_groups_);
+        }
+      }
+    };
+
+    const int64_t num_cycles =
+        200 * (int64_t(1) << static_cast<int64_t>(max_num_qubits)) *
+        (num_snapshots + 1);
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        maps.size(), num_cycles, DoWork);
+    OP_REQUIRES_OK(context, compute_status);
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqClassicalShadows").Device(tensorflow::DEVICE_CPU),
+    TfqClassicalShadowsOp);
+
+REGISTER_OP("TfqClassicalShadows")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("pauli_sums: string")
+    .Input("num_snapshots: int32")
+    .Output("expectations: float")
+    .Attr("num_groups: int >= 1 = 10")
+    .Attr("share_states: bool = false")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle pauli_sums_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &pauli_sums_shape));
+
+      tensorflow::shape_inference::ShapeHandle num_snapshots_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &num_snapshots_shape));
+
+      tensorflow::shape_inference::DimensionHandle output_rows =
+          c->Dim(symbol_values_shape, 0);
+      tensorflow::shape_inference::DimensionHandle output_cols =
+          c->Dim(pauli_sums_shape, 1);
+      c->set_output(0, c->Matrix(output_rows, output_cols));
+
+      return ::tensorflow::Status();
+    });
+
+}  // namespace tfq
@@ -14,6 +14,7 @@ limitations under the License.
 ==============================================================================*/
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "../qsim/lib/circuit.h"
@@ -25,12 +26,17 @@ limitations under the License.
 #include "tensorflow/core/framework/shape_inference.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/refcount.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/platform/mutex.h"
 #include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
 #include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
+#include "tensorflow_quantum/core/src/pauli_propagation.h"
 #include "tensorflow_quantum/core/src/util_qsim.h"
 
 namespace tfq {
@@ -42,21 +48,48 @@ using ::tfq::proto::Program;
 typedef qsim::Cirq::GateCirq<float> QsimGate;
 typedef qsim::Circuit<QsimGate> QsimCircuit;
 
-class TfqSimulateExpectationOp : public tensorflow::OpKernel {
+class TfqSimulateExpectationOp : public tensorflow::AsyncOpKernel {
  public:
-  explicit TfqSimulateExpectationOp(tensorflow::OpKernelConstruction* context)
-      : OpKernel(context) {}
+  explicit TfqSimulateExpectationOp(tensorflow::OpKernelConstruction* context,
+                                    bool append_programs = false)
+      : AsyncOpKernel(context), append_programs_(append_programs) {
+    OP_REQUIRES_OK(context, context->GetAttr("share_states", &share_states_));
+    std::string backend;
+    OP_REQUIRES_OK(context, context->GetAttr("backend", &backend));
+    pauli_propagation_ = backend == "pauli_propagation";
+    OP_REQUIRES_OK(context, context->GetAttr("truncation_threshold",
+                                             &truncation_threshold_));
+    OP_REQUIRES(context, truncation_threshold_ >= 0.0,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "truncation_threshold must be non-negative. Got ",
+                    truncation_threshold_, ".")));
+  }
+
+  void ComputeAsync(tensorflow::OpKernelContext* context,
+                    DoneCallback done) override {
+    // Hand the work to the shared scheduler instead of blocking an inter-op
+    // thread for the whole simulation.
+    SimulationScheduler::Global()->Schedule([this, context, done]() {
+      ComputeOnScheduler(context);
+      done();
+    });
+  }
 
-  void Compute(tensorflow::OpKernelContext* context) override {
+ private:
+  void ComputeOnScheduler(tensorflow::OpKernelContext* context) {
     // TODO (mbbrough): add more dimension checks for other inputs here.
     const int num_inputs = context->num_inputs();
-    OP_REQUIRES(context, num_inputs == 4,
-                tensorflow::errors::InvalidArgument(absl::StrCat(
-                    "Expected 4 inputs, got ", num_inputs, " inputs.")));
+    const int expected_inputs = append_programs_ ? 5 : 4;
+    OP_REQUIRES(context, num_inputs == expected_inputs,
+                tensorflow::errors::InvalidArgument(
+                    absl::StrCat("Expected ", expected_inputs, " inputs, got ",
+                                 num_inputs, " inputs.")));
 
     // Create the output Tensor.
-    const int output_dim_batch_size = context->input(0).dim_size(0);
-    const int output_dim_op_size = context->input(3).dim_size(1);
+    const int output_dim_batch_size =
+        context->input(expected_inputs - 2).dim_size(0);
+    const int output_dim_op_size =
+        context->input(expected_inputs - 1).dim_size(1);
     tensorflow::TensorShape output_shape;
     output_shape.AddDim(output_dim_batch_size);
     output_shape.AddDim(output_dim_op_size);
@@ -69,65 +102,156 @@ class TfqSimulateExpectationOp : public tensorflow::OpKernel {
     std::vector<Program> programs;
     std::vector<int> num_qubits;
     std::vector<std::vector<PauliSum>> pauli_sums;
-    OP_REQUIRES_OK(context, GetProgramsAndNumQubits(context, &programs,
-                                                    &num_qubits, &pauli_sums));
+    if (append_programs_) {
+      OP_REQUIRES_OK(context,
+                     GetAppendedProgramsAndNumQubits(context, &programs,
+                                                     &num_qubits, &pauli_sums));
+    } else {
+      OP_REQUIRES_OK(context,
+                     GetBroadcastProgramsAndNumQubits(
+                         context, &programs, &num_qubits, &pauli_sums));
+    }
 
     std::vector<SymbolMap> maps;
     OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
 
-    OP_REQUIRES(context, programs.size() == maps.size(),
+    OP_REQUIRES(context, num_qubits.size() == maps.size(),
                 tensorflow::errors::InvalidArgument(absl::StrCat(
                     "Number of circuits and symbol_values do not match. Got ",
                     programs.size(), " circuits and ", maps.size(),
                     " symbol values.")));
 
-    // Construct qsim circuits.
-    std::vector<QsimCircuit> qsim_circuits(programs.size(), QsimCircuit());
-    std::vector<std::vector<qsim::GateFused<QsimGate>>> fused_circuits(
-        programs.size(), std::vector<qsim::GateFused<QsimGate>>({}));
-
-    Status parse_status = ::tensorflow::Status();
-    auto p_lock = tensorflow::mutex();
-    auto construct_f = [&](int start, int end) {
-      for (int i = start; i < end; i++) {
-        Status local =
-            QsimCircuitFromProgram(programs[i], maps[i], num_qubits[i],
-                                   &qsim_circuits[i], &fused_circuits[i]);
-        NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
-      }
-    };
-
-    const int num_cycles = 1000;
-    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-        programs.size(), num_cycles, construct_f);
-    OP_REQUIRES_OK(context, parse_status);
-
     int max_num_qubits = 0;
     for (const int num : num_qubits) {
       max_num_qubits = std::max(max_num_qubits, num);
     }
 
+    if (pauli_propagation_) {
+      // No state vectors are formed, so neither the state cache nor the
+      // scheduler's memory budget apply.
+      ComputePauliPropagation(programs, maps, num_qubits, pauli_sums, context,
+                              &output_tensor);
+      return;
+    }
+
+    // Share final states with sibling ops simulating the same circuits.
+    StateCache* cache = nullptr;
+    if (share_states_) {
+      OP_REQUIRES_OK(context, GetStepStateCache(context, &cache));
+    }
+    tensorflow::core::ScopedUnref unref_cache(cache);
+    std::vector<uint64_t> keys;
+    if (cache != nullptr) {
+      OP_REQUIRES_OK(context,
+                     GetStateCacheKeys(context, &keys, append_programs_));
+    }
+
     // Cross reference with standard google cloud compute instances
     // Memory ~= 2 * num_threads * (2 * 64 * 2 ** num_qubits in circuits)
     // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
     // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
     // ...
-    if (max_num_qubits >= 26 || programs.size() == 1) {
-      ComputeLarge(num_qubits, fused_circuits, pauli_sums, context,
-                   &output_tensor);
-    } else {
-      ComputeSmall(num_qubits, max_num_qubits, fused_circuits, pauli_sums,
+    const bool large = max_num_qubits >= 26 || maps.size() == 1;
+
+    // Reserve this op's state vector memory in the shared budget.
+    const int num_workers =
+        large ? 1
+              : context->device()->tensorflow_cpu_worker_threads()->num_threads;
+    SimulationScheduler::ScopedMemory memory(
+        SimulationScheduler::Global(),
+        2 * num_workers * SimulationScheduler::StateBytes(max_num_qubits));
+
+    if (large) {
+      ComputeLarge(programs, maps, num_qubits, pauli_sums, cache, keys,
                    context, &output_tensor);
+    } else {
+      ComputeSmall(programs, maps, num_qubits, max_num_qubits, pauli_sums,
+                   cache, keys, context, &output_tensor);
     }
   }
 
- private:
-  void ComputeLarge(
+  // When true, 'programs_to_append' is appended onto 'programs' while
+  // parsing, fusing TfqAppendCircuit into the simulation.
+  const bool append_programs_;
+
+  // When true, final states are shared with sibling ops of the same step
+  // that also set share_states.
+  bool share_states_;
+
+  // When true, observables are propagated backwards through the circuit
+  // gates instead of simulating state vectors, dropping Pauli strings whose
+  // coefficient falls below truncation_threshold_.
+  bool pauli_propagation_;
+  float truncation_threshold_;
+
+  void ComputePauliPropagation(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
       const std::vector<int>& num_qubits,
-      const std::vector<std::vector<qsim::GateFused<QsimGate>>>& fused_circuits,
       const std::vector<std::vector<PauliSum>>& pauli_sums,
       tensorflow::OpKernelContext* context,
       tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    const int output_dim_op_size = output_tensor->dimension(1);
+
+    Status compute_status = ::tensorflow::Status();
+    auto c_lock = tensorflow::mutex();
+    auto DoWork = [&](int start, int end) {
+      int old_batch_index = -2;
+      QsimCircuit qsim_circuit;
+      for (int i = start; i < end; i++) {
+        const int cur_batch_index = i / output_dim_op_size;
+        const int cur_op_index = i % output_dim_op_size;
+
+        // (#679) Just ignore empty program
+        if (num_qubits[cur_batch_index] == 0) {
+          (*output_tensor)(cur_batch_index, cur_op_index) = -2.0;
+          continue;
+        }
+
+        if (cur_batch_index != old_batch_index) {
+          // Gates are conjugated one at a time, so the circuit is not fused.
+          qsim_circuit = QsimCircuit();
+          const Program& program =
+              programs.size() == 1 ? programs[0] : programs[cur_batch_index];
+          Status local = QsimCircuitFromProgram(
+              program, maps[cur_batch_index], num_qubits[cur_batch_index],
+              &qsim_circuit, nullptr);
+          NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+          old_batch_index = cur_batch_index;
+        }
+
+        float exp_v = 0.0;
+        NESTED_FN_STATUS_SYNC(
+            compute_status,
+            ComputeExpectationPauliPropagation(
+                qsim_circuit, pauli_sums[cur_batch_index][cur_op_index],
+                truncation_threshold_, &exp_v),
+            c_lock);
+        (*output_tensor)(cur_batch_index, cur_op_index) = exp_v;
+      }
+    };
+
+    // The number of strings is unknown ahead of time, so only the depth of
+    // the deepest circuit informs the cost estimate.
+    int64_t max_moments = 1;
+    for (const Program& program : programs) {
+      max_moments = std::max(
+          max_moments, static_cast<int64_t>(program.circuit().moments_size()));
+    }
+    const int64_t num_cycles = 10000 * max_moments;
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        maps.size() * output_dim_op_size, num_cycles, DoWork);
+    OP_REQUIRES_OK(context, compute_status);
+  }
+
+  // Circuits are built and fused right before they are simulated and freed
+  // as soon as their outputs are written, so peak memory holds at most one
+  // fused circuit per worker instead of one for every circuit in the batch.
+  void ComputeLarge(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
+      const std::vector<int>& num_qubits,
+      const std::vector<std::vector<PauliSum>>& pauli_sums, StateCache* cache,
+      const std::vector<uint64_t>& keys, tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
     // Instantiate qsim objects.
     const auto tfq_for = tfq::QsimFor(context);
     using Simulator = qsim::Simulator<const tfq::QsimFor&>;
@@ -143,7 +267,7 @@ class TfqSimulateExpectationOp : public tensorflow::OpKernel {
     // Simulate programs one by one. Parallelizing over state vectors
     // we no longer parallelize over circuits. Each time we encounter a
     // a larger circuit we will grow the Statevector as necessary.
-    for (size_t i = 0; i < fused_circuits.size(); i++) {
+    for (size_t i = 0; i < maps.size(); i++) {
       int nq = num_qubits[i];
 
       if (nq > largest_nq) {
@@ -155,13 +279,25 @@ class TfqSimulateExpectationOp : public tensorflow::OpKernel {
       // TODO: add heuristic here so that we do not always recompute
       //  the state if there is a possibility that circuit[i] and
       //  circuit[i + 1] produce the same state.
-      ss.SetStateZero(sv);
-      for (size_t j = 0; j < fused_circuits[i].size(); j++) {
-        qsim::ApplyFusedGate(sim, fused_circuits[i][j], sv);
+      if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+        QsimCircuit qsim_circuit;
+        std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        OP_REQUIRES_OK(context,
+                       QsimCircuitFromProgram(program, maps[i], nq,
+                                              &qsim_circuit, &fused_circuit));
+        ss.SetStateZero(sv);
+        for (size_t j = 0; j < fused_circuit.size(); j++) {
+          qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+        }
+        if (cache != nullptr) {
+          cache->Store(keys[i], nq, ss, sv);
+        }
       }
       for (size_t j = 0; j < pauli_sums[i].size(); j++) {
         // (#679) Just ignore empty program
-        if (fused_circuits[i].size() == 0) {
+        if (nq == 0) {
           (*output_tensor)(i, j) = -2.0;
           continue;
         }
@@ -175,10 +311,10 @@ class TfqSimulateExpectationOp : public tensorflow::OpKernel {
   }
 
   void ComputeSmall(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
       const std::vector<int>& num_qubits, const int max_num_qubits,
-      const std::vector<std::vector<qsim::GateFused<QsimGate>>>& fused_circuits,
-      const std::vector<std::vector<PauliSum>>& pauli_sums,
-      tensorflow::OpKernelContext* context,
+      const std::vector<std::vector<PauliSum>>& pauli_sums, StateCache* cache,
+      const std::vector<uint64_t>& keys, tensorflow::OpKernelContext* context,
       tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
     const auto tfq_for = qsim::SequentialFor(1);
     using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
@@ -205,7 +341,7 @@ class TfqSimulateExpectationOp : public tensorflow::OpKernel {
         const int nq = num_qubits[cur_batch_index];
 
         // (#679) Just ignore empty program
-        if (fused_circuits[cur_batch_index].size() == 0) {
+        if (nq == 0) {
           (*output_tensor)(cur_batch_index, cur_op_index) = -2.0;
           continue;
         }
@@ -220,9 +356,23 @@ class TfqSimulateExpectationOp : public tensorflow::OpKernel {
           }
           // no need to update scratch_state since ComputeExpectation
           // will take care of things for us.
-          ss.SetStateZero(sv);
-          for (size_t j = 0; j < fused_circuits[cur_batch_index].size(); j++) {
-            qsim::ApplyFusedGate(sim, fused_circuits[cur_batch_index][j], sv);
+          if (cache == nullptr ||
+              !cache->Restore(keys[cur_batch_index], nq, ss, sv)) {
+            QsimCircuit qsim_circuit;
+            std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+            const Program& program =
+                programs.size() == 1 ? programs[0] : programs[cur_batch_index];
+            Status local = QsimCircuitFromProgram(
+                program, maps[cur_batch_index], nq, &qsim_circuit,
+                &fused_circuit);
+            NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+            ss.SetStateZero(sv);
+            for (size_t j = 0; j < fused_circuit.size(); j++) {
+              qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+            }
+            if (cache != nullptr) {
+              cache->Store(keys[cur_batch_index], nq, ss, sv);
+            }
           }
         }
 
@@ -240,21 +390,35 @@ class TfqSimulateExpectationOp : public tensorflow::OpKernel {
     const int64_t num_cycles =
         200 * (int64_t(1) << static_cast<int64_t>(max_num_qubits));
     context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-        fused_circuits.size() * output_dim_op_size, num_cycles, DoWork);
+        maps.size() * output_dim_op_size, num_cycles, DoWork);
     OP_REQUIRES_OK(context, compute_status);
   }
 };
 
+class TfqAppendSimulateExpectationOp : public TfqSimulateExpectationOp {
+ public:
+  explicit TfqAppendSimulateExpectationOp(
+      tensorflow::OpKernelConstruction* context)
+      : TfqSimulateExpectationOp(context, /*append_programs=*/true) {}
+};
+
 REGISTER_KERNEL_BUILDER(
     Name("TfqSimulateExpectation").Device(tensorflow::DEVICE_CPU),
     TfqSimulateExpectationOp);
 
+REGISTER_KERNEL_BUILDER(
+    Name("TfqAppendSimulateExpectation").Device(tensorflow::DEVICE_CPU),
+    TfqAppendSimulateExpectationOp);
+
 REGISTER_OP("TfqSimulateExpectation")
     .Input("programs: string")
     .Input("symbol_names: string")
     .Input("symbol_values: float")
     .Input("pauli_sums: string")
     .Output("expectations: float")
+    .Attr("backend: {'state_vector', 'pauli_propagation'} = 'state_vector'")
+    .Attr("truncation_threshold: float = 1e-6")
+    .Attr("share_states: bool = false")
     .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
       tensorflow::shape_inference::ShapeHandle programs_shape;
       TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
@@ -269,7 +433,43 @@ REGISTER_OP("TfqSimulateExpectation")
       TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &pauli_sums_shape));
 
       tensorflow::shape_inference::DimensionHandle output_rows =
-          c->Dim(programs_shape, 0);
+          c->Dim(symbol_values_shape, 0);
+      tensorflow::shape_inference::DimensionHandle output_cols =
+          c->Dim(pauli_sums_shape, 1);
+      c->set_output(0, c->Matrix(output_rows, output_cols));
+
+      return ::tensorflow::Status();
+    });
+
+REGISTER_OP("TfqAppendSimulateExpectation")
+    .Input("programs: string")
+    .Input("programs_to_append: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("pauli_sums: string")
+    .Output("expectations: float")
+    .Attr("backend: {'state_vector', 'pauli_propagation'} = 'state_vector'")
+    .Attr("truncation_threshold: float = 1e-6")
+    .Attr("share_states: bool = false")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle programs_to_append_shape;
+      TF_RETURN_IF_ERROR(
+          c->WithRank(c->input(1), 1, &programs_to_append_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle pauli_sums_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &pauli_sums_shape));
+
+      tensorflow::shape_inference::DimensionHandle output_rows =
+          c->Dim(symbol_values_shape, 0);
       tensorflow::shape_inference::DimensionHandle output_cols =
           c->Dim(pauli_sums_shape, 1);
       c->set_output(0, c->Matrix(output_rows, output_cols));
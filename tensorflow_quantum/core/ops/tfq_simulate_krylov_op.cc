@@ -0,0 +1,417 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <string>
+#include <vector>
+
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/seqfor.h"
+#include "../qsim/lib/simmux.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
+#include "tensorflow_quantum/core/src/krylov.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+
+namespace tfq {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::Program;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::Circuit<QsimGate> QsimCircuit;
+
+// Applies a PauliSum Hamiltonian to the final states of circuits inside of
+// Lanczos iterations, without ever forming its matrix. The ground state op
+// uses the circuit states as starting vectors for restarted Lanczos and the
+// evolution op computes exp(-i H t) times them with Krylov projections.
+class TfqSimulateKrylovOp : public tensorflow::AsyncOpKernel {
+ public:
+  explicit TfqSimulateKrylovOp(tensorflow::OpKernelConstruction* context,
+                               bool evolve)
+      : AsyncOpKernel(context), evolve_(evolve) {
+    OP_REQUIRES_OK(context, context->GetAttr("share_states", &share_states_));
+    OP_REQUIRES_OK(context, context->GetAttr("krylov_dim", &krylov_dim_));
+    if (evolve_) {
+      OP_REQUIRES_OK(context, context->GetAttr("time_steps", &num_steps_));
+    } else {
+      OP_REQUIRES_OK(context, context->GetAttr("num_cycles", &num_steps_));
+    }
+  }
+
+  void ComputeAsync(tensorflow::OpKernelContext* context,
+                    DoneCallback done) override {
+    // Hand the work to the shared scheduler instead of blocking an inter-op
+    // thread for the whole simulation.
+    SimulationScheduler::Global()->Schedule([this, context, done]() {
+      ComputeOnScheduler(context);
+      done();
+    });
+  }
+
+ private:
+  // When true, final states are shared with sibling ops of the same step
+  // that also set share_states.
+  bool share_states_;
+
+  // When true, evolve under the Hamiltonian instead of finding its ground
+  // state.
+  const bool evolve_;
+  int krylov_dim_;
+  // Krylov time steps when evolving, Lanczos cycles otherwise.
+  int num_steps_;
+
+  void ComputeOnScheduler(tensorflow::OpKernelContext* context) {
+    const int num_inputs = context->num_inputs();
+    const int expected_inputs = evolve_ ? 5 : 4;
+    OP_REQUIRES(context, num_inputs == expected_inputs,
+                tensorflow::errors::InvalidArgument(
+                    absl::StrCat("Expected ", expected_inputs, " inputs, got ",
+                                 num_inputs, " inputs.")));
+
+    // Parse program protos and resolve the Hamiltonians against them.
+    std::vector<Program> programs;
+    std::vector<int> num_qubits;
+    std::vector<std::vector<PauliSum>> pauli_sums;
+    OP_REQUIRES_OK(context, GetBroadcastProgramsAndNumQubits(
+                                context, &programs, &num_qubits, &pauli_sums));
+
+    std::vector<SymbolMap> maps;
+    OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
+    OP_REQUIRES(context, num_qubits.size() == maps.size(),
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Number of circuits and symbol_values do not match. Got ",
+                    programs.size(), " circuits and ", maps.size(),
+                    " symbol values.")));
+
+    for (size_t i = 0; i < pauli_sums.size(); i++) {
+      OP_REQUIRES(context, pauli_sums[i].size() == 1,
+                  tensorflow::errors::InvalidArgument(absl::StrCat(
+                      "Expected one Hamiltonian per circuit. Got ",
+                      pauli_sums[i].size(), " for circuit ", i, ".")));
+      for (const auto& term : pauli_sums[i][0].terms()) {
+        OP_REQUIRES(context, term.coefficient_imag() == 0.0,
+                    tensorflow::errors::InvalidArgument(
+                        "Hamiltonian terms must have real coefficients."));
+      }
+    }
+
+    std::vector<float> times(maps.size(), 0.0);
+    if (evolve_) {
+      const tensorflow::Tensor* times_input;
+      OP_REQUIRES_OK(context, context->input("times", &times_input));
+      OP_REQUIRES(context,
+                  times_input->dims() == 1 &&
+                      times_input->dim_size(0) ==
+                          static_cast<int64_t>(maps.size()),
+                  tensorflow::errors::InvalidArgument(absl::StrCat(
+                      "times must have shape [", maps.size(), "]. Got ",
+                      times_input->shape().DebugString(), ".")));
+      const auto times_vec = times_input->vec<float>();
+      for (size_t i = 0; i < maps.size(); i++) {
+        times[i] = times_vec(i);
+      }
+    }
+
+    int max_num_qubits = 0;
+    for (const int num : num_qubits) {
+      max_num_qubits = std::max(max_num_qubits, num);
+    }
+
+    // Initial states are shared with sibling ops simulating the same
+    // circuits.
+    StateCache* cache = nullptr;
+    if (share_states_) {
+      OP_REQUIRES_OK(context, GetStepStateCache(context, &cache));
+    }
+    tensorflow::core::ScopedUnref unref_cache(cache);
+    std::vector<uint64_t> keys;
+    if (cache != nullptr) {
+      OP_REQUIRES_OK(context, GetStateCacheKeys(context, &keys));
+    }
+
+    tensorflow::TensorShape states_shape;
+    states_shape.AddDim(maps.size());
+    states_shape.AddDim(1 << max_num_qubits);
+    tensorflow::Tensor* states_output = nullptr;
+    tensorflow::Tensor* energies_output = nullptr;
+    if (evolve_) {
+      OP_REQUIRES_OK(context,
+                     context->allocate_output(0, states_shape, &states_output));
+    } else {
+      tensorflow::TensorShape energies_shape;
+      energies_shape.AddDim(maps.size());
+      OP_REQUIRES_OK(context, context->allocate_output(0, energies_shape,
+                                                       &energies_output));
+      OP_REQUIRES_OK(context,
+                     context->allocate_output(1, states_shape, &states_output));
+    }
+    auto states_tensor = states_output->matrix<std::complex<float>>();
+
+    // Writes the state and energy of circuit i, or pads them when the
+    // circuit is empty.
+    auto write_f = [&](int i, int nq, float energy, auto& ss, auto& sv) {
+      if (energies_output != nullptr) {
+        energies_output->flat<float>()(i) = energy;
+      }
+      for (uint64_t j = 0; j < (uint64_t(1) << nq); j++) {
+        states_tensor(i, j) = ss.GetAmpl(sv, j);
+      }
+      for (uint64_t j = (uint64_t(1) << nq);
+           j < (uint64_t(1) << max_num_qubits); j++) {
+        states_tensor(i, j) = std::complex<float>(-2, 0);
+      }
+    };
+    auto pad_f = [&](int i) {
+      if (energies_output != nullptr) {
+        energies_output->flat<float>()(i) = -2.0;
+      }
+      for (uint64_t j = 0; j < (uint64_t(1) << max_num_qubits); j++) {
+        states_tensor(i, j) = std::complex<float>(-2, 0);
+      }
+    };
+
+    // Cross reference with standard google cloud compute instances
+    // Memory ~= 2 * num_threads * (2 * 64 * 2 ** num_qubits in circuits)
+    // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
+    // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
+    // ...
+    const bool large = max_num_qubits >= 26 || maps.size() == 1;
+
+    // Reserve this op's state vector memory in the shared budget. Lanczos
+    // needs four work states next to the circuit state, plus one for the
+    // imaginary part of the evolved state.
+    const int num_workers =
+        large ? 1
+              : context->device()->tensorflow_cpu_worker_threads()->num_threads;
+    const int num_states = evolve_ ? 6 : 5;
+    SimulationScheduler::ScopedMemory memory(
+        SimulationScheduler::Global(),
+        num_states * num_workers *
+            SimulationScheduler::StateBytes(max_num_qubits));
+
+    if (large) {
+      const auto tfq_for = tfq::QsimFor(context);
+      using Simulator = qsim::Simulator<const tfq::QsimFor&>;
+      Simulator sim = Simulator(tfq_for);
+      Simulator::StateSpace ss = Simulator::StateSpace(tfq_for);
+      OP_REQUIRES_OK(context,
+                     ComputeRange(programs, maps, num_qubits, pauli_sums,
+                                  times, cache, keys, sim, ss, 0, maps.size(),
+                                  write_f, pad_f));
+    } else {
+      const auto tfq_for = qsim::SequentialFor(1);
+      using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
+
+      Status compute_status = ::tensorflow::Status();
+      auto c_lock = tensorflow::mutex();
+      auto DoWork = [&](int start, int end) {
+        Simulator sim = Simulator(tfq_for);
+        Simulator::StateSpace ss = Simulator::StateSpace(tfq_for);
+        Status local =
+            ComputeRange(programs, maps, num_qubits, pauli_sums, times, cache,
+                         keys, sim, ss, start, end, write_f, pad_f);
+        NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+      };
+
+      const int64_t num_cycles = 200 * krylov_dim_ * num_steps_ *
+                                 (int64_t(1) << max_num_qubits);
+      context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+          maps.size(), num_cycles, DoWork);
+      OP_REQUIRES_OK(context, compute_status);
+    }
+  }
+
+  // Runs circuits [start, end) one after the other. The large path passes
+  // the whole batch with a parallel StateSpace and Simulator; the small path
+  // runs one shard of the batch per worker with sequential ones.
+  template <typename SimT, typename StateSpaceT, typename WriteF,
+            typename PadF>
+  Status ComputeRange(const std::vector<Program>& programs,
+                      const std::vector<SymbolMap>& maps,
+                      const std::vector<int>& num_qubits,
+                      const std::vector<std::vector<PauliSum>>& pauli_sums,
+                      const std::vector<float>& times, StateCache* cache,
+                      const std::vector<uint64_t>& keys, const SimT& sim,
+                      const StateSpaceT& ss, const int start, const int end,
+                      WriteF& write_f, PadF& pad_f) {
+    // The work states must match the number of qubits of each circuit
+    // exactly, since AccumulateOperators maps qubits through them.
+    int state_nq = 1;
+    auto sv = ss.Create(state_nq);
+    auto v_prev = ss.Create(state_nq);
+    auto v = ss.Create(state_nq);
+    auto w = ss.Create(state_nq);
+    auto scratch = ss.Create(state_nq);
+    auto imag = ss.Create(evolve_ ? state_nq : 1);
+
+    for (int i = start; i < end; i++) {
+      const int nq = num_qubits[i];
+      if (nq == 0) {
+        pad_f(i);
+        continue;
+      }
+      if (nq != state_nq) {
+        state_nq = nq;
+        sv = ss.Create(state_nq);
+        v_prev = ss.Create(state_nq);
+        v = ss.Create(state_nq);
+        w = ss.Create(state_nq);
+        scratch = ss.Create(state_nq);
+        if (evolve_) {
+          imag = ss.Create(state_nq);
+        }
+      }
+
+      if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+        QsimCircuit qsim_circuit;
+        std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        Status status = QsimCircuitFromProgram(program, maps[i], nq,
+                                               &qsim_circuit, &fused_circuit);
+        if (!status.ok()) {
+          return status;
+        }
+        ss.SetStateZero(sv);
+        for (size_t j = 0; j < fused_circuit.size(); j++) {
+          qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+        }
+        if (cache != nullptr) {
+          cache->Store(keys[i], nq, ss, sv);
+        }
+      }
+
+      float energy = 0.0;
+      Status status;
+      if (evolve_) {
+        status = KrylovEvolve(pauli_sums[i][0], sim, ss, times[i], krylov_dim_,
+                              num_steps_, v_prev, v, w, scratch, imag, sv);
+      } else {
+        status = LanczosGroundState(pauli_sums[i][0], sim, ss, krylov_dim_,
+                                    num_steps_, v_prev, v, w, scratch, sv,
+                                    &energy);
+      }
+      if (!status.ok()) {
+        return status;
+      }
+      write_f(i, nq, energy, ss, sv);
+    }
+    return ::tensorflow::Status();
+  }
+};
+
+class TfqSimulateGroundStateOp : public TfqSimulateKrylovOp {
+ public:
+  explicit TfqSimulateGroundStateOp(tensorflow::OpKernelConstruction* context)
+      : TfqSimulateKrylovOp(context, /*evolve=*/false) {}
+};
+
+class TfqSimulateKrylovEvolutionOp : public TfqSimulateKrylovOp {
+ public:
+  explicit TfqSimulateKrylovEvolutionOp(
+      tensorflow::OpKernelConstruction* context)
+      : TfqSimulateKrylovOp(context, /*evolve=*/true) {}
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqSimulateGroundState").Device(tensorflow::DEVICE_CPU),
+    TfqSimulateGroundStateOp);
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqSimulateKrylovEvolution").Device(tensorflow::DEVICE_CPU),
+    TfqSimulateKrylovEvolutionOp);
+
+REGISTER_OP("TfqSimulateGroundState")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("pauli_sums: string")
+    .Output("energies: float")
+    .Output("ground_states: complex64")
+    .Attr("krylov_dim: int >= 1 = 30")
+    .Attr("num_cycles: int >= 1 = 3")
+    .Attr("share_states: bool = false")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle pauli_sums_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &pauli_sums_shape));
+
+      c->set_output(0, c->Vector(c->Dim(symbol_values_shape, 0)));
+      c->set_output(
+          1, c->MakeShape(
+                 {c->Dim(symbol_values_shape, 0),
+                  tensorflow::shape_inference::InferenceContext::kUnknownDim}));
+
+      return ::tensorflow::Status();
+    });
+
+REGISTER_OP("TfqSimulateKrylovEvolution")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("pauli_sums: string")
+    .Input("times: float")
+    .Output("state_vector: complex64")
+    .Attr("krylov_dim: int >= 1 = 20")
+    .Attr("time_steps: int >= 1 = 1")
+    .Attr("share_states: bool = false")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle pauli_sums_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &pauli_sums_shape));
+
+      tensorflow::shape_inference::ShapeHandle times_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &times_shape));
+
+      c->set_output(
+          0, c->MakeShape(
+                 {c->Dim(symbol_values_shape, 0),
+                  tensorflow::shape_inference::InferenceContext::kUnknownDim}));
+
+      return ::tensorflow::Status();
+    });
+
+}  // namespace tfq
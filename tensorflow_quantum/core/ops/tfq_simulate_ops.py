@@ -19,12 +19,20 @@ from tensorflow_quantum.core.ops.load_module import load_module
 SIM_OP_MODULE = load_module("_tfq_simulate_ops.so")
 
 
-def tfq_simulate_expectation(programs, symbol_names, symbol_values, pauli_sums):
+def tfq_simulate_expectation(programs,
+                             symbol_names,
+                             symbol_values,
+                             pauli_sums,
+                             backend='state_vector',
+                             truncation_threshold=1e-6,
+                             share_states=False):
     """Calculate the expectation value of circuits wrt some operator(s)
 
     Args:
         programs: `tf.Tensor` of strings with shape [batch_size] containing
-            the string representations of the circuits to be executed.
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
         symbol_names: `tf.Tensor` of strings with shape [n_params], which
             is used to specify the order in which the values in
             `symbol_values` should be placed inside of the circuits in
@@ -36,16 +44,139 @@ def tfq_simulate_expectation(programs, symbol_names, symbol_values, pauli_sums):
         pauli_sums: `tf.Tensor` of strings with shape [batch_size, n_ops]
             containing the string representation of the operators that will
             be used on all of the circuits in the expectation calculations.
+        backend: Python `str`, either 'state_vector' (default) to simulate
+            the final state vectors, or 'pauli_propagation' to propagate
+            each operator backwards through the circuit gates as a sum of
+            Pauli strings. The latter never forms a state vector, so it
+            handles circuits of up to 256 qubits whose gates are mostly
+            Clifford, but it requires unitary gates on at most four qubits.
+        truncation_threshold: Python `float`. With the 'pauli_propagation'
+            backend, Pauli strings whose coefficient magnitude falls below
+            this value are dropped after every gate. 0 keeps every string
+            and gives exact results.
+        share_states: Python `bool`. When True, the final states are kept
+            for the rest of the step, and sibling ops with identical
+            `programs`, `symbol_names` and `symbol_values` inputs that also
+            set `share_states` restore them instead of simulating again.
+            Every final state is copied once, so only set it on ops that
+            have such siblings.
     Returns:
         `tf.Tensor` with shape [batch_size, n_ops] that holds the
             expectation value for each circuit with each op applied to it
             (after resolving the corresponding parameters in).
     """
     return SIM_OP_MODULE.tfq_simulate_expectation(
-        programs, symbol_names, tf.cast(symbol_values, tf.float32), pauli_sums)
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        pauli_sums,
+        backend=backend,
+        truncation_threshold=truncation_threshold,
+        share_states=share_states)
+
+
+def tfq_append_simulate_expectation(programs,
+                                    programs_to_append,
+                                    symbol_names,
+                                    symbol_values,
+                                    pauli_sums,
+                                    backend='state_vector',
+                                    truncation_threshold=1e-6,
+                                    share_states=False):
+    """Calculate expectation values of circuits with other circuits appended.
+
+    Equivalent to calling `tfq_simulate_expectation` on the output of
+    `tfq_utility_ops.append_circuit(programs, programs_to_append)`, but the
+    appended programs are never serialized back into strings and re-parsed.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed.
+        programs_to_append: `tf.Tensor` of strings with shape [batch_size]
+            containing the string representations of the circuits to be
+            appended onto `programs` before simulation. A tensor of shape [1]
+            is appended onto every program.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        pauli_sums: `tf.Tensor` of strings with shape [batch_size, n_ops]
+            containing the string representation of the operators that will
+            be used on all of the circuits in the expectation calculations.
+        backend: Python `str`, see `tfq_simulate_expectation`.
+        truncation_threshold: Python `float`, see `tfq_simulate_expectation`.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        `tf.Tensor` with shape [batch_size, n_ops] that holds the
+            expectation value for each appended circuit with each op applied
+            to it (after resolving the corresponding parameters in).
+    """
+    return SIM_OP_MODULE.tfq_append_simulate_expectation(
+        programs,
+        programs_to_append,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        pauli_sums,
+        backend=backend,
+        truncation_threshold=truncation_threshold,
+        share_states=share_states)
 
 
-def tfq_simulate_state(programs, symbol_names, symbol_values):
+def tfq_simulate_sparse_expectation(programs,
+                                    symbol_names,
+                                    symbol_values,
+                                    observables,
+                                    share_states=False):
+    """Calculate expectation values of circuits wrt sparse matrix observables.
+
+    Unlike `tfq_simulate_expectation`, the observables are given as matrices
+    over the full Hilbert space of each circuit, which avoids expanding
+    operators such as fermionic Hamiltonians into Pauli sums with very many
+    terms. Each expectation value costs one sparse matrix-vector product.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        observables: `tf.SparseTensor` of complex numbers with dense shape
+            [batch_size, n_ops, 2 ** n, 2 ** n] holding Hermitian matrices,
+            where n is the largest number of qubits in `programs`. Rows and
+            columns of the matrices for circuit i index its basis states in
+            the same order as `tfq_simulate_state`, and must lie below
+            2 ** n_i where n_i is the number of qubits in circuit i.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        `tf.Tensor` with shape [batch_size, n_ops] that holds the
+            expectation value for each circuit with each observable applied
+            to it (after resolving the corresponding parameters in).
+    """
+    return SIM_OP_MODULE.tfq_simulate_sparse_expectation(
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        observables.indices,
+        tf.cast(observables.values, tf.complex64),
+        observables.dense_shape,
+        share_states=share_states)
+
+
+def tfq_simulate_state(programs,
+                       symbol_names,
+                       symbol_values,
+                       share_states=False):
     """Returns the state of the programs using the C++ state vector simulator.
 
     Simulate the final state of `programs` given `symbol_values` are placed
@@ -53,7 +184,9 @@ def tfq_simulate_state(programs, symbol_names, symbol_values):
 
     Args:
         programs: `tf.Tensor` of strings with shape [batch_size] containing
-            the string representations of the circuits to be executed.
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
         symbol_names: `tf.Tensor` of strings with shape [n_params], which
             is used to specify the order in which the values in
             `symbol_values` should be placed inside of the circuits in
@@ -62,11 +195,14 @@ def tfq_simulate_state(programs, symbol_names, symbol_values):
             [batch_size, n_params] specifying parameter values to resolve
             into the circuits specificed by programs, following the ordering
             dictated by `symbol_names`.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
     Returns:
         A `tf.Tensor` containing the final state of each circuit in `programs`.
     """
-    return SIM_OP_MODULE.tfq_simulate_state(programs, symbol_names,
-                                            tf.cast(symbol_values, tf.float32))
+    return SIM_OP_MODULE.tfq_simulate_state(programs,
+                                            symbol_names,
+                                            tf.cast(symbol_values, tf.float32),
+                                            share_states=share_states)
 
 
 def tfq_simulate_samples(programs, symbol_names, symbol_values, num_samples):
@@ -79,7 +215,9 @@ def tfq_simulate_samples(programs, symbol_names, symbol_values, num_samples):
 
     Args:
         programs: `tf.Tensor` of strings with shape [batch_size] containing
-            the string representations of the circuits to be executed.
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
         symbol_names: `tf.Tensor` of strings with shape [n_params], which
             is used to specify the order in which the values in
             `symbol_values` should be placed inside of the circuits in
@@ -98,8 +236,15 @@ def tfq_simulate_samples(programs, symbol_names, symbol_values, num_samples):
         programs, symbol_names, tf.cast(symbol_values, tf.float32), num_samples)
 
 
-def tfq_simulate_sampled_expectation(programs, symbol_names, symbol_values,
-                                     pauli_sums, num_samples):
+def tfq_simulate_sampled_expectation(programs,
+                                     symbol_names,
+                                     symbol_values,
+                                     pauli_sums,
+                                     num_samples,
+                                     shot_noise_model='sample',
+                                     shot_allocation='uniform',
+                                     pilot_fraction=0.0,
+                                     share_states=False):
     """Calculate the expectation value of circuits using samples.
 
     Simulate the final state of `programs` given `symbol_values` are placed
@@ -109,7 +254,9 @@ def tfq_simulate_sampled_expectation(programs, symbol_names, symbol_values,
 
     Args:
         programs: `tf.Tensor` of strings with shape [batch_size] containing
-            the string representations of the circuits to be executed.
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
         symbol_names: `tf.Tensor` of strings with shape [n_params], which
             is used to specify the order in which the values in
             `symbol_values` should be placed inside of the circuits in
@@ -125,11 +272,388 @@ def tfq_simulate_sampled_expectation(programs, symbol_names, symbol_values,
             number of samples to draw in each term of `pauli_sums[i][j]`
             when estimating the expectation. Therefore, `num_samples` must
             have the same shape as `pauli_sums`.
+        shot_noise_model: Python `str`, either 'sample' or 'binomial'.
+            'sample' draws `num_samples` bitstrings for every term and
+            averages their parities. 'binomial' computes the exact
+            expectation of every term and draws the number of odd parity
+            outcomes from the equivalent binomial distribution, which gives
+            the same statistics at a cost independent of `num_samples`.
+        shot_allocation: Python `str`, either 'uniform' or 'weighted'.
+            'uniform' draws `num_samples[i][j]` shots for every term of
+            `pauli_sums[i][j]`. 'weighted' instead treats `num_samples[i][j]`
+            as the total budget for `pauli_sums[i][j]` and splits it across
+            its terms proportionally to |c_k| * sigma_k, which minimizes the
+            variance of the estimate for that budget. The budget left after
+            the pilot must give every non-identity term at least one shot.
+        pilot_fraction: Python `float` in [0, 1). Only used with
+            'weighted' allocation. The fraction of the budget spent evenly
+            across terms to estimate each sigma_k before allocating the rest.
+            Pilot shots only choose the allocation and are not part of the
+            estimate. With 0 every sigma_k is assumed to be 1.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
     Returns:
         `tf.Tensor` with shape [batch_size, n_ops] that holds the
             expectation value for each circuit with each op applied to it
             (after resolving the corresponding parameters in).
     """
     return SIM_OP_MODULE.tfq_simulate_sampled_expectation(
-        programs, symbol_names, tf.cast(symbol_values, tf.float32), pauli_sums,
-        tf.cast(num_samples, dtype=tf.int32))
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        pauli_sums,
+        tf.cast(num_samples, dtype=tf.int32),
+        shot_noise_model=shot_noise_model,
+        shot_allocation=shot_allocation,
+        pilot_fraction=pilot_fraction,
+        share_states=share_states)
+
+
+def tfq_classical_shadows(programs,
+                          symbol_names,
+                          symbol_values,
+                          pauli_sums,
+                          num_snapshots,
+                          num_groups=10,
+                          share_states=False):
+    """Estimate expectation values of circuits from classical shadows.
+
+    Simulate the final state of `programs` given `symbol_values` are placed
+    inside of the symbols with the name in `symbol_names` in each circuit.
+    Then measure every qubit of the state `num_snapshots` times in a
+    uniformly random Pauli basis and estimate every term of `pauli_sums`
+    from these same measurements with median of means. The cost of the
+    measurements does not depend on the number of ops, which makes this
+    much cheaper than `tfq_simulate_sampled_expectation` for many local
+    observables on the same state.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        pauli_sums: `tf.Tensor` of strings with shape [batch_size, n_ops]
+            containing the string representation of the operators that will
+            be estimated on all of the circuits.
+        num_snapshots: `tf.Tensor` with one element indicating the number of
+            random basis measurements to take of each circuit.
+        num_groups: Python `int`, the number of groups the snapshots are
+            split into for the median of means estimate.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        `tf.Tensor` with shape [batch_size, n_ops] that holds the
+            estimated expectation value for each circuit with each op
+            applied to it (after resolving the corresponding parameters in).
+    """
+    return SIM_OP_MODULE.tfq_classical_shadows(
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        pauli_sums,
+        tf.cast(num_snapshots, dtype=tf.int32),
+        num_groups=num_groups,
+        share_states=share_states)
+
+
+def tfq_simulate_marginal_probabilities(programs,
+                                        symbol_names,
+                                        symbol_values,
+                                        qubits,
+                                        share_states=False):
+    """Compute exact marginal measurement probabilities of circuits.
+
+    Simulate the final state of `programs` given `symbol_values` are placed
+    inside of the symbols with the name in `symbol_names` in each circuit.
+    Then reduce |amplitude|^2 onto the computational basis outcomes of
+    `qubits` inside of the simulator. Neither the full state vector nor any
+    samples are ever materialized.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        qubits: `tf.Tensor` of integers with shape [n_marginal_qubits]
+            holding the indices of the qubits to keep, in the sorted order
+            of the qubits of each circuit. The first index is the most
+            significant bit of the outcomes.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        `tf.Tensor` with shape [batch_size, 2 ** n_marginal_qubits] holding
+            the probability of every outcome of `qubits` for each circuit.
+            Rows of empty circuits are filled with -2.
+    """
+    return SIM_OP_MODULE.tfq_simulate_marginal_probabilities(
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        tf.cast(qubits, tf.int32),
+        share_states=share_states)
+
+
+def tfq_simulate_reduced_density_matrix(programs,
+                                        symbol_names,
+                                        symbol_values,
+                                        qubits,
+                                        share_states=False):
+    """Compute reduced density matrices of circuits over a subset of qubits.
+
+    Simulate the final state of `programs` given `symbol_values` are placed
+    inside of the symbols with the name in `symbol_names` in each circuit.
+    Then trace out every qubit not in `qubits`, streaming over the state
+    vector inside of the simulator without materializing it.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        qubits: `tf.Tensor` of at most 10 integers with shape [n_kept_qubits]
+            holding the indices of the qubits to keep, in the sorted order
+            of the qubits of each circuit. The first index is the most
+            significant bit of the basis states.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        `tf.Tensor` with shape
+            [batch_size, 2 ** n_kept_qubits, 2 ** n_kept_qubits] holding
+            the reduced density matrix of each circuit. Entries of empty
+            circuits are filled with -2.
+    """
+    return SIM_OP_MODULE.tfq_simulate_reduced_density_matrix(
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        tf.cast(qubits, tf.int32),
+        share_states=share_states)
+
+
+def tfq_simulate_entanglement_entropy(programs,
+                                      symbol_names,
+                                      symbol_values,
+                                      qubits,
+                                      alpha=1.0,
+                                      share_states=False):
+    """Compute the entanglement entropy of `qubits` with the other qubits.
+
+    Simulate the final state of `programs` given `symbol_values` are placed
+    inside of the symbols with the name in `symbol_names` in each circuit.
+    Then compute the Renyi entropy of order `alpha` of the reduced density
+    matrix of `qubits`. Since the final states are pure, the smaller of
+    `qubits` and its complement is the one traced out.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        qubits: `tf.Tensor` of integers with shape [n_subsystem_qubits]
+            holding the indices of one side of the bipartition, in the
+            sorted order of the qubits of each circuit. The smaller side
+            may have at most 10 qubits.
+        alpha: Python `float` order of the Renyi entropy. The default of 1
+            gives the von Neumann entropy.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        `tf.Tensor` with shape [batch_size] holding the entropy in bits of
+            each circuit. Entries of empty circuits are -2.
+    """
+    return SIM_OP_MODULE.tfq_simulate_entanglement_entropy(
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        tf.cast(qubits, tf.int32),
+        alpha=alpha,
+        share_states=share_states)
+
+
+def tfq_simulate_pauli_evolution(programs,
+                                 symbol_names,
+                                 symbol_values,
+                                 pauli_sums,
+                                 times,
+                                 trotter_steps=1,
+                                 order=1,
+                                 share_states=False):
+    """Evolve the final states of circuits under Hamiltonians.
+
+    Simulate the final state of `programs` given `symbol_values` are placed
+    inside of the symbols with the name in `symbol_names` in each circuit.
+    Then apply exp(-i t H) for every Hamiltonian H in `pauli_sums`, in
+    order, using Trotterized Pauli rotations. Each rotation exp(-i c t P) is
+    applied natively in one pass over the state vector.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        pauli_sums: `tf.Tensor` of strings with shape
+            [batch_size, n_hamiltonians] containing the string
+            representation of the Hamiltonians to evolve under, one after
+            the other. All terms must have real coefficients.
+        times: `tf.Tensor` of real numbers with shape
+            [batch_size, n_hamiltonians] holding the evolution time under
+            each Hamiltonian.
+        trotter_steps: Python `int` number of Trotter steps used for every
+            Hamiltonian.
+        order: Python `int` order of the product formula, either 1 or 2
+            (symmetric Strang splitting).
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        `tf.Tensor` with shape [batch_size, <size of state>] that contains
+            the evolved state vectors, padded with -2 like
+            `tfq_simulate_state`.
+    """
+    return SIM_OP_MODULE.tfq_simulate_pauli_evolution(
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        pauli_sums,
+        tf.cast(times, tf.float32),
+        trotter_steps=trotter_steps,
+        order=order,
+        share_states=share_states)
+
+
+def tfq_simulate_ground_state(programs,
+                              symbol_names,
+                              symbol_values,
+                              pauli_sums,
+                              krylov_dim=30,
+                              num_cycles=3,
+                              share_states=False):
+    """Find ground states of Hamiltonians with matrix-free Lanczos.
+
+    Simulate the final state of `programs` given `symbol_values` are placed
+    inside of the symbols with the name in `symbol_names` in each circuit,
+    then use it as the starting vector of restarted Lanczos iterations on
+    the matching Hamiltonian in `pauli_sums`. The Hamiltonian is only ever
+    applied to states, so memory grows with a handful of state vectors.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits preparing the
+            starting states. These must overlap with the ground states.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        pauli_sums: `tf.Tensor` of strings with shape [batch_size, 1]
+            containing the string representation of the Hamiltonian of
+            each circuit. All terms must have real coefficients.
+        krylov_dim: Python `int` number of Lanczos steps per cycle.
+        num_cycles: Python `int` number of Lanczos cycles, each restarted
+            from the ground state estimate of the previous one.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        A tuple of a `tf.Tensor` with shape [batch_size] holding the ground
+        energies and a `tf.Tensor` with shape [batch_size, <size of state>]
+        holding the ground states, padded with -2 like `tfq_simulate_state`.
+    """
+    return SIM_OP_MODULE.tfq_simulate_ground_state(
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        pauli_sums,
+        krylov_dim=krylov_dim,
+        num_cycles=num_cycles,
+        share_states=share_states)
+
+
+def tfq_simulate_krylov_evolution(programs,
+                                  symbol_names,
+                                  symbol_values,
+                                  pauli_sums,
+                                  times,
+                                  krylov_dim=20,
+                                  time_steps=1,
+                                  share_states=False):
+    """Evolve the final states of circuits with Krylov exponentials.
+
+    Simulate the final state of `programs` given `symbol_values` are placed
+    inside of the symbols with the name in `symbol_names` in each circuit.
+    Then compute exp(-i t H) applied to it by projecting onto Krylov spaces
+    of the matching Hamiltonian H in `pauli_sums`. Unlike
+    `tfq_simulate_pauli_evolution` there is no Trotter error, only the
+    truncation of the Krylov space.
+
+    Args:
+        programs: `tf.Tensor` of strings with shape [batch_size] containing
+            the string representations of the circuits to be executed. A
+            single program (shape [1]) is broadcast against every row of
+            `symbol_values` and only parsed once.
+        symbol_names: `tf.Tensor` of strings with shape [n_params], which
+            is used to specify the order in which the values in
+            `symbol_values` should be placed inside of the circuits in
+            `programs`.
+        symbol_values: `tf.Tensor` of real numbers with shape
+            [batch_size, n_params] specifying parameter values to resolve
+            into the circuits specificed by programs, following the ordering
+            dictated by `symbol_names`.
+        pauli_sums: `tf.Tensor` of strings with shape [batch_size, 1]
+            containing the string representation of the Hamiltonian of
+            each circuit. All terms must have real coefficients.
+        times: `tf.Tensor` of real numbers with shape [batch_size] holding
+            the evolution time of each circuit.
+        krylov_dim: Python `int` dimension of the Krylov spaces.
+        time_steps: Python `int` number of equal steps the evolution is
+            split into, each with its own Krylov space. Long times need
+            more steps for the same `krylov_dim`.
+        share_states: Python `bool`, see `tfq_simulate_expectation`.
+    Returns:
+        `tf.Tensor` with shape [batch_size, <size of state>] that contains
+            the evolved state vectors, padded with -2 like
+            `tfq_simulate_state`.
+    """
+    return SIM_OP_MODULE.tfq_simulate_krylov_evolution(
+        programs,
+        symbol_names,
+        tf.cast(symbol_values, tf.float32),
+        pauli_sums,
+        tf.cast(times, tf.float32),
+        krylov_dim=krylov_dim,
+        time_steps=time_steps,
+        share_states=share_states)
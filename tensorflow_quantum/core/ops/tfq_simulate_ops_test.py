@@ -25,11 +25,32 @@ import numpy as np
 from absl.testing import parameterized
 import tensorflow as tf
 import cirq
+import sympy
 
 from tensorflow_quantum.core.ops import tfq_simulate_ops
+from tensorflow_quantum.core.ops import tfq_utility_ops
 from tensorflow_quantum.python import util
 
 
+def _random_batch(n_qubits, batch_size):
+    """Random single symbol circuits that act on all of their qubits."""
+    symbol_names = ['alpha']
+    qubits = cirq.GridQubit.rect(1, n_qubits)
+    circuit_batch, resolver_batch = \
+        util.random_symbol_circuit_resolver_batch(
+            qubits, symbol_names, batch_size)
+    # Make sure every circuit acts on all of the qubits.
+    circuit_batch = [
+        cirq.Circuit(cirq.H.on_each(*qubits)) + c for c in circuit_batch
+    ]
+    symbol_values_array = np.array(
+        [[resolver[symbol]
+          for symbol in symbol_names]
+         for resolver in resolver_batch])
+    return (qubits, util.convert_to_tensor(circuit_batch), symbol_names,
+            symbol_values_array)
+
+
 class SimulateExpectationTest(tf.test.TestCase):
     """Tests tfq_simulate_expectation."""
 
@@ -203,6 +224,153 @@ class SimulateExpectationTest(tf.test.TestCase):
         self.assertDTypeEqual(res, np.float32)
 
 
+class StateCacheTest(tf.test.TestCase):
+    """Tests simulate ops sharing states within a single step."""
+
+    def test_sibling_ops_share_states(self):
+        """Sibling ops in one graph must match independently run ops."""
+        n_qubits = 3
+        batch_size = 4
+        symbol_names = ['alpha']
+        qubits = cirq.GridQubit.rect(1, n_qubits)
+        circuit_batch, resolver_batch = \
+            util.random_symbol_circuit_resolver_batch(
+                qubits, symbol_names, batch_size)
+        symbol_values = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+        programs = util.convert_to_tensor(circuit_batch)
+        ops_a = util.convert_to_tensor(
+            [[x] for x in util.random_pauli_sums(qubits, 3, batch_size)])
+        ops_b = util.convert_to_tensor(
+            [[x] for x in util.random_pauli_sums(qubits, 3, batch_size)])
+
+        @tf.function
+        def siblings():
+            exp_a = tfq_simulate_ops.tfq_simulate_expectation(
+                programs, symbol_names, symbol_values, ops_a, share_states=True)
+            exp_b = tfq_simulate_ops.tfq_simulate_expectation(
+                programs, symbol_names, symbol_values, ops_b, share_states=True)
+            states = tfq_simulate_ops.tfq_simulate_state(programs,
+                                                         symbol_names,
+                                                         symbol_values,
+                                                         share_states=True)
+            return exp_a, exp_b, states
+
+        exp_a, exp_b, states = siblings()
+        self.assertAllClose(
+            exp_a,
+            tfq_simulate_ops.tfq_simulate_expectation(programs, symbol_names,
+                                                      symbol_values, ops_a),
+            atol=1e-5)
+        self.assertAllClose(
+            exp_b,
+            tfq_simulate_ops.tfq_simulate_expectation(programs, symbol_names,
+                                                      symbol_values, ops_b),
+            atol=1e-5)
+        self.assertAllClose(
+            states,
+            tfq_simulate_ops.tfq_simulate_state(programs, symbol_names,
+                                                symbol_values),
+            atol=1e-5)
+
+
+class AppendSimulateExpectationTest(tf.test.TestCase):
+    """Tests tfq_append_simulate_expectation."""
+
+    def test_append_simulate_expectation_matches_unfused(self):
+        """Make sure fused append + expectation matches the two op chain."""
+        n_qubits = 4
+        batch_size = 5
+        symbol_names = ['alpha', 'beta']
+        qubits = cirq.GridQubit.rect(1, n_qubits)
+        circuit_batch, resolver_batch = \
+            util.random_symbol_circuit_resolver_batch(
+                qubits, symbol_names, batch_size)
+        append_batch = [
+            cirq.Circuit(cirq.H.on_each(*qubits[i % n_qubits:]))
+            for i in range(batch_size)
+        ]
+        symbol_values_array = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+        pauli_sums = util.random_pauli_sums(qubits, 3, batch_size)
+        pauli_sums_tensor = util.convert_to_tensor([[x] for x in pauli_sums])
+
+        fused = tfq_simulate_ops.tfq_append_simulate_expectation(
+            util.convert_to_tensor(circuit_batch),
+            util.convert_to_tensor(append_batch), symbol_names,
+            symbol_values_array, pauli_sums_tensor)
+        unfused = tfq_simulate_ops.tfq_simulate_expectation(
+            tfq_utility_ops.append_circuit(
+                util.convert_to_tensor(circuit_batch),
+                util.convert_to_tensor(append_batch)), symbol_names,
+            symbol_values_array, pauli_sums_tensor)
+        self.assertAllClose(fused, unfused, atol=1e-5)
+
+        # A single appended circuit is shared by the whole batch.
+        fused = tfq_simulate_ops.tfq_append_simulate_expectation(
+            util.convert_to_tensor(circuit_batch),
+            util.convert_to_tensor(append_batch[:1]), symbol_names,
+            symbol_values_array, pauli_sums_tensor)
+        unfused = tfq_simulate_ops.tfq_simulate_expectation(
+            util.convert_to_tensor(
+                [circuit + append_batch[0] for circuit in circuit_batch]),
+            symbol_names, symbol_values_array, pauli_sums_tensor)
+        self.assertAllClose(fused, unfused, atol=1e-5)
+
+    def test_append_simulate_expectation_inputs(self):
+        """Make sure that the fused op fails gracefully on bad inputs."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        circuits = util.convert_to_tensor([cirq.Circuit(cirq.H(qubits[0]))])
+        pauli_sums = util.convert_to_tensor([[cirq.Z(qubits[0])]])
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'must have matching sizes'):
+            tfq_simulate_ops.tfq_append_simulate_expectation(
+                circuits, util.convert_to_tensor([cirq.Circuit()] * 2), [],
+                [[]], pauli_sums)
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'qubits not found in circuit'):
+            tfq_simulate_ops.tfq_append_simulate_expectation(
+                circuits, util.convert_to_tensor([cirq.Circuit()]), [], [[]],
+                util.convert_to_tensor([[cirq.Z(qubits[1])]]))
+
+        # Appended qubits are visible to the observables.
+        res = tfq_simulate_ops.tfq_append_simulate_expectation(
+            circuits, util.convert_to_tensor([cirq.Circuit(cirq.X(qubits[1]))
+                                             ]), [], [[]],
+            util.convert_to_tensor([[cirq.Z(qubits[1])]]))
+        self.assertAllClose(res, [[-1.0]])
+
+    def test_append_simulate_expectation_static_shape(self):
+        """The output has one row per row of symbol_values, as computed."""
+
+        @tf.function(input_signature=[
+            tf.TensorSpec([None], tf.string),
+            tf.TensorSpec([None], tf.string),
+            tf.TensorSpec([3, 0], tf.float32),
+            tf.TensorSpec([None, 2], tf.string)
+        ])
+        def append_expectation(programs, programs_to_append, symbol_values,
+                               pauli_sums):
+            res = tfq_simulate_ops.tfq_append_simulate_expectation(
+                programs, programs_to_append, [], symbol_values, pauli_sums)
+            self.assertEqual(res.shape.as_list(), [3, 2])
+            return res
+
+        qubit = cirq.GridQubit(0, 0)
+        res = append_expectation(
+            util.convert_to_tensor([cirq.Circuit()] * 3),
+            util.convert_to_tensor([cirq.Circuit(cirq.X(qubit))] * 3),
+            tf.zeros((3, 0)),
+            util.convert_to_tensor([[cirq.Z(qubit), cirq.X(qubit)]] * 3))
+        self.assertAllClose(res, [[-1.0, 0.0]] * 3)
+
+
 class SimulateStateTest(tf.test.TestCase, parameterized.TestCase):
     """Tests tfq_simulate_state."""
 
@@ -659,7 +827,7 @@ class SimulateSampledExpectationTest(tf.test.TestCase):
                                     expected_regex='do not match'):
             # wrong op size.
             tfq_simulate_ops.tfq_simulate_sampled_expectation(
-                util.convert_to_tensor([cirq.Circuit()]), symbol_names,
+                util.convert_to_tensor([cirq.Circuit()] * 2), symbol_names,
                 symbol_values_array.astype(np.float64),
                 util.convert_to_tensor([[x] for x in pauli_sums]), num_samples)
 
@@ -689,6 +857,663 @@ class SimulateSampledExpectationTest(tf.test.TestCase):
                 symbol_names, symbol_values_array,
                 util.convert_to_tensor([[x] for x in pauli_sums]), num_samples)
 
+    def test_simulate_sampled_expectation_binomial(self):
+        """Binomial shot noise must agree with exact expectations."""
+        n_qubits = 4
+        batch_size = 5
+        symbol_names = ['alpha']
+        qubits = cirq.GridQubit.rect(1, n_qubits)
+        circuit_batch, resolver_batch = \
+            util.random_symbol_circuit_resolver_batch(
+                qubits, symbol_names, batch_size)
+
+        symbol_values_array = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+
+        pauli_sums = util.convert_to_tensor(
+            [[x] for x in util.random_pauli_sums(qubits, 3, batch_size)])
+        exact = tfq_simulate_ops.tfq_simulate_expectation(
+            util.convert_to_tensor(circuit_batch), symbol_names,
+            symbol_values_array, pauli_sums)
+        sampled = tfq_simulate_ops.tfq_simulate_sampled_expectation(
+            util.convert_to_tensor(circuit_batch),
+            symbol_names,
+            symbol_values_array,
+            pauli_sums, [[1000000]] * batch_size,
+            shot_noise_model='binomial')
+        self.assertAllClose(exact, sampled, atol=1e-2)
+
+        with self.assertRaisesRegex(Exception, 'shot_noise_model'):
+            tfq_simulate_ops.tfq_simulate_sampled_expectation(
+                util.convert_to_tensor(circuit_batch),
+                symbol_names,
+                symbol_values_array,
+                pauli_sums, [[10]] * batch_size,
+                shot_noise_model='junk')
+
+    def test_simulate_sampled_expectation_independent_threads(self):
+        """Every entry of a large batch draws its own shot noise."""
+        qubit = cirq.GridQubit(0, 0)
+        batch_size = 64
+        n_ops = 4
+        programs = util.convert_to_tensor([cirq.Circuit(cirq.H(qubit))] *
+                                          batch_size)
+        pauli_sums = util.convert_to_tensor([[cirq.Z(qubit)] * n_ops] *
+                                            batch_size)
+        sampled = tfq_simulate_ops.tfq_simulate_sampled_expectation(
+            programs, [], np.zeros((batch_size, 0)), pauli_sums,
+            [[100000000] * n_ops] * batch_size,
+            shot_noise_model='binomial').numpy()
+        # Binomial(1e8, 0.5) draws repeat with probability ~6e-5, so only a
+        # handful of the 256 entries can match unless random streams of
+        # different threads overlap.
+        self.assertGreater(len(np.unique(sampled)), 240)
+
+    def test_simulate_sampled_expectation_weighted(self):
+        """Weighted shot allocation must agree with exact expectations."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        circuit = cirq.Circuit(
+            cirq.X(qubits[0])**sympy.Symbol('alpha'),
+            cirq.H(qubits[1]),
+            cirq.CNOT(qubits[0], qubits[1]))
+        pauli_sum = (2.0 * cirq.Z(qubits[0]) + 0.5 * cirq.X(qubits[1]) +
+                     0.1 * cirq.Z(qubits[0]) * cirq.Z(qubits[1]) + 1.0)
+        symbol_values = np.array([[0.25], [0.5], [0.75]])
+        batch_size = len(symbol_values)
+        programs = util.convert_to_tensor([circuit] * batch_size)
+        pauli_sums = util.convert_to_tensor([[pauli_sum]] * batch_size)
+
+        exact = tfq_simulate_ops.tfq_simulate_expectation(
+            programs, ['alpha'], symbol_values, pauli_sums)
+        for pilot_fraction in [0.0, 0.1]:
+            sampled = tfq_simulate_ops.tfq_simulate_sampled_expectation(
+                programs, ['alpha'],
+                symbol_values,
+                pauli_sums, [[3000000]] * batch_size,
+                shot_noise_model='binomial',
+                shot_allocation='weighted',
+                pilot_fraction=pilot_fraction)
+            self.assertAllClose(exact, sampled, atol=1e-2)
+
+        sampled = tfq_simulate_ops.tfq_simulate_sampled_expectation(
+            programs, ['alpha'],
+            symbol_values,
+            pauli_sums, [[100000]] * batch_size,
+            shot_allocation='weighted',
+            pilot_fraction=0.1)
+        self.assertAllClose(exact, sampled, atol=5e-2)
+
+        with self.assertRaisesRegex(Exception, 'pilot_fraction'):
+            tfq_simulate_ops.tfq_simulate_sampled_expectation(
+                programs, ['alpha'],
+                symbol_values,
+                pauli_sums, [[10]] * batch_size,
+                shot_allocation='weighted',
+                pilot_fraction=1.5)
+
+        # 3 non-identity terms need at least 3 shots after the pilot.
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'at least one shot'):
+            tfq_simulate_ops.tfq_simulate_sampled_expectation(
+                programs, ['alpha'],
+                symbol_values,
+                pauli_sums, [[10]] * batch_size,
+                shot_allocation='weighted',
+                pilot_fraction=0.85)
+
+
+class ClassicalShadowsTest(tf.test.TestCase):
+    """Tests tfq_classical_shadows."""
+
+    def test_classical_shadows_matches_exact(self):
+        """Shadow estimates of local observables must match exact values."""
+        n_qubits = 3
+        qubits = cirq.GridQubit.rect(1, n_qubits)
+        circuit = cirq.Circuit(
+            cirq.H(qubits[0]),
+            cirq.X(qubits[1])**sympy.Symbol('alpha'),
+            cirq.CNOT(qubits[0], qubits[2]),
+            cirq.Y(qubits[1])**0.3)
+        ops = [
+            cirq.Z(qubits[0]) * cirq.Z(qubits[2]),
+            cirq.X(qubits[0]) * cirq.X(qubits[2]),
+            0.5 * cirq.Z(qubits[1]) - cirq.X(qubits[1]) + 2.0,
+            cirq.Y(qubits[1]),
+        ]
+        symbol_values = np.array([[0.0], [0.4], [0.9]])
+        batch_size = len(symbol_values)
+        programs = util.convert_to_tensor([circuit] * batch_size)
+        pauli_sums = util.convert_to_tensor([ops] * batch_size)
+
+        exact = tfq_simulate_ops.tfq_simulate_expectation(
+            programs, ['alpha'], symbol_values, pauli_sums)
+        shadows = tfq_simulate_ops.tfq_classical_shadows(
+            programs, ['alpha'], symbol_values, pauli_sums, [30000])
+        self.assertAllClose(exact, shadows, atol=0.15)
+
+    def test_classical_shadows_inputs(self):
+        """Make sure the shadows op fails gracefully on bad inputs."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        programs = util.convert_to_tensor([cirq.Circuit(cirq.H.on_each(
+            *qubits))] * 2)
+        pauli_sums = util.convert_to_tensor([[cirq.Z(qubits[0])]] * 2)
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'num_snapshots must contain 1 element'):
+            tfq_simulate_ops.tfq_classical_shadows(programs, [],
+                                                   np.zeros((2, 0)),
+                                                   pauli_sums, [10, 10])
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'num_snapshots must be non-negative'):
+            tfq_simulate_ops.tfq_classical_shadows(programs, [],
+                                                   np.zeros((2, 0)),
+                                                   pauli_sums, [-1])
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'do not match'):
+            tfq_simulate_ops.tfq_classical_shadows(programs, [],
+                                                   np.zeros((3, 0)),
+                                                   pauli_sums, [10])
+
+    def test_classical_shadows_empty_program(self):
+        """Empty programs are padded like the other simulate ops."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        programs = util.convert_to_tensor([cirq.Circuit(), cirq.Circuit()])
+        pauli_sums = util.convert_to_tensor([[cirq.Z(qubits[0])]] * 2)
+        shadows = tfq_simulate_ops.tfq_classical_shadows(
+            programs, [], np.zeros((2, 0)), pauli_sums, [10])
+        self.assertAllClose(shadows, [[-2.0], [-2.0]])
+
+
+class SimulateMarginalProbabilitiesTest(tf.test.TestCase):
+    """Tests tfq_simulate_marginal_probabilities."""
+
+    def test_marginals_match_state(self):
+        """Marginals must match reducing the simulated state."""
+        n_qubits = 4
+        batch_size = 5
+        _, programs, symbol_names, symbol_values_array = _random_batch(
+            n_qubits, batch_size)
+
+        states = tfq_simulate_ops.tfq_simulate_state(programs, symbol_names,
+                                                     symbol_values_array)
+        probs = np.abs(states.numpy())**2
+        keep = [2, 0]
+        for i in range(batch_size):
+            p = probs[i].reshape([2] * n_qubits)
+            drop = tuple(q for q in range(n_qubits) if q not in keep)
+            expected = np.transpose(np.sum(p, axis=drop),
+                                    np.argsort(np.argsort(keep))).flatten()
+            marginals = tfq_simulate_ops.tfq_simulate_marginal_probabilities(
+                programs[i:i + 1], symbol_names, symbol_values_array[i:i + 1],
+                keep)
+            self.assertAllClose(marginals[0], expected, atol=1e-5)
+
+    def test_marginals_inputs(self):
+        """Make sure the marginals op fails gracefully on bad inputs."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        programs = util.convert_to_tensor([cirq.Circuit(cirq.H.on_each(
+            *qubits))] * 2)
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'out of range'):
+            tfq_simulate_ops.tfq_simulate_marginal_probabilities(
+                programs, [], np.zeros((2, 0)), [2])
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'duplicates'):
+            tfq_simulate_ops.tfq_simulate_marginal_probabilities(
+                programs, [], np.zeros((2, 0)), [1, 1])
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'do not match'):
+            tfq_simulate_ops.tfq_simulate_marginal_probabilities(
+                programs, [], np.zeros((3, 0)), [0])
+
+
+class SimulateReducedDensityMatrixTest(tf.test.TestCase):
+    """Tests tfq_simulate_reduced_density_matrix and entanglement entropy."""
+
+    def test_density_matrix_matches_state(self):
+        """Reduced density matrices must match tracing the state."""
+        n_qubits = 4
+        batch_size = 5
+        _, programs, symbol_names, symbol_values_array = _random_batch(
+            n_qubits, batch_size)
+        states = tfq_simulate_ops.tfq_simulate_state(
+            programs, symbol_names, symbol_values_array).numpy()
+        keep = [2, 0]
+        rho = tfq_simulate_ops.tfq_simulate_reduced_density_matrix(
+            programs, symbol_names, symbol_values_array, keep)
+        self.assertAllEqual(rho.shape, [batch_size, 4, 4])
+        for i in range(batch_size):
+            drop = [q for q in range(n_qubits) if q not in keep]
+            psi = np.transpose(states[i].reshape([2] * n_qubits),
+                               keep + drop).reshape(4, -1)
+            self.assertAllClose(rho[i], psi @ psi.conj().T, atol=1e-5)
+
+    def test_entropy_matches_state(self):
+        """Entropies must match the spectrum of the reduced state."""
+        n_qubits = 5
+        batch_size = 4
+        _, programs, symbol_names, symbol_values_array = _random_batch(
+            n_qubits, batch_size)
+        states = tfq_simulate_ops.tfq_simulate_state(
+            programs, symbol_names, symbol_values_array).numpy()
+        # Three kept qubits exercise tracing out the complement instead.
+        keep = [0, 1, 3]
+        von_neumann = tfq_simulate_ops.tfq_simulate_entanglement_entropy(
+            programs, symbol_names, symbol_values_array, keep)
+        renyi = tfq_simulate_ops.tfq_simulate_entanglement_entropy(
+            programs, symbol_names, symbol_values_array, keep, alpha=2.0)
+        for i in range(batch_size):
+            drop = [q for q in range(n_qubits) if q not in keep]
+            psi = np.transpose(states[i].reshape([2] * n_qubits),
+                               keep + drop).reshape(8, -1)
+            p = np.linalg.eigvalsh(psi @ psi.conj().T)
+            p = p[p > 1e-12]
+            self.assertAllClose(von_neumann[i],
+                                -np.sum(p * np.log2(p)),
+                                atol=1e-4)
+            self.assertAllClose(renyi[i], -np.log2(np.sum(p**2)), atol=1e-4)
+
+    def test_bell_state_entropy(self):
+        """One ebit of entanglement is one bit of entropy."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        programs = util.convert_to_tensor([
+            cirq.Circuit(cirq.H(qubits[0]), cirq.CNOT(*qubits)),
+            cirq.Circuit(cirq.H.on_each(*qubits)),
+            cirq.Circuit()
+        ])
+        entropy = tfq_simulate_ops.tfq_simulate_entanglement_entropy(
+            programs, [], np.zeros((3, 0)), [0])
+        self.assertAllClose(entropy, [1.0, 0.0, -2.0], atol=1e-5)
+
+    def test_density_matrix_inputs(self):
+        """Make sure the reduced density matrix ops fail gracefully."""
+        qubits = cirq.GridQubit.rect(1, 12)
+        programs = util.convert_to_tensor([cirq.Circuit(cirq.H.on_each(
+            *qubits))] * 2)
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'at most 10 qubits'):
+            tfq_simulate_ops.tfq_simulate_reduced_density_matrix(
+                programs, [], np.zeros((2, 0)), list(range(11)))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'out of range'):
+            tfq_simulate_ops.tfq_simulate_entanglement_entropy(
+                programs, [], np.zeros((2, 0)), [12])
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'alpha must be positive'):
+            tfq_simulate_ops.tfq_simulate_entanglement_entropy(
+                programs, [], np.zeros((2, 0)), [0], alpha=0.0)
+        # Only the smaller side of the bipartition has to fit.
+        entropy = tfq_simulate_ops.tfq_simulate_entanglement_entropy(
+            programs, [], np.zeros((2, 0)), list(range(11)))
+        self.assertAllClose(entropy, [0.0, 0.0], atol=1e-5)
+
+
+class SimulatePauliEvolutionTest(tf.test.TestCase, parameterized.TestCase):
+    """Tests tfq_simulate_pauli_evolution."""
+
+    @staticmethod
+    def _expm(psum, qubits, time):
+        energies, vectors = np.linalg.eigh(psum.matrix(qubits))
+        return vectors @ np.diag(np.exp(-1j * time * energies)) @ \
+            vectors.conj().T
+
+    @parameterized.parameters([{
+        'order': 1,
+        'batch_size': 1
+    }, {
+        'order': 2,
+        'batch_size': 4
+    }])
+    def test_evolution_matches_exact(self, order, batch_size):
+        """Many Trotter steps must approach the exact evolution."""
+        n_qubits = 3
+        qubits, programs, symbol_names, symbol_values_array = \
+            _random_batch(n_qubits, batch_size)
+        psums = util.random_pauli_sums(qubits, 3, batch_size)
+        times = np.random.uniform(0.1, 0.3, size=(batch_size, 1))
+
+        states = tfq_simulate_ops.tfq_simulate_state(
+            programs, symbol_names, symbol_values_array).numpy()
+        evolved = tfq_simulate_ops.tfq_simulate_pauli_evolution(
+            programs,
+            symbol_names,
+            symbol_values_array,
+            util.convert_to_tensor([[x] for x in psums]),
+            times,
+            trotter_steps=100,
+            order=order)
+        for i in range(batch_size):
+            expected = self._expm(psums[i], qubits, times[i, 0]) @ states[i]
+            self.assertAllClose(evolved[i], expected, atol=5e-3)
+
+    def test_commuting_terms_exact(self):
+        """A single step is exact when all terms commute."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        circuit = cirq.Circuit(cirq.H.on_each(*qubits))
+        psum = cirq.Z(qubits[0]) * cirq.Z(qubits[1]) + 0.5 * cirq.Z(qubits[1])
+        programs = util.convert_to_tensor([circuit, circuit])
+        times = np.array([[0.3, 0.4], [0.0, 1.0]])
+        evolved = tfq_simulate_ops.tfq_simulate_pauli_evolution(
+            programs, [], np.zeros((2, 0)),
+            util.convert_to_tensor([[psum, psum], [psum, psum]]), times)
+        psi = np.full(4, 0.5, dtype=np.complex64)
+        for i in range(2):
+            expected = self._expm(psum, qubits, np.sum(times[i])) @ psi
+            self.assertAllClose(evolved[i], expected, atol=1e-5)
+
+    def test_evolution_empty_program(self):
+        """Empty programs are padded instead of failing the batch."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        psum = cirq.X(qubits[0]) + cirq.Z(qubits[1])
+        programs = util.convert_to_tensor(
+            [cirq.Circuit(cirq.H.on_each(*qubits)),
+             cirq.Circuit()])
+        evolved = tfq_simulate_ops.tfq_simulate_pauli_evolution(
+            programs, [], np.zeros((2, 0)),
+            util.convert_to_tensor([[psum], [psum]]), np.full((2, 1), 0.3))
+        psi = np.full(4, 0.5, dtype=np.complex64)
+        self.assertAllClose(evolved[0],
+                            self._expm(psum, qubits, 0.3) @ psi,
+                            atol=1e-5)
+        self.assertAllClose(evolved[1], [-2] * 4)
+
+        # A single empty program takes the other code path.
+        evolved = tfq_simulate_ops.tfq_simulate_pauli_evolution(
+            util.convert_to_tensor([cirq.Circuit()]), [], np.zeros((1, 0)),
+            util.convert_to_tensor([[psum]]), np.full((1, 1), 0.3))
+        self.assertAllClose(evolved, [[-2]])
+
+    def test_evolution_inputs(self):
+        """Make sure the evolution op fails gracefully on bad inputs."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        programs = util.convert_to_tensor([cirq.Circuit(cirq.H.on_each(
+            *qubits))] * 2)
+        psums = util.convert_to_tensor([[cirq.X(qubits[0])]] * 2)
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'times must have shape'):
+            tfq_simulate_ops.tfq_simulate_pauli_evolution(
+                programs, [], np.zeros((2, 0)), psums, np.zeros((2, 2)))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'real coefficients'):
+            tfq_simulate_ops.tfq_simulate_pauli_evolution(
+                programs, [], np.zeros((2, 0)),
+                util.convert_to_tensor([[1j * cirq.X(qubits[0])]] * 2),
+                np.zeros((2, 1)))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'order must be 1 or 2'):
+            tfq_simulate_ops.tfq_simulate_pauli_evolution(
+                programs, [], np.zeros((2, 0)), psums, np.zeros((2, 1)),
+                order=3)
+
+
+class SimulateKrylovTest(tf.test.TestCase):
+    """Tests tfq_simulate_ground_state and tfq_simulate_krylov_evolution."""
+
+    def test_ground_state_matches_exact(self):
+        """Ground energies must match dense diagonalization."""
+        n_qubits = 4
+        batch_size = 3
+        qubits, programs, symbol_names, symbol_values_array = \
+            _random_batch(n_qubits, batch_size)
+        # Transverse field Ising chain with random fields.
+        psums = []
+        for _ in range(batch_size):
+            h = np.random.uniform(0.5, 1.5)
+            psum = sum(
+                cirq.Z(qubits[q]) * cirq.Z(qubits[q + 1])
+                for q in range(n_qubits - 1))
+            psums.append(psum + sum(h * cirq.X(q) for q in qubits))
+
+        energies, states = tfq_simulate_ops.tfq_simulate_ground_state(
+            programs, symbol_names, symbol_values_array,
+            util.convert_to_tensor([[x] for x in psums]))
+        for i in range(batch_size):
+            matrix = psums[i].matrix(qubits)
+            expected = np.linalg.eigvalsh(matrix)[0]
+            self.assertAllClose(energies[i], expected, atol=1e-3)
+            state = states[i].numpy()
+            self.assertAllClose(np.vdot(state, matrix @ state).real,
+                                expected,
+                                atol=1e-3)
+
+    def test_evolution_matches_exact(self):
+        """Evolved states must match dense exponentials."""
+        n_qubits = 3
+        batch_size = 4
+        qubits, programs, symbol_names, symbol_values_array = \
+            _random_batch(n_qubits, batch_size)
+        psums = util.random_pauli_sums(qubits, 3, batch_size)
+        times = np.random.uniform(0.5, 1.5, size=batch_size)
+
+        states = tfq_simulate_ops.tfq_simulate_state(
+            programs, symbol_names, symbol_values_array).numpy()
+        evolved = tfq_simulate_ops.tfq_simulate_krylov_evolution(
+            programs,
+            symbol_names,
+            symbol_values_array,
+            util.convert_to_tensor([[x] for x in psums]),
+            times,
+            krylov_dim=8,
+            time_steps=2)
+        for i in range(batch_size):
+            energies, vectors = np.linalg.eigh(psums[i].matrix(qubits))
+            unitary = vectors @ np.diag(np.exp(-1j * times[i] * energies)) \
+                @ vectors.conj().T
+            self.assertAllClose(evolved[i], unitary @ states[i], atol=1e-4)
+
+    def test_krylov_inputs(self):
+        """Make sure the Krylov ops fail gracefully on bad inputs."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        programs = util.convert_to_tensor([cirq.Circuit(cirq.H.on_each(
+            *qubits))] * 2)
+        psums = util.convert_to_tensor([[cirq.X(qubits[0])]] * 2)
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'one Hamiltonian per circuit'):
+            tfq_simulate_ops.tfq_simulate_ground_state(
+                programs, [], np.zeros((2, 0)),
+                util.convert_to_tensor([[cirq.X(qubits[0])] * 2] * 2))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'real coefficients'):
+            tfq_simulate_ops.tfq_simulate_ground_state(
+                programs, [], np.zeros((2, 0)),
+                util.convert_to_tensor([[1j * cirq.X(qubits[0])]] * 2))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'times must have shape'):
+            tfq_simulate_ops.tfq_simulate_krylov_evolution(
+                programs, [], np.zeros((2, 0)), psums, np.zeros(3))
+
+
+class SimulateSparseExpectationTest(tf.test.TestCase):
+    """Tests tfq_simulate_sparse_expectation."""
+
+    def test_sparse_expectation_matches_pauli_sums(self):
+        """Make sure sparse observables agree with the same Pauli sums."""
+        n_qubits = 4
+        batch_size = 5
+        symbol_names = ['alpha', 'beta']
+        qubits = cirq.GridQubit.rect(1, n_qubits)
+        circuit_batch, resolver_batch = \
+            util.random_symbol_circuit_resolver_batch(
+                qubits, symbol_names, batch_size)
+        symbol_values_array = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+        pauli_sums = [[
+            x, y
+        ] for x, y in zip(util.random_pauli_sums(qubits, 3, batch_size),
+                          util.random_pauli_sums(qubits, 2, batch_size))]
+        observables = tf.sparse.from_dense(
+            np.array([[x.matrix(qubits) for x in row] for row in pauli_sums],
+                     dtype=np.complex64))
+        programs = util.convert_to_tensor(circuit_batch)
+
+        expected = tfq_simulate_ops.tfq_simulate_expectation(
+            programs, symbol_names, symbol_values_array,
+            util.convert_to_tensor(pauli_sums))
+        actual = tfq_simulate_ops.tfq_simulate_sparse_expectation(
+            programs, symbol_names, symbol_values_array, observables)
+        self.assertAllClose(actual, expected, atol=1e-5)
+
+    def test_sparse_expectation_inputs(self):
+        """Make sure the sparse expectation op fails gracefully."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        programs = util.convert_to_tensor([cirq.Circuit(cirq.H(qubits[0]))])
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'out of range for circuit'):
+            tfq_simulate_ops.tfq_simulate_sparse_expectation(
+                util.convert_to_tensor([
+                    cirq.Circuit(cirq.H.on_each(*qubits)),
+                    cirq.Circuit(cirq.H(qubits[0]))
+                ]), [], [[]] * 2,
+                tf.SparseTensor([[1, 0, 2, 0]], [1.0 + 0j], [2, 1, 4, 4]))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    r'must be 2 \*\* n by 2 \*\* n'):
+            tfq_simulate_ops.tfq_simulate_sparse_expectation(
+                programs, [], [[]],
+                tf.SparseTensor([[0, 0, 0, 0]], [1.0 + 0j], [1, 1, 8, 8]))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'Number of circuits and observables'):
+            tfq_simulate_ops.tfq_simulate_sparse_expectation(
+                programs, [], [[]],
+                tf.SparseTensor([[0, 0, 0, 0]], [1.0 + 0j], [2, 1, 4, 4]))
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'square matrices'):
+            tfq_simulate_ops.tfq_simulate_sparse_expectation(
+                programs, [], [[]],
+                tf.SparseTensor([[0, 0, 0, 0]], [1.0 + 0j], [1, 1, 2, 4]))
+
+        # Empty programs are padded.
+        res = tfq_simulate_ops.tfq_simulate_sparse_expectation(
+            util.convert_to_tensor([cirq.Circuit()]), [], [[]],
+            tf.SparseTensor([[0, 0, 0, 0]], [1.0 + 0j], [1, 1, 1, 1]))
+        self.assertAllClose(res, [[-2.0]])
+
+
+class PauliPropagationTest(tf.test.TestCase):
+    """Tests the pauli_propagation backend of tfq_simulate_expectation."""
+
+    def test_pauli_propagation_matches_state_vector(self):
+        """Make sure untruncated propagation matches state vectors."""
+        n_qubits = 4
+        batch_size = 5
+        symbol_names = ['alpha', 'beta']
+        qubits = cirq.GridQubit.rect(1, n_qubits)
+        circuit_batch, resolver_batch = \
+            util.random_symbol_circuit_resolver_batch(
+                qubits, symbol_names, batch_size)
+        symbol_values_array = np.array(
+            [[resolver[symbol]
+              for symbol in symbol_names]
+             for resolver in resolver_batch])
+        pauli_sums = util.convert_to_tensor(
+            [[x] for x in util.random_pauli_sums(qubits, 3, batch_size)])
+        programs = util.convert_to_tensor(circuit_batch)
+
+        expected = tfq_simulate_ops.tfq_simulate_expectation(
+            programs, symbol_names, symbol_values_array, pauli_sums)
+        actual = tfq_simulate_ops.tfq_simulate_expectation(
+            programs,
+            symbol_names,
+            symbol_values_array,
+            pauli_sums,
+            backend='pauli_propagation',
+            truncation_threshold=0.0)
+        self.assertAllClose(actual, expected, atol=1e-4)
+
+    def test_pauli_propagation_large_clifford(self):
+        """Make sure circuits beyond state vector sizes are supported."""
+        qubits = cirq.GridQubit.rect(1, 80)
+        circuit = cirq.Circuit(cirq.H(qubits[0]))
+        for q0, q1 in zip(qubits, qubits[1:]):
+            circuit += cirq.CNOT(q0, q1)
+        circuit += cirq.rx(sympy.Symbol('alpha')).on(qubits[-1])
+        pauli_sums = util.convert_to_tensor(
+            [[cirq.Z(qubits[0]) * cirq.Z(qubits[-1])]])
+        res = tfq_simulate_ops.tfq_simulate_expectation(
+            util.convert_to_tensor([circuit]), ['alpha'], [[0.3]], pauli_sums,
+            backend='pauli_propagation')
+        self.assertAllClose(res, [[np.cos(0.3)]], atol=1e-5)
+
+    def test_pauli_propagation_inputs(self):
+        """Make sure the pauli_propagation backend rejects bad inputs."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        programs = util.convert_to_tensor([cirq.Circuit(cirq.H(qubits[0]))])
+        pauli_sums = util.convert_to_tensor([[cirq.Z(qubits[0])]])
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'truncation_threshold'):
+            tfq_simulate_ops.tfq_simulate_expectation(
+                programs, [], [[]],
+                pauli_sums,
+                backend='pauli_propagation',
+                truncation_threshold=-1.0)
+
+    def test_pauli_propagation_no_circuit(self):
+        """Verify that the no circuit case is handled gracefully."""
+        out = tfq_simulate_ops.tfq_simulate_expectation(
+            tf.raw_ops.Empty(shape=(0,), dtype=tf.string),
+            tf.raw_ops.Empty(shape=(0,), dtype=tf.string),
+            tf.raw_ops.Empty(shape=(0, 0), dtype=tf.float32),
+            tf.raw_ops.Empty(shape=(0, 0), dtype=tf.string),
+            backend='pauli_propagation')
+        self.assertShapeEqual(np.zeros((0, 0)), out)
+
+
+class BroadcastProgramsTest(tf.test.TestCase):
+    """Tests broadcasting a single program against many symbol values."""
+
+    def test_broadcast_matches_tiled(self):
+        """A single program must behave like a tiled batch of programs."""
+        n_qubits = 3
+        batch_size = 6
+        qubits = cirq.GridQubit.rect(1, n_qubits)
+        circuit = cirq.Circuit(
+            cirq.H.on_each(*qubits),
+            cirq.X(qubits[0])**sympy.Symbol('alpha'),
+            cirq.CNOT(qubits[0], qubits[1]),
+            cirq.Y(qubits[2])**sympy.Symbol('beta'))
+        symbol_names = ['alpha', 'beta']
+        symbol_values = np.random.uniform(size=(batch_size, 2))
+        pauli_sums = util.convert_to_tensor(
+            [[x] for x in util.random_pauli_sums(qubits, 3, batch_size)])
+        single = util.convert_to_tensor([circuit])
+        tiled = util.convert_to_tensor([circuit] * batch_size)
+
+        self.assertAllClose(
+            tfq_simulate_ops.tfq_simulate_expectation(single, symbol_names,
+                                                      symbol_values,
+                                                      pauli_sums),
+            tfq_simulate_ops.tfq_simulate_expectation(tiled, symbol_names,
+                                                      symbol_values,
+                                                      pauli_sums),
+            atol=1e-5)
+        self.assertAllClose(
+            tfq_simulate_ops.tfq_simulate_state(single, symbol_names,
+                                                symbol_values),
+            tfq_simulate_ops.tfq_simulate_state(tiled, symbol_names,
+                                                symbol_values),
+            atol=1e-5)
+
+        samples = tfq_simulate_ops.tfq_simulate_samples(
+            single, symbol_names, symbol_values, [10])
+        self.assertShapeEqual(np.zeros((batch_size, 10, n_qubits)), samples)
+
+        sampled = tfq_simulate_ops.tfq_simulate_sampled_expectation(
+            single, symbol_names, symbol_values, pauli_sums,
+            [[10]] * batch_size)
+        self.assertShapeEqual(np.zeros((batch_size, 1)), sampled)
+
+    def test_broadcast_pauli_sum_mismatch(self):
+        """Broadcasting still requires one row of ops per symbol row."""
+        qubits = cirq.GridQubit.rect(1, 2)
+        pauli_sums = util.convert_to_tensor([[cirq.Z(qubits[0])]] * 2)
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'do not match'):
+            tfq_simulate_ops.tfq_simulate_expectation(
+                util.convert_to_tensor([cirq.Circuit(cirq.H.on_each(qubits))
+                                       ]), [], np.zeros((3, 0)), pauli_sums)
+
 
 class InputTypesTest(tf.test.TestCase, parameterized.TestCase):
     """Tests that different inputs types work for all of the ops. """
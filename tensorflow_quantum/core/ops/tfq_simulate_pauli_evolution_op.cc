@@ -0,0 +1,414 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/seqfor.h"
+#include "../qsim/lib/simmux.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
+#include "tensorflow_quantum/core/src/pauli_evolution.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+
+namespace tfq {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::Program;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::Circuit<QsimGate> QsimCircuit;
+
+// Simulates circuits and then evolves their final states under a sequence of
+// Hamiltonians with Trotterized Pauli rotations. Every rotation is applied
+// natively in a single pass over the state, instead of being decomposed into
+// basis changes, CNOT ladders and Rz gates for the circuit parser and fuser.
+class TfqSimulatePauliEvolutionOp : public tensorflow::AsyncOpKernel {
+ public:
+  explicit TfqSimulatePauliEvolutionOp(
+      tensorflow::OpKernelConstruction* context)
+      : AsyncOpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("share_states", &share_states_));
+    OP_REQUIRES_OK(context, context->GetAttr("trotter_steps", &num_steps_));
+    OP_REQUIRES_OK(context, context->GetAttr("order", &order_));
+    OP_REQUIRES(context, order_ == 1 || order_ == 2,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "order must be 1 or 2. Got ", order_, ".")));
+  }
+
+  void ComputeAsync(tensorflow::OpKernelContext* context,
+                    DoneCallback done) override {
+    // Hand the work to the shared scheduler instead of blocking an inter-op
+    // thread for the whole simulation.
+    SimulationScheduler::Global()->Schedule([this, context, done]() {
+      ComputeOnScheduler(context);
+      done();
+    });
+  }
+
+ private:
+  // When true, final states are shared with sibling ops of the same step
+  // that also set share_states.
+  bool share_states_;
+
+  int num_steps_;
+  int order_;
+
+  void ComputeOnScheduler(tensorflow::OpKernelContext* context) {
+    const int num_inputs = context->num_inputs();
+    OP_REQUIRES(context, num_inputs == 5,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Expected 5 inputs, got ", num_inputs, " inputs.")));
+
+    // Parse program protos and resolve the Hamiltonians against them.
+    std::vector<Program> programs;
+    std::vector<int> num_qubits;
+    std::vector<std::vector<PauliSum>> pauli_sums;
+    OP_REQUIRES_OK(context, GetBroadcastProgramsAndNumQubits(
+                                context, &programs, &num_qubits, &pauli_sums));
+
+    std::vector<SymbolMap> maps;
+    OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
+    OP_REQUIRES(context, num_qubits.size() == maps.size(),
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Number of circuits and symbol_values do not match. Got ",
+                    programs.size(), " circuits and ", maps.size(),
+                    " symbol values.")));
+
+    const tensorflow::Tensor* times_input;
+    OP_REQUIRES_OK(context, context->input("times", &times_input));
+    OP_REQUIRES(context, times_input->dims() == 2,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "times must be rank 2. Got rank ", times_input->dims(),
+                    ".")));
+    const auto times = times_input->matrix<float>();
+    const int num_hamiltonians = pauli_sums.empty() ? 0 : pauli_sums[0].size();
+    OP_REQUIRES(
+        context,
+        times_input->dim_size(0) == static_cast<int64_t>(maps.size()) &&
+            times_input->dim_size(1) == num_hamiltonians,
+        tensorflow::errors::InvalidArgument(absl::StrCat(
+            "times must have shape [", maps.size(), ", ", num_hamiltonians,
+            "] to match pauli_sums. Got [", times_input->dim_size(0), ", ",
+            times_input->dim_size(1), "].")));
+
+    // Lower every Hamiltonian to Pauli rotations up front so that bad terms
+    // are reported before any simulation starts.
+    std::vector<std::vector<std::vector<PauliRotation>>> rotations(
+        maps.size());
+    for (size_t i = 0; i < maps.size(); i++) {
+      rotations[i].resize(num_hamiltonians);
+      if (num_qubits[i] == 0) {
+        // (#679) Empty programs are padded, their terms are not resolved.
+        continue;
+      }
+      for (int j = 0; j < num_hamiltonians; j++) {
+        const PauliSum& p_sum = pauli_sums[i][j];
+        rotations[i][j].resize(p_sum.terms_size());
+        for (int t = 0; t < p_sum.terms_size(); t++) {
+          OP_REQUIRES_OK(context,
+                         PauliRotationFromTerm(p_sum.terms(t), num_qubits[i],
+                                               &rotations[i][j][t]));
+        }
+      }
+    }
+
+    int max_num_qubits = 0;
+    for (const int num : num_qubits) {
+      max_num_qubits = std::max(max_num_qubits, num);
+    }
+
+    // Initial states are shared with sibling ops simulating the same
+    // circuits. Evolved states are not stored, since the keys only describe
+    // the circuits.
+    StateCache* cache = nullptr;
+    if (share_states_) {
+      OP_REQUIRES_OK(context, GetStepStateCache(context, &cache));
+    }
+    tensorflow::core::ScopedUnref unref_cache(cache);
+    std::vector<uint64_t> keys;
+    if (cache != nullptr) {
+      OP_REQUIRES_OK(context, GetStateCacheKeys(context, &keys));
+    }
+
+    tensorflow::TensorShape output_shape;
+    output_shape.AddDim(maps.size());
+    output_shape.AddDim(1 << max_num_qubits);
+
+    tensorflow::Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+    tensorflow::TTypes<std::complex<float>, 1>::Matrix output_tensor =
+        output->matrix<std::complex<float>>();
+
+    // Cross reference with standard google cloud compute instances
+    // Memory ~= 2 * num_threads * (2 * 64 * 2 ** num_qubits in circuits)
+    // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
+    // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
+    // ...
+    const bool large = max_num_qubits >= 26 || maps.size() == 1;
+
+    // Reserve this op's state vector memory in the shared budget.
+    const int num_workers =
+        large ? 1
+              : context->device()->tensorflow_cpu_worker_threads()->num_threads;
+    SimulationScheduler::ScopedMemory memory(
+        SimulationScheduler::Global(),
+        num_workers * SimulationScheduler::StateBytes(max_num_qubits));
+
+    if (large) {
+      ComputeLarge(programs, maps, num_qubits, max_num_qubits, rotations,
+                   times, cache, keys, context, &output_tensor);
+    } else {
+      ComputeSmall(programs, maps, num_qubits, max_num_qubits, rotations,
+                   times, cache, keys, context, &output_tensor);
+    }
+  }
+
+  void ComputeLarge(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
+      const std::vector<int>& num_qubits, const int max_num_qubits,
+      const std::vector<std::vector<std::vector<PauliRotation>>>& rotations,
+      const tensorflow::TTypes<float>::ConstMatrix& times, StateCache* cache,
+      const std::vector<uint64_t>& keys, tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<std::complex<float>, 1>::Matrix* output_tensor) {
+    // Instantiate qsim objects.
+    const auto tfq_for = tfq::QsimFor(context);
+    using Simulator = qsim::Simulator<const tfq::QsimFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    // Begin simulation.
+    int largest_nq = 1;
+    Simulator sim = Simulator(tfq_for);
+    StateSpace ss = StateSpace(tfq_for);
+    auto sv = ss.Create(largest_nq);
+
+    for (size_t i = 0; i < maps.size(); i++) {
+      int nq = num_qubits[i];
+
+      if (nq == 0) {
+        // (#679) Just ignore empty program
+        auto pad_f = [i, &output_tensor](uint64_t start, uint64_t end) {
+          for (uint64_t j = start; j < end; j++) {
+            (*output_tensor)(i, j) = std::complex<float>(-2, 0);
+          }
+        };
+        const int num_cycles_pad = 10;
+        context->device()
+            ->tensorflow_cpu_worker_threads()
+            ->workers->ParallelFor(uint64_t(1) << max_num_qubits,
+                                   num_cycles_pad, pad_f);
+        continue;
+      }
+
+      if (nq > largest_nq) {
+        // need to switch to larger statespace.
+        largest_nq = nq;
+        sv = ss.Create(largest_nq);
+      }
+      if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+        QsimCircuit qsim_circuit;
+        std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        OP_REQUIRES_OK(context,
+                       QsimCircuitFromProgram(program, maps[i], nq,
+                                              &qsim_circuit, &fused_circuit));
+        ss.SetStateZero(sv);
+        for (size_t j = 0; j < fused_circuit.size(); j++) {
+          qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+        }
+        if (cache != nullptr) {
+          cache->Store(keys[i], nq, ss, sv);
+        }
+      }
+
+      // Each rotation is one parallel pass over the state. ParallelFor
+      // returns once every shard is done, which orders the rotations.
+      for (size_t j = 0; j < rotations[i].size(); j++) {
+        const auto step =
+            TrotterStep(rotations[i][j], times(i, j) / num_steps_, order_);
+        for (int r = 0; r < num_steps_; r++) {
+          for (const auto& rot : step) {
+            auto rotate_f = [&](int64_t start, int64_t end) {
+              ApplyPauliRotation(ss, sv, rotations[i][j][rot.first],
+                                 rot.second, start, end);
+            };
+            const int num_cycles_rotate = 50;
+            context->device()
+                ->tensorflow_cpu_worker_threads()
+                ->workers->ParallelFor(uint64_t(1) << nq, num_cycles_rotate,
+                                       rotate_f);
+          }
+        }
+      }
+
+      // Parallel copy state vector information from qsim into tensorflow
+      // tensors.
+      auto copy_f = [i, nq, &output_tensor, &ss, &sv](uint64_t start,
+                                                      uint64_t end) {
+        uint64_t crossover = uint64_t(1) << nq;
+        uint64_t upper = std::min(end, crossover);
+
+        if (start < crossover) {
+          for (uint64_t j = start; j < upper; j++) {
+            (*output_tensor)(i, j) = ss.GetAmpl(sv, j);
+          }
+        }
+        for (uint64_t j = std::max(start, upper); j < end; j++) {
+          (*output_tensor)(i, j) = std::complex<float>(-2, 0);
+        }
+      };
+      const int num_cycles_copy = 50;
+      context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+          uint64_t(1) << max_num_qubits, num_cycles_copy, copy_f);
+    }
+  }
+
+  void ComputeSmall(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
+      const std::vector<int>& num_qubits, const int max_num_qubits,
+      const std::vector<std::vector<std::vector<PauliRotation>>>& rotations,
+      const tensorflow::TTypes<float>::ConstMatrix& times, StateCache* cache,
+      const std::vector<uint64_t>& keys, tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<std::complex<float>, 1>::Matrix* output_tensor) {
+    const auto tfq_for = qsim::SequentialFor(1);
+    using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    Status compute_status = ::tensorflow::Status();
+    auto c_lock = tensorflow::mutex();
+    auto DoWork = [&](int start, int end) {
+      int largest_nq = 1;
+      Simulator sim = Simulator(tfq_for);
+      StateSpace ss = StateSpace(tfq_for);
+      auto sv = ss.Create(largest_nq);
+      for (int i = start; i < end; i++) {
+        int nq = num_qubits[i];
+
+        if (nq == 0) {
+          // (#679) Just ignore empty program
+          for (uint64_t j = 0; j < (uint64_t(1) << max_num_qubits); j++) {
+            (*output_tensor)(i, j) = std::complex<float>(-2, 0);
+          }
+          continue;
+        }
+
+        if (nq > largest_nq) {
+          // need to switch to larger statespace.
+          largest_nq = nq;
+          sv = ss.Create(largest_nq);
+        }
+        if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+          QsimCircuit qsim_circuit;
+          std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+          const Program& program =
+              programs.size() == 1 ? programs[0] : programs[i];
+          Status local = QsimCircuitFromProgram(program, maps[i], nq,
+                                                &qsim_circuit, &fused_circuit);
+          NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+          ss.SetStateZero(sv);
+          for (size_t j = 0; j < fused_circuit.size(); j++) {
+            qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+          }
+          if (cache != nullptr) {
+            cache->Store(keys[i], nq, ss, sv);
+          }
+        }
+
+        const uint64_t size = uint64_t(1) << nq;
+        for (size_t j = 0; j < rotations[i].size(); j++) {
+          const auto step =
+              TrotterStep(rotations[i][j], times(i, j) / num_steps_, order_);
+          for (int r = 0; r < num_steps_; r++) {
+            for (const auto& rot : step) {
+              ApplyPauliRotation(ss, sv, rotations[i][j][rot.first],
+                                 rot.second, 0, size);
+            }
+          }
+        }
+
+        for (uint64_t j = 0; j < size; j++) {
+          (*output_tensor)(i, j) = ss.GetAmpl(sv, j);
+        }
+        for (uint64_t j = size; j < (uint64_t(1) << max_num_qubits); j++) {
+          (*output_tensor)(i, j) = std::complex<float>(-2, 0);
+        }
+      }
+    };
+
+    const int64_t num_cycles =
+        200 * (int64_t(1) << static_cast<int64_t>(max_num_qubits));
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        maps.size(), num_cycles, DoWork);
+    OP_REQUIRES_OK(context, compute_status);
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqSimulatePauliEvolution").Device(tensorflow::DEVICE_CPU),
+    TfqSimulatePauliEvolutionOp);
+
+REGISTER_OP("TfqSimulatePauliEvolution")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("pauli_sums: string")
+    .Input("times: float")
+    .Output("state_vector: complex64")
+    .Attr("trotter_steps: int >= 1 = 1")
+    .Attr("order: int = 1")
+    .Attr("share_states: bool = false")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle pauli_sums_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &pauli_sums_shape));
+
+      tensorflow::shape_inference::ShapeHandle times_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &times_shape));
+
+      c->set_output(
+          0, c->MakeShape(
+                 {c->Dim(symbol_values_shape, 0),
+                  tensorflow::shape_inference::InferenceContext::kUnknownDim}));
+
+      return ::tensorflow::Status();
+    });
+
+}  // namespace tfq
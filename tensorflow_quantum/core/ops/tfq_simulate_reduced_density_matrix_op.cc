@@ -0,0 +1,456 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/seqfor.h"
+#include "../qsim/lib/simmux.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
+#include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+#include "third_party/eigen3/Eigen/Eigenvalues"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::Status;
+using ::tfq::proto::Program;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::Circuit<QsimGate> QsimCircuit;
+
+// Largest subsystem whose density matrix is formed. Every worker holds one
+// 4 ** k buffer of complex doubles, 16MB at this size.
+constexpr int kMaxSubsystemQubits = 10;
+
+// Renyi entropy of order alpha, in bits, of the dim by dim density matrix
+// rho. alpha == 1 gives the von Neumann entropy.
+float RenyiEntropy(const std::vector<std::complex<double>>& rho,
+                   const uint64_t dim, const float alpha) {
+  Eigen::MatrixXcd matrix(dim, dim);
+  for (uint64_t a = 0; a < dim; a++) {
+    for (uint64_t b = 0; b < dim; b++) {
+      matrix(a, b) = rho[a * dim + b];
+    }
+  }
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXcd> solver(
+      matrix, Eigen::EigenvaluesOnly);
+  const Eigen::VectorXd& eigenvalues = solver.eigenvalues();
+
+  double entropy = 0.0;
+  if (alpha == 1.0) {
+    for (int j = 0; j < eigenvalues.size(); j++) {
+      // Round off can produce tiny negative eigenvalues.
+      const double p = eigenvalues(j);
+      if (p > 1e-12) {
+        entropy -= p * std::log2(p);
+      }
+    }
+    return entropy;
+  }
+  for (int j = 0; j < eigenvalues.size(); j++) {
+    entropy += std::pow(std::max(eigenvalues(j), 0.0), alpha);
+  }
+  return std::log2(entropy) / (1.0 - alpha);
+}
+
+}  // namespace
+
+// Computes reduced density matrices of the final states of circuits over a
+// subset of their qubits. With entropy set, the Renyi entropy of each
+// reduced density matrix is returned instead. For entropies of these pure
+// states the smaller of the subset and its complement is traced out, since
+// both have the same spectrum.
+class TfqSimulateReducedDensityMatrixOp : public tensorflow::AsyncOpKernel {
+ public:
+  explicit TfqSimulateReducedDensityMatrixOp(
+      tensorflow::OpKernelConstruction* context, bool entropy = false)
+      : AsyncOpKernel(context), entropy_(entropy) {
+    OP_REQUIRES_OK(context, context->GetAttr("share_states", &share_states_));
+    if (entropy_) {
+      OP_REQUIRES_OK(context, context->GetAttr("alpha", &alpha_));
+      OP_REQUIRES(context, alpha_ > 0.0,
+                  tensorflow::errors::InvalidArgument(absl::StrCat(
+                      "alpha must be positive. Got ", alpha_, ".")));
+    }
+  }
+
+  void ComputeAsync(tensorflow::OpKernelContext* context,
+                    DoneCallback done) override {
+    // Hand the work to the shared scheduler instead of blocking an inter-op
+    // thread for the whole simulation.
+    SimulationScheduler::Global()->Schedule([this, context, done]() {
+      ComputeOnScheduler(context);
+      done();
+    });
+  }
+
+ private:
+  // When true, final states are shared with sibling ops of the same step
+  // that also set share_states.
+  bool share_states_;
+
+  // When true, output the Renyi entropy of order alpha_ of each reduced
+  // density matrix instead of the matrix itself.
+  const bool entropy_;
+  float alpha_ = 1.0;
+
+  void ComputeOnScheduler(tensorflow::OpKernelContext* context) {
+    const int num_inputs = context->num_inputs();
+    OP_REQUIRES(context, num_inputs == 4,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Expected 4 inputs, got ", num_inputs, " inputs.")));
+
+    // Parse to Program Proto and num_qubits.
+    std::vector<Program> programs;
+    std::vector<int> num_qubits;
+    OP_REQUIRES_OK(context, GetBroadcastProgramsAndNumQubits(
+                                context, &programs, &num_qubits));
+
+    // Parse symbol maps for parameter resolution in the circuits.
+    std::vector<SymbolMap> maps;
+    OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
+    OP_REQUIRES(
+        context, maps.size() == num_qubits.size(),
+        tensorflow::errors::InvalidArgument(absl::StrCat(
+            "Number of circuits and values do not match. Got ", programs.size(),
+            " circuits and ", maps.size(), " values.")));
+
+    std::vector<int> qubits;
+    OP_REQUIRES_OK(context, GetQubitSubset(context, num_qubits, &qubits));
+
+    // The qubits kept in the reduced density matrix of every circuit.
+    std::vector<std::vector<int>> subsystems(maps.size(), qubits);
+    int max_num_qubits = 0;
+    for (size_t i = 0; i < num_qubits.size(); i++) {
+      const int nq = num_qubits[i];
+      max_num_qubits = std::max(max_num_qubits, nq);
+      if (entropy_ && nq > 0 && 2 * static_cast<int>(qubits.size()) > nq) {
+        std::vector<int> complement;
+        for (int q = 0; q < nq; q++) {
+          if (std::find(qubits.begin(), qubits.end(), q) == qubits.end()) {
+            complement.push_back(q);
+          }
+        }
+        subsystems[i] = complement;
+      }
+      OP_REQUIRES(context,
+                  static_cast<int>(subsystems[i].size()) <= kMaxSubsystemQubits,
+                  tensorflow::errors::InvalidArgument(absl::StrCat(
+                      "Reduced density matrices of at most ",
+                      kMaxSubsystemQubits, " qubits are supported. Got ",
+                      subsystems[i].size(), " qubits for circuit ", i, ".")));
+    }
+
+    // Share final states with sibling ops simulating the same circuits.
+    StateCache* cache = nullptr;
+    if (share_states_) {
+      OP_REQUIRES_OK(context, GetStepStateCache(context, &cache));
+    }
+    tensorflow::core::ScopedUnref unref_cache(cache);
+    std::vector<uint64_t> keys;
+    if (cache != nullptr) {
+      OP_REQUIRES_OK(context, GetStateCacheKeys(context, &keys));
+    }
+
+    const uint64_t dim = uint64_t(1) << qubits.size();
+    tensorflow::TensorShape output_shape;
+    output_shape.AddDim(maps.size());
+    if (!entropy_) {
+      output_shape.AddDim(dim);
+      output_shape.AddDim(dim);
+    }
+    tensorflow::Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+
+    // Writes the result for circuit i from its reduced density matrix.
+    auto write_f = [&](int i, const std::vector<std::complex<double>>& rho) {
+      if (entropy_) {
+        const uint64_t sub_dim = uint64_t(1) << subsystems[i].size();
+        output->flat<float>()(i) = RenyiEntropy(rho, sub_dim, alpha_);
+        return;
+      }
+      auto output_tensor = output->tensor<std::complex<float>, 3>();
+      for (uint64_t a = 0; a < dim; a++) {
+        for (uint64_t b = 0; b < dim; b++) {
+          output_tensor(i, a, b) = std::complex<float>(rho[a * dim + b]);
+        }
+      }
+    };
+    // (#679) Just ignore empty program
+    auto pad_f = [&](int i) {
+      if (entropy_) {
+        output->flat<float>()(i) = -2.0;
+        return;
+      }
+      auto output_tensor = output->tensor<std::complex<float>, 3>();
+      for (uint64_t a = 0; a < dim; a++) {
+        for (uint64_t b = 0; b < dim; b++) {
+          output_tensor(i, a, b) = std::complex<float>(-2, 0);
+        }
+      }
+    };
+
+    // Cross reference with standard google cloud compute instances
+    // Memory ~= 2 * num_threads * (2 * 64 * 2 ** num_qubits in circuits)
+    // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
+    // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
+    // ...
+    const bool large = max_num_qubits >= 26 || maps.size() == 1;
+
+    // Reserve this op's state vector memory in the shared budget.
+    const int num_workers =
+        large ? 1
+              : context->device()->tensorflow_cpu_worker_threads()->num_threads;
+    SimulationScheduler::ScopedMemory memory(
+        SimulationScheduler::Global(),
+        num_workers * SimulationScheduler::StateBytes(max_num_qubits));
+
+    if (large) {
+      ComputeLarge(programs, maps, num_qubits, subsystems, cache, keys,
+                   context, write_f, pad_f);
+    } else {
+      ComputeSmall(programs, maps, num_qubits, max_num_qubits, subsystems,
+                   cache, keys, context, write_f, pad_f);
+    }
+  }
+
+  template <typename WriteF, typename PadF>
+  void ComputeLarge(const std::vector<Program>& programs,
+                    const std::vector<SymbolMap>& maps,
+                    const std::vector<int>& num_qubits,
+                    const std::vector<std::vector<int>>& subsystems,
+                    StateCache* cache, const std::vector<uint64_t>& keys,
+                    tensorflow::OpKernelContext* context, WriteF& write_f,
+                    PadF& pad_f) {
+    // Instantiate qsim objects.
+    const auto tfq_for = tfq::QsimFor(context);
+    using Simulator = qsim::Simulator<const tfq::QsimFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    // Begin simulation.
+    int largest_nq = 1;
+    Simulator sim = Simulator(tfq_for);
+    StateSpace ss = StateSpace(tfq_for);
+    auto sv = ss.Create(largest_nq);
+
+    for (size_t i = 0; i < maps.size(); i++) {
+      const int nq = num_qubits[i];
+      if (nq == 0) {
+        pad_f(i);
+        continue;
+      }
+
+      if (nq > largest_nq) {
+        // need to switch to larger statespace.
+        largest_nq = nq;
+        sv = ss.Create(largest_nq);
+      }
+      if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+        QsimCircuit qsim_circuit;
+        std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        OP_REQUIRES_OK(context,
+                       QsimCircuitFromProgram(program, maps[i], nq,
+                                              &qsim_circuit, &fused_circuit));
+        ss.SetStateZero(sv);
+        for (size_t j = 0; j < fused_circuit.size(); j++) {
+          qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+        }
+        if (cache != nullptr) {
+          cache->Store(keys[i], nq, ss, sv);
+        }
+      }
+
+      // Parallel partial traces over disjoint environment ranges.
+      const int k = subsystems[i].size();
+      const uint64_t sub_dim = uint64_t(1) << k;
+      std::vector<std::complex<double>> rho(sub_dim * sub_dim);
+      auto r_lock = tensorflow::mutex();
+      auto trace_f = [&](int64_t start, int64_t end) {
+        std::vector<std::complex<double>> partial(sub_dim * sub_dim);
+        AccumulateReducedDensityMatrix(ss, sv, nq, subsystems[i], start, end,
+                                       &partial);
+        r_lock.lock();
+        for (uint64_t j = 0; j < partial.size(); j++) {
+          rho[j] += partial[j];
+        }
+        r_lock.unlock();
+      };
+      const int64_t num_cycles_trace = 20 * sub_dim * sub_dim;
+      context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+          uint64_t(1) << (nq - k), num_cycles_trace, trace_f);
+      write_f(i, rho);
+    }
+  }
+
+  template <typename WriteF, typename PadF>
+  void ComputeSmall(const std::vector<Program>& programs,
+                    const std::vector<SymbolMap>& maps,
+                    const std::vector<int>& num_qubits,
+                    const int max_num_qubits,
+                    const std::vector<std::vector<int>>& subsystems,
+                    StateCache* cache, const std::vector<uint64_t>& keys,
+                    tensorflow::OpKernelContext* context, WriteF& write_f,
+                    PadF& pad_f) {
+    const auto tfq_for = qsim::SequentialFor(1);
+    using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    Status compute_status = ::tensorflow::Status();
+    auto c_lock = tensorflow::mutex();
+    auto DoWork = [&](int start, int end) {
+      int largest_nq = 1;
+      Simulator sim = Simulator(tfq_for);
+      StateSpace ss = StateSpace(tfq_for);
+      auto sv = ss.Create(largest_nq);
+      std::vector<std::complex<double>> rho;
+      for (int i = start; i < end; i++) {
+        const int nq = num_qubits[i];
+        if (nq == 0) {
+          pad_f(i);
+          continue;
+        }
+
+        if (nq > largest_nq) {
+          // need to switch to larger statespace.
+          largest_nq = nq;
+          sv = ss.Create(largest_nq);
+        }
+        if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+          QsimCircuit qsim_circuit;
+          std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+          const Program& program =
+              programs.size() == 1 ? programs[0] : programs[i];
+          Status local = QsimCircuitFromProgram(program, maps[i], nq,
+                                                &qsim_circuit, &fused_circuit);
+          NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+          ss.SetStateZero(sv);
+          for (size_t j = 0; j < fused_circuit.size(); j++) {
+            qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+          }
+          if (cache != nullptr) {
+            cache->Store(keys[i], nq, ss, sv);
+          }
+        }
+
+        const int k = subsystems[i].size();
+        const uint64_t sub_dim = uint64_t(1) << k;
+        rho.assign(sub_dim * sub_dim, 0.0);
+        AccumulateReducedDensityMatrix(ss, sv, nq, subsystems[i], 0,
+                                       uint64_t(1) << (nq - k), &rho);
+        write_f(i, rho);
+      }
+    };
+
+    const int64_t num_cycles =
+        200 * (int64_t(1) << static_cast<int64_t>(max_num_qubits));
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        maps.size(), num_cycles, DoWork);
+    OP_REQUIRES_OK(context, compute_status);
+  }
+};
+
+class TfqSimulateEntanglementEntropyOp
+    : public TfqSimulateReducedDensityMatrixOp {
+ public:
+  explicit TfqSimulateEntanglementEntropyOp(
+      tensorflow::OpKernelConstruction* context)
+      : TfqSimulateReducedDensityMatrixOp(context, /*entropy=*/true) {}
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqSimulateReducedDensityMatrix").Device(tensorflow::DEVICE_CPU),
+    TfqSimulateReducedDensityMatrixOp);
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqSimulateEntanglementEntropy").Device(tensorflow::DEVICE_CPU),
+    TfqSimulateEntanglementEntropyOp);
+
+REGISTER_OP("TfqSimulateReducedDensityMatrix")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("qubits: int32")
+    .Output("density_matrices: complex64")
+    .Attr("share_states: bool = false")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle qubits_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &qubits_shape));
+
+      c->set_output(
+          0, c->MakeShape(
+                 {c->Dim(symbol_values_shape, 0),
+                  tensorflow::shape_inference::InferenceContext::kUnknownDim,
+                  tensorflow::shape_inference::InferenceContext::kUnknownDim}));
+
+      return ::tensorflow::Status();
+    });
+
+REGISTER_OP("TfqSimulateEntanglementEntropy")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("qubits: int32")
+    .Output("entropies: float")
+    .Attr("alpha: float = 1.0")
+    .Attr("share_states: bool = false")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle qubits_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &qubits_shape));
+
+      c->set_output(0, c->Vector(c->Dim(symbol_values_shape, 0)));
+
+      return ::tensorflow::Status();
+    });
+
+}  // namespace tfq
@@ -14,6 +14,7 @@ limitations under the License.
 ==============================================================================*/
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "../qsim/lib/circuit.h"
@@ -25,6 +26,7 @@ limitations under the License.
 #include "tensorflow/core/framework/shape_inference.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/refcount.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/random/random.h"
@@ -32,6 +34,8 @@ limitations under the License.
 #include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/util/guarded_philox_random.h"
 #include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
 #include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
 #include "tensorflow_quantum/core/src/util_qsim.h"
@@ -45,13 +49,41 @@ using ::tfq::proto::Program;
 typedef qsim::Cirq::GateCirq<float> QsimGate;
 typedef qsim::Circuit<QsimGate> QsimCircuit;
 
-class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
+class TfqSimulateSampledExpectationOp : public tensorflow::AsyncOpKernel {
  public:
   explicit TfqSimulateSampledExpectationOp(
       tensorflow::OpKernelConstruction* context)
-      : OpKernel(context) {}
+      : AsyncOpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("share_states", &share_states_));
+    std::string shot_noise_model;
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("shot_noise_model", &shot_noise_model));
+    binomial_shot_noise_ = shot_noise_model == "binomial";
+
+    std::string shot_allocation;
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("shot_allocation", &shot_allocation));
+    weighted_allocation_ = shot_allocation == "weighted";
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("pilot_fraction", &pilot_fraction_));
+    OP_REQUIRES(context, pilot_fraction_ >= 0.0 && pilot_fraction_ < 1.0,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "pilot_fraction must be in [0, 1). Got ", pilot_fraction_,
+                    ".")));
+  }
 
-  void Compute(tensorflow::OpKernelContext* context) override {
+  void ComputeAsync(tensorflow::OpKernelContext* context,
+                    DoneCallback done) override {
+    // Hand the work to the shared scheduler instead of blocking an inter-op
+    // thread for the whole simulation.
+    SimulationScheduler::Global()->Schedule([this, context, done]() {
+      ComputeOnScheduler(context);
+      done();
+    });
+  }
+
+ private:
+  void ComputeOnScheduler(tensorflow::OpKernelContext* context) {
     // TODO (mbbrough): add more dimension checks for other inputs here.
     const int num_inputs = context->num_inputs();
     OP_REQUIRES(context, num_inputs == 5,
@@ -59,7 +91,7 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
                     "Expected 5 inputs, got ", num_inputs, " inputs.")));
 
     // Create the output Tensor.
-    const int output_dim_batch_size = context->input(0).dim_size(0);
+    const int output_dim_batch_size = context->input(2).dim_size(0);
     const int output_dim_op_size = context->input(3).dim_size(1);
     tensorflow::TensorShape output_shape;
     output_shape.AddDim(output_dim_batch_size);
@@ -72,13 +104,14 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
     std::vector<Program> programs;
     std::vector<int> num_qubits;
     std::vector<std::vector<PauliSum>> pauli_sums;
-    OP_REQUIRES_OK(context, GetProgramsAndNumQubits(context, &programs,
+    OP_REQUIRES_OK(context,
+                   GetBroadcastProgramsAndNumQubits(context, &programs,
                                                     &num_qubits, &pauli_sums));
 
     std::vector<SymbolMap> maps;
     OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
 
-    OP_REQUIRES(context, programs.size() == maps.size(),
+    OP_REQUIRES(context, num_qubits.size() == maps.size(),
                 tensorflow::errors::InvalidArgument(absl::StrCat(
                     "Number of circuits and symbol_values do not match. Got ",
                     programs.size(), " circuits and ", maps.size(),
@@ -100,53 +133,99 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
             context->input(4).dim_size(1), " lists of sample sizes and ",
             context->input(3).dim_size(1), " lists of pauli sums.")));
 
-    // Construct qsim circuits.
-    std::vector<QsimCircuit> qsim_circuits(programs.size(), QsimCircuit());
-    std::vector<std::vector<qsim::GateFused<QsimGate>>> fused_circuits(
-        programs.size(), std::vector<qsim::GateFused<QsimGate>>({}));
-
-    Status parse_status = ::tensorflow::Status();
-    auto p_lock = tensorflow::mutex();
-    auto construct_f = [&](int start, int end) {
-      for (int i = start; i < end; i++) {
-        Status local =
-            QsimCircuitFromProgram(programs[i], maps[i], num_qubits[i],
-                                   &qsim_circuits[i], &fused_circuits[i]);
-        NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
-      }
-    };
-
-    const int num_cycles = 1000;
-    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-        programs.size(), num_cycles, construct_f);
-    OP_REQUIRES_OK(context, parse_status);
-
     int max_num_qubits = 0;
     for (const int num : num_qubits) {
       max_num_qubits = std::max(max_num_qubits, num);
     }
 
+    // Share final states with sibling ops simulating the same circuits.
+    StateCache* cache = nullptr;
+    if (share_states_) {
+      OP_REQUIRES_OK(context, GetStepStateCache(context, &cache));
+    }
+    tensorflow::core::ScopedUnref unref_cache(cache);
+    std::vector<uint64_t> keys;
+    if (cache != nullptr) {
+      OP_REQUIRES_OK(context, GetStateCacheKeys(context, &keys));
+    }
+
     // Cross reference with standard google cloud compute instances
     // Memory ~= 2 * num_threads * (2 * 64 * 2 ** num_qubits in circuits)
     // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
     // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
     // ...
-    if (max_num_qubits >= 26 || programs.size() == 1) {
-      ComputeLarge(num_qubits, fused_circuits, pauli_sums, num_samples, context,
-                   &output_tensor);
+    const bool large = max_num_qubits >= 26 || maps.size() == 1;
+
+    // Reserve this op's state vector memory in the shared budget.
+    const int num_workers =
+        large ? 1
+              : context->device()->tensorflow_cpu_worker_threads()->num_threads;
+    SimulationScheduler::ScopedMemory memory(
+        SimulationScheduler::Global(),
+        2 * num_workers * SimulationScheduler::StateBytes(max_num_qubits));
+
+    if (large) {
+      ComputeLarge(programs, maps, num_qubits, pauli_sums, num_samples, cache,
+                   keys, context, &output_tensor);
     } else {
-      ComputeSmall(num_qubits, max_num_qubits, fused_circuits, pauli_sums,
-                   num_samples, context, &output_tensor);
+      ComputeSmall(programs, maps, num_qubits, max_num_qubits, pauli_sums,
+                   num_samples, cache, keys, context, &output_tensor);
     }
   }
 
- private:
+  // When true, final states are shared with sibling ops of the same step
+  // that also set share_states.
+  bool share_states_;
+
+  // When true, shot noise is drawn from Binomial(num_samples, p) around the
+  // exact expectation of each term instead of sampling bitstrings.
+  bool binomial_shot_noise_;
+
+  // When true, num_samples is a total budget for each PauliSum, split across
+  // its terms proportionally to |c_i| * sigma_i, with pilot_fraction_ of it
+  // spent first on estimating sigma_i.
+  bool weighted_allocation_;
+  float pilot_fraction_;
+
+  // Largest number of Rand32 draws SampledExpectation takes for one term.
+  int RandomDrawsPerTerm() const {
+    return weighted_allocation_
+               ? kWeightedSampleCallsPerTerm * kRandomDrawsPerTerm
+               : kRandomDrawsPerTerm;
+  }
+
+  // Estimates <p_sum> from num_samples shots with the configured shot noise
+  // model and shot allocation.
+  template <typename SimT, typename StateSpaceT, typename StateT>
+  Status SampledExpectation(const PauliSum& p_sum, const SimT& sim,
+                            const StateSpaceT& ss, StateT& state,
+                            StateT& scratch, const int num_samples,
+                            tensorflow::random::SimplePhilox& random_source,
+                            float* expectation_value) const {
+    if (weighted_allocation_) {
+      return ComputeWeightedSampledExpectationQsim(
+          p_sum, sim, ss, state, scratch, num_samples, pilot_fraction_,
+          binomial_shot_noise_, random_source, expectation_value);
+    }
+    if (binomial_shot_noise_) {
+      return ComputeBinomialSampledExpectationQsim(
+          p_sum, sim, ss, state, scratch, num_samples, random_source,
+          expectation_value);
+    }
+    return ComputeSampledExpectationQsim(p_sum, sim, ss, state, scratch,
+                                         num_samples, random_source,
+                                         expectation_value);
+  }
+
+  // Circuits are built and fused right before they are simulated and freed
+  // as soon as their outputs are written, so peak memory holds at most one
+  // fused circuit per worker instead of one for every circuit in the batch.
   void ComputeLarge(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
       const std::vector<int>& num_qubits,
-      const std::vector<std::vector<qsim::GateFused<QsimGate>>>& fused_circuits,
       const std::vector<std::vector<PauliSum>>& pauli_sums,
-      const std::vector<std::vector<int>>& num_samples,
-      tensorflow::OpKernelContext* context,
+      const std::vector<std::vector<int>>& num_samples, StateCache* cache,
+      const std::vector<uint64_t>& keys, tensorflow::OpKernelContext* context,
       tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
     // Instantiate qsim objects.
     const auto tfq_for = tfq::QsimFor(context);
@@ -169,13 +248,15 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
       }
     }
     auto local_gen = random_gen.ReserveSamples32(
-        largest_sum * pauli_sums[0].size() * fused_circuits.size() + 1);
+        largest_sum * RandomDrawsPerTerm() * pauli_sums[0].size() *
+            maps.size() +
+        1);
     tensorflow::random::SimplePhilox rand_source(&local_gen);
 
     // Simulate programs one by one. Parallelizing over state vectors
     // we no longer parallelize over circuits. Each time we encounter a
     // a larger circuit we will grow the Statevector as necessary.
-    for (int i = 0; i < fused_circuits.size(); i++) {
+    for (int i = 0; i < maps.size(); i++) {
       int nq = num_qubits[i];
 
       if (nq > largest_nq) {
@@ -187,18 +268,30 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
       // TODO: add heuristic here so that we do not always recompute
       //  the state if there is a possibility that circuit[i] and
       //  circuit[i + 1] produce the same state.
-      ss.SetStateZero(sv);
-      for (int j = 0; j < fused_circuits[i].size(); j++) {
-        qsim::ApplyFusedGate(sim, fused_circuits[i][j], sv);
+      if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+        QsimCircuit qsim_circuit;
+        std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        OP_REQUIRES_OK(context,
+                       QsimCircuitFromProgram(program, maps[i], nq,
+                                              &qsim_circuit, &fused_circuit));
+        ss.SetStateZero(sv);
+        for (int j = 0; j < fused_circuit.size(); j++) {
+          qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+        }
+        if (cache != nullptr) {
+          cache->Store(keys[i], nq, ss, sv);
+        }
       }
       for (int j = 0; j < pauli_sums[i].size(); j++) {
         // (#679) Just ignore empty program
-        if (fused_circuits[i].size() == 0) {
+        if (nq == 0) {
           (*output_tensor)(i, j) = -2.0;
           continue;
         }
         float exp_v = 0.0;
-        OP_REQUIRES_OK(context, ComputeSampledExpectationQsim(
+        OP_REQUIRES_OK(context, SampledExpectation(
                                     pauli_sums[i][j], sim, ss, sv, scratch,
                                     num_samples[i][j], rand_source, &exp_v));
         (*output_tensor)(i, j) = exp_v;
@@ -207,11 +300,11 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
   }
 
   void ComputeSmall(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
       const std::vector<int>& num_qubits, const int max_num_qubits,
-      const std::vector<std::vector<qsim::GateFused<QsimGate>>>& fused_circuits,
       const std::vector<std::vector<PauliSum>>& pauli_sums,
-      const std::vector<std::vector<int>>& num_samples,
-      tensorflow::OpKernelContext* context,
+      const std::vector<std::vector<int>>& num_samples, StateCache* cache,
+      const std::vector<uint64_t>& keys, tensorflow::OpKernelContext* context,
       tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
     const auto tfq_for = qsim::SequentialFor(1);
     using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
@@ -227,9 +320,6 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
         largest_sum = std::max(largest_sum, sum.terms().size());
       }
     }
-    const int num_threads = context->device()
-                                ->tensorflow_cpu_worker_threads()
-                                ->workers->NumThreads();
 
     Status compute_status = ::tensorflow::Status();
     auto c_lock = tensorflow::mutex();
@@ -244,9 +334,10 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
       auto sv = ss.Create(largest_nq);
       auto scratch = ss.Create(largest_nq);
 
-      int n_random = largest_sum * output_dim_op_size * fused_circuits.size();
-      n_random /= num_threads;
-      n_random += 1;
+      // Reserve enough samples for every term this shard can sample, so
+      // that its slice of the Philox stream never runs into another one.
+      const int64_t n_random =
+          int64_t(end - start) * largest_sum * RandomDrawsPerTerm() + 1;
       auto local_gen = random_gen.ReserveSamples32(n_random);
       tensorflow::random::SimplePhilox rand_source(&local_gen);
 
@@ -257,7 +348,7 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
         const int nq = num_qubits[cur_batch_index];
 
         // (#679) Just ignore empty program
-        if (fused_circuits[cur_batch_index].size() == 0) {
+        if (nq == 0) {
           (*output_tensor)(cur_batch_index, cur_op_index) = -2.0;
           continue;
         }
@@ -272,16 +363,30 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
           }
           // no need to update scratch_state since ComputeExpectation
           // will take care of things for us.
-          ss.SetStateZero(sv);
-          for (int j = 0; j < fused_circuits[cur_batch_index].size(); j++) {
-            qsim::ApplyFusedGate(sim, fused_circuits[cur_batch_index][j], sv);
+          if (cache == nullptr ||
+              !cache->Restore(keys[cur_batch_index], nq, ss, sv)) {
+            QsimCircuit qsim_circuit;
+            std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+            const Program& program =
+                programs.size() == 1 ? programs[0] : programs[cur_batch_index];
+            Status local = QsimCircuitFromProgram(
+                program, maps[cur_batch_index], nq, &qsim_circuit,
+                &fused_circuit);
+            NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+            ss.SetStateZero(sv);
+            for (int j = 0; j < fused_circuit.size(); j++) {
+              qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+            }
+            if (cache != nullptr) {
+              cache->Store(keys[cur_batch_index], nq, ss, sv);
+            }
           }
         }
 
         float exp_v = 0.0;
         NESTED_FN_STATUS_SYNC(
             compute_status,
-            ComputeSampledExpectationQsim(
+            SampledExpectation(
                 pauli_sums[cur_batch_index][cur_op_index], sim, ss, sv, scratch,
                 num_samples[cur_batch_index][cur_op_index], rand_source,
                 &exp_v),
@@ -295,7 +400,7 @@ class TfqSimulateSampledExpectationOp : public tensorflow::OpKernel {
     const int64_t num_cycles =
         200 * (int64_t(1) << static_cast<int64_t>(max_num_qubits));
     context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-        fused_circuits.size() * output_dim_op_size, num_cycles, DoWork);
+        maps.size() * output_dim_op_size, num_cycles, DoWork);
     OP_REQUIRES_OK(context, compute_status);
   }
 };
@@ -311,6 +416,10 @@ REGISTER_OP("TfqSimulateSampledExpectation")
     .Input("pauli_sums: string")
     .Input("num_samples: int32")
     .Output("expectations: float")
+    .Attr("shot_noise_model: {'sample', 'binomial'} = 'sample'")
+    .Attr("shot_allocation: {'uniform', 'weighted'} = 'uniform'")
+    .Attr("pilot_fraction: float = 0.0")
+    .Attr("share_states: bool = false")
     .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
       tensorflow::shape_inference::ShapeHandle programs_shape;
       TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
@@ -328,7 +437,7 @@ REGISTER_OP("TfqSimulateSampledExpectation")
       TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &num_samples_shape));
 
       tensorflow::shape_inference::DimensionHandle output_rows =
-          c->Dim(programs_shape, 0);
+          c->Dim(symbol_values_shape, 0);
       tensorflow::shape_inference::DimensionHandle output_cols =
           c->Dim(pauli_sums_shape, 1);
       c->set_output(0, c->Matrix(output_rows, output_cols));
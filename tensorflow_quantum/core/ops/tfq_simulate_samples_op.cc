@@ -33,6 +33,7 @@ limitations under the License.
 #include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/util/guarded_philox_random.h"
 #include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
 #include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
 #include "tensorflow_quantum/core/src/util_qsim.h"
@@ -45,26 +46,37 @@ using ::tfq::proto::Program;
 typedef qsim::Cirq::GateCirq<float> QsimGate;
 typedef qsim::Circuit<QsimGate> QsimCircuit;
 
-class TfqSimulateSamplesOp : public tensorflow::OpKernel {
+class TfqSimulateSamplesOp : public tensorflow::AsyncOpKernel {
  public:
   explicit TfqSimulateSamplesOp(tensorflow::OpKernelConstruction* context)
-      : OpKernel(context) {}
+      : AsyncOpKernel(context) {}
+
+  void ComputeAsync(tensorflow::OpKernelContext* context,
+                    DoneCallback done) override {
+    // Hand the work to the shared scheduler instead of blocking an inter-op
+    // thread for the whole simulation.
+    SimulationScheduler::Global()->Schedule([this, context, done]() {
+      ComputeOnScheduler(context);
+      done();
+    });
+  }
 
-  void Compute(tensorflow::OpKernelContext* context) override {
+ private:
+  void ComputeOnScheduler(tensorflow::OpKernelContext* context) {
     // TODO (mbbrough): add more dimension checks for other inputs here.
     DCHECK_EQ(4, context->num_inputs());
 
     // Parse to Program Proto and num_qubits.
     std::vector<Program> programs;
     std::vector<int> num_qubits;
-    OP_REQUIRES_OK(context,
-                   GetProgramsAndNumQubits(context, &programs, &num_qubits));
+    OP_REQUIRES_OK(context, GetBroadcastProgramsAndNumQubits(
+                                context, &programs, &num_qubits));
 
     // Parse symbol maps for parameter resolution in the circuits.
     std::vector<SymbolMap> maps;
     OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
     OP_REQUIRES(
-        context, maps.size() == programs.size(),
+        context, maps.size() == num_qubits.size(),
         tensorflow::errors::InvalidArgument(absl::StrCat(
             "Number of circuits and values do not match. Got ", programs.size(),
             " circuits and ", maps.size(), " values.")));
@@ -72,27 +84,6 @@ class TfqSimulateSamplesOp : public tensorflow::OpKernel {
     int num_samples = 0;
     OP_REQUIRES_OK(context, GetIndividualSample(context, &num_samples));
 
-    // Construct qsim circuits.
-    std::vector<QsimCircuit> qsim_circuits(programs.size(), QsimCircuit());
-    std::vector<std::vector<qsim::GateFused<QsimGate>>> fused_circuits(
-        programs.size(), std::vector<qsim::GateFused<QsimGate>>({}));
-
-    Status parse_status = ::tensorflow::Status();
-    auto p_lock = tensorflow::mutex();
-    auto construct_f = [&](int start, int end) {
-      for (int i = start; i < end; i++) {
-        Status local =
-            QsimCircuitFromProgram(programs[i], maps[i], num_qubits[i],
-                                   &qsim_circuits[i], &fused_circuits[i]);
-        NESTED_FN_STATUS_SYNC(parse_status, local, p_lock);
-      }
-    };
-
-    const int num_cycles = 1000;
-    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-        programs.size(), num_cycles, construct_f);
-    OP_REQUIRES_OK(context, parse_status);
-
     // Find largest circuit for tensor size padding and allocate
     // the output tensor.
     int max_num_qubits = 0;
@@ -119,21 +110,32 @@ class TfqSimulateSamplesOp : public tensorflow::OpKernel {
     // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
     // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
     // ...
-    if (max_num_qubits >= 26 || programs.size() == 1) {
-      ComputeLarge(num_qubits, max_num_qubits, num_samples, fused_circuits,
+    const bool large = max_num_qubits >= 26 || maps.size() == 1;
+
+    // Reserve this op's state vector memory in the shared budget.
+    const int num_workers =
+        large ? 1
+              : context->device()->tensorflow_cpu_worker_threads()->num_threads;
+    SimulationScheduler::ScopedMemory memory(
+        SimulationScheduler::Global(),
+        num_workers * SimulationScheduler::StateBytes(max_num_qubits));
+
+    if (large) {
+      ComputeLarge(programs, maps, num_qubits, max_num_qubits, num_samples,
                    context, &output_tensor);
     } else {
-      ComputeSmall(num_qubits, max_num_qubits, num_samples, fused_circuits,
+      ComputeSmall(programs, maps, num_qubits, max_num_qubits, num_samples,
                    context, &output_tensor);
     }
   }
 
- private:
+  // Circuits are built and fused right before they are simulated and freed
+  // as soon as their outputs are written, so peak memory holds at most one
+  // fused circuit per worker instead of one for every circuit in the batch.
   void ComputeLarge(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
       const std::vector<int>& num_qubits, const int max_num_qubits,
-      const int num_samples,
-      const std::vector<std::vector<qsim::GateFused<QsimGate>>>& fused_circuits,
-      tensorflow::OpKernelContext* context,
+      const int num_samples, tensorflow::OpKernelContext* context,
       tensorflow::TTypes<int8_t, 3>::Tensor* output_tensor) {
     // Instantiate qsim objects.
     const auto tfq_for = tfq::QsimFor(context);
@@ -148,13 +150,13 @@ class TfqSimulateSamplesOp : public tensorflow::OpKernel {
 
     tensorflow::GuardedPhiloxRandom random_gen;
     random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
-    auto local_gen = random_gen.ReserveSamples32(fused_circuits.size() + 1);
+    auto local_gen = random_gen.ReserveSamples32(maps.size() + 1);
     tensorflow::random::SimplePhilox rand_source(&local_gen);
 
     // Simulate programs one by one. Parallelizing over state vectors
     // we no longer parallelize over circuits. Each time we encounter a
     // a larger circuit we will grow the Statevector as nescessary.
-    for (int i = 0; i < fused_circuits.size(); i++) {
+    for (int i = 0; i < maps.size(); i++) {
       int nq = num_qubits[i];
 
       if (nq > largest_nq) {
@@ -162,9 +164,15 @@ class TfqSimulateSamplesOp : public tensorflow::OpKernel {
         largest_nq = nq;
         sv = ss.Create(largest_nq);
       }
+      QsimCircuit qsim_circuit;
+      std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+      const Program& program = programs.size() == 1 ? programs[0] : programs[i];
+      OP_REQUIRES_OK(context,
+                     QsimCircuitFromProgram(program, maps[i], nq, &qsim_circuit,
+                                            &fused_circuit));
       ss.SetStateZero(sv);
-      for (int j = 0; j < fused_circuits[i].size(); j++) {
-        qsim::ApplyFusedGate(sim, fused_circuits[i][j], sv);
+      for (int j = 0; j < fused_circuit.size(); j++) {
+        qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
       }
 
       auto samples = ss.Sample(sv, num_samples, rand_source.Rand32());
@@ -189,10 +197,9 @@ class TfqSimulateSamplesOp : public tensorflow::OpKernel {
   }
 
   void ComputeSmall(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
       const std::vector<int>& num_qubits, const int max_num_qubits,
-      const int num_samples,
-      const std::vector<std::vector<qsim::GateFused<QsimGate>>>& fused_circuits,
-      tensorflow::OpKernelContext* context,
+      const int num_samples, tensorflow::OpKernelContext* context,
       tensorflow::TTypes<int8_t, 3>::Tensor* output_tensor) {
     const auto tfq_for = qsim::SequentialFor(1);
     using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
@@ -201,13 +208,15 @@ class TfqSimulateSamplesOp : public tensorflow::OpKernel {
     tensorflow::GuardedPhiloxRandom random_gen;
     random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
 
+    Status compute_status = ::tensorflow::Status();
+    auto c_lock = tensorflow::mutex();
     auto DoWork = [&](int start, int end) {
       int largest_nq = 1;
       Simulator sim = Simulator(tfq_for);
       StateSpace ss = StateSpace(tfq_for);
       auto sv = ss.Create(largest_nq);
 
-      auto local_gen = random_gen.ReserveSamples32(fused_circuits.size() + 1);
+      auto local_gen = random_gen.ReserveSamples32(maps.size() + 1);
       tensorflow::random::SimplePhilox rand_source(&local_gen);
 
       for (int i = start; i < end; i++) {
@@ -218,9 +227,16 @@ class TfqSimulateSamplesOp : public tensorflow::OpKernel {
           largest_nq = nq;
           sv = ss.Create(largest_nq);
         }
+        QsimCircuit qsim_circuit;
+        std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        Status local = QsimCircuitFromProgram(program, maps[i], nq,
+                                              &qsim_circuit, &fused_circuit);
+        NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
         ss.SetStateZero(sv);
-        for (int j = 0; j < fused_circuits[i].size(); j++) {
-          qsim::ApplyFusedGate(sim, fused_circuits[i][j], sv);
+        for (int j = 0; j < fused_circuit.size(); j++) {
+          qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
         }
 
         auto samples = ss.Sample(sv, num_samples, rand_source.Rand32());
@@ -247,7 +263,8 @@ class TfqSimulateSamplesOp : public tensorflow::OpKernel {
     const int64_t num_cycles =
         200 * (int64_t(1) << static_cast<int64_t>(max_num_qubits));
     context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
-        fused_circuits.size(), num_cycles, DoWork);
+        maps.size(), num_cycles, DoWork);
+    OP_REQUIRES_OK(context, compute_status);
   }
 };
 
@@ -277,7 +294,7 @@ REGISTER_OP("TfqSimulateSamples")
       // [batch_size, n_samples, largest_n_qubits]
       c->set_output(
           0, c->MakeShape(
-                 {c->Dim(programs_shape, 0),
+                 {c->Dim(symbol_values_shape, 0),
                   tensorflow::shape_inference::InferenceContext::kUnknownDim,
                   tensorflow::shape_inference::InferenceContext::kUnknownDim}));
 
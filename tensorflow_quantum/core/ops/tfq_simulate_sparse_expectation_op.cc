@@ -0,0 +1,342 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <complex>
+#include <memory>
+#include <vector>
+
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/seqfor.h"
+#include "../qsim/lib/simmux.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_quantum/core/ops/parse_context.h"
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
+#include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
+#include "tensorflow_quantum/core/src/sparse_observable.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+
+namespace tfq {
+
+using ::tensorflow::Status;
+using ::tfq::proto::Program;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::Circuit<QsimGate> QsimCircuit;
+
+// Computes expectation values of matrix observables given in sparse form,
+// one sparse matrix-vector product per observable on the final state.
+class TfqSimulateSparseExpectationOp : public tensorflow::AsyncOpKernel {
+ public:
+  explicit TfqSimulateSparseExpectationOp(
+      tensorflow::OpKernelConstruction* context)
+      : AsyncOpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("share_states", &share_states_));
+  }
+
+  void ComputeAsync(tensorflow::OpKernelContext* context,
+                    DoneCallback done) override {
+    // Hand the work to the shared scheduler instead of blocking an inter-op
+    // thread for the whole simulation.
+    SimulationScheduler::Global()->Schedule([this, context, done]() {
+      ComputeOnScheduler(context);
+      done();
+    });
+  }
+
+ private:
+  // When true, final states are shared with sibling ops of the same step
+  // that also set share_states.
+  bool share_states_;
+
+  void ComputeOnScheduler(tensorflow::OpKernelContext* context) {
+    const int num_inputs = context->num_inputs();
+    OP_REQUIRES(context, num_inputs == 6,
+                tensorflow::errors::InvalidArgument(absl::StrCat(
+                    "Expected 6 inputs, got ", num_inputs, " inputs.")));
+
+    // Parse to Program Proto and num_qubits.
+    std::vector<Program> programs;
+    std::vector<int> num_qubits;
+    OP_REQUIRES_OK(context, GetBroadcastProgramsAndNumQubits(
+                                context, &programs, &num_qubits));
+
+    // Parse symbol maps for parameter resolution in the circuits.
+    std::vector<SymbolMap> maps;
+    OP_REQUIRES_OK(context, GetSymbolMaps(context, &maps));
+    OP_REQUIRES(
+        context, maps.size() == num_qubits.size(),
+        tensorflow::errors::InvalidArgument(absl::StrCat(
+            "Number of circuits and values do not match. Got ", programs.size(),
+            " circuits and ", maps.size(), " values.")));
+
+    std::vector<std::vector<SparseObservable>> observables;
+    OP_REQUIRES_OK(context,
+                   GetSparseObservables(context, num_qubits, &observables));
+
+    const int num_ops = context->input(5).vec<int64_t>()(1);
+    tensorflow::TensorShape output_shape;
+    output_shape.AddDim(maps.size());
+    output_shape.AddDim(num_ops);
+    tensorflow::Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, output_shape, &output));
+    auto output_tensor = output->matrix<float>();
+
+    int max_num_qubits = 0;
+    for (const int num : num_qubits) {
+      max_num_qubits = std::max(max_num_qubits, num);
+    }
+
+    // Share final states with sibling ops simulating the same circuits.
+    StateCache* cache = nullptr;
+    if (share_states_) {
+      OP_REQUIRES_OK(context, GetStepStateCache(context, &cache));
+    }
+    tensorflow::core::ScopedUnref unref_cache(cache);
+    std::vector<uint64_t> keys;
+    if (cache != nullptr) {
+      OP_REQUIRES_OK(context, GetStateCacheKeys(context, &keys));
+    }
+
+    // Cross reference with standard google cloud compute instances
+    // Memory ~= 2 * num_threads * (2 * 64 * 2 ** num_qubits in circuits)
+    // e2s2 = 2 CPU, 8GB -> Can safely do 25 since Memory = 4GB
+    // e2s4 = 4 CPU, 16GB -> Can safely do 25 since Memory = 8GB
+    // ...
+    const bool large = max_num_qubits >= 26 || maps.size() == 1;
+
+    // Reserve this op's state vector and observable memory in the shared
+    // budget.
+    const int num_workers =
+        large ? 1
+              : context->device()->tensorflow_cpu_worker_threads()->num_threads;
+    uint64_t observable_bytes = 0;
+    for (const auto& circuit_observables : observables) {
+      for (const SparseObservable& observable : circuit_observables) {
+        observable_bytes += observable.Bytes();
+      }
+    }
+    SimulationScheduler::ScopedMemory memory(
+        SimulationScheduler::Global(),
+        num_workers * SimulationScheduler::StateBytes(max_num_qubits) +
+            observable_bytes);
+
+    if (large) {
+      ComputeLarge(programs, maps, num_qubits, observables, cache, keys,
+                   context, &output_tensor);
+    } else {
+      ComputeSmall(programs, maps, num_qubits, max_num_qubits, observables,
+                   cache, keys, context, &output_tensor);
+    }
+  }
+
+  void ComputeLarge(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
+      const std::vector<int>& num_qubits,
+      const std::vector<std::vector<SparseObservable>>& observables,
+      StateCache* cache, const std::vector<uint64_t>& keys,
+      tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    // Instantiate qsim objects.
+    const auto tfq_for = tfq::QsimFor(context);
+    using Simulator = qsim::Simulator<const tfq::QsimFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    // Begin simulation.
+    int largest_nq = 1;
+    Simulator sim = Simulator(tfq_for);
+    StateSpace ss = StateSpace(tfq_for);
+    auto sv = ss.Create(largest_nq);
+
+    auto workers = context->device()->tensorflow_cpu_worker_threads()->workers;
+    // Rows are split into a fixed number of blocks whose partial sums are
+    // added in order, so results do not depend on thread scheduling.
+    const int num_blocks = 4 * workers->NumThreads();
+    std::vector<std::complex<double>> partials(num_blocks);
+
+    for (size_t i = 0; i < maps.size(); i++) {
+      const int nq = num_qubits[i];
+      if (nq == 0) {
+        // (#679) Just ignore empty program
+        for (size_t j = 0; j < observables[i].size(); j++) {
+          (*output_tensor)(i, j) = -2.0;
+        }
+        continue;
+      }
+
+      if (nq > largest_nq) {
+        // need to switch to larger statespace.
+        largest_nq = nq;
+        sv = ss.Create(largest_nq);
+      }
+      if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+        QsimCircuit qsim_circuit;
+        std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+        const Program& program =
+            programs.size() == 1 ? programs[0] : programs[i];
+        OP_REQUIRES_OK(context,
+                       QsimCircuitFromProgram(program, maps[i], nq,
+                                              &qsim_circuit, &fused_circuit));
+        ss.SetStateZero(sv);
+        for (size_t j = 0; j < fused_circuit.size(); j++) {
+          qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+        }
+        if (cache != nullptr) {
+          cache->Store(keys[i], nq, ss, sv);
+        }
+      }
+
+      for (size_t j = 0; j < observables[i].size(); j++) {
+        const SparseObservable& observable = observables[i][j];
+        const uint64_t num_rows = observable.NumRows();
+        // Roughly one cycle per stored entry and per nonzero row.
+        const int64_t num_cycles_block =
+            (observable.cols.size() + num_rows) / num_blocks + 1;
+        auto block_f = [&](int64_t start, int64_t end) {
+          for (int64_t b = start; b < end; b++) {
+            partials[b] = SparseExpectation(observable, ss, sv,
+                                            b * num_rows / num_blocks,
+                                            (b + 1) * num_rows / num_blocks);
+          }
+        };
+        workers->ParallelFor(num_blocks, num_cycles_block, block_f);
+        std::complex<double> total(0, 0);
+        for (const std::complex<double>& partial : partials) {
+          total += partial;
+        }
+        (*output_tensor)(i, j) = total.real();
+      }
+    }
+  }
+
+  void ComputeSmall(
+      const std::vector<Program>& programs, const std::vector<SymbolMap>& maps,
+      const std::vector<int>& num_qubits, const int max_num_qubits,
+      const std::vector<std::vector<SparseObservable>>& observables,
+      StateCache* cache, const std::vector<uint64_t>& keys,
+      tensorflow::OpKernelContext* context,
+      tensorflow::TTypes<float, 1>::Matrix* output_tensor) {
+    const auto tfq_for = qsim::SequentialFor(1);
+    using Simulator = qsim::Simulator<const qsim::SequentialFor&>;
+    using StateSpace = Simulator::StateSpace;
+
+    Status compute_status = ::tensorflow::Status();
+    auto c_lock = tensorflow::mutex();
+    auto DoWork = [&](int start, int end) {
+      int largest_nq = 1;
+      Simulator sim = Simulator(tfq_for);
+      StateSpace ss = StateSpace(tfq_for);
+      auto sv = ss.Create(largest_nq);
+      for (int i = start; i < end; i++) {
+        const int nq = num_qubits[i];
+        if (nq == 0) {
+          // (#679) Just ignore empty program
+          for (size_t j = 0; j < observables[i].size(); j++) {
+            (*output_tensor)(i, j) = -2.0;
+          }
+          continue;
+        }
+
+        if (nq > largest_nq) {
+          // need to switch to larger statespace.
+          largest_nq = nq;
+          sv = ss.Create(largest_nq);
+        }
+        if (cache == nullptr || !cache->Restore(keys[i], nq, ss, sv)) {
+          QsimCircuit qsim_circuit;
+          std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+          const Program& program =
+              programs.size() == 1 ? programs[0] : programs[i];
+          Status local = QsimCircuitFromProgram(program, maps[i], nq,
+                                                &qsim_circuit, &fused_circuit);
+          NESTED_FN_STATUS_SYNC(compute_status, local, c_lock);
+          ss.SetStateZero(sv);
+          for (size_t j = 0; j < fused_circuit.size(); j++) {
+            qsim::ApplyFusedGate(sim, fused_circuit[j], sv);
+          }
+          if (cache != nullptr) {
+            cache->Store(keys[i], nq, ss, sv);
+          }
+        }
+
+        for (size_t j = 0; j < observables[i].size(); j++) {
+          (*output_tensor)(i, j) =
+              SparseExpectation(observables[i][j], ss, sv, 0,
+                                observables[i][j].NumRows())
+                  .real();
+        }
+      }
+    };
+
+    const int64_t num_cycles =
+        200 * (int64_t(1) << static_cast<int64_t>(max_num_qubits));
+    context->device()->tensorflow_cpu_worker_threads()->workers->ParallelFor(
+        maps.size(), num_cycles, DoWork);
+    OP_REQUIRES_OK(context, compute_status);
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("TfqSimulateSparseExpectation").Device(tensorflow::DEVICE_CPU),
+    TfqSimulateSparseExpectationOp);
+
+REGISTER_OP("TfqSimulateSparseExpectation")
+    .Input("programs: string")
+    .Input("symbol_names: string")
+    .Input("symbol_values: float")
+    .Input("observable_indices: int64")
+    .Input("observable_values: complex64")
+    .Input("observable_shape: int64")
+    .Output("expectations: float")
+    .Attr("share_states: bool = false")
+    .SetShapeFn([](tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::ShapeHandle programs_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 1, &programs_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_names_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &symbol_names_shape));
+
+      tensorflow::shape_inference::ShapeHandle symbol_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 2, &symbol_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle observable_indices_shape;
+      TF_RETURN_IF_ERROR(
+          c->WithRank(c->input(3), 2, &observable_indices_shape));
+
+      tensorflow::shape_inference::ShapeHandle observable_values_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 1, &observable_values_shape));
+
+      tensorflow::shape_inference::ShapeHandle observable_shape_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 1, &observable_shape_shape));
+
+      c->set_output(
+          0, c->Matrix(
+                 c->Dim(symbol_values_shape, 0),
+                 tensorflow::shape_inference::InferenceContext::kUnknownDim));
+
+      return ::tensorflow::Status();
+    });
+
+}  // namespace tfq
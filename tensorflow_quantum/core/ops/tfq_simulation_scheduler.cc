@@ -0,0 +1,65 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mem.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tfq {
+
+SimulationScheduler* SimulationScheduler::Global() {
+  // Each admitted op still parallelizes internally over the intra-op pool,
+  // so only a few need to be in flight to keep all cores busy.
+  static SimulationScheduler* scheduler = new SimulationScheduler(
+      std::max(2, tensorflow::port::MaxParallelism() / 4),
+      static_cast<uint64_t>(tensorflow::port::AvailableRam()) / 2);
+  return scheduler;
+}
+
+SimulationScheduler::SimulationScheduler(int num_threads,
+                                         uint64_t memory_budget)
+    : workers_(new tensorflow::thread::ThreadPool(
+          tensorflow::Env::Default(), "tfq_simulation", num_threads)),
+      memory_budget_(memory_budget) {}
+
+void SimulationScheduler::Schedule(std::function<void()> fn) {
+  workers_->Schedule(std::move(fn));
+}
+
+void SimulationScheduler::AcquireMemory(uint64_t bytes) {
+  tensorflow::mutex_lock l(mu_);
+  while (memory_used_ > 0 && memory_used_ + bytes > memory_budget_) {
+    memory_cv_.wait(l);
+  }
+  memory_used_ += bytes;
+}
+
+void SimulationScheduler::ReleaseMemory(uint64_t bytes) {
+  {
+    tensorflow::mutex_lock l(mu_);
+    memory_used_ -= bytes;
+  }
+  memory_cv_.notify_all();
+}
+
+}  // namespace tfq
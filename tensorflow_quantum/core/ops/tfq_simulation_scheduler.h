@@ -0,0 +1,78 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_OPS_TFQ_SIMULATION_SCHEDULER_H_
+#define TFQ_CORE_OPS_TFQ_SIMULATION_SCHEDULER_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tfq {
+
+// Process wide scheduler shared by all of the simulation ops.
+//
+// Simulation ops are AsyncOpKernels that hand their work to this scheduler
+// instead of blocking an inter-op thread. The scheduler bounds how many ops
+// run at once and how much state vector memory they hold in total, so that
+// concurrent ops in a graph share the intra-op pool without oversubscribing
+// memory, and without having to be serialized from python.
+class SimulationScheduler {
+ public:
+  static SimulationScheduler* Global();
+
+  SimulationScheduler(int num_threads, uint64_t memory_budget);
+
+  // Runs fn on one of the scheduler threads.
+  void Schedule(std::function<void()> fn);
+
+  // Blocks until bytes of state vector memory are available. A request
+  // larger than the whole budget is admitted once nothing else holds memory.
+  void AcquireMemory(uint64_t bytes);
+  void ReleaseMemory(uint64_t bytes);
+
+  // Bytes used by a single qsim state vector over num_qubits.
+  static uint64_t StateBytes(int num_qubits) {
+    return uint64_t(2 * sizeof(float)) << num_qubits;
+  }
+
+  // Holds a memory reservation for the lifetime of the object.
+  class ScopedMemory {
+   public:
+    ScopedMemory(SimulationScheduler* scheduler, uint64_t bytes)
+        : scheduler_(scheduler), bytes_(bytes) {
+      scheduler_->AcquireMemory(bytes_);
+    }
+    ~ScopedMemory() { scheduler_->ReleaseMemory(bytes_); }
+
+   private:
+    SimulationScheduler* scheduler_;
+    const uint64_t bytes_;
+  };
+
+ private:
+  std::unique_ptr<tensorflow::thread::ThreadPool> workers_;
+  tensorflow::mutex mu_;
+  tensorflow::condition_variable memory_cv_;
+  const uint64_t memory_budget_;
+  uint64_t memory_used_ TF_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_OPS_TFQ_SIMULATION_SCHEDULER_H_
@@ -0,0 +1,147 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/ops/tfq_simulation_scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tfq {
+namespace {
+
+// Long enough for a blocked thread to have run past AcquireMemory if it
+// was not blocked.
+const auto kSettle = std::chrono::milliseconds(100);
+
+TEST(SimulationSchedulerTest, StateBytes) {
+  EXPECT_EQ(SimulationScheduler::StateBytes(0), uint64_t{8});
+  EXPECT_EQ(SimulationScheduler::StateBytes(10), uint64_t{8 * 1024});
+}
+
+TEST(SimulationSchedulerTest, BlocksUntilReleased) {
+  SimulationScheduler scheduler(1, 100);
+  scheduler.AcquireMemory(60);
+
+  std::atomic<bool> acquired(false);
+  std::thread waiter([&]() {
+    SimulationScheduler::ScopedMemory memory(&scheduler, 60);
+    acquired = true;
+  });
+  std::this_thread::sleep_for(kSettle);
+  EXPECT_FALSE(acquired);
+
+  scheduler.ReleaseMemory(60);
+  waiter.join();
+  EXPECT_TRUE(acquired);
+
+  // The scoped reservation was released, so the whole budget is free.
+  scheduler.AcquireMemory(100);
+  scheduler.ReleaseMemory(100);
+}
+
+TEST(SimulationSchedulerTest, RequestsWithinBudgetShare) {
+  SimulationScheduler scheduler(1, 100);
+  SimulationScheduler::ScopedMemory first(&scheduler, 40);
+
+  std::atomic<bool> acquired(false);
+  std::thread other([&]() {
+    SimulationScheduler::ScopedMemory second(&scheduler, 60);
+    acquired = true;
+  });
+  other.join();
+  EXPECT_TRUE(acquired);
+}
+
+TEST(SimulationSchedulerTest, OversizedRequestMakesProgress) {
+  SimulationScheduler scheduler(1, 100);
+
+  // Nothing else holds memory, so the request is admitted right away.
+  { SimulationScheduler::ScopedMemory memory(&scheduler, 1000); }
+
+  // Otherwise it waits for the other reservations to be released.
+  scheduler.AcquireMemory(10);
+  std::atomic<bool> acquired(false);
+  std::thread waiter([&]() {
+    SimulationScheduler::ScopedMemory memory(&scheduler, 1000);
+    acquired = true;
+  });
+  std::this_thread::sleep_for(kSettle);
+  EXPECT_FALSE(acquired);
+  scheduler.ReleaseMemory(10);
+  waiter.join();
+  EXPECT_TRUE(acquired);
+}
+
+TEST(SimulationSchedulerTest, ConcurrentSchedulingStaysWithinBudget) {
+  const int num_tasks = 64;
+  const uint64_t budget = 100;
+  const uint64_t task_bytes = 30;
+  SimulationScheduler scheduler(4, budget);
+
+  tensorflow::mutex mu;
+  uint64_t in_use = 0;
+  uint64_t max_in_use = 0;
+  tensorflow::BlockingCounter done(num_tasks);
+  for (int i = 0; i < num_tasks; i++) {
+    scheduler.Schedule([&]() {
+      {
+        SimulationScheduler::ScopedMemory memory(&scheduler, task_bytes);
+        {
+          tensorflow::mutex_lock l(mu);
+          in_use += task_bytes;
+          max_in_use = std::max(max_in_use, in_use);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        {
+          tensorflow::mutex_lock l(mu);
+          in_use -= task_bytes;
+        }
+      }
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  EXPECT_LE(max_in_use, budget);
+  EXPECT_EQ(in_use, uint64_t{0});
+}
+
+TEST(SimulationSchedulerTest, RunsTasksConcurrently) {
+  // Both tasks wait for each other, which only finishes if they run at the
+  // same time.
+  SimulationScheduler scheduler(2, 100);
+  tensorflow::BlockingCounter started(2);
+  tensorflow::BlockingCounter done(2);
+  std::atomic<int> met(0);
+  for (int i = 0; i < 2; i++) {
+    scheduler.Schedule([&]() {
+      started.DecrementCount();
+      if (started.WaitFor(std::chrono::milliseconds(10000))) {
+        met++;
+      }
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  EXPECT_EQ(met.load(), 2);
+}
+
+}  // namespace
+}  // namespace tfq
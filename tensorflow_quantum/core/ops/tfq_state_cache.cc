@@ -0,0 +1,151 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/resource_mgr.h"
+#include "tensorflow/core/lib/core/error_codes.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/fingerprint.h"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::OpKernelContext;
+using ::tensorflow::Status;
+using ::tensorflow::Tensor;
+
+// Budget for all states cached within a single step. States larger than
+// this (~25 qubits) are never cached.
+constexpr uint64_t kMaxStateCacheBytes = uint64_t(1) << 28;
+
+constexpr char kStateCacheName[] = "tfq_state_cache";
+
+}  // namespace
+
+std::string StateCache::DebugString() const {
+  return absl::StrCat("TFQ StateCache with budget ", max_bytes_, " bytes.");
+}
+
+std::shared_ptr<const StateCache::Amplitudes> StateCache::Lookup(
+    uint64_t key) {
+  tensorflow::mutex_lock l(mu_);
+  auto it = states_.find(key);
+  if (it == states_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+bool StateCache::HasRoomFor(uint64_t bytes) {
+  tensorflow::mutex_lock l(mu_);
+  return used_bytes_ + bytes <= max_bytes_;
+}
+
+void StateCache::Insert(uint64_t key, Amplitudes&& amplitudes) {
+  const uint64_t bytes = amplitudes.size() * sizeof(float);
+  tensorflow::mutex_lock l(mu_);
+  if (used_bytes_ + bytes > max_bytes_ || states_.contains(key)) {
+    return;
+  }
+  used_bytes_ += bytes;
+  states_[key] = std::make_shared<const Amplitudes>(std::move(amplitudes));
+}
+
+Status GetStepStateCache(OpKernelContext* context, StateCache** cache) {
+  *cache = nullptr;
+  if (context->step_container() == nullptr ||
+      context->resource_manager() == nullptr) {
+    return ::tensorflow::Status();
+  }
+  return context->step_container()->LookupOrCreate<StateCache>(
+      context->resource_manager(), kStateCacheName, cache,
+      [](StateCache** ret) {
+        *ret = new StateCache(kMaxStateCacheBytes);
+        return ::tensorflow::Status();
+      });
+}
+
+Status GetStateCacheKeys(OpKernelContext* context, std::vector<uint64_t>* keys,
+                         bool include_appended /*=false*/) {
+  const Tensor* programs;
+  Status status = context->input("programs", &programs);
+  if (!status.ok()) {
+    return status;
+  }
+  const Tensor* symbol_names;
+  status = context->input("symbol_names", &symbol_names);
+  if (!status.ok()) {
+    return status;
+  }
+  const Tensor* symbol_values;
+  status = context->input("symbol_values", &symbol_values);
+  if (!status.ok()) {
+    return status;
+  }
+  const Tensor* programs_to_append = nullptr;
+  if (include_appended) {
+    status = context->input("programs_to_append", &programs_to_append);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  // Shapes were already validated by the parsing functions.
+  const auto program_strings = programs->flat<tensorflow::tstring>();
+  const auto name_strings = symbol_names->flat<tensorflow::tstring>();
+  const auto values = symbol_values->flat_inner_dims<float>();
+  const int num_symbols = values.dimension(1);
+
+  uint64_t names_key = 0;
+  for (int j = 0; j < name_strings.dimension(0); j++) {
+    names_key = tensorflow::FingerprintCat64(
+        names_key, tensorflow::Fingerprint64(name_strings(j)));
+  }
+
+  // A single program may be broadcast against all symbol_values rows.
+  const int num_programs = program_strings.dimension(0);
+  const int num_keys = num_programs == 1 ? values.dimension(0) : num_programs;
+  keys->assign(num_keys, 0);
+  for (int i = 0; i < num_keys; i++) {
+    const int p = num_programs == 1 ? 0 : i;
+    uint64_t key = tensorflow::FingerprintCat64(
+        names_key, tensorflow::Fingerprint64(program_strings(p)));
+    if (programs_to_append != nullptr) {
+      // A single program to append is shared by every program.
+      const int a = programs_to_append->dim_size(0) == 1 ? 0 : p;
+      key = tensorflow::FingerprintCat64(
+          key, tensorflow::Fingerprint64(
+                   programs_to_append->flat<tensorflow::tstring>()(a)));
+    }
+    if (num_symbols > 0 && i < values.dimension(0)) {
+      key = tensorflow::FingerprintCat64(
+          key, tensorflow::Fingerprint64(tensorflow::StringPiece(
+                   reinterpret_cast<const char*>(&values(i, 0)),
+                   num_symbols * sizeof(float))));
+    }
+    (*keys)[i] = key;
+  }
+
+  return ::tensorflow::Status();
+}
+
+}  // namespace tfq
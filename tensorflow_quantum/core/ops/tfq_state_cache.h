@@ -0,0 +1,114 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_OPS_TFQ_STATE_CACHE_H_
+#define TFQ_CORE_OPS_TFQ_STATE_CACHE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/resource_mgr.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tfq {
+
+// Final state vectors of simulated circuits, shared between the simulation
+// ops that run inside of the same step and set their share_states attr.
+// Sibling ops that receive identical (programs, symbol_names, symbol_values)
+// inputs, for example several Expectation layers with different observables
+// on the same circuits, only simulate each circuit once.
+//
+// States are stored as the raw qsim buffer over their num_qubits. The
+// amplitude layout of the qsim state spaces only depends on the vector width
+// the ops were built for and not on the size of the state, so a stored state
+// restores into a larger state with one bulk copy.
+class StateCache : public tensorflow::ResourceBase {
+ public:
+  typedef std::vector<float> Amplitudes;
+
+  explicit StateCache(uint64_t max_bytes) : max_bytes_(max_bytes) {}
+
+  std::string DebugString() const override;
+
+  // Returns the cached amplitudes for key or nullptr on a miss.
+  std::shared_ptr<const Amplitudes> Lookup(uint64_t key);
+
+  // Takes ownership of amplitudes. Silently drops the entry once the
+  // memory budget of this cache has been used up.
+  void Insert(uint64_t key, Amplitudes&& amplitudes);
+
+  // Whether bytes more would still fit into the budget. Lets callers skip
+  // copying states out of qsim that would be dropped anyway.
+  bool HasRoomFor(uint64_t bytes);
+
+  // Loads the state for key into the first num_qubits of state. The
+  // remaining qubits of state are left in |0>. Returns false on a miss.
+  template <typename StateSpace, typename State>
+  bool Restore(uint64_t key, int num_qubits, const StateSpace& ss,
+               State& state) {
+    auto amplitudes = Lookup(key);
+    if (amplitudes == nullptr ||
+        amplitudes->size() != StateSpace::MinSize(num_qubits)) {
+      return false;
+    }
+    if (state.num_qubits() > static_cast<unsigned>(num_qubits)) {
+      ss.SetAllZeros(state);
+    }
+    std::copy(amplitudes->begin(), amplitudes->end(), state.get());
+    return true;
+  }
+
+  // Copies the first num_qubits of state into the cache under key.
+  template <typename StateSpace, typename State>
+  void Store(uint64_t key, int num_qubits, const StateSpace& ss,
+             const State& state) {
+    const uint64_t size = StateSpace::MinSize(num_qubits);
+    if (!HasRoomFor(size * sizeof(float))) {
+      return;
+    }
+    Insert(key, Amplitudes(state.get(), state.get() + size));
+  }
+
+ private:
+  const uint64_t max_bytes_;
+  tensorflow::mutex mu_;
+  uint64_t used_bytes_ TF_GUARDED_BY(mu_) = 0;
+  absl::flat_hash_map<uint64_t, std::shared_ptr<const Amplitudes>> states_
+      TF_GUARDED_BY(mu_);
+};
+
+// Fetches (or creates) the StateCache of the current step. On success the
+// caller owns a reference and must Unref() it. *cache is set to nullptr when
+// the op is not running inside of a step container, in which case callers
+// simply simulate everything themselves.
+tensorflow::Status GetStepStateCache(tensorflow::OpKernelContext* context,
+                                     StateCache** cache);
+
+// Computes one cache key per circuit from the 'programs', 'symbol_names' and
+// 'symbol_values' inputs (and 'programs_to_append' if include_appended).
+// Two circuits with equal keys produce the same final state.
+tensorflow::Status GetStateCacheKeys(tensorflow::OpKernelContext* context,
+                                     std::vector<uint64_t>* keys,
+                                     bool include_appended = false);
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_OPS_TFQ_STATE_CACHE_H_
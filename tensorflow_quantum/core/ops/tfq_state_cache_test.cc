@@ -0,0 +1,98 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/ops/tfq_state_cache.h"
+
+#include <complex>
+#include <cstdint>
+
+#include "../qsim/lib/formux.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/simmux.h"
+#include "gtest/gtest.h"
+
+namespace tfq {
+namespace {
+
+typedef qsim::Simulator<qsim::SequentialFor> Simulator;
+typedef Simulator::StateSpace StateSpace;
+
+// A state on num_qubits with a distinct amplitude on every basis state.
+StateSpace::State DistinctState(const StateSpace& ss, int num_qubits) {
+  auto state = ss.Create(num_qubits);
+  ss.SetAllZeros(state);
+  for (uint64_t j = 0; j < (uint64_t(1) << num_qubits); j++) {
+    ss.SetAmpl(state, j, std::complex<float>(j + 1, -float(j)));
+  }
+  return state;
+}
+
+TEST(StateCacheTest, RestoresStoredState) {
+  StateSpace ss(1);
+  StateCache* cache = new StateCache(uint64_t(1) << 20);
+  const auto stored = DistinctState(ss, 4);
+  cache->Store(7, 4, ss, stored);
+
+  auto restored = ss.Create(4);
+  ss.SetStateZero(restored);
+  ASSERT_TRUE(cache->Restore(7, 4, ss, restored));
+  for (uint64_t j = 0; j < 16; j++) {
+    EXPECT_EQ(ss.GetAmpl(restored, j), ss.GetAmpl(stored, j));
+  }
+
+  // Unknown keys and mismatched sizes are misses.
+  EXPECT_FALSE(cache->Restore(8, 4, ss, restored));
+  auto larger = ss.Create(6);
+  EXPECT_FALSE(cache->Restore(7, 6, ss, larger));
+  cache->Unref();
+}
+
+TEST(StateCacheTest, RestoresIntoLargerState) {
+  StateSpace ss(1);
+  StateCache* cache = new StateCache(uint64_t(1) << 20);
+  for (int num_qubits : {1, 2, 5}) {
+    const auto stored = DistinctState(ss, num_qubits);
+    cache->Store(num_qubits, num_qubits, ss, stored);
+
+    // Leftover amplitudes of the larger state must be cleared.
+    auto larger = DistinctState(ss, 7);
+    ASSERT_TRUE(cache->Restore(num_qubits, num_qubits, ss, larger));
+    for (uint64_t j = 0; j < 128; j++) {
+      const std::complex<float> expected =
+          j < (uint64_t(1) << num_qubits) ? ss.GetAmpl(stored, j)
+                                          : std::complex<float>(0, 0);
+      EXPECT_EQ(ss.GetAmpl(larger, j), expected);
+    }
+  }
+  cache->Unref();
+}
+
+TEST(StateCacheTest, DropsStatesOverBudget) {
+  StateSpace ss(1);
+  const uint64_t state_bytes = StateSpace::MinSize(8) * sizeof(float);
+  StateCache* cache = new StateCache(state_bytes);
+  const auto state = DistinctState(ss, 8);
+  cache->Store(1, 8, ss, state);
+  cache->Store(2, 8, ss, state);
+
+  auto restored = ss.Create(8);
+  EXPECT_TRUE(cache->Restore(1, 8, ss, restored));
+  EXPECT_FALSE(cache->Restore(2, 8, ss, restored));
+  cache->Unref();
+}
+
+}  // namespace
+}  // namespace tfq
@@ -13,6 +13,7 @@
 # limitations under the License.
 # =============================================================================
 """Expose bindings for tfq utility ops."""
+import cirq
 import tensorflow as tf
 from tensorflow_quantum.core.ops.load_module import load_module
 
@@ -56,10 +57,12 @@ def append_circuit(programs, programs_to_append):
             the string representations of circuits.
         programs_to_append: `tf.Tensor` of strings with shape [batch_size]
             containing the string representations of circuits to append.
+            A tensor of shape [1] is appended onto every program.
 
     Returns:
         `tf.Tensor` with shape [batch_size]. Entry `i` is the string
             representing the circuit which is `programs_to_append[i]`
+            (or `programs_to_append[0]` if it holds a single circuit)
             appended to `programs[i]`.
     """
     return UTILITY_OP_MODULE.tfq_append_circuit(programs, programs_to_append)
@@ -139,3 +142,61 @@ def resolve_parameters(programs, symbol_names, symbol_values):
     """
     return UTILITY_OP_MODULE.tfq_resolve_parameters(
         programs, symbol_names, tf.cast(symbol_values, tf.float32))
+
+
+# Gate codes accepted by `build_circuits`. Must be kept in sync with
+# kGateCodes in tfq_build_circuits_op.cc.
+GATE_CODES = {
+    cirq.HPowGate: 0,
+    cirq.XPowGate: 1,
+    cirq.YPowGate: 2,
+    cirq.ZPowGate: 3,
+    cirq.XXPowGate: 4,
+    cirq.YYPowGate: 5,
+    cirq.ZZPowGate: 6,
+    cirq.CZPowGate: 7,
+    cirq.CNotPowGate: 8,
+    cirq.SwapPowGate: 9,
+    cirq.ISwapPowGate: 10,
+}
+
+
+def build_circuits(gate_codes, qubit_indices, params):
+    """Build a batch of serialized circuits from numeric tensors.
+
+    Each row of the inputs describes one circuit as a sequence of gates. Gate
+    `j` of circuit `i` is `GATE_CODES` gate `gate_codes[i][j]` raised to the
+    power `params[i][j]`, acting on `cirq.GridQubit(0, qubit_indices[i][j][0])`
+    (and `cirq.GridQubit(0, qubit_indices[i][j][1])` for two qubit gates).
+    Gates are placed in the earliest moment possible, just like
+    `cirq.InsertStrategy.EARLIEST`. A gate code of -1 marks padding.
+
+    Since this runs entirely in C++ it can be used inside of `tf.data`
+    pipelines to generate random or data-encoding circuits.
+
+
+    >>> codes = [[0, 8, -1]]
+    >>> qubits = [[[0, -1], [0, 1], [-1, -1]]]
+    >>> params = [[1.0, 1.0, 0.0]]
+    >>> tfq.from_tensor(build_circuits(codes, qubits, params))
+    [(0, 0): ───H───@───
+                    │
+    (0, 1): ────────X───]
+
+
+    Args:
+        gate_codes: `tf.Tensor` of integers with shape [batch_size, n_gates]
+            containing values from `GATE_CODES` or -1 for padding.
+        qubit_indices: `tf.Tensor` of integers with shape
+            [batch_size, n_gates, 2] containing the qubit(s) each gate acts
+            on. The second entry is ignored for single qubit gates.
+        params: `tf.Tensor` of real numbers with shape [batch_size, n_gates]
+            containing the exponent of each gate.
+
+    Returns:
+        `tf.Tensor` with shape [batch_size] containing the string
+            representations of the circuits.
+    """
+    return UTILITY_OP_MODULE.tfq_build_circuits(
+        tf.cast(gate_codes, tf.int32), tf.cast(qubit_indices, tf.int32),
+        tf.cast(params, tf.float32))
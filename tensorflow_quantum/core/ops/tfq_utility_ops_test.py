@@ -52,15 +52,10 @@ class AppendCircuitOpTest(tf.test.TestCase, parameterized.TestCase):
                 'programs and programs_to_append must have matching sizes.'):
             tfq_utility_ops.append_circuit([test_circuit],
                                            [test_circuit, test_circuit])
-        with self.assertRaisesRegex(
-                tf.errors.InvalidArgumentError,
-                'programs and programs_to_append must have matching sizes.'):
-            tfq_utility_ops.append_circuit([test_circuit, test_circuit],
-                                           [test_circuit])
         with self.assertRaisesRegex(
                 tf.errors.InvalidArgumentError,
                 'programs and programs_to_append must have matching sizes'):
-            tfq_utility_ops.append_circuit([], [test_circuit])
+            tfq_utility_ops.append_circuit([], [test_circuit, test_circuit])
 
         with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
                                     'programs must be rank 1. Got rank 2'):
@@ -131,6 +126,34 @@ class AppendCircuitOpTest(tf.test.TestCase, parameterized.TestCase):
             util.convert_to_tensor(cirq_results,
                                    deterministic_proto_serialize=True))
 
+    def test_append_circuit_broadcast(self):
+        """Check that a single circuit is appended onto every program."""
+        qubits = cirq.GridQubit.rect(1, 3)
+        base_circuits = [
+            cirq.Circuit(cirq.X(qubits[0])),
+            cirq.Circuit(cirq.H(qubits[1]), cirq.Y(qubits[2])),
+            cirq.Circuit()
+        ]
+        circuit_to_append = cirq.Circuit(cirq.CNOT(qubits[0], qubits[1]),
+                                         cirq.Z(qubits[2]))
+
+        tfq_results = tfq_utility_ops.append_circuit(
+            util.convert_to_tensor(base_circuits),
+            util.convert_to_tensor([circuit_to_append]))
+
+        cirq_results = [a + circuit_to_append for a in base_circuits]
+        self.assertAllEqual(
+            util.convert_to_tensor(util.from_tensor(tfq_results),
+                                   deterministic_proto_serialize=True),
+            util.convert_to_tensor(cirq_results,
+                                   deterministic_proto_serialize=True))
+
+        # No programs give no outputs.
+        res = tfq_utility_ops.append_circuit(
+            tf.constant([], dtype=tf.string),
+            util.convert_to_tensor([circuit_to_append]))
+        self.assertEqual(res.shape, [0])
+
     @parameterized.parameters([{
         'padded_array': [[[1, 0, 0, 0], [1, 1, 1, 1]],
                          [[1, 1, -2, -2], [0, 0, -2, -2]],
@@ -328,5 +351,50 @@ class ResolveParametersOpTest(tf.test.TestCase, parameterized.TestCase):
                                                         exp_o.gate))
 
 
+class BuildCircuitsOpTest(tf.test.TestCase):
+    """Test the in-graph circuit construction op."""
+
+    def test_build_circuits_input_checking(self):
+        """Check that the build op has correct input checking."""
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'Unknown gate code'):
+            tfq_utility_ops.build_circuits([[99]], [[[0, -1]]], [[1.0]])
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'Invalid qubit index'):
+            tfq_utility_ops.build_circuits([[8]], [[[0, -1]]], [[1.0]])
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'two distinct qubits'):
+            tfq_utility_ops.build_circuits([[8]], [[[1, 1]]], [[1.0]])
+
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    'matching shapes'):
+            tfq_utility_ops.build_circuits([[0, 1]], [[[0, -1], [0, -1]]],
+                                           [[1.0]])
+
+    def test_build_circuits(self):
+        """Check built circuits against cirq with EARLIEST insertion."""
+        q = cirq.GridQubit.rect(1, 3)
+        gate_codes = [[0, 0, 8, 6, 3, -1], [1, -1, -1, -1, -1, -1]]
+        qubit_indices = [[[0, -1], [2, -1], [0, 1], [1, 2], [0, -1], [-1, -1]],
+                         [[1, -1], [-1, -1], [-1, -1], [-1, -1], [-1, -1],
+                          [-1, -1]]]
+        params = [[1.0, 1.0, 1.0, 0.25, 0.5, 0.0],
+                  [0.375, 0.0, 0.0, 0.0, 0.0, 0.0]]
+        expected = [
+            cirq.Circuit(
+                cirq.Moment([cirq.H(q[0]), cirq.H(q[2])]),
+                cirq.Moment([cirq.CNOT(q[0], q[1])]),
+                cirq.Moment([cirq.ZZ(q[1], q[2])**0.25,
+                             cirq.Z(q[0])**0.5])),
+            cirq.Circuit(cirq.X(q[1])**0.375)
+        ]
+        built = util.from_tensor(
+            tfq_utility_ops.build_circuits(gate_codes, qubit_indices, params))
+        for circuit, expected_circuit in zip(built, expected):
+            cirq.testing.assert_same_circuits(circuit, expected_circuit)
+
+
 if __name__ == '__main__':
     tf.test.main()
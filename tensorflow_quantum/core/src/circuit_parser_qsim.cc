@@ -802,13 +802,55 @@ tensorflow::Status ParseAppendChannel(const Operation& op,
   return build_f->second(op, num_qubits, time, ncircuit);
 }
 
+// Appends the depolarizing channels of noise_model that follow gate.
+void AppendGateNoise(const QsimGate& gate, const NoiseModel& noise_model,
+                     const unsigned int num_qubits, const unsigned int time,
+                     NoisyQsimCircuit* ncircuit) {
+  const NoiseModel::Rate rate =
+      gate.qubits.size() + gate.controlled_by.size() == 1
+          ? NoiseModel::kGateDepolarize
+          : NoiseModel::kMultiQubitGateDepolarize;
+  auto append = [&](const unsigned int q) {
+    const float p = noise_model.Get(num_qubits - q - 1, rate);
+    if (p > 0.0f) {
+      ncircuit->channels.push_back(
+          qsim::Cirq::DepolarizingChannel<float>::Create(time, q, p));
+    }
+  };
+  for (const unsigned int q : gate.qubits) {
+    append(q);
+  }
+  for (const unsigned int q : gate.controlled_by) {
+    append(q);
+  }
+}
+
+// Appends the damping channels of noise_model that end every moment.
+void AppendMomentNoise(const NoiseModel& noise_model,
+                       const unsigned int num_qubits, const unsigned int time,
+                       NoisyQsimCircuit* ncircuit) {
+  for (unsigned int location = 0; location < num_qubits; location++) {
+    const unsigned int q = num_qubits - location - 1;
+    const float gamma = noise_model.Get(location, NoiseModel::kAmplitudeDamp);
+    if (gamma > 0.0f) {
+      ncircuit->channels.push_back(
+          qsim::Cirq::AmplitudeDampingChannel<float>::Create(time, q, gamma));
+    }
+    const float lambda = noise_model.Get(location, NoiseModel::kPhaseDamp);
+    if (lambda > 0.0f) {
+      ncircuit->channels.push_back(
+          qsim::Cirq::PhaseDampingChannel<float>::Create(time, q, lambda));
+    }
+  }
+}
+
 }  // namespace
 
-tensorflow::Status NoisyQsimCircuitFromProgram(const Program& program,
-                                               const SymbolMap& param_map,
-                                               const int num_qubits,
-                                               const bool add_tmeasures,
-                                               NoisyQsimCircuit* ncircuit) {
+tensorflow::Status NoisyQsimCircuitFromProgram(
+    const Program& program, const SymbolMap& param_map, const int num_qubits,
+    const bool add_tmeasures, NoisyQsimCircuit* ncircuit,
+    const NoiseModel* noise_model /*=nullptr*/,
+    std::vector<GateMetaData>* metadata /*=nullptr*/) {
   // Special case empty.
   ncircuit->num_qubits = num_qubits;
   if (num_qubits <= 0) {
@@ -819,20 +861,28 @@ tensorflow::Status NoisyQsimCircuitFromProgram(const Program& program,
   bool gate_found;
   QsimCircuit placeholder;
   placeholder.gates.reserve(2);
+  const bool inject_noise = noise_model != nullptr && !noise_model->empty();
 
   for (const Moment& moment : program.circuit().moments()) {
     for (const Operation& op : moment.operations()) {
       placeholder.gates.clear();
       gate_found = false;
       Status status = ParseAppendGate(op, param_map, num_qubits, time,
-                                      &placeholder, nullptr, &gate_found);
+                                      &placeholder, metadata, &gate_found);
       if (gate_found && !status.ok()) {
         // gate found, failed when parsing proto.
         return status;
       } else if (status.ok()) {
         // gate found. succeeded in parsing.
+        if (metadata != nullptr) {
+          metadata->back().index = ncircuit->channels.size();
+        }
         ncircuit->channels.push_back(
             qsim::MakeChannelFromGate(time, placeholder.gates[0]));
+        if (inject_noise) {
+          AppendGateNoise(placeholder.gates[0], *noise_model, num_qubits,
+                          time, ncircuit);
+        }
       } else {
         // got not found. Attempt to find and append channel.
         status = ParseAppendChannel(op, num_qubits, time, ncircuit);
@@ -842,6 +892,9 @@ tensorflow::Status NoisyQsimCircuitFromProgram(const Program& program,
         return status;
       }
     }
+    if (inject_noise) {
+      AppendMomentNoise(*noise_model, num_qubits, time, ncircuit);
+    }
     time++;
   }
 
@@ -889,9 +942,11 @@ tensorflow::Status QsimCircuitFromProgram(
   }
 
   // Build fused circuit.
-  *fused_circuit = qsim::BasicGateFuser<qsim::IO, QsimGate>().FuseGates(
-      qsim::BasicGateFuser<qsim::IO, QsimGate>::Parameter(),
-      circuit->num_qubits, circuit->gates);
+  if (fused_circuit != nullptr) {
+    *fused_circuit = qsim::BasicGateFuser<qsim::IO, QsimGate>().FuseGates(
+        qsim::BasicGateFuser<qsim::IO, QsimGate>::Parameter(),
+        circuit->num_qubits, circuit->gates);
+  }
   return ::tensorflow::Status();
 }
 
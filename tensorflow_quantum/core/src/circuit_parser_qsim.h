@@ -27,6 +27,7 @@ limitations under the License.
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
 #include "tensorflow_quantum/core/proto/program.pb.h"
+#include "tensorflow_quantum/core/src/noise_model.h"
 
 namespace tfq {
 
@@ -66,7 +67,7 @@ struct GateMetaData {
 
 // parse a serialized Cirq program into a qsim representation.
 // ingests a Cirq Circuit proto and produces a resolved qsim Circuit,
-// as well as a fused circuit.
+// as well as a fused circuit unless fused_circuit is nullptr.
 tensorflow::Status QsimCircuitFromProgram(
     const tfq::proto::Program& program,
     const absl::flat_hash_map<std::string, std::pair<int, float>>& param_map,
@@ -78,13 +79,19 @@ tensorflow::Status QsimCircuitFromProgram(
 // ingests a Cirq Circuit proto and produces a resolved Noisy qsim Circuit.
 // If add_tmeasures is true then terminal measurements are added on all
 // qubits.
-// Note: no metadata or fused circuits are produced as the qsim api for
+// If noise_model is given and not empty, its channels are inserted after
+// every gate and every moment of the program, see NoiseModel.
+// If metadata is given, it receives one entry per gate of the program, in
+// order, whose index is the position of the gate's channel in ncircuit.
+// Note: no fused circuits are produced as the qsim api for
 // 	noisy simulation appears to take care of a lot of this for us.
 tensorflow::Status NoisyQsimCircuitFromProgram(
     const tfq::proto::Program& program,
     const absl::flat_hash_map<std::string, std::pair<int, float>>& param_map,
     const int num_qubits, const bool add_tmeasures,
-    qsim::NoisyCircuit<qsim::Cirq::GateCirq<float>>* ncircuit);
+    qsim::NoisyCircuit<qsim::Cirq::GateCirq<float>>* ncircuit,
+    const NoiseModel* noise_model = nullptr,
+    std::vector<GateMetaData>* metadata = nullptr);
 
 // parse a serialized pauliTerm from a larger cirq.Paulisum proto
 // into a qsim Circuit and fused circuit.
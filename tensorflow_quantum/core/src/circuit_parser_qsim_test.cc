@@ -1558,6 +1558,75 @@ TEST(QsimCircuitParserTest, NoisyEmpty) {
   ASSERT_EQ(test_circuit.num_qubits, 0);
 }
 
+TEST(QsimCircuitParserTest, NoiseModelInjection) {
+  Program program_proto;
+  Circuit* circuit_proto = program_proto.mutable_circuit();
+  circuit_proto->set_scheduling_strategy(circuit_proto->MOMENT_BY_MOMENT);
+
+  // Moment 0: I on qubit 0. Moment 1: I2 on qubits 0 and 1.
+  const std::vector<std::vector<std::string>> moment_qubits = {{"0"},
+                                                               {"0", "1"}};
+  for (const auto& qubits : moment_qubits) {
+    Operation* operations_proto =
+        circuit_proto->add_moments()->add_operations();
+    operations_proto->mutable_gate()->set_id(qubits.size() == 1 ? "I" : "I2");
+    google::protobuf::Map<std::string, Arg>* args_proto =
+        operations_proto->mutable_args();
+    (*args_proto)["control_qubits"] = MakeControlArg("");
+    (*args_proto)["control_values"] = MakeControlArg("");
+    for (const auto& id : qubits) {
+      operations_proto->add_qubits()->set_id(id);
+    }
+  }
+
+  // Qubit 0 (qsim qubit 1) has gate noise, qubit 1 (qsim qubit 0) only
+  // amplitude damping.
+  NoiseModel noise_model;
+  noise_model.rates = {0.01, 0.02, 0.0, 0.0, 0.0, 0.03, 0.04, 0.0};
+
+  NoisyQsimCircuit test_circuit;
+  ASSERT_EQ(NoisyQsimCircuitFromProgram(program_proto, {}, 2, false,
+                                        &test_circuit, &noise_model),
+            ::tensorflow::Status());
+  ASSERT_EQ(test_circuit.channels.size(), 7);
+  AssertChannelEqual(
+      test_circuit.channels[1],
+      qsim::Cirq::DepolarizingChannel<float>::Create(0, 1, 0.01));
+  AssertChannelEqual(
+      test_circuit.channels[2],
+      qsim::Cirq::AmplitudeDampingChannel<float>::Create(0, 0, 0.04));
+  // The two qubit gate depolarizes each of its qubits with that qubit's
+  // rate, in the order of the gate's qubits.
+  for (int k = 4; k < 6; k++) {
+    const unsigned int q = test_circuit.channels[k][0].ops[0].qubits[0];
+    AssertChannelEqual(test_circuit.channels[k],
+                       qsim::Cirq::DepolarizingChannel<float>::Create(
+                           1, q, q == 1 ? 0.02 : 0.03));
+  }
+  AssertChannelEqual(
+      test_circuit.channels[6],
+      qsim::Cirq::AmplitudeDampingChannel<float>::Create(1, 0, 0.04));
+
+  // Gate metadata points at the channels holding the gates.
+  std::vector<GateMetaData> metadata;
+  NoisyQsimCircuit meta_circuit;
+  ASSERT_EQ(NoisyQsimCircuitFromProgram(program_proto, {}, 2, false,
+                                        &meta_circuit, &noise_model,
+                                        &metadata),
+            ::tensorflow::Status());
+  ASSERT_EQ(metadata.size(), 2);
+  EXPECT_EQ(metadata[0].index, 0);
+  EXPECT_EQ(metadata[1].index, 3);
+
+  // An empty model adds nothing.
+  NoisyQsimCircuit plain_circuit;
+  NoiseModel empty_model;
+  ASSERT_EQ(NoisyQsimCircuitFromProgram(program_proto, {}, 2, false,
+                                        &plain_circuit, &empty_model),
+            ::tensorflow::Status());
+  ASSERT_EQ(plain_circuit.channels.size(), 2);
+}
+
 TEST(QsimCircuitParserTest, NoisyBadProto) {
   Program program_proto;
   Circuit* circuit_proto = program_proto.mutable_circuit();
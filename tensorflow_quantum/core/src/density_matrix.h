@@ -0,0 +1,134 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_DENSITY_MATRIX_H_
+#define TFQ_CORE_SRC_DENSITY_MATRIX_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "tensorflow_quantum/core/src/noisy_trajectory.h"
+
+namespace tfq {
+
+// Density matrices of n qubits are stored as state vectors of 2n qubits:
+// entry rho[r][c] is the amplitude at index c | (r << n). A gate U acting
+// on qubit q of the circuit acts as U on qubit q + n (the row) and as
+// conj(U) on qubit q (the column), so rho -> U rho U^dagger is two plain
+// state vector gates. The row qubits line up with the qubits a PauliSum
+// resolves to on a 2n qubit state, so O|vec(I)> computed by
+// AccumulateOperators is vec(O), and Tr(A^dagger B) is the inner product
+// of vec(A) and vec(B).
+
+// The row (on qubits + n) or column (on qubits) half of gate as it acts on
+// a density matrix, taking the adjoint of gate first if dagger is true.
+inline QsimGate DensityMatrixGate(const QsimGate& gate,
+                                  const unsigned int num_qubits,
+                                  const bool row, const bool dagger) {
+  QsimGate half = gate;
+  if (row) {
+    for (auto& q : half.qubits) {
+      q += num_qubits;
+    }
+    for (auto& q : half.controlled_by) {
+      q += num_qubits;
+    }
+  }
+  if (dagger) {
+    const unsigned int dim = 1 << gate.qubits.size();
+    for (unsigned int r = 0; r < dim; r++) {
+      for (unsigned int c = 0; c < dim; c++) {
+        half.matrix[2 * (r * dim + c)] = gate.matrix[2 * (c * dim + r)];
+        half.matrix[2 * (r * dim + c) + 1] =
+            -gate.matrix[2 * (c * dim + r) + 1];
+      }
+    }
+  }
+  if (!row) {
+    for (size_t i = 1; i < half.matrix.size(); i += 2) {
+      half.matrix[i] = -half.matrix[i];
+    }
+  }
+  return half;
+}
+
+// rho -> gate rho gate^dagger, or gate^dagger rho gate if dagger is true.
+template <typename Simulator, typename State>
+void ApplyDensityMatrixGate(const Simulator& sim, const QsimGate& gate,
+                            const bool dagger, State& rho) {
+  const unsigned int n = rho.num_qubits() / 2;
+  qsim::ApplyGate(sim, DensityMatrixGate(gate, n, true, dagger), rho);
+  qsim::ApplyGate(sim, DensityMatrixGate(gate, n, false, dagger), rho);
+}
+
+// Applies channel to rho, or its adjoint (the Heisenberg picture map
+// sum_k K_k^dagger rho K_k) if adjoint is true. Unitary Kraus operators
+// are weighted by their probabilities, the others hold their full
+// matrices. Gates are applied in place, other channels need two scratch
+// states.
+template <typename Simulator, typename StateSpace, typename State>
+void ApplyDensityMatrixChannel(const Simulator& sim, const StateSpace& ss,
+                               const QsimChannel& channel, const bool adjoint,
+                               State& rho, State& scratch, State& sum) {
+  if (IsGateChannel(channel)) {
+    if (adjoint) {
+      for (auto op = channel[0].ops.rbegin(); op != channel[0].ops.rend();
+           ++op) {
+        ApplyDensityMatrixGate(sim, *op, true, rho);
+      }
+    } else {
+      for (const auto& op : channel[0].ops) {
+        ApplyDensityMatrixGate(sim, op, false, rho);
+      }
+    }
+    return;
+  }
+
+  ss.SetAllZeros(sum);
+  for (const auto& kop : channel) {
+    ss.Copy(rho, scratch);
+    if (adjoint) {
+      for (auto op = kop.ops.rbegin(); op != kop.ops.rend(); ++op) {
+        ApplyDensityMatrixGate(sim, *op, true, scratch);
+      }
+    } else {
+      for (const auto& op : kop.ops) {
+        ApplyDensityMatrixGate(sim, op, false, scratch);
+      }
+    }
+    if (kop.unitary) {
+      ss.Multiply(kop.prob, scratch);
+    }
+    ss.Add(scratch, sum);
+  }
+  ss.Copy(sum, rho);
+}
+
+// Sets state to vec(I), the identity on state.num_qubits() / 2 qubits.
+template <typename StateSpace, typename State>
+void SetDensityMatrixIdentity(const StateSpace& ss, State& state) {
+  const unsigned int n = state.num_qubits() / 2;
+  ss.SetAllZeros(state);
+  for (uint64_t i = 0; i < (uint64_t{1} << n); i++) {
+    ss.SetAmpl(state, i | (i << n), 1, 0);
+  }
+}
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_DENSITY_MATRIX_H_
@@ -0,0 +1,117 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/density_matrix.h"
+
+#include <complex>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/channels_cirq.h"
+#include "../qsim/lib/formux.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/simmux.h"
+#include "gtest/gtest.h"
+
+namespace tfq {
+namespace {
+
+typedef qsim::Simulator<qsim::SequentialFor> Simulator;
+
+TEST(DensityMatrixTest, GatesMatchStateVector) {
+  std::vector<QsimGate> gates;
+  gates.push_back(qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0));
+  gates.push_back(qsim::Cirq::XPowGate<float>::Create(1, 1, 0.3, -0.5));
+  QsimGate controlled = qsim::Cirq::YPowGate<float>::Create(2, 1, 0.7, 0.1);
+  qsim::MakeControlledGate({0}, {1}, controlled);
+  gates.push_back(controlled);
+  gates.push_back(qsim::Cirq::ISwapPowGate<float>::Create(3, 0, 1, 0.4, 0.0));
+
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(2);
+  auto rho = ss.Create(4);
+  ss.SetStateZero(sv);
+  ss.SetStateZero(rho);
+  for (const QsimGate& gate : gates) {
+    qsim::ApplyGate(sim, gate, sv);
+    ApplyDensityMatrixGate(sim, gate, false, rho);
+  }
+
+  for (uint64_t r = 0; r < 4; r++) {
+    for (uint64_t c = 0; c < 4; c++) {
+      const std::complex<float> expected =
+          ss.GetAmpl(sv, r) * std::conj(ss.GetAmpl(sv, c));
+      const std::complex<float> actual = ss.GetAmpl(rho, c | (r << 2));
+      EXPECT_NEAR(actual.real(), expected.real(), 1e-5);
+      EXPECT_NEAR(actual.imag(), expected.imag(), 1e-5);
+    }
+  }
+
+  // The adjoints undo the gates.
+  for (auto gate = gates.rbegin(); gate != gates.rend(); ++gate) {
+    ApplyDensityMatrixGate(sim, *gate, true, rho);
+  }
+  EXPECT_NEAR(ss.GetAmpl(rho, 0).real(), 1.0, 1e-5);
+  EXPECT_NEAR(ss.Norm(rho), 1.0, 1e-5);
+}
+
+TEST(DensityMatrixTest, Channels) {
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto rho = ss.Create(2);
+  auto scratch = ss.Create(2);
+  auto sum = ss.Create(2);
+
+  // Bit flip on |0><0| gives diag(1 - p, p).
+  ss.SetStateZero(rho);
+  ApplyDensityMatrixChannel(
+      sim, ss, qsim::Cirq::BitFlipChannel<float>::Create(0, 0, 0.2), false,
+      rho, scratch, sum);
+  EXPECT_NEAR(ss.GetAmpl(rho, 0).real(), 0.8, 1e-5);
+  EXPECT_NEAR(ss.GetAmpl(rho, 3).real(), 0.2, 1e-5);
+  EXPECT_NEAR(std::abs(ss.GetAmpl(rho, 1)), 0.0, 1e-5);
+
+  // Amplitude damping maps |1><1| to diag(gamma, 1 - gamma) and its
+  // adjoint maps Z to diag(1, 2 gamma - 1).
+  const auto damp = qsim::Cirq::AmplitudeDampingChannel<float>::Create(0, 0,
+                                                                       0.3);
+  ss.SetAllZeros(rho);
+  ss.SetAmpl(rho, 3, 1, 0);
+  ApplyDensityMatrixChannel(sim, ss, damp, false, rho, scratch, sum);
+  EXPECT_NEAR(ss.GetAmpl(rho, 0).real(), 0.3, 1e-5);
+  EXPECT_NEAR(ss.GetAmpl(rho, 3).real(), 0.7, 1e-5);
+
+  ss.SetAllZeros(rho);
+  ss.SetAmpl(rho, 0, 1, 0);
+  ss.SetAmpl(rho, 3, -1, 0);
+  ApplyDensityMatrixChannel(sim, ss, damp, true, rho, scratch, sum);
+  EXPECT_NEAR(ss.GetAmpl(rho, 0).real(), 1.0, 1e-5);
+  EXPECT_NEAR(ss.GetAmpl(rho, 3).real(), -0.4, 1e-5);
+}
+
+TEST(DensityMatrixTest, Identity) {
+  Simulator::StateSpace ss(1);
+  auto state = ss.Create(4);
+  SetDensityMatrixIdentity(ss, state);
+  EXPECT_NEAR(ss.Norm(state), 4.0, 1e-5);
+  EXPECT_NEAR(ss.GetAmpl(state, 5).real(), 1.0, 1e-5);
+  EXPECT_NEAR(ss.GetAmpl(state, 15).real(), 1.0, 1e-5);
+  EXPECT_NEAR(std::abs(ss.GetAmpl(state, 1)), 0.0, 1e-5);
+}
+
+}  // namespace
+}  // namespace tfq
@@ -0,0 +1,319 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_KRYLOV_H_
+#define TFQ_CORE_SRC_KRYLOV_H_
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+#include "third_party/eigen3/Eigen/Eigenvalues"
+
+namespace tfq {
+
+// Matrix-free Lanczos routines for PauliSum Hamiltonians on qsim states.
+//
+// H is applied with AccumulateOperators, and all other work is real scalar
+// multiplies, adds and inner products of whole states, plus a global phase
+// of i applied as a gate, so everything runs through the StateSpace and
+// Simulator handed in and parallelizes with them.
+// The Lanczos vectors are never stored: routines that need a combination
+// of them run the recurrence a second time. Every routine takes the same
+// four work states v_prev, v, w and scratch, which must be created with
+// the same number of qubits as the input state.
+
+namespace internal {
+
+// Norms below this end the recurrence, or reject its start vector.
+constexpr double kLanczosTolerance = 1e-7;
+
+// Advances the three-term recurrence by one step. On entry v holds the
+// normalized Lanczos vector v_j and v_prev holds v_{j-1} (ignored when
+// beta_prev is zero). On exit v holds v_{j+1}, v_prev holds v_j, and alpha
+// and beta hold <v_j|H|v_j> and the norm of the residual. When beta is
+// below tolerance the Krylov space is invariant and v is left unchanged.
+template <typename SimT, typename StateSpaceT, typename StateT>
+tensorflow::Status LanczosStep(const tfq::proto::PauliSum& p_sum,
+                               const SimT& sim, const StateSpaceT& ss,
+                               const double beta_prev, StateT& v_prev,
+                               StateT& v, StateT& w, StateT& scratch,
+                               double* alpha, double* beta) {
+  // w = H v_j, scratch holds a copy of v_j afterwards.
+  tensorflow::Status status =
+      AccumulateOperators({p_sum}, {1.0f}, sim, ss, v, scratch, w);
+  if (!status.ok()) {
+    return status;
+  }
+  *alpha = ss.RealInnerProduct(v, w);
+
+  // w -= alpha v_j + beta_prev v_{j-1}.
+  ss.Multiply(-*alpha, scratch);
+  ss.Add(scratch, w);
+  if (beta_prev != 0.0) {
+    ss.Multiply(-beta_prev, v_prev);
+    ss.Add(v_prev, w);
+  }
+
+  *beta = std::sqrt(std::max(ss.RealInnerProduct(w, w), 0.0));
+  if (*beta < kLanczosTolerance) {
+    return status;
+  }
+  ss.Copy(v, v_prev);
+  ss.Copy(w, v);
+  ss.Multiply(1.0 / *beta, v);
+  return status;
+}
+
+// Copies state into v normalized and writes the norm of state, which must
+// not be below kLanczosTolerance.
+template <typename StateSpaceT, typename StateT>
+tensorflow::Status LanczosStart(const StateSpaceT& ss, const StateT& state,
+                                StateT& v, double* norm) {
+  *norm = std::sqrt(std::max(ss.RealInnerProduct(state, state), 0.0));
+  if (*norm < kLanczosTolerance) {
+    return tensorflow::Status(
+        static_cast<tensorflow::error::Code>(
+            absl::StatusCode::kInvalidArgument),
+        absl::StrCat("Lanczos start state has norm ", *norm,
+                     ", which is below ", kLanczosTolerance, "."));
+  }
+  ss.Copy(state, v);
+  ss.Multiply(1.0 / *norm, v);
+  return ::tensorflow::Status();
+}
+
+}  // namespace internal
+
+// Runs up to krylov_dim Lanczos steps from state and returns the diagonal
+// (alphas) and off diagonal (betas) of the projected tridiagonal matrix.
+// Stops early if the Krylov space becomes invariant, so alphas may be
+// shorter than krylov_dim. state is not modified.
+template <typename SimT, typename StateSpaceT, typename StateT>
+tensorflow::Status LanczosTridiagonalize(
+    const tfq::proto::PauliSum& p_sum, const SimT& sim, const StateSpaceT& ss,
+    const StateT& state, const int krylov_dim, StateT& v_prev, StateT& v,
+    StateT& w, StateT& scratch, std::vector<double>* alphas,
+    std::vector<double>* betas) {
+  alphas->clear();
+  betas->clear();
+  double norm;
+  tensorflow::Status status = internal::LanczosStart(ss, state, v, &norm);
+  if (!status.ok()) {
+    return status;
+  }
+  double beta = 0.0;
+  for (int j = 0; j < krylov_dim; j++) {
+    double alpha;
+    status = internal::LanczosStep(
+        p_sum, sim, ss, beta, v_prev, v, w, scratch, &alpha, &beta);
+    if (!status.ok()) {
+      return status;
+    }
+    alphas->push_back(alpha);
+    if (beta < internal::kLanczosTolerance || j == krylov_dim - 1) {
+      break;
+    }
+    betas->push_back(beta);
+  }
+  return ::tensorflow::Status();
+}
+
+// Replaces state, the start vector of a previous LanczosTridiagonalize call,
+// with sum_j coeffs_real[j] v_j, regenerating the Lanczos vectors v_j on the
+// way. If imag is not null it receives sum_j coeffs_imag[j] v_j.
+template <typename SimT, typename StateSpaceT, typename StateT>
+tensorflow::Status LanczosCombine(const tfq::proto::PauliSum& p_sum,
+                                  const SimT& sim, const StateSpaceT& ss,
+                                  const std::vector<double>& coeffs_real,
+                                  const std::vector<double>& coeffs_imag,
+                                  StateT& v_prev, StateT& v, StateT& w,
+                                  StateT& scratch, StateT& state,
+                                  StateT* imag) {
+  double norm;
+  tensorflow::Status status = internal::LanczosStart(ss, state, v, &norm);
+  if (!status.ok()) {
+    return status;
+  }
+  // state is free once v_0 has been formed.
+  ss.SetAllZeros(state);
+  if (imag != nullptr) {
+    ss.SetAllZeros(*imag);
+  }
+  double beta = 0.0;
+  for (size_t j = 0; j < coeffs_real.size(); j++) {
+    ss.Copy(v, scratch);
+    ss.Multiply(coeffs_real[j], scratch);
+    ss.Add(scratch, state);
+    if (imag != nullptr) {
+      ss.Copy(v, scratch);
+      ss.Multiply(coeffs_imag[j], scratch);
+      ss.Add(scratch, *imag);
+    }
+    if (j + 1 == coeffs_real.size()) {
+      break;
+    }
+    double alpha;
+    status = internal::LanczosStep(p_sum, sim, ss, beta, v_prev, v, w,
+                                   scratch, &alpha, &beta);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+// Replaces state with an approximation of the ground state of p_sum and
+// writes its energy. Each of the num_cycles cycles runs krylov_dim Lanczos
+// steps from the current estimate and then rebuilds the lowest Ritz vector,
+// which becomes the start of the next cycle. state must overlap with the
+// ground state. Without reorthogonalization the Ritz values pick up
+// spurious copies, which do not affect the lowest one, and the energy
+// reported is the exact Rayleigh quotient of the returned state.
+template <typename SimT, typename StateSpaceT, typename StateT>
+tensorflow::Status LanczosGroundState(const tfq::proto::PauliSum& p_sum,
+                                      const SimT& sim, const StateSpaceT& ss,
+                                      const int krylov_dim,
+                                      const int num_cycles, StateT& v_prev,
+                                      StateT& v, StateT& w, StateT& scratch,
+                                      StateT& state, float* energy) {
+  std::vector<double> alphas;
+  std::vector<double> betas;
+  for (int c = 0; c < num_cycles; c++) {
+    tensorflow::Status status = LanczosTridiagonalize(
+        p_sum, sim, ss, state, krylov_dim, v_prev, v, w, scratch, &alphas,
+        &betas);
+    if (!status.ok()) {
+      return status;
+    }
+
+    const int m = alphas.size();
+    Eigen::VectorXd diag(m);
+    Eigen::VectorXd sub_diag(std::max(m - 1, 0));
+    for (int j = 0; j < m; j++) {
+      diag(j) = alphas[j];
+    }
+    for (int j = 0; j < m - 1; j++) {
+      sub_diag(j) = betas[j];
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver;
+    solver.computeFromTridiagonal(diag, sub_diag, Eigen::ComputeEigenvectors);
+
+    // Eigenvalues are sorted in increasing order.
+    std::vector<double> coeffs(m);
+    for (int j = 0; j < m; j++) {
+      coeffs[j] = solver.eigenvectors()(j, 0);
+    }
+    status = LanczosCombine(p_sum, sim, ss, coeffs, {}, v_prev, v, w,
+                            scratch, state, static_cast<StateT*>(nullptr));
+    if (!status.ok()) {
+      return status;
+    }
+    double norm;
+    status = internal::LanczosStart(ss, state, v, &norm);
+    if (!status.ok()) {
+      return status;
+    }
+    ss.Copy(v, state);
+  }
+
+  tensorflow::Status status =
+      AccumulateOperators({p_sum}, {1.0f}, sim, ss, state, scratch, w);
+  *energy = ss.RealInnerProduct(state, w);
+  return status;
+}
+
+// Adds i * imag to state and leaves i * imag in imag. The factor of i is
+// applied as the one qubit gate i * I, so both steps run through sim and ss.
+// state must have at least one qubit.
+template <typename SimT, typename StateSpaceT, typename StateT>
+void AddImaginaryPart(const SimT& sim, const StateSpaceT& ss, StateT& imag,
+                      StateT& state) {
+  using fp_type = typename StateSpaceT::fp_type;
+  qsim::ApplyGate(sim,
+                  qsim::Cirq::MatrixGate1<fp_type>::Create(
+                      0, 0, {0, 1, 0, 0, 0, 0, 0, 1}),
+                  imag);
+  ss.Add(imag, state);
+}
+
+// Replaces state with exp(-i p_sum time) state, split into num_steps equal
+// steps that each project onto a krylov_dim dimensional Krylov space. imag
+// is one more work state.
+template <typename SimT, typename StateSpaceT, typename StateT>
+tensorflow::Status KrylovEvolve(const tfq::proto::PauliSum& p_sum,
+                                const SimT& sim, const StateSpaceT& ss,
+                                const double time, const int krylov_dim,
+                                const int num_steps, StateT& v_prev,
+                                StateT& v, StateT& w, StateT& scratch,
+                                StateT& imag, StateT& state) {
+  const double dt = time / num_steps;
+  std::vector<double> alphas;
+  std::vector<double> betas;
+  for (int s = 0; s < num_steps; s++) {
+    const double norm = std::sqrt(ss.RealInnerProduct(state, state));
+    tensorflow::Status status = LanczosTridiagonalize(
+        p_sum, sim, ss, state, krylov_dim, v_prev, v, w, scratch, &alphas,
+        &betas);
+    if (!status.ok()) {
+      return status;
+    }
+
+    // exp(-i T dt) e_0 = Q exp(-i Lambda dt) Q^T e_0 for T = Q Lambda Q^T.
+    const int m = alphas.size();
+    Eigen::VectorXd diag(m);
+    Eigen::VectorXd sub_diag(std::max(m - 1, 0));
+    for (int j = 0; j < m; j++) {
+      diag(j) = alphas[j];
+    }
+    for (int j = 0; j < m - 1; j++) {
+      sub_diag(j) = betas[j];
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver;
+    solver.computeFromTridiagonal(diag, sub_diag, Eigen::ComputeEigenvectors);
+    const Eigen::MatrixXd& q = solver.eigenvectors();
+    std::vector<double> coeffs_real(m, 0.0);
+    std::vector<double> coeffs_imag(m, 0.0);
+    for (int j = 0; j < m; j++) {
+      for (int l = 0; l < m; l++) {
+        const double phase = -solver.eigenvalues()(l) * dt;
+        const double weight = norm * q(j, l) * q(0, l);
+        coeffs_real[j] += weight * std::cos(phase);
+        coeffs_imag[j] += weight * std::sin(phase);
+      }
+    }
+
+    status = LanczosCombine(p_sum, sim, ss, coeffs_real, coeffs_imag, v_prev,
+                            v, w, scratch, state, &imag);
+    if (!status.ok()) {
+      return status;
+    }
+    AddImaginaryPart(sim, ss, imag, state);
+  }
+  return ::tensorflow::Status();
+}
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_KRYLOV_H_
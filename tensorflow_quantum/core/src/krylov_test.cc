@@ -0,0 +1,161 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/krylov.h"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "../qsim/lib/formux.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/simmux.h"
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliQubitPair;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+
+typedef qsim::Simulator<qsim::SequentialFor> Simulator;
+typedef Simulator::StateSpace StateSpace;
+
+void AddPauli(PauliTerm* term, const std::string& qubit_id,
+              const std::string& pauli_type) {
+  PauliQubitPair* pair = term->add_paulis();
+  pair->set_qubit_id(qubit_id);
+  pair->set_pauli_type(pauli_type);
+}
+
+TEST(KrylovTest, LanczosGroundState) {
+  // Z0 Z1 + 0.5 X0 splits into Z0 +- 0.5 X0 on the sectors of Z1, so the
+  // ground energy is -sqrt(1.25).
+  PauliSum p_sum;
+  PauliTerm* zz = p_sum.add_terms();
+  zz->set_coefficient_real(1.0);
+  AddPauli(zz, "0", "Z");
+  AddPauli(zz, "1", "Z");
+  PauliTerm* x = p_sum.add_terms();
+  x->set_coefficient_real(0.5);
+  AddPauli(x, "0", "X");
+
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto state = ss.Create(2);
+  auto v_prev = ss.Create(2);
+  auto v = ss.Create(2);
+  auto w = ss.Create(2);
+  auto scratch = ss.Create(2);
+  ss.SetStateZero(state);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0),
+                  state);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 1, 1.0, 0.0),
+                  state);
+
+  float energy = 0.0;
+  ASSERT_EQ(LanczosGroundState(p_sum, sim, ss, 4, 2, v_prev, v, w, scratch,
+                               state, &energy),
+            Status());
+  EXPECT_NEAR(energy, -std::sqrt(1.25), 1e-4);
+  EXPECT_NEAR(ss.RealInnerProduct(state, state), 1.0, 1e-4);
+}
+
+TEST(KrylovTest, KrylovEvolveSingleQubit) {
+  // exp(-i X t)|0> = cos(t)|0> - i sin(t)|1>.
+  PauliSum p_sum;
+  PauliTerm* x = p_sum.add_terms();
+  x->set_coefficient_real(1.0);
+  AddPauli(x, "0", "X");
+
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto state = ss.Create(1);
+  auto v_prev = ss.Create(1);
+  auto v = ss.Create(1);
+  auto w = ss.Create(1);
+  auto scratch = ss.Create(1);
+  auto imag = ss.Create(1);
+  ss.SetStateZero(state);
+
+  const double time = 0.8;
+  ASSERT_EQ(KrylovEvolve(p_sum, sim, ss, time, 2, 2, v_prev, v, w, scratch,
+                         imag, state),
+            Status());
+  EXPECT_NEAR(ss.GetAmpl(state, 0).real(), std::cos(time), 1e-4);
+  EXPECT_NEAR(ss.GetAmpl(state, 0).imag(), 0.0, 1e-4);
+  EXPECT_NEAR(ss.GetAmpl(state, 1).real(), 0.0, 1e-4);
+  EXPECT_NEAR(ss.GetAmpl(state, 1).imag(), -std::sin(time), 1e-4);
+}
+
+TEST(KrylovTest, LanczosTridiagonalizeInvariantSpace) {
+  // |0> is an eigenstate of Z, so the Krylov space has dimension one.
+  PauliSum p_sum;
+  PauliTerm* z = p_sum.add_terms();
+  z->set_coefficient_real(2.0);
+  AddPauli(z, "0", "Z");
+
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto state = ss.Create(1);
+  auto v_prev = ss.Create(1);
+  auto v = ss.Create(1);
+  auto w = ss.Create(1);
+  auto scratch = ss.Create(1);
+  ss.SetStateZero(state);
+
+  std::vector<double> alphas;
+  std::vector<double> betas;
+  ASSERT_EQ(LanczosTridiagonalize(p_sum, sim, ss, state, 5, v_prev, v, w,
+                                  scratch, &alphas, &betas),
+            Status());
+  ASSERT_EQ(alphas.size(), 1);
+  EXPECT_TRUE(betas.empty());
+  EXPECT_NEAR(alphas[0], 2.0, 1e-5);
+}
+
+TEST(KrylovTest, LanczosTridiagonalizeZeroState) {
+  PauliSum p_sum;
+  PauliTerm* z = p_sum.add_terms();
+  z->set_coefficient_real(1.0);
+  AddPauli(z, "0", "Z");
+
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto state = ss.Create(1);
+  auto v_prev = ss.Create(1);
+  auto v = ss.Create(1);
+  auto w = ss.Create(1);
+  auto scratch = ss.Create(1);
+  ss.SetAllZeros(state);
+
+  std::vector<double> alphas;
+  std::vector<double> betas;
+  EXPECT_EQ(LanczosTridiagonalize(p_sum, sim, ss, state, 5, v_prev, v, w,
+                                  scratch, &alphas, &betas),
+            Status(static_cast<tensorflow::error::Code>(
+                       absl::StatusCode::kInvalidArgument),
+                   "Lanczos start state has norm 0, which is below 1e-07."));
+  EXPECT_TRUE(alphas.empty());
+}
+
+}  // namespace
+}  // namespace tfq
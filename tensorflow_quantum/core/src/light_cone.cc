@@ -0,0 +1,143 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/light_cone.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+
+namespace tfq {
+
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::NoisyCircuit<QsimGate> NoisyQsimCircuit;
+typedef qsim::Channel<QsimGate> QsimChannel;
+
+namespace {
+
+// Calls f on every qubit, targets and controls, that channel acts on.
+template <typename F>
+void ForEachChannelQubit(const QsimChannel& channel, F f) {
+  for (const auto& kop : channel) {
+    for (const QsimGate& op : kop.ops) {
+      for (const unsigned int q : op.qubits) {
+        f(q);
+      }
+      for (const unsigned int q : op.controlled_by) {
+        f(q);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+bool PruneToLightCone(std::vector<PauliSum>* p_sums,
+                      NoisyQsimCircuit* ncircuit) {
+  const int num_qubits = ncircuit->num_qubits;
+  if (num_qubits <= 0) {
+    return true;
+  }
+
+  // PauliSum qubit ids are locations, with qsim index num_qubits - id - 1.
+  std::vector<bool> in_cone(num_qubits, false);
+  for (const PauliSum& p_sum : *p_sums) {
+    for (const PauliTerm& term : p_sum.terms()) {
+      for (const auto& pair : term.paulis()) {
+        int location;
+        if (!absl::SimpleAtoi(pair.qubit_id(), &location) || location < 0 ||
+            location >= num_qubits) {
+          return false;
+        }
+        in_cone[num_qubits - location - 1] = true;
+      }
+    }
+  }
+
+  std::vector<bool> keep(ncircuit->channels.size(), false);
+  for (int c = ncircuit->channels.size() - 1; c >= 0; c--) {
+    const QsimChannel& channel = ncircuit->channels[c];
+    bool touches = false;
+    ForEachChannelQubit(channel,
+                        [&](const unsigned int q) { touches |= in_cone[q]; });
+    if (touches) {
+      keep[c] = true;
+      ForEachChannelQubit(channel,
+                          [&](const unsigned int q) { in_cone[q] = true; });
+    }
+  }
+
+  // Remaining qubits keep their order, so gate matrices stay valid.
+  std::vector<int> index(num_qubits, -1);
+  int num_kept = 0;
+  for (int q = 0; q < num_qubits; q++) {
+    if (in_cone[q]) {
+      index[q] = num_kept++;
+    }
+  }
+  if (num_kept == 0) {
+    index[0] = num_kept++;
+  }
+  if (num_kept == num_qubits) {
+    return true;
+  }
+
+  size_t num_channels = 0;
+  for (size_t c = 0; c < ncircuit->channels.size(); c++) {
+    if (!keep[c]) {
+      continue;
+    }
+    if (c != num_channels) {
+      ncircuit->channels[num_channels] = std::move(ncircuit->channels[c]);
+    }
+    QsimChannel& channel = ncircuit->channels[num_channels++];
+    for (auto& kop : channel) {
+      for (QsimGate& op : kop.ops) {
+        for (unsigned int& q : op.qubits) {
+          q = index[q];
+        }
+        for (unsigned int& q : op.controlled_by) {
+          q = index[q];
+        }
+      }
+    }
+  }
+  ncircuit->channels.resize(num_channels);
+  ncircuit->num_qubits = num_kept;
+
+  for (PauliSum& p_sum : *p_sums) {
+    for (PauliTerm& term : *p_sum.mutable_terms()) {
+      for (auto& pair : *term.mutable_paulis()) {
+        int location;
+        (void)absl::SimpleAtoi(pair.qubit_id(), &location);
+        const int q = index[num_qubits - location - 1];
+        pair.set_qubit_id(absl::StrCat(num_kept - q - 1));
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace tfq
@@ -0,0 +1,44 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_LIGHT_CONE_H_
+#define TFQ_CORE_SRC_LIGHT_CONE_H_
+
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+
+namespace tfq {
+
+// Restricts ncircuit to the backward light cone of p_sums. Walking the
+// channels backwards from the qubits p_sums act on, a gate or channel is
+// kept if it touches the cone and its qubits then join the cone. Every
+// channel is trace preserving, so the dropped ones only act on qubits that
+// are traced out and cannot change the expectation values of p_sums. The
+// qubits left outside the cone stay in |0> and are removed, and ncircuit
+// and p_sums are rewritten in place for the remaining qubits.
+// At least one qubit is kept, so nonempty circuits keep a nonzero qubit
+// count even when p_sums are constant and every channel is dropped.
+// Returns false, changing nothing, if p_sums holds unresolved qubits.
+bool PruneToLightCone(
+    std::vector<tfq::proto::PauliSum>* p_sums,
+    qsim::NoisyCircuit<qsim::Cirq::GateCirq<float>>* ncircuit);
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_LIGHT_CONE_H_
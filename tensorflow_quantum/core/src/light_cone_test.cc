@@ -0,0 +1,126 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/light_cone.h"
+
+#include <string>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/channels_cirq.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "gtest/gtest.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+
+namespace tfq {
+namespace {
+
+using ::tfq::proto::PauliQubitPair;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::NoisyCircuit<QsimGate> NoisyQsimCircuit;
+
+void AddPauli(PauliTerm* term, const std::string& qubit_id,
+              const std::string& pauli_type) {
+  PauliQubitPair* pair = term->add_paulis();
+  pair->set_qubit_id(qubit_id);
+  pair->set_pauli_type(pauli_type);
+}
+
+// H(0), CX(0, 1) and damping on idle qubits 2 and 3, in qsim indices.
+NoisyQsimCircuit DampedBellCircuit() {
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 4;
+  ncircuit.channels.push_back(qsim::MakeChannelFromGate(
+      0, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0)));
+  ncircuit.channels.push_back(
+      qsim::Cirq::AmplitudeDampingChannel<float>::Create(0, 3, 0.1));
+  ncircuit.channels.push_back(qsim::MakeChannelFromGate(
+      1, qsim::Cirq::CXPowGate<float>::Create(1, 0, 1, 1.0, 0.0)));
+  ncircuit.channels.push_back(
+      qsim::Cirq::PhaseDampingChannel<float>::Create(1, 2, 0.1));
+  ncircuit.channels.push_back(
+      qsim::Cirq::DepolarizingChannel<float>::Create(1, 1, 0.1));
+  return ncircuit;
+}
+
+TEST(LightConeTest, DropsIdleQubits) {
+  NoisyQsimCircuit ncircuit = DampedBellCircuit();
+
+  // Z on qsim qubit 1, which is location 2.
+  std::vector<PauliSum> p_sums(1);
+  PauliTerm* term = p_sums[0].add_terms();
+  term->set_coefficient_real(1.0);
+  AddPauli(term, "2", "Z");
+
+  ASSERT_TRUE(PruneToLightCone(&p_sums, &ncircuit));
+  EXPECT_EQ(ncircuit.num_qubits, 2);
+  ASSERT_EQ(ncircuit.channels.size(), 3);
+  EXPECT_EQ(ncircuit.channels[0][0].ops[0].qubits[0], 0);
+  EXPECT_EQ(ncircuit.channels[1][0].ops[0].qubits.size(), 2);
+  EXPECT_EQ(ncircuit.channels[2].size(), 4);
+  EXPECT_EQ(ncircuit.channels[2][1].ops[0].qubits[0], 1);
+  // qsim qubit 1 of 2 is location 0.
+  EXPECT_EQ(p_sums[0].terms(0).paulis(0).qubit_id(), "0");
+}
+
+TEST(LightConeTest, KeepsQubitsReachedThroughGates) {
+  NoisyQsimCircuit ncircuit = DampedBellCircuit();
+
+  // Z on qsim qubit 2 reaches its damping channel only.
+  std::vector<PauliSum> p_sums(1);
+  PauliTerm* term = p_sums[0].add_terms();
+  term->set_coefficient_real(1.0);
+  AddPauli(term, "1", "Z");
+
+  ASSERT_TRUE(PruneToLightCone(&p_sums, &ncircuit));
+  EXPECT_EQ(ncircuit.num_qubits, 1);
+  ASSERT_EQ(ncircuit.channels.size(), 1);
+  EXPECT_EQ(ncircuit.channels[0][0].ops[0].qubits[0], 0);
+  EXPECT_EQ(p_sums[0].terms(0).paulis(0).qubit_id(), "0");
+
+  // Observables on every qubit keep the whole circuit.
+  ncircuit = DampedBellCircuit();
+  p_sums.assign(1, PauliSum());
+  term = p_sums[0].add_terms();
+  for (const char* id : {"0", "1", "3"}) {
+    AddPauli(term, id, "X");
+  }
+  ASSERT_TRUE(PruneToLightCone(&p_sums, &ncircuit));
+  EXPECT_EQ(ncircuit.num_qubits, 4);
+  EXPECT_EQ(ncircuit.channels.size(), 5);
+  EXPECT_EQ(p_sums[0].terms(0).paulis(2).qubit_id(), "3");
+}
+
+TEST(LightConeTest, IdentityAndUnresolved) {
+  // Identity terms keep a single empty qubit.
+  NoisyQsimCircuit ncircuit = DampedBellCircuit();
+  std::vector<PauliSum> p_sums(1);
+  p_sums[0].add_terms()->set_coefficient_real(2.0);
+  ASSERT_TRUE(PruneToLightCone(&p_sums, &ncircuit));
+  EXPECT_EQ(ncircuit.num_qubits, 1);
+  EXPECT_TRUE(ncircuit.channels.empty());
+
+  ncircuit = DampedBellCircuit();
+  AddPauli(p_sums[0].add_terms(), "q(0)", "Z");
+  EXPECT_FALSE(PruneToLightCone(&p_sums, &ncircuit));
+  EXPECT_EQ(ncircuit.num_qubits, 4);
+}
+
+}  // namespace
+}  // namespace tfq
@@ -0,0 +1,56 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_NOISE_MODEL_H_
+#define TFQ_CORE_SRC_NOISE_MODEL_H_
+
+#include <vector>
+
+namespace tfq {
+
+// Channel rates that NoisyQsimCircuitFromProgram inserts while parsing, so
+// that programs do not have to carry a channel per gate and per qubit and
+// noise can be swept without serializing the circuits again. Rates are given
+// per qubit, indexed by the position of the qubit in the sorted qubits of
+// the program (the same order used to resolve PauliSums). A zero rate adds
+// no channel.
+struct NoiseModel {
+  enum Rate {
+    // Depolarizing channel on the qubit after every single qubit gate on it.
+    kGateDepolarize = 0,
+    // Depolarizing channel on the qubit after every gate acting on two or
+    // more qubits (controls included) that involves it.
+    kMultiQubitGateDepolarize = 1,
+    // Amplitude damping on the qubit at the end of every moment, whether
+    // the qubit is idle or not.
+    kAmplitudeDamp = 2,
+    // Phase damping on the qubit at the end of every moment.
+    kPhaseDamp = 3,
+    kNumRates = 4,
+  };
+
+  // rates[location * kNumRates + rate], empty for no injected noise.
+  std::vector<float> rates;
+
+  bool empty() const { return rates.empty(); }
+
+  float Get(const unsigned int location, const Rate rate) const {
+    return rates[location * kNumRates + rate];
+  }
+};
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_NOISE_MODEL_H_
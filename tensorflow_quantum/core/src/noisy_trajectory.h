@@ -0,0 +1,353 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_NOISY_TRAJECTORY_H_
+#define TFQ_CORE_SRC_NOISY_TRAJECTORY_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/fuser.h"
+#include "../qsim/lib/fuser_mqubit.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/io.h"
+
+namespace tfq {
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::NoisyCircuit<QsimGate> NoisyQsimCircuit;
+typedef qsim::Channel<QsimGate> QsimChannel;
+typedef qsim::KrausOperator<QsimGate> QsimKrausOperator;
+
+// Index of the Kraus operator of channel with the largest probability. For
+// the usual noise channels this is the "no error" branch.
+inline unsigned DominantKrausOperator(const QsimChannel& channel) {
+  unsigned dominant = 0;
+  for (unsigned k = 1; k < channel.size(); k++) {
+    if (channel[k].prob > channel[dominant].prob) {
+      dominant = k;
+    }
+  }
+  return dominant;
+}
+
+// Expected number of channels in one trajectory of ncircuit that pick
+// something other than their most likely Kraus operator. For the usual
+// channels the most likely operator is (close to) the identity, so this
+// is the expected number of errors per trajectory. Gates are channels
+// with a single operator and contribute nothing.
+inline double ExpectedErrorsPerTrajectory(const NoisyQsimCircuit& ncircuit) {
+  double errors = 0.0;
+  for (const auto& channel : ncircuit.channels) {
+    // For non-unitary operators prob is a lower bound, which is still
+    // exact for the dominant operator of the damping channels.
+    const double p_max = channel[DominantKrausOperator(channel)].prob;
+    errors += std::max(0.0, 1.0 - p_max);
+  }
+  return errors;
+}
+
+// Number of shots to draw from each trajectory when sampling num_samples
+// shots of ncircuit. Shots drawn from the same trajectory state are each
+// distributed exactly like independent shots, but they are correlated, so
+// a trajectory is only reused for about as many shots as it takes for the
+// next error to be expected. A noiseless circuit is sampled from a single
+// trajectory.
+inline int AutoShotsPerTrajectory(const NoisyQsimCircuit& ncircuit,
+                                  const int num_samples) {
+  const double errors = ExpectedErrorsPerTrajectory(ncircuit);
+  if (errors * num_samples <= 1.0) {
+    return std::max(num_samples, 1);
+  }
+  return std::max(1, static_cast<int>(std::floor(1.0 / errors)));
+}
+
+// A noisy circuit with the gates between its noise channels fused once, so
+// that trajectories only sample and apply Kraus operators on top of the
+// pre-fused segments. The circuit must not contain measurements and must
+// outlive the FusedNoisyCircuit.
+struct FusedNoisyCircuit {
+  FusedNoisyCircuit() = default;
+  FusedNoisyCircuit(FusedNoisyCircuit&&) = default;
+  FusedNoisyCircuit& operator=(FusedNoisyCircuit&&) = default;
+  // segments point into gates.
+  FusedNoisyCircuit(const FusedNoisyCircuit&) = delete;
+  FusedNoisyCircuit& operator=(const FusedNoisyCircuit&) = delete;
+
+  unsigned num_qubits = 0;
+  // The channels with more than one Kraus operator, in circuit order.
+  std::vector<const QsimChannel*> channels;
+  // segments[k] holds the fused gates applied right before channels[k], the
+  // last segment follows the last channel.
+  std::vector<std::vector<qsim::GateFused<QsimGate>>> segments;
+  // Gates of each segment, referenced by the fused gates.
+  std::vector<std::vector<QsimGate>> gates;
+};
+
+// True if channel is a plain gate that every trajectory applies.
+inline bool IsGateChannel(const QsimChannel& channel) {
+  return channel.size() == 1 && channel[0].unitary &&
+         channel[0].kind != QsimKrausOperator::kMeasurement;
+}
+
+// Splits ncircuit at its noise channels and fuses the gates in between.
+inline void FuseNoisyCircuit(const NoisyQsimCircuit& ncircuit,
+                             FusedNoisyCircuit* fcircuit) {
+  fcircuit->num_qubits = ncircuit.num_qubits;
+  fcircuit->channels.clear();
+  fcircuit->gates.assign(1, std::vector<QsimGate>());
+  for (const auto& channel : ncircuit.channels) {
+    if (IsGateChannel(channel)) {
+      for (const auto& op : channel[0].ops) {
+        fcircuit->gates.back().push_back(op);
+      }
+    } else {
+      fcircuit->channels.push_back(&channel);
+      fcircuit->gates.push_back(std::vector<QsimGate>());
+    }
+  }
+
+  // All segments are in place, so the gate vectors no longer move.
+  qsim::MultiQubitGateFuser<qsim::IO, QsimGate>::Parameter param;
+  fcircuit->segments.assign(fcircuit->gates.size(),
+                            std::vector<qsim::GateFused<QsimGate>>());
+  for (size_t k = 0; k < fcircuit->gates.size(); k++) {
+    if (!fcircuit->gates[k].empty()) {
+      fcircuit->segments[k] =
+          qsim::MultiQubitGateFuser<qsim::IO, QsimGate>::FuseGates(
+              param, ncircuit.num_qubits, fcircuit->gates[k]);
+    }
+  }
+}
+
+template <typename Simulator, typename State>
+void ApplyFusedSegment(const Simulator& sim,
+                       const std::vector<qsim::GateFused<QsimGate>>& segment,
+                       State& state) {
+  for (const auto& fgate : segment) {
+    qsim::ApplyFusedGate(sim, fgate, state);
+  }
+}
+
+template <typename Simulator, typename State>
+void ApplyKrausOperator(const Simulator& sim, const QsimKrausOperator& kop,
+                        State& state) {
+  for (const auto& op : kop.ops) {
+    qsim::ApplyGate(sim, op, state);
+  }
+}
+
+// Applies kop to the normalized state and renormalizes it. Returns the
+// probability of kop.
+template <typename Simulator, typename StateSpace, typename State>
+double ApplyKrausOperatorAndNormalize(const Simulator& sim,
+                                      const StateSpace& ss,
+                                      const QsimKrausOperator& kop,
+                                      State& state) {
+  ApplyKrausOperator(sim, kop, state);
+  if (kop.unitary) {
+    return kop.prob;
+  }
+  const double p = ss.Norm(state);
+  if (p > 0.0) {
+    ss.Multiply(1.0 / std::sqrt(p), state);
+  }
+  return p;
+}
+
+// Probability of picking kop on the normalized state, computed in scratch
+// unless kop is a unitary with a fixed probability.
+template <typename Simulator, typename StateSpace, typename State>
+double KrausOperatorProbability(const Simulator& sim, const StateSpace& ss,
+                                const QsimKrausOperator& kop,
+                                const State& state, State& scratch) {
+  if (kop.unitary) {
+    return kop.prob;
+  }
+  ss.Copy(state, scratch);
+  ApplyKrausOperator(sim, kop, scratch);
+  return ss.Norm(scratch);
+}
+
+// Applies one Kraus operator of channel to the normalized state, drawn with
+// the uniform number r in [0, 1). Unitary operators are picked by their
+// fixed probabilities, the others are tried in scratch as needed.
+template <typename Simulator, typename StateSpace, typename State>
+void ApplyRandomKrausOperator(const Simulator& sim, const StateSpace& ss,
+                              const QsimChannel& channel, double r,
+                              State& state, State& scratch) {
+  unsigned last = 0;
+  for (unsigned k = 0; k < channel.size(); k++) {
+    const double p =
+        KrausOperatorProbability(sim, ss, channel[k], state, scratch);
+    if (p <= 0.0) {
+      continue;
+    }
+    last = k;
+    if (r < p) {
+      if (channel[k].unitary) {
+        ApplyKrausOperator(sim, channel[k], state);
+      } else {
+        ss.Copy(scratch, state);
+        ss.Multiply(1.0 / std::sqrt(p), state);
+      }
+      return;
+    }
+    r -= p;
+  }
+  // Rounding left r past the last operator.
+  ApplyKrausOperatorAndNormalize(sim, ss, channel[last], state);
+}
+
+// Runs a trajectory of fcircuit on state, starting with segment first.
+template <typename Simulator, typename StateSpace, typename State>
+void RunTrajectoryFrom(const FusedNoisyCircuit& fcircuit, const size_t first,
+                       std::mt19937_64& gen, const Simulator& sim,
+                       const StateSpace& ss, State& state, State& scratch) {
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+  ApplyFusedSegment(sim, fcircuit.segments[first], state);
+  for (size_t k = first; k < fcircuit.channels.size(); k++) {
+    ApplyRandomKrausOperator(sim, ss, *fcircuit.channels[k], distribution(gen),
+                             state, scratch);
+    ApplyFusedSegment(sim, fcircuit.segments[k + 1], state);
+  }
+}
+
+// Simulates one trajectory of fcircuit from |0...0> into state.
+template <typename Simulator, typename StateSpace, typename State>
+void RunTrajectory(const FusedNoisyCircuit& fcircuit, const uint64_t seed,
+                   const Simulator& sim, const StateSpace& ss, State& state,
+                   State& scratch) {
+  std::mt19937_64 gen(seed);
+  ss.SetStateZero(state);
+  RunTrajectoryFrom(fcircuit, 0, gen, sim, ss, state, scratch);
+}
+
+// The trajectories of a noisy circuit split into the single error free
+// trajectory, in which every channel picks its dominant Kraus operator, and
+// the trajectories with at least one error.
+struct ErrorFreeStratum {
+  // Probability of the error free trajectory.
+  double probability = 1.0;
+  // first_error_cdf[k] is the probability that the first error of a
+  // trajectory happens at one of the noise channels 0..k.
+  std::vector<double> first_error_cdf;
+
+  // Probability of a trajectory with at least one error.
+  double ErrorProbability() const {
+    return first_error_cdf.empty() ? 0.0 : first_error_cdf.back();
+  }
+};
+
+// Simulates the error free trajectory of fcircuit into state and fills in
+// stratum, using scratch for the probabilities of the other Kraus operators.
+template <typename Simulator, typename StateSpace, typename State>
+void RunErrorFreeTrajectory(const FusedNoisyCircuit& fcircuit,
+                            const Simulator& sim, const StateSpace& ss,
+                            State& state, State& scratch,
+                            ErrorFreeStratum* stratum) {
+  const size_t num_channels = fcircuit.channels.size();
+  stratum->first_error_cdf.assign(num_channels, 0.0);
+  ss.SetStateZero(state);
+  ApplyFusedSegment(sim, fcircuit.segments[0], state);
+
+  double weight = 1.0;
+  double cdf = 0.0;
+  for (size_t k = 0; k < num_channels && weight > 0.0; k++) {
+    const auto& channel = *fcircuit.channels[k];
+    const unsigned dominant = DominantKrausOperator(channel);
+    double p_error = 0.0;
+    for (unsigned j = 0; j < channel.size(); j++) {
+      if (j != dominant) {
+        p_error +=
+            KrausOperatorProbability(sim, ss, channel[j], state, scratch);
+      }
+    }
+    cdf += weight * p_error;
+    std::fill(stratum->first_error_cdf.begin() + k,
+              stratum->first_error_cdf.end(), cdf);
+    weight *= ApplyKrausOperatorAndNormalize(sim, ss, channel[dominant], state);
+    ApplyFusedSegment(sim, fcircuit.segments[k + 1], state);
+  }
+  stratum->probability = weight;
+}
+
+// Simulates a trajectory of fcircuit conditioned on at least one error into
+// state. The channel of the first error is drawn from stratum, the channels
+// before it take their dominant Kraus operator and the ones after it are
+// sampled as usual.
+template <typename Simulator, typename StateSpace, typename State>
+void RunErroneousTrajectory(const FusedNoisyCircuit& fcircuit,
+                            const ErrorFreeStratum& stratum,
+                            const uint64_t seed, const Simulator& sim,
+                            const StateSpace& ss, State& state,
+                            State& scratch) {
+  std::mt19937_64 gen(seed);
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+
+  const auto& cdf = stratum.first_error_cdf;
+  const double u = distribution(gen) * stratum.ErrorProbability();
+  const size_t first_error = std::min(
+      static_cast<size_t>(std::upper_bound(cdf.begin(), cdf.end(), u) -
+                          cdf.begin()),
+      cdf.size() - 1);
+
+  ss.SetStateZero(state);
+  ApplyFusedSegment(sim, fcircuit.segments[0], state);
+  for (size_t k = 0; k < first_error; k++) {
+    const auto& channel = *fcircuit.channels[k];
+    ApplyKrausOperatorAndNormalize(sim, ss,
+                                   channel[DominantKrausOperator(channel)],
+                                   state);
+    ApplyFusedSegment(sim, fcircuit.segments[k + 1], state);
+  }
+
+  // Pick one of the non-dominant operators of the first error channel.
+  const auto& channel = *fcircuit.channels[first_error];
+  const unsigned dominant = DominantKrausOperator(channel);
+  std::vector<double> probs(channel.size(), 0.0);
+  double p_error = 0.0;
+  for (unsigned k = 0; k < channel.size(); k++) {
+    if (k != dominant) {
+      probs[k] = KrausOperatorProbability(sim, ss, channel[k], state, scratch);
+      p_error += probs[k];
+    }
+  }
+  unsigned pick = dominant;
+  double r = distribution(gen) * p_error;
+  for (unsigned k = 0; k < channel.size(); k++) {
+    if (k == dominant || probs[k] <= 0.0) {
+      continue;
+    }
+    pick = k;
+    if (r < probs[k]) {
+      break;
+    }
+    r -= probs[k];
+  }
+  ApplyKrausOperatorAndNormalize(sim, ss, channel[pick], state);
+
+  RunTrajectoryFrom(fcircuit, first_error + 1, gen, sim, ss, state, scratch);
+}
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_NOISY_TRAJECTORY_H_
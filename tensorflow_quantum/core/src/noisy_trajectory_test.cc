@@ -0,0 +1,214 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/noisy_trajectory.h"
+
+#include <cmath>
+#include <complex>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/channels_cirq.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/formux.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/simmux.h"
+#include "gtest/gtest.h"
+
+namespace tfq {
+namespace {
+
+typedef qsim::Simulator<qsim::SequentialFor> Simulator;
+
+NoisyQsimCircuit DepolarizedCircuit(const float p, const int num_channels) {
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 1;
+  for (int t = 0; t < num_channels; t++) {
+    ncircuit.channels.push_back(qsim::MakeChannelFromGate(
+        2 * t, qsim::Cirq::HPowGate<float>::Create(2 * t, 0, 1.0, 0.0)));
+    ncircuit.channels.push_back(
+        qsim::Cirq::DepolarizingChannel<float>::Create(2 * t + 1, 0, p));
+  }
+  return ncircuit;
+}
+
+TEST(NoisyTrajectoryTest, ExpectedErrorsPerTrajectory) {
+  EXPECT_NEAR(ExpectedErrorsPerTrajectory(DepolarizedCircuit(0.01, 5)), 0.05,
+              1e-6);
+  EXPECT_NEAR(ExpectedErrorsPerTrajectory(DepolarizedCircuit(0.0, 5)), 0.0,
+              1e-6);
+
+  // Amplitude damping is not a unitary mixture but is still counted.
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 1;
+  ncircuit.channels.push_back(
+      qsim::Cirq::AmplitudeDampingChannel<float>::Create(0, 0, 0.1));
+  EXPECT_NEAR(ExpectedErrorsPerTrajectory(ncircuit), 0.1, 1e-6);
+}
+
+TEST(NoisyTrajectoryTest, AutoShotsPerTrajectory) {
+  // One error per 20 trajectories.
+  EXPECT_EQ(AutoShotsPerTrajectory(DepolarizedCircuit(0.01, 5), 100000), 20);
+  // Too few shots to expect a single error.
+  EXPECT_EQ(AutoShotsPerTrajectory(DepolarizedCircuit(0.01, 5), 10), 10);
+  // Noiseless circuits need a single trajectory.
+  EXPECT_EQ(AutoShotsPerTrajectory(DepolarizedCircuit(0.0, 5), 1000), 1000);
+  // Strong noise falls back to one shot per trajectory.
+  EXPECT_EQ(AutoShotsPerTrajectory(DepolarizedCircuit(0.5, 5), 1000), 1);
+}
+
+TEST(NoisyTrajectoryTest, FuseNoisyCircuit) {
+  const NoisyQsimCircuit ncircuit = DepolarizedCircuit(0.01, 3);
+  FusedNoisyCircuit fcircuit;
+  FuseNoisyCircuit(ncircuit, &fcircuit);
+  EXPECT_EQ(fcircuit.num_qubits, 1);
+  ASSERT_EQ(fcircuit.channels.size(), 3);
+  ASSERT_EQ(fcircuit.segments.size(), 4);
+  for (int k = 0; k < 3; k++) {
+    EXPECT_EQ(fcircuit.channels[k], &ncircuit.channels[2 * k + 1]);
+    EXPECT_EQ(fcircuit.segments[k].size(), 1);
+  }
+  EXPECT_TRUE(fcircuit.segments[3].empty());
+
+  // A noiseless circuit is a single fused segment.
+  NoisyQsimCircuit gates;
+  gates.num_qubits = 2;
+  gates.channels.push_back(qsim::MakeChannelFromGate(
+      0, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0)));
+  gates.channels.push_back(qsim::MakeChannelFromGate(
+      1, qsim::Cirq::CXPowGate<float>::Create(1, 0, 1, 1.0, 0.0)));
+  FuseNoisyCircuit(gates, &fcircuit);
+  EXPECT_TRUE(fcircuit.channels.empty());
+  ASSERT_EQ(fcircuit.segments.size(), 1);
+  EXPECT_EQ(fcircuit.gates[0].size(), 2);
+
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(2);
+  auto scratch = ss.Create(2);
+  RunTrajectory(fcircuit, 0, sim, ss, sv, scratch);
+  EXPECT_NEAR(std::norm(ss.GetAmpl(sv, 0)), 0.5, 1e-5);
+  EXPECT_NEAR(std::norm(ss.GetAmpl(sv, 3)), 0.5, 1e-5);
+}
+
+TEST(NoisyTrajectoryTest, RunTrajectoryAmplitudeDamping) {
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  auto scratch = ss.Create(1);
+
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 1;
+  ncircuit.channels.push_back(qsim::MakeChannelFromGate(
+      0, qsim::Cirq::XPowGate<float>::Create(0, 0, 1.0, 0.0)));
+  ncircuit.channels.push_back(
+      qsim::Cirq::AmplitudeDampingChannel<float>::Create(1, 0, 0.3));
+  FusedNoisyCircuit fcircuit;
+  FuseNoisyCircuit(ncircuit, &fcircuit);
+
+  int num_decayed = 0;
+  const int num_trajectories = 1000;
+  for (int seed = 0; seed < num_trajectories; seed++) {
+    RunTrajectory(fcircuit, seed, sim, ss, sv, scratch);
+    EXPECT_NEAR(ss.Norm(sv), 1.0, 1e-5);
+    num_decayed += std::norm(ss.GetAmpl(sv, 0)) > 0.5;
+  }
+  EXPECT_NEAR(num_decayed / static_cast<double>(num_trajectories), 0.3, 0.05);
+}
+
+TEST(NoisyTrajectoryTest, ErrorFreeStratumUnitaryMixture) {
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  auto scratch = ss.Create(1);
+
+  const NoisyQsimCircuit ncircuit = DepolarizedCircuit(0.01, 5);
+  FusedNoisyCircuit fcircuit;
+  FuseNoisyCircuit(ncircuit, &fcircuit);
+
+  ErrorFreeStratum stratum;
+  RunErrorFreeTrajectory(fcircuit, sim, ss, sv, scratch, &stratum);
+  EXPECT_NEAR(stratum.probability, std::pow(0.99, 5), 1e-5);
+  EXPECT_NEAR(stratum.ErrorProbability(), 1.0 - std::pow(0.99, 5), 1e-5);
+  ASSERT_EQ(stratum.first_error_cdf.size(), 5);
+  EXPECT_NEAR(stratum.first_error_cdf[0], 0.01, 1e-6);
+  EXPECT_NEAR(stratum.first_error_cdf[1], 0.01 + 0.99 * 0.01, 1e-6);
+
+  // Five Hadamards leave the error free trajectory in |+>.
+  EXPECT_NEAR(std::real(ss.GetAmpl(sv, 0)), 1.0 / std::sqrt(2.0), 1e-5);
+  EXPECT_NEAR(std::real(ss.GetAmpl(sv, 1)), 1.0 / std::sqrt(2.0), 1e-5);
+}
+
+TEST(NoisyTrajectoryTest, ErrorFreeStratumAmplitudeDamping) {
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  auto scratch = ss.Create(1);
+
+  // X followed by amplitude damping: the error branch decays to |0>.
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 1;
+  ncircuit.channels.push_back(qsim::MakeChannelFromGate(
+      0, qsim::Cirq::XPowGate<float>::Create(0, 0, 1.0, 0.0)));
+  ncircuit.channels.push_back(
+      qsim::Cirq::AmplitudeDampingChannel<float>::Create(1, 0, 0.3));
+  FusedNoisyCircuit fcircuit;
+  FuseNoisyCircuit(ncircuit, &fcircuit);
+
+  ErrorFreeStratum stratum;
+  RunErrorFreeTrajectory(fcircuit, sim, ss, sv, scratch, &stratum);
+  EXPECT_NEAR(stratum.probability, 0.7, 1e-5);
+  EXPECT_NEAR(stratum.ErrorProbability(), 0.3, 1e-5);
+  EXPECT_NEAR(std::norm(ss.GetAmpl(sv, 1)), 1.0, 1e-5);
+
+  for (uint64_t seed = 0; seed < 10; seed++) {
+    RunErroneousTrajectory(fcircuit, stratum, seed, sim, ss, sv, scratch);
+    EXPECT_NEAR(std::norm(ss.GetAmpl(sv, 0)), 1.0, 1e-5);
+  }
+}
+
+TEST(NoisyTrajectoryTest, ErroneousTrajectoryContinuesSampling) {
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  auto scratch = ss.Create(1);
+
+  // Two bit flips: after the first error the second one is still sampled,
+  // so both |0> and |1> must show up.
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 1;
+  ncircuit.channels.push_back(
+      qsim::Cirq::BitFlipChannel<float>::Create(0, 0, 0.5));
+  ncircuit.channels.push_back(
+      qsim::Cirq::BitFlipChannel<float>::Create(1, 0, 0.5));
+  FusedNoisyCircuit fcircuit;
+  FuseNoisyCircuit(ncircuit, &fcircuit);
+
+  ErrorFreeStratum stratum;
+  RunErrorFreeTrajectory(fcircuit, sim, ss, sv, scratch, &stratum);
+  EXPECT_NEAR(stratum.ErrorProbability(), 0.75, 1e-5);
+
+  int num_zero = 0;
+  const int num_trajectories = 300;
+  for (int seed = 0; seed < num_trajectories; seed++) {
+    RunErroneousTrajectory(fcircuit, stratum, seed, sim, ss, sv, scratch);
+    num_zero += std::norm(ss.GetAmpl(sv, 0)) > 0.5;
+  }
+  // Conditioned on an error, |0> has probability 1/3.
+  EXPECT_NEAR(num_zero / static_cast<double>(num_trajectories), 1.0 / 3.0,
+              0.1);
+}
+
+}  // namespace
+}  // namespace tfq
@@ -0,0 +1,199 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_PAULI_EVOLUTION_H_
+#define TFQ_CORE_SRC_PAULI_EVOLUTION_H_
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+
+namespace tfq {
+
+// A Pauli string as bitmasks over qsim qubit indices, together with its real
+// coefficient. Applying it to the basis state |j> gives
+//   i ** num_y * (-1) ** popcount(j & z_mask) |j ^ x_mask>.
+struct PauliRotation {
+  // Qubits acted on by X or Y.
+  uint64_t x_mask = 0;
+  // Qubits acted on by Y or Z.
+  uint64_t z_mask = 0;
+  int num_y = 0;
+  double coefficient = 0.0;
+};
+
+// Converts a PauliTerm with resolved qubit ids into a PauliRotation on a
+// circuit with num_qubits qubits. Like the circuit parser, qubit id q maps
+// to qsim qubit num_qubits - q - 1.
+inline tensorflow::Status PauliRotationFromTerm(
+    const tfq::proto::PauliTerm& term, const int num_qubits,
+    PauliRotation* rotation) {
+  if (term.coefficient_imag() != 0.0) {
+    return tensorflow::Status(
+        static_cast<tensorflow::error::Code>(
+            absl::StatusCode::kInvalidArgument),
+        "Hamiltonian terms must have real coefficients to generate unitary "
+        "evolution.");
+  }
+  *rotation = PauliRotation();
+  rotation->coefficient = term.coefficient_real();
+  for (const tfq::proto::PauliQubitPair& pair : term.paulis()) {
+    int q;
+    if (!absl::SimpleAtoi(pair.qubit_id(), &q) || q < 0 || q >= num_qubits) {
+      return tensorflow::Status(
+          static_cast<tensorflow::error::Code>(
+              absl::StatusCode::kInvalidArgument),
+          "Unresolved qubit in Hamiltonian term: " + pair.qubit_id());
+    }
+    const uint64_t bit = uint64_t(1) << (num_qubits - q - 1);
+    if ((rotation->x_mask | rotation->z_mask) & bit) {
+      return tensorflow::Status(
+          static_cast<tensorflow::error::Code>(
+              absl::StatusCode::kInvalidArgument),
+          "Hamiltonian term acts on qubit " + pair.qubit_id() + " twice.");
+    }
+    if (pair.pauli_type() == "X") {
+      rotation->x_mask |= bit;
+    } else if (pair.pauli_type() == "Y") {
+      rotation->x_mask |= bit;
+      rotation->z_mask |= bit;
+      rotation->num_y++;
+    } else if (pair.pauli_type() == "Z") {
+      rotation->z_mask |= bit;
+    } else {
+      return tensorflow::Status(
+          static_cast<tensorflow::error::Code>(
+              absl::StatusCode::kInvalidArgument),
+          "Unknown pauli type: " + pair.pauli_type());
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+// Applies exp(-i theta P) in place to the amplitudes of state whose index
+// lies in [begin, end), where P is the Pauli string of rotation. Every pair
+// of amplitudes coupled by P is updated once, by the range holding its lower
+// index, so disjoint ranges may run concurrently. This is a single pass over
+// the state, where the equivalent basis change, CNOT ladder and Rz gates
+// would take 2 * weight + 1 passes.
+template <typename StateSpaceT, typename StateT>
+void ApplyPauliRotation(const StateSpaceT& ss, StateT& state,
+                        const PauliRotation& rotation, const double theta,
+                        const uint64_t begin, const uint64_t end) {
+  using fp_type = typename StateSpaceT::fp_type;
+  const double c = std::cos(theta);
+  const double s = std::sin(theta);
+
+  if (rotation.x_mask == 0) {
+    // Diagonal: |j> picks up exp(-i theta (-1) ** popcount(j & z_mask)).
+    const std::complex<double> even(c, -s);
+    const std::complex<double> odd(c, s);
+    for (uint64_t j = begin; j < end; j++) {
+      const bool parity = __builtin_parityll(j & rotation.z_mask);
+      const std::complex<double> amp = ss.GetAmpl(state, j);
+      ss.SetAmpl(state, j,
+                 std::complex<fp_type>(amp * (parity ? odd : even)));
+    }
+    return;
+  }
+
+  // -i * i ** num_y, the phase shared by both off-diagonal entries.
+  static const std::complex<double> kPhases[4] = {
+      {0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+  const std::complex<double> phase = s * kPhases[rotation.num_y % 4];
+  const uint64_t top = uint64_t(1) << (63 - __builtin_clzll(rotation.x_mask));
+  for (uint64_t j = begin; j < end; j++) {
+    if (j & top) {
+      continue;
+    }
+    const uint64_t k = j ^ rotation.x_mask;
+    const std::complex<double> amp_j = ss.GetAmpl(state, j);
+    const std::complex<double> amp_k = ss.GetAmpl(state, k);
+    const double sign_j =
+        __builtin_parityll(k & rotation.z_mask) ? -1.0 : 1.0;
+    const double sign_k =
+        __builtin_parityll(j & rotation.z_mask) ? -1.0 : 1.0;
+    ss.SetAmpl(state, j,
+               std::complex<fp_type>(c * amp_j + sign_j * phase * amp_k));
+    ss.SetAmpl(state, k,
+               std::complex<fp_type>(c * amp_k + sign_k * phase * amp_j));
+  }
+}
+
+// Lists the Pauli rotations of one Trotter step of duration dt, as
+// (rotation index, angle) pairs. order 1 applies every term once and order 2
+// is the symmetric Strang splitting, with the two half steps on the last
+// term merged.
+inline std::vector<std::pair<int, double>> TrotterStep(
+    const std::vector<PauliRotation>& rotations, const double dt,
+    const int order) {
+  std::vector<std::pair<int, double>> step;
+  const int n = rotations.size();
+  if (order == 1) {
+    for (int t = 0; t < n; t++) {
+      step.push_back({t, rotations[t].coefficient * dt});
+    }
+    return step;
+  }
+  for (int t = 0; t < n - 1; t++) {
+    step.push_back({t, rotations[t].coefficient * dt / 2});
+  }
+  if (n > 0) {
+    step.push_back({n - 1, rotations[n - 1].coefficient * dt});
+  }
+  for (int t = n - 2; t >= 0; t--) {
+    step.push_back({t, rotations[t].coefficient * dt / 2});
+  }
+  return step;
+}
+
+// Evolves state under the Hamiltonian p_sum for the given time, using
+// num_steps Trotter steps of the given order. Runs on the calling thread;
+// callers that parallelize over the state should drive TrotterStep and
+// ApplyPauliRotation directly with a barrier between rotations.
+template <typename StateSpaceT, typename StateT>
+tensorflow::Status EvolvePauliSum(const StateSpaceT& ss, StateT& state,
+                                  const tfq::proto::PauliSum& p_sum,
+                                  const int num_qubits, const double time,
+                                  const int num_steps, const int order) {
+  std::vector<PauliRotation> rotations(p_sum.terms_size());
+  for (int t = 0; t < p_sum.terms_size(); t++) {
+    tensorflow::Status status =
+        PauliRotationFromTerm(p_sum.terms(t), num_qubits, &rotations[t]);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  const auto step = TrotterStep(rotations, time / num_steps, order);
+  const uint64_t size = uint64_t(1) << num_qubits;
+  for (int r = 0; r < num_steps; r++) {
+    for (const auto& rot : step) {
+      ApplyPauliRotation(ss, state, rotations[rot.first], rot.second, 0, size);
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_PAULI_EVOLUTION_H_
@@ -0,0 +1,212 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/pauli_evolution.h"
+
+#include <cmath>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "../qsim/lib/formux.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/simmux.h"
+#include "gtest/gtest.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliQubitPair;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+
+typedef qsim::Simulator<qsim::SequentialFor> Simulator;
+typedef Simulator::StateSpace StateSpace;
+
+void AddPauli(PauliTerm* term, const std::string& qubit_id,
+              const std::string& pauli_type) {
+  PauliQubitPair* pair = term->add_paulis();
+  pair->set_qubit_id(qubit_id);
+  pair->set_pauli_type(pauli_type);
+}
+
+TEST(PauliEvolutionTest, PauliRotationFromTerm) {
+  PauliTerm term;
+  term.set_coefficient_real(0.5);
+  AddPauli(&term, "0", "X");
+  AddPauli(&term, "1", "Y");
+  AddPauli(&term, "2", "Z");
+
+  PauliRotation rotation;
+  ASSERT_EQ(PauliRotationFromTerm(term, 3, &rotation), Status());
+  // Qubit id q is qsim qubit 2 - q.
+  EXPECT_EQ(rotation.x_mask, 0b110);
+  EXPECT_EQ(rotation.z_mask, 0b011);
+  EXPECT_EQ(rotation.num_y, 1);
+  EXPECT_NEAR(rotation.coefficient, 0.5, 1e-6);
+}
+
+TEST(PauliEvolutionTest, PauliRotationFromTermErrors) {
+  PauliRotation rotation;
+
+  PauliTerm imaginary;
+  imaginary.set_coefficient_imag(1.0);
+  AddPauli(&imaginary, "0", "X");
+  EXPECT_FALSE(PauliRotationFromTerm(imaginary, 1, &rotation).ok());
+
+  PauliTerm unknown;
+  AddPauli(&unknown, "0", "W");
+  EXPECT_FALSE(PauliRotationFromTerm(unknown, 1, &rotation).ok());
+
+  PauliTerm out_of_range;
+  AddPauli(&out_of_range, "1", "Z");
+  EXPECT_FALSE(PauliRotationFromTerm(out_of_range, 1, &rotation).ok());
+}
+
+class SingleQubitRotationFixture
+    : public ::testing::TestWithParam<std::string> {};
+
+TEST_P(SingleQubitRotationFixture, MatchesCirqRotation) {
+  // exp(-i theta P) is cirq's P ** (2 theta / pi) with global shift -0.5.
+  const std::string pauli_type = GetParam();
+  const float theta = 0.3;
+  const float exponent = 2.0 * theta / M_PI;
+
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto expected = ss.Create(2);
+  ss.SetStateZero(expected);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0),
+                  expected);
+  qsim::ApplyGate(sim, qsim::Cirq::YPowGate<float>::Create(1, 1, 0.3, 0.0),
+                  expected);
+  auto actual = ss.Create(2);
+  ss.Copy(expected, actual);
+
+  // Qubit id 1 is qsim qubit 0.
+  if (pauli_type == "X") {
+    qsim::ApplyGate(
+        sim, qsim::Cirq::XPowGate<float>::Create(2, 0, exponent, -0.5),
+        expected);
+  } else if (pauli_type == "Y") {
+    qsim::ApplyGate(
+        sim, qsim::Cirq::YPowGate<float>::Create(2, 0, exponent, -0.5),
+        expected);
+  } else {
+    qsim::ApplyGate(
+        sim, qsim::Cirq::ZPowGate<float>::Create(2, 0, exponent, -0.5),
+        expected);
+  }
+
+  PauliTerm term;
+  AddPauli(&term, "1", pauli_type);
+  PauliRotation rotation;
+  ASSERT_EQ(PauliRotationFromTerm(term, 2, &rotation), Status());
+  ApplyPauliRotation(ss, actual, rotation, theta, 0, 4);
+
+  for (uint64_t j = 0; j < 4; j++) {
+    EXPECT_NEAR(ss.GetAmpl(actual, j).real(), ss.GetAmpl(expected, j).real(),
+                1e-5);
+    EXPECT_NEAR(ss.GetAmpl(actual, j).imag(), ss.GetAmpl(expected, j).imag(),
+                1e-5);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(SingleQubitRotationTests, SingleQubitRotationFixture,
+                        ::testing::Values("X", "Y", "Z"));
+
+TEST(PauliEvolutionTest, ApplyPauliRotationQuarterTurn) {
+  // exp(-i pi / 2 X0 Y1) |00> = -i X0 Y1 |00> = |11>.
+  StateSpace ss(1);
+  auto sv = ss.Create(2);
+  ss.SetStateZero(sv);
+
+  PauliTerm term;
+  AddPauli(&term, "0", "X");
+  AddPauli(&term, "1", "Y");
+  PauliRotation rotation;
+  ASSERT_EQ(PauliRotationFromTerm(term, 2, &rotation), Status());
+
+  // Split ranges must give the same result as a single pass.
+  ApplyPauliRotation(ss, sv, rotation, M_PI / 2, 0, 2);
+  ApplyPauliRotation(ss, sv, rotation, M_PI / 2, 2, 4);
+
+  for (uint64_t j = 0; j < 3; j++) {
+    EXPECT_NEAR(std::abs(ss.GetAmpl(sv, j)), 0.0, 1e-5);
+  }
+  EXPECT_NEAR(ss.GetAmpl(sv, 3).real(), 1.0, 1e-5);
+  EXPECT_NEAR(ss.GetAmpl(sv, 3).imag(), 0.0, 1e-5);
+}
+
+TEST(PauliEvolutionTest, TrotterStepSecondOrder) {
+  std::vector<PauliRotation> rotations(3);
+  rotations[0].coefficient = 1.0;
+  rotations[1].coefficient = 2.0;
+  rotations[2].coefficient = 3.0;
+
+  const auto first = TrotterStep(rotations, 0.1, 1);
+  ASSERT_EQ(first.size(), 3);
+  EXPECT_NEAR(first[2].second, 0.3, 1e-9);
+
+  const auto second = TrotterStep(rotations, 0.1, 2);
+  const std::vector<int> order = {0, 1, 2, 1, 0};
+  ASSERT_EQ(second.size(), order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    EXPECT_EQ(second[i].first, order[i]);
+  }
+  EXPECT_NEAR(second[0].second, 0.05, 1e-9);
+  EXPECT_NEAR(second[2].second, 0.3, 1e-9);
+}
+
+TEST(PauliEvolutionTest, EvolvePauliSumCommuting) {
+  // Z0 Z1 + 0.5 Z1 commute, so a single Trotter step is exact and only
+  // phases the basis states.
+  PauliSum p_sum;
+  PauliTerm* zz = p_sum.add_terms();
+  zz->set_coefficient_real(1.0);
+  AddPauli(zz, "0", "Z");
+  AddPauli(zz, "1", "Z");
+  PauliTerm* z = p_sum.add_terms();
+  z->set_coefficient_real(0.5);
+  AddPauli(z, "1", "Z");
+
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto sv = ss.Create(2);
+  ss.SetStateZero(sv);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0),
+                  sv);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 1, 1.0, 0.0),
+                  sv);
+
+  const double time = 0.7;
+  ASSERT_EQ(EvolvePauliSum(ss, sv, p_sum, 2, time, 1, 1), Status());
+  for (uint64_t j = 0; j < 4; j++) {
+    const double z0 = (j & 2) ? -1.0 : 1.0;
+    const double z1 = (j & 1) ? -1.0 : 1.0;
+    const double energy = z0 * z1 + 0.5 * z1;
+    EXPECT_NEAR(ss.GetAmpl(sv, j).real(), 0.5 * std::cos(energy * time),
+                1e-5);
+    EXPECT_NEAR(ss.GetAmpl(sv, j).imag(), -0.5 * std::sin(energy * time),
+                1e-5);
+  }
+}
+
+}  // namespace
+}  // namespace tfq
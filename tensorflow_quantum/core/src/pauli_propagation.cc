@@ -0,0 +1,438 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/pauli_propagation.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <complex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+
+namespace tfq {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::Circuit<QsimGate> QsimCircuit;
+typedef qsim::NoisyCircuit<QsimGate> NoisyQsimCircuit;
+typedef qsim::Channel<QsimGate> QsimChannel;
+typedef std::complex<double> Complex;
+
+namespace {
+
+// Largest gate, counting controls, that ConjugateByGate expands.
+constexpr int kMaxGateQubits = 4;
+
+// Entry (r, c) of the single qubit Pauli with code 0, 1, 2, 3 = I, X, Y, Z.
+Complex PauliEntry(const int pauli, const int r, const int c) {
+  switch (pauli) {
+    case 1:
+      return r != c ? Complex(1, 0) : Complex(0, 0);
+    case 2:
+      if (r == c) {
+        return Complex(0, 0);
+      }
+      return r == 0 ? Complex(0, -1) : Complex(0, 1);
+    case 3:
+      if (r != c) {
+        return Complex(0, 0);
+      }
+      return r == 0 ? Complex(1, 0) : Complex(-1, 0);
+    default:
+      return r == c ? Complex(1, 0) : Complex(0, 0);
+  }
+}
+
+// Entry (r, c) of the k qubit Pauli whose base 4 digit i acts on bit i of
+// the matrix index.
+Complex LocalPauliEntry(const int label, const int k, const int r,
+                        const int c) {
+  Complex entry(1, 0);
+  for (int i = 0; i < k; i++) {
+    entry *= PauliEntry((label >> (2 * i)) & 3, (r >> i) & 1, (c >> i) & 1);
+    if (entry == Complex(0, 0)) {
+      break;
+    }
+  }
+  return entry;
+}
+
+// The unitary of a gate over its target qubits followed by its control
+// qubits, and the decompositions of U^dagger P U into local Paulis, built
+// as they are needed.
+class GateConjugation {
+ public:
+  explicit GateConjugation(const QsimGate& gate) {
+    qubits_ = gate.qubits;
+    qubits_.insert(qubits_.end(), gate.controlled_by.begin(),
+                   gate.controlled_by.end());
+    k_ = qubits_.size();
+    dim_ = 1 << k_;
+    const int num_targets = gate.qubits.size();
+    const int target_dim = 1 << num_targets;
+    const uint64_t control_mask = (dim_ - 1) ^ (target_dim - 1);
+    const uint64_t control_values = gate.cmask << num_targets;
+
+    // Identity everywhere the controls are not all in their active state.
+    unitary_.assign(dim_ * dim_, Complex(0, 0));
+    for (int r = 0; r < dim_; r++) {
+      for (int c = 0; c < dim_; c++) {
+        if ((r & control_mask) != (c & control_mask)) {
+          continue;
+        }
+        if ((r & control_mask) != control_values) {
+          unitary_[r * dim_ + c] = r == c ? Complex(1, 0) : Complex(0, 0);
+          continue;
+        }
+        const int rt = r & (target_dim - 1);
+        const int ct = c & (target_dim - 1);
+        const int m = 2 * (rt * target_dim + ct);
+        unitary_[r * dim_ + c] = Complex(gate.matrix[m], gate.matrix[m + 1]);
+      }
+    }
+  }
+
+  const std::vector<unsigned int>& qubits() const { return qubits_; }
+
+  // Decomposition of U^dagger P U for the local Pauli with the given label
+  // as (label, coefficient) pairs.
+  const std::vector<std::pair<int, double>>& Decompose(const int label) {
+    auto it = decompositions_.find(label);
+    if (it != decompositions_.end()) {
+      return it->second;
+    }
+
+    // A = U^dagger P U.
+    std::vector<Complex> pu(dim_ * dim_, Complex(0, 0));
+    for (int r = 0; r < dim_; r++) {
+      for (int c = 0; c < dim_; c++) {
+        for (int l = 0; l < dim_; l++) {
+          pu[r * dim_ + c] +=
+              LocalPauliEntry(label, k_, r, l) * unitary_[l * dim_ + c];
+        }
+      }
+    }
+    std::vector<Complex> a(dim_ * dim_, Complex(0, 0));
+    for (int r = 0; r < dim_; r++) {
+      for (int c = 0; c < dim_; c++) {
+        for (int l = 0; l < dim_; l++) {
+          a[r * dim_ + c] +=
+              std::conj(unitary_[l * dim_ + r]) * pu[l * dim_ + c];
+        }
+      }
+    }
+
+    // Coefficient of Q is Tr(Q A) / dim, real since A is Hermitian.
+    std::vector<std::pair<int, double>> terms;
+    for (int q = 0; q < (1 << (2 * k_)); q++) {
+      Complex trace(0, 0);
+      for (int r = 0; r < dim_; r++) {
+        for (int c = 0; c < dim_; c++) {
+          trace += LocalPauliEntry(q, k_, r, c) * a[c * dim_ + r];
+        }
+      }
+      const double coefficient = trace.real() / dim_;
+      if (std::fabs(coefficient) > 1e-9) {
+        terms.push_back({q, coefficient});
+      }
+    }
+    return decompositions_[label] = std::move(terms);
+  }
+
+ private:
+  std::vector<unsigned int> qubits_;
+  int k_;
+  int dim_;
+  std::vector<Complex> unitary_;
+  absl::flat_hash_map<int, std::vector<std::pair<int, double>>>
+      decompositions_;
+};
+
+// Code 0, 1, 2, 3 of the single qubit Pauli that the 2x2 gate matrix is
+// proportional to, or -1 if there is none.
+int PauliFromMatrix(const std::vector<float>& matrix) {
+  if (matrix.size() != 8) {
+    return -1;
+  }
+  Complex m[4];
+  double scale = 0.0;
+  for (int i = 0; i < 4; i++) {
+    m[i] = Complex(matrix[2 * i], matrix[2 * i + 1]);
+    scale = std::max(scale, std::abs(m[i]));
+  }
+  if (scale == 0.0) {
+    return -1;
+  }
+  for (int code = 0; code < 4; code++) {
+    // I and Z are nonzero at (0, 0), X and Y at (0, 1).
+    const int c0 = code == 1 || code == 2 ? 1 : 0;
+    const Complex phase = m[c0] / PauliEntry(code, 0, c0);
+    bool match = true;
+    for (int r = 0; r < 2 && match; r++) {
+      for (int c = 0; c < 2 && match; c++) {
+        match = std::abs(m[2 * r + c] - phase * PauliEntry(code, r, c)) <=
+                1e-5 * scale;
+      }
+    }
+    if (match) {
+      return code;
+    }
+  }
+  return -1;
+}
+
+// The Pauli string a Kraus operator applies, up to a phase. Returns false
+// unless the operator is a product of single qubit Paulis.
+bool KrausPauliString(const qsim::KrausOperator<QsimGate>& kop,
+                      PauliString* pauli) {
+  if (kop.kind != qsim::KrausOperator<QsimGate>::kNormal || !kop.unitary) {
+    return false;
+  }
+  *pauli = PauliString();
+  for (const QsimGate& op : kop.ops) {
+    if (op.qubits.size() != 1 || !op.controlled_by.empty()) {
+      return false;
+    }
+    const int code = PauliFromMatrix(op.matrix);
+    if (code < 0) {
+      return false;
+    }
+    // Products of Paulis on one qubit only add their bits, up to a phase.
+    const unsigned int q = op.qubits[0];
+    const uint64_t bit = uint64_t(1) << (q % 64);
+    if (code == 1 || code == 2) {
+      pauli->x[q / 64] ^= bit;
+    }
+    if (code == 2 || code == 3) {
+      pauli->z[q / 64] ^= bit;
+    }
+  }
+  return true;
+}
+
+bool Anticommute(const PauliString& a, const PauliString& b) {
+  size_t count = 0;
+  for (int w = 0; w < PauliString::kWords; w++) {
+    count += std::bitset<64>((a.x[w] & b.z[w]) ^ (a.z[w] & b.x[w])).count();
+  }
+  return count & 1;
+}
+
+}  // namespace
+
+Status PauliPolynomialFromPauliSum(const PauliSum& p_sum, const int num_qubits,
+                                   PauliPolynomial* observable) {
+  if (num_qubits > kMaxPropagationQubits) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("Pauli propagation supports at most ",
+                               kMaxPropagationQubits, " qubits. Got ",
+                               num_qubits, "."));
+  }
+  observable->clear();
+  for (const PauliTerm& term : p_sum.terms()) {
+    PauliString pauli;
+    for (const tfq::proto::PauliQubitPair& pair : term.paulis()) {
+      int q;
+      if (!absl::SimpleAtoi(pair.qubit_id(), &q) || q < 0 ||
+          q >= num_qubits) {
+        return Status(static_cast<tensorflow::error::Code>(
+                          absl::StatusCode::kInvalidArgument),
+                      "Unresolved qubit in PauliSum: " + pair.qubit_id());
+      }
+      int code = 0;
+      if (pair.pauli_type() == "X") {
+        code = 1;
+      } else if (pair.pauli_type() == "Y") {
+        code = 2;
+      } else if (pair.pauli_type() == "Z") {
+        code = 3;
+      } else {
+        return Status(static_cast<tensorflow::error::Code>(
+                          absl::StatusCode::kInvalidArgument),
+                      "Unknown pauli type: " + pair.pauli_type());
+      }
+      pauli.Set(num_qubits - q - 1, code);
+    }
+    (*observable)[pauli] += term.coefficient_real();
+  }
+  return ::tensorflow::Status();
+}
+
+Status ConjugateByGate(const QsimGate& gate, const double threshold,
+                       PauliPolynomial* observable) {
+  const int k = gate.qubits.size() + gate.controlled_by.size();
+  if (k > kMaxGateQubits) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  absl::StrCat("Pauli propagation supports gates on at most ",
+                               kMaxGateQubits, " qubits including controls. ",
+                               "Got ", k, "."));
+  }
+  if (gate.matrix.empty()) {
+    return Status(static_cast<tensorflow::error::Code>(
+                      absl::StatusCode::kInvalidArgument),
+                  "Pauli propagation only supports unitary gates.");
+  }
+
+  GateConjugation conjugation(gate);
+  const std::vector<unsigned int>& qubits = conjugation.qubits();
+  PauliPolynomial result;
+  result.reserve(observable->size());
+  for (const auto& entry : *observable) {
+    int label = 0;
+    for (int i = 0; i < k; i++) {
+      label |= entry.first.Get(qubits[i]) << (2 * i);
+    }
+    if (label == 0) {
+      // The gate commutes with strings that are identity on its qubits.
+      result[entry.first] += entry.second;
+      continue;
+    }
+    for (const auto& term : conjugation.Decompose(label)) {
+      PauliString pauli = entry.first;
+      for (int i = 0; i < k; i++) {
+        pauli.Set(qubits[i], (term.first >> (2 * i)) & 3);
+      }
+      result[pauli] += entry.second * term.second;
+    }
+  }
+
+  observable->clear();
+  for (const auto& entry : result) {
+    if (entry.second != 0.0 && std::fabs(entry.second) >= threshold) {
+      observable->insert(entry);
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+Status ComputeExpectationPauliPropagation(const QsimCircuit& circuit,
+                                          const PauliSum& p_sum,
+                                          const double threshold,
+                                          float* expectation_value) {
+  PauliPolynomial observable;
+  Status status =
+      PauliPolynomialFromPauliSum(p_sum, circuit.num_qubits, &observable);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // <0|G_1^dagger ... G_m^dagger O G_m ... G_1|0>, innermost gate first.
+  for (auto it = circuit.gates.rbegin(); it != circuit.gates.rend(); ++it) {
+    status = ConjugateByGate(*it, threshold, &observable);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  double total = 0.0;
+  for (const auto& entry : observable) {
+    if (entry.first.IsDiagonal()) {
+      total += entry.second;
+    }
+  }
+  *expectation_value = total;
+  return ::tensorflow::Status();
+}
+
+Status ConjugateByPauliChannel(const QsimChannel& channel,
+                               const double threshold,
+                               PauliPolynomial* observable) {
+  std::vector<PauliString> paulis(channel.size());
+  for (size_t k = 0; k < channel.size(); k++) {
+    if (!KrausPauliString(channel[k], &paulis[k])) {
+      return Status(static_cast<tensorflow::error::Code>(
+                        absl::StatusCode::kInvalidArgument),
+                    "Pauli propagation only supports Pauli channels "
+                    "(depolarizing, asymmetric depolarizing, bit flip and "
+                    "phase flip).");
+    }
+  }
+
+  for (auto it = observable->begin(); it != observable->end();) {
+    double factor = 0.0;
+    for (size_t k = 0; k < channel.size(); k++) {
+      factor += Anticommute(paulis[k], it->first) ? -channel[k].prob
+                                                  : channel[k].prob;
+    }
+    it->second *= factor;
+    if (it->second == 0.0 || std::fabs(it->second) < threshold) {
+      observable->erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+Status ComputeNoisyExpectationPauliPropagation(const NoisyQsimCircuit& ncircuit,
+                                               const PauliSum& p_sum,
+                                               const double threshold,
+                                               float* expectation_value) {
+  PauliPolynomial observable;
+  Status status =
+      PauliPolynomialFromPauliSum(p_sum, ncircuit.num_qubits, &observable);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Channels holding a single unitary operator are the gates.
+  for (auto it = ncircuit.channels.rbegin(); it != ncircuit.channels.rend();
+       ++it) {
+    const QsimChannel& channel = *it;
+    if (channel.size() == 1 && channel[0].unitary) {
+      for (auto op = channel[0].ops.rbegin(); op != channel[0].ops.rend();
+           ++op) {
+        status = ConjugateByGate(*op, threshold, &observable);
+        if (!status.ok()) {
+          return status;
+        }
+      }
+    } else {
+      status = ConjugateByPauliChannel(channel, threshold, &observable);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+
+  double total = 0.0;
+  for (const auto& entry : observable) {
+    if (entry.first.IsDiagonal()) {
+      total += entry.second;
+    }
+  }
+  *expectation_value = total;
+  return ::tensorflow::Status();
+}
+
+}  // namespace tfq
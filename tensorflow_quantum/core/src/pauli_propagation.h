@@ -0,0 +1,134 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_PAULI_PROPAGATION_H_
+#define TFQ_CORE_SRC_PAULI_PROPAGATION_H_
+
+#include <array>
+#include <cstdint>
+#include <utility>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "absl/container/flat_hash_map.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+
+namespace tfq {
+
+// Heisenberg picture simulation: instead of evolving |0> forwards through a
+// circuit, the observable is conjugated backwards through it, gate by gate,
+// as a weighted sum of Pauli strings. Clifford gates map every string to a
+// single string, so the sum only grows at non-Clifford gates, and terms
+// with a coefficient below a threshold are dropped as they appear. Cost
+// depends on the number of strings rather than on 2 ** num_qubits.
+
+// Largest circuit Pauli propagation supports.
+constexpr int kMaxPropagationQubits = 256;
+
+// A Hermitian Pauli string as X and Z bitmasks over qsim qubit indices. Y
+// sets both bits.
+struct PauliString {
+  static constexpr int kWords = kMaxPropagationQubits / 64;
+  std::array<uint64_t, kWords> x{};
+  std::array<uint64_t, kWords> z{};
+
+  // 0, 1, 2, 3 for I, X, Y, Z on qubit q.
+  int Get(const unsigned int q) const {
+    const int xb = (x[q / 64] >> (q % 64)) & 1;
+    const int zb = (z[q / 64] >> (q % 64)) & 1;
+    return zb ? 3 - xb : xb;
+  }
+
+  void Set(const unsigned int q, const int pauli) {
+    const uint64_t bit = uint64_t(1) << (q % 64);
+    x[q / 64] &= ~bit;
+    z[q / 64] &= ~bit;
+    if (pauli == 1 || pauli == 2) {
+      x[q / 64] |= bit;
+    }
+    if (pauli == 2 || pauli == 3) {
+      z[q / 64] |= bit;
+    }
+  }
+
+  // True when the string only holds I and Z, so <0|P|0> = 1. Every other
+  // string has <0|P|0> = 0.
+  bool IsDiagonal() const {
+    for (const uint64_t word : x) {
+      if (word != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool operator==(const PauliString& other) const {
+    return x == other.x && z == other.z;
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const PauliString& p) {
+    return H::combine(std::move(h), p.x, p.z);
+  }
+};
+
+// An observable as a sum of Pauli strings with real coefficients.
+typedef absl::flat_hash_map<PauliString, double> PauliPolynomial;
+
+// Converts a PauliSum with resolved qubit ids into a PauliPolynomial on a
+// circuit with num_qubits qubits, using the qubit order of the circuit
+// parser.
+tensorflow::Status PauliPolynomialFromPauliSum(
+    const tfq::proto::PauliSum& p_sum, const int num_qubits,
+    PauliPolynomial* observable);
+
+// Replaces observable with gate^dagger observable gate, dropping terms
+// whose coefficient magnitude falls below threshold. Gates may act on at
+// most four qubits, counting controls.
+tensorflow::Status ConjugateByGate(const qsim::Cirq::GateCirq<float>& gate,
+                                   const double threshold,
+                                   PauliPolynomial* observable);
+
+// Computes <0|U^dagger p_sum U|0> for the unitary U of circuit by
+// propagating p_sum backwards through its gates.
+tensorflow::Status ComputeExpectationPauliPropagation(
+    const qsim::Circuit<qsim::Cirq::GateCirq<float>>& circuit,
+    const tfq::proto::PauliSum& p_sum, const double threshold,
+    float* expectation_value);
+
+// Replaces observable with sum_k p_k K_k^dagger observable K_k for a Pauli
+// channel, where every K_k is a Pauli string. Each string P is only scaled,
+// by sum_k p_k (-1)^[K_k anticommutes with P], so no strings are created.
+// Fails for channels that are not mixtures of Pauli strings.
+tensorflow::Status ConjugateByPauliChannel(
+    const qsim::Channel<qsim::Cirq::GateCirq<float>>& channel,
+    const double threshold, PauliPolynomial* observable);
+
+// Computes the noisy expectation value Tr(p_sum E(|0><0|)) of ncircuit
+// exactly, by propagating p_sum backwards through its gates and channels.
+// Gates may be any unitary gates ConjugateByGate supports and channels must
+// be Pauli channels (depolarizing, asymmetric depolarizing, bit flip and
+// phase flip), so no trajectories are sampled.
+tensorflow::Status ComputeNoisyExpectationPauliPropagation(
+    const qsim::NoisyCircuit<qsim::Cirq::GateCirq<float>>& ncircuit,
+    const tfq::proto::PauliSum& p_sum, const double threshold,
+    float* expectation_value);
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_PAULI_PROPAGATION_H_
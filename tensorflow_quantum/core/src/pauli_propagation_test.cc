@@ -0,0 +1,229 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/pauli_propagation.h"
+
+#include <string>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/channels_cirq.h"
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/formux.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/simmux.h"
+#include "gtest/gtest.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliQubitPair;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+
+typedef qsim::Cirq::GateCirq<float> QsimGate;
+typedef qsim::Circuit<QsimGate> QsimCircuit;
+typedef qsim::NoisyCircuit<QsimGate> NoisyQsimCircuit;
+
+void AddPauli(PauliTerm* term, const std::string& qubit_id,
+              const std::string& pauli_type) {
+  PauliQubitPair* pair = term->add_paulis();
+  pair->set_qubit_id(qubit_id);
+  pair->set_pauli_type(pauli_type);
+}
+
+TEST(PauliPropagationTest, PauliStringGetSet) {
+  PauliString pauli;
+  pauli.Set(3, 1);
+  pauli.Set(70, 2);
+  pauli.Set(200, 3);
+  EXPECT_EQ(pauli.Get(3), 1);
+  EXPECT_EQ(pauli.Get(70), 2);
+  EXPECT_EQ(pauli.Get(200), 3);
+  EXPECT_EQ(pauli.Get(4), 0);
+  EXPECT_FALSE(pauli.IsDiagonal());
+  pauli.Set(3, 0);
+  pauli.Set(70, 3);
+  EXPECT_TRUE(pauli.IsDiagonal());
+}
+
+TEST(PauliPropagationTest, MatchesStateVector) {
+  // Clifford gates, small rotations and a controlled gate on three qubits.
+  QsimCircuit circuit;
+  circuit.num_qubits = 3;
+  circuit.gates.push_back(qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0));
+  circuit.gates.push_back(
+      qsim::Cirq::CXPowGate<float>::Create(1, 0, 1, 1.0, 0.0));
+  circuit.gates.push_back(qsim::Cirq::ZPowGate<float>::Create(2, 1, 0.25, 0.0));
+  circuit.gates.push_back(
+      qsim::Cirq::XPowGate<float>::Create(3, 2, 0.1, -0.5));
+  QsimGate controlled = qsim::Cirq::YPowGate<float>::Create(4, 1, 0.3, 0.0);
+  qsim::MakeControlledGate({2}, {0}, controlled);
+  circuit.gates.push_back(controlled);
+  circuit.gates.push_back(
+      qsim::Cirq::CZPowGate<float>::Create(5, 0, 2, 0.7, 0.0));
+  circuit.gates.push_back(qsim::Cirq::HPowGate<float>::Create(6, 1, 1.0, 0.0));
+
+  PauliSum p_sum;
+  PauliTerm* term = p_sum.add_terms();
+  term->set_coefficient_real(0.5);
+  AddPauli(term, "0", "X");
+  AddPauli(term, "2", "Z");
+  term = p_sum.add_terms();
+  term->set_coefficient_real(-1.5);
+  AddPauli(term, "1", "Y");
+  term = p_sum.add_terms();
+  term->set_coefficient_real(2.0);
+  AddPauli(term, "0", "Z");
+  AddPauli(term, "1", "X");
+  AddPauli(term, "2", "Y");
+  term = p_sum.add_terms();
+  term->set_coefficient_real(0.25);
+
+  qsim::Simulator<qsim::SequentialFor> sim(1);
+  qsim::Simulator<qsim::SequentialFor>::StateSpace ss(1);
+  auto sv = ss.Create(3);
+  auto scratch = ss.Create(3);
+  ss.SetStateZero(sv);
+  for (const QsimGate& gate : circuit.gates) {
+    qsim::ApplyGate(sim, gate, sv);
+  }
+  float expected = 0.0;
+  ASSERT_EQ(ComputeExpectationQsim(p_sum, sim, ss, sv, scratch, &expected),
+            Status());
+
+  float actual = 0.0;
+  ASSERT_EQ(ComputeExpectationPauliPropagation(circuit, p_sum, 0.0, &actual),
+            Status());
+  EXPECT_NEAR(actual, expected, 1e-5);
+}
+
+TEST(PauliPropagationTest, CliffordDoesNotBranch) {
+  // Conjugating by a Clifford gate maps a string to a single string.
+  PauliPolynomial observable;
+  PauliString pauli;
+  pauli.Set(0, 1);
+  observable[pauli] = 1.0;
+  ASSERT_EQ(ConjugateByGate(qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0),
+                            0.0, &observable),
+            Status());
+  ASSERT_EQ(observable.size(), 1);
+  EXPECT_EQ(observable.begin()->first.Get(0), 3);
+  EXPECT_NEAR(observable.begin()->second, 1.0, 1e-6);
+}
+
+TEST(PauliPropagationTest, TruncationDropsSmallTerms) {
+  // Rx(theta)^dagger Z Rx(theta) = cos(theta) Z + sin(theta) Y.
+  const float exponent = 0.01;
+  PauliPolynomial observable;
+  PauliString pauli;
+  pauli.Set(0, 3);
+  observable[pauli] = 1.0;
+  PauliPolynomial truncated = observable;
+
+  const QsimGate gate =
+      qsim::Cirq::XPowGate<float>::Create(0, 0, exponent, -0.5);
+  ASSERT_EQ(ConjugateByGate(gate, 0.0, &observable), Status());
+  EXPECT_EQ(observable.size(), 2);
+  ASSERT_EQ(ConjugateByGate(gate, 0.1, &truncated), Status());
+  EXPECT_EQ(truncated.size(), 1);
+}
+
+TEST(PauliPropagationTest, LargeGhzState) {
+  // 100 qubits is far beyond state vectors but a Clifford circuit keeps a
+  // single string per term.
+  const int n = 100;
+  QsimCircuit circuit;
+  circuit.num_qubits = n;
+  circuit.gates.push_back(qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0));
+  for (int q = 0; q < n - 1; q++) {
+    circuit.gates.push_back(
+        qsim::Cirq::CXPowGate<float>::Create(q + 1, q, q + 1, 1.0, 0.0));
+  }
+
+  PauliSum p_sum;
+  PauliTerm* zz = p_sum.add_terms();
+  zz->set_coefficient_real(1.0);
+  AddPauli(zz, "0", "Z");
+  AddPauli(zz, std::to_string(n - 1), "Z");
+  PauliTerm* xs = p_sum.add_terms();
+  xs->set_coefficient_real(0.5);
+  for (int q = 0; q < n; q++) {
+    AddPauli(xs, std::to_string(q), "X");
+  }
+  PauliTerm* z = p_sum.add_terms();
+  z->set_coefficient_real(2.0);
+  AddPauli(z, "3", "Z");
+
+  float actual = 0.0;
+  ASSERT_EQ(ComputeExpectationPauliPropagation(circuit, p_sum, 1e-6, &actual),
+            Status());
+  EXPECT_NEAR(actual, 1.5, 1e-5);
+}
+
+TEST(PauliPropagationTest, NoisyBellState) {
+  // Bit flip(p) scales Z strings on its qubit by 1 - 2p and depolarizing(p)
+  // scales every non identity string on its qubit by 1 - 4p / 3.
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 2;
+  ncircuit.channels.push_back(qsim::MakeChannelFromGate(
+      0, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0)));
+  ncircuit.channels.push_back(qsim::MakeChannelFromGate(
+      1, qsim::Cirq::CXPowGate<float>::Create(1, 0, 1, 1.0, 0.0)));
+  ncircuit.channels.push_back(
+      qsim::Cirq::BitFlipChannel<float>::Create(2, 1, 0.1));
+  ncircuit.channels.push_back(
+      qsim::Cirq::DepolarizingChannel<float>::Create(2, 0, 0.3));
+
+  PauliSum p_sum;
+  PauliTerm* zz = p_sum.add_terms();
+  zz->set_coefficient_real(1.0);
+  AddPauli(zz, "0", "Z");
+  AddPauli(zz, "1", "Z");
+  PauliTerm* xx = p_sum.add_terms();
+  xx->set_coefficient_real(0.5);
+  AddPauli(xx, "0", "X");
+  AddPauli(xx, "1", "X");
+
+  float actual = 0.0;
+  ASSERT_EQ(
+      ComputeNoisyExpectationPauliPropagation(ncircuit, p_sum, 0.0, &actual),
+      Status());
+  EXPECT_NEAR(actual, 0.8 * 0.6 + 0.5 * 0.6, 1e-5);
+
+  // Amplitude damping is not a mixture of Pauli strings.
+  ncircuit.channels.push_back(
+      qsim::Cirq::AmplitudeDampingChannel<float>::Create(3, 0, 0.1));
+  EXPECT_FALSE(
+      ComputeNoisyExpectationPauliPropagation(ncircuit, p_sum, 0.0, &actual)
+          .ok());
+}
+
+TEST(PauliPropagationTest, Errors) {
+  PauliPolynomial observable;
+  PauliSum p_sum;
+  AddPauli(p_sum.add_terms(), "5", "Z");
+  EXPECT_FALSE(PauliPolynomialFromPauliSum(p_sum, 2, &observable).ok());
+  EXPECT_FALSE(PauliPolynomialFromPauliSum(PauliSum(), 300, &observable).ok());
+}
+
+}  // namespace
+}  // namespace tfq
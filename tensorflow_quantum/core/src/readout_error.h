@@ -0,0 +1,129 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_READOUT_ERROR_H_
+#define TFQ_CORE_SRC_READOUT_ERROR_H_
+
+#include <cmath>
+#include <cstdint>
+
+namespace tfq {
+
+// Readout errors act independently on every qubit: a measured 0 is read as
+// 1 with probability p0to1 and a measured 1 is read as 0 with probability
+// p1to0. Shots of one qubit are packed 64 to a word, so a whole word of
+// shots is flipped with a couple of bit operations on random masks.
+
+// Number of uniform 32 bit values, out of 2^32, below which a draw counts
+// as a flip with probability p.
+inline uint64_t ReadoutThreshold(const double p) {
+  if (p <= 0.0) {
+    return 0;
+  }
+  if (p >= 1.0) {
+    return uint64_t(1) << 32;
+  }
+  return static_cast<uint64_t>(p * 4294967296.0);
+}
+
+// Thresholds below this, flip probabilities under 1/16, build their masks
+// from geometric skips between set bits rather than from bit planes.
+constexpr uint64_t kGeometricReadoutThreshold = uint64_t(1) << 28;
+
+// Returns a uniform 64 bit word made of two draws of next().
+template <typename RandomT>
+uint64_t RandomWord(RandomT& next) {
+  const uint64_t high = next();
+  const uint64_t low = next();
+  return (high << 32) | low;
+}
+
+// Returns a mask whose 64 bits are set independently with probability
+// threshold / 2^32. next() must return uniform 32 bit values. No values are
+// drawn for a zero threshold or a threshold of 2^32.
+//
+// Small thresholds jump from one set bit to the next, drawing about
+// 64 * threshold / 2^32 + 1 values. Larger ones compare 64 uniform 32 bit
+// values with the threshold together, one bit plane per random word from the
+// most significant bit down. A bit is decided at the first plane where its
+// value differs from the threshold, so about half of the undecided bits
+// settle on every word and a mask takes around 8 words instead of 64 draws.
+template <typename RandomT>
+uint64_t BernoulliMask(const uint64_t threshold, RandomT& next) {
+  if (threshold == 0) {
+    return 0;
+  }
+  if (threshold >= uint64_t(1) << 32) {
+    return ~uint64_t(0);
+  }
+
+  uint64_t mask = 0;
+  if (threshold < kGeometricReadoutThreshold) {
+    const double log_q =
+        std::log1p(-static_cast<double>(threshold) / 4294967296.0);
+    int b = -1;
+    while (true) {
+      const double u = (static_cast<double>(next()) + 0.5) / 4294967296.0;
+      const double skip = std::floor(std::log(u) / log_q);
+      if (skip > 62 - b) {
+        break;
+      }
+      b += 1 + static_cast<int>(skip);
+      mask |= uint64_t(1) << b;
+    }
+    return mask;
+  }
+
+  uint64_t undecided = ~uint64_t(0);
+  for (int plane = 31; plane >= 0 && undecided != 0; plane--) {
+    const uint64_t word = RandomWord(next);
+    if ((threshold >> plane) & 1) {
+      // Values with a 0 here are below the threshold.
+      mask |= undecided & ~word;
+      undecided &= word;
+    } else {
+      // Values with a 1 here are above it.
+      undecided &= ~word;
+    }
+  }
+  // Values still undecided equal the threshold and are not below it.
+  return mask;
+}
+
+// Flips the packed shots in bits that read 0 where flips0 is set and those
+// that read 1 where flips1 is set.
+inline uint64_t ApplyReadoutFlips(const uint64_t bits, const uint64_t flips0,
+                                  const uint64_t flips1) {
+  return bits ^ ((~bits & flips0) | (bits & flips1));
+}
+
+// Single shot estimates of <Z> for a qubit read as 0 and as 1. Their
+// expectation under the readout error is the noiseless <Z>, and since errors
+// are independent between qubits the product of these values over the qubits
+// of a Z string estimates the noiseless string without bias (tensored
+// mitigation). Requires p0to1 + p1to0 < 1.
+struct MitigatedZ {
+  double zero;
+  double one;
+};
+
+inline MitigatedZ MitigatedZValues(const double p0to1, const double p1to0) {
+  const double det = 1.0 - p0to1 - p1to0;
+  return {(1.0 + p0to1 - p1to0) / det, (p0to1 - p1to0 - 1.0) / det};
+}
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_READOUT_ERROR_H_
@@ -0,0 +1,114 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/readout_error.h"
+
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace tfq {
+namespace {
+
+// Counts the values drawn from a std::mt19937.
+struct CountingRandom {
+  explicit CountingRandom(const int seed) : gen(seed) {}
+  uint32_t operator()() {
+    num_draws++;
+    return static_cast<uint32_t>(gen());
+  }
+  std::mt19937 gen;
+  int num_draws = 0;
+};
+
+TEST(ReadoutErrorTest, BernoulliMask) {
+  CountingRandom gen(1234);
+  EXPECT_EQ(BernoulliMask(ReadoutThreshold(0.0), gen), 0);
+  EXPECT_EQ(BernoulliMask(ReadoutThreshold(1.0), gen), ~uint64_t(0));
+  EXPECT_EQ(gen.num_draws, 0);
+
+  // Covers both the geometric skips and the bit planes.
+  for (const double p : {0.01, 0.2, 0.5, 0.9}) {
+    int num_set = 0;
+    const int num_words = 2000;
+    for (int w = 0; w < num_words; w++) {
+      num_set +=
+          std::bitset<64>(BernoulliMask(ReadoutThreshold(p), gen)).count();
+    }
+    const double sigma = std::sqrt(p * (1.0 - p) / (64.0 * num_words));
+    EXPECT_NEAR(num_set / (64.0 * num_words), p, 5.0 * sigma);
+  }
+}
+
+TEST(ReadoutErrorTest, BernoulliMaskBitsAreIndependent) {
+  CountingRandom gen(4321);
+  const double p = 0.3;
+  const int num_words = 4000;
+  std::vector<int> counts(64, 0);
+  int num_both = 0;
+  for (int w = 0; w < num_words; w++) {
+    const uint64_t mask = BernoulliMask(ReadoutThreshold(p), gen);
+    for (int b = 0; b < 64; b++) {
+      counts[b] += (mask >> b) & 1;
+    }
+    num_both += (mask & 1) & ((mask >> 1) & 1);
+  }
+  for (int b = 0; b < 64; b++) {
+    EXPECT_NEAR(counts[b] / double(num_words), p, 0.04);
+  }
+  EXPECT_NEAR(num_both / double(num_words), p * p, 0.03);
+}
+
+TEST(ReadoutErrorTest, BernoulliMaskDraws) {
+  const int num_words = 1000;
+  for (const double p : {0.001, 0.3}) {
+    CountingRandom gen(99);
+    for (int w = 0; w < num_words; w++) {
+      BernoulliMask(ReadoutThreshold(p), gen);
+    }
+    // Far below the 64 draws a word of independent comparisons takes.
+    EXPECT_LT(gen.num_draws, 24 * num_words);
+  }
+}
+
+TEST(ReadoutErrorTest, ApplyReadoutFlips) {
+  const uint64_t bits = 0b1100;
+  // Only zeros flip.
+  EXPECT_EQ(ApplyReadoutFlips(bits, 0b1111, 0), 0b1111);
+  // Only ones flip.
+  EXPECT_EQ(ApplyReadoutFlips(bits, 0, 0b1111), 0);
+  // Masks only act on the matching readings.
+  EXPECT_EQ(ApplyReadoutFlips(bits, 0b0110, 0b0110), 0b1010);
+}
+
+TEST(ReadoutErrorTest, MitigatedZValues) {
+  const MitigatedZ ideal = MitigatedZValues(0.0, 0.0);
+  EXPECT_DOUBLE_EQ(ideal.zero, 1.0);
+  EXPECT_DOUBLE_EQ(ideal.one, -1.0);
+
+  // Averaged over the readout error the estimate is the noiseless <Z>.
+  const double p0to1 = 0.05;
+  const double p1to0 = 0.15;
+  const MitigatedZ z = MitigatedZValues(p0to1, p1to0);
+  EXPECT_NEAR((1.0 - p0to1) * z.zero + p0to1 * z.one, 1.0, 1e-12);
+  EXPECT_NEAR(p1to0 * z.zero + (1.0 - p1to0) * z.one, -1.0, 1e-12);
+}
+
+}  // namespace
+}  // namespace tfq
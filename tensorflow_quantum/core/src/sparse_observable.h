@@ -0,0 +1,149 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_SPARSE_OBSERVABLE_H_
+#define TFQ_CORE_SRC_SPARSE_OBSERVABLE_H_
+
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace tfq {
+
+// A matrix observable over the full Hilbert space of a circuit in
+// compressed sparse row form over its nonzero rows only, so memory grows
+// with the number of entries and not with the dimension. Basis states are
+// ordered as in the output of tfq_simulate_state, so entry (r, c) is
+// <r|O|c>. Applying it to a state is a single sparse matrix-vector product,
+// however many Pauli strings the matrix would expand into.
+struct SparseObservable {
+  // Row indices of the nonzero rows in increasing order. Entries of row
+  // rows[k] are at positions row_ptr[k] to row_ptr[k + 1].
+  std::vector<int64_t> rows;
+  std::vector<int64_t> row_ptr;
+  std::vector<int64_t> cols;
+  std::vector<std::complex<float>> values;
+
+  // Number of nonzero rows.
+  uint64_t NumRows() const { return rows.size(); }
+
+  // Heap memory held by the observable.
+  uint64_t Bytes() const {
+    return (rows.capacity() + row_ptr.capacity() + cols.capacity()) *
+               sizeof(int64_t) +
+           values.capacity() * sizeof(std::complex<float>);
+  }
+};
+
+// Builds a SparseObservable from (row, col, value) entries given in any
+// order. Entries repeating a (row, col) pair add up. Indices must already be
+// validated to lie inside the matrix.
+inline void SparseObservableFromCoo(
+    const std::vector<int64_t>& rows, const std::vector<int64_t>& cols,
+    const std::vector<std::complex<float>>& values,
+    SparseObservable* observable) {
+  // A stable sort keeps the input order within a row, so sums over a row
+  // do not depend on how the entries were batched.
+  std::vector<size_t> order(rows.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&rows](size_t a, size_t b) { return rows[a] < rows[b]; });
+
+  observable->rows.clear();
+  observable->row_ptr.clear();
+  observable->cols.resize(rows.size());
+  observable->values.resize(rows.size());
+  for (size_t j = 0; j < order.size(); j++) {
+    const size_t k = order[j];
+    if (observable->rows.empty() || observable->rows.back() != rows[k]) {
+      observable->rows.push_back(rows[k]);
+      observable->row_ptr.push_back(j);
+    }
+    observable->cols[j] = cols[k];
+    observable->values[j] = values[k];
+  }
+  observable->row_ptr.push_back(rows.size());
+  observable->rows.shrink_to_fit();
+  observable->row_ptr.shrink_to_fit();
+}
+
+// Returns the contribution of nonzero rows [begin, end) to
+// <state|observable|state>, counting rows as in observable.rows. Summing
+// over disjoint row ranges gives the full expectation value, so ranges can
+// be handed to different threads.
+template <typename StateSpaceT, typename StateT>
+std::complex<double> SparseExpectation(const SparseObservable& observable,
+                                       const StateSpaceT& ss,
+                                       const StateT& state,
+                                       const uint64_t begin,
+                                       const uint64_t end) {
+  std::complex<double> total(0, 0);
+  for (uint64_t k = begin; k < end; k++) {
+    const int64_t row_begin = observable.row_ptr[k];
+    const int64_t row_end = observable.row_ptr[k + 1];
+    std::complex<double> row(0, 0);
+    for (int64_t j = row_begin; j < row_end; j++) {
+      row += std::complex<double>(observable.values[j]) *
+             std::complex<double>(ss.GetAmpl(state, observable.cols[j]));
+    }
+    total += std::conj(std::complex<double>(
+                 ss.GetAmpl(state, observable.rows[k]))) *
+             row;
+  }
+  return total;
+}
+
+// Adds weight * observable|state> to dest over nonzero rows [begin, end),
+// counting rows as in observable.rows. dest must be a different state from
+// state.
+template <typename StateSpaceT, typename StateT>
+void AccumulateSparseOperator(const SparseObservable& observable,
+                              const float weight, const StateSpaceT& ss,
+                              const StateT& state, StateT& dest,
+                              const uint64_t begin, const uint64_t end) {
+  for (uint64_t k = begin; k < end; k++) {
+    const int64_t row_begin = observable.row_ptr[k];
+    const int64_t row_end = observable.row_ptr[k + 1];
+    std::complex<float> row(0, 0);
+    for (int64_t j = row_begin; j < row_end; j++) {
+      row += observable.values[j] * ss.GetAmpl(state, observable.cols[j]);
+    }
+    const int64_t r = observable.rows[k];
+    ss.SetAmpl(dest, r, ss.GetAmpl(dest, r) + weight * row);
+  }
+}
+
+// Computes (sum_j weights[j] * observables[j])|state> into dest, the sparse
+// counterpart of AccumulateOperators.
+template <typename StateSpaceT, typename StateT>
+void AccumulateSparseOperators(
+    const std::vector<SparseObservable>& observables,
+    const std::vector<float>& weights, const StateSpaceT& ss,
+    const StateT& state, StateT& dest) {
+  ss.SetAllZeros(dest);
+  for (size_t j = 0; j < observables.size(); j++) {
+    if (weights[j] == 0.0) {
+      continue;
+    }
+    AccumulateSparseOperator(observables[j], weights[j], ss, state, dest, 0,
+                             observables[j].NumRows());
+  }
+}
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_SPARSE_OBSERVABLE_H_
@@ -0,0 +1,195 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/sparse_observable.h"
+
+#include <complex>
+#include <vector>
+
+#include "../qsim/lib/formux.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/simmux.h"
+#include "gtest/gtest.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliQubitPair;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+
+typedef qsim::Simulator<qsim::SequentialFor> Simulator;
+typedef Simulator::StateSpace StateSpace;
+
+// 0.5 Z0 X1 - 0.25 Y1 on two qubits, with qubit 0 as the most significant
+// bit of the basis index.
+SparseObservable TwoQubitObservable() {
+  std::vector<int64_t> rows;
+  std::vector<int64_t> cols;
+  std::vector<std::complex<float>> values;
+  auto add = [&](int64_t r, int64_t c, std::complex<float> v) {
+    rows.push_back(r);
+    cols.push_back(c);
+    values.push_back(v);
+  };
+  // Z0 X1 is +X1 on rows 0, 1 and -X1 on rows 2, 3.
+  add(3, 2, -0.5);
+  add(0, 1, 0.5);
+  add(1, 0, 0.5);
+  add(2, 3, -0.5);
+  // Y1 = [[0, -i], [i, 0]] on both blocks.
+  for (int64_t block : {0, 2}) {
+    add(block, block + 1, std::complex<float>(0, 0.25));
+    add(block + 1, block, std::complex<float>(0, -0.25));
+  }
+  SparseObservable observable;
+  SparseObservableFromCoo(rows, cols, values, &observable);
+  return observable;
+}
+
+PauliSum TwoQubitPauliSum() {
+  PauliSum p_sum;
+  PauliTerm* zx = p_sum.add_terms();
+  zx->set_coefficient_real(0.5);
+  PauliQubitPair* pair = zx->add_paulis();
+  pair->set_qubit_id("0");
+  pair->set_pauli_type("Z");
+  pair = zx->add_paulis();
+  pair->set_qubit_id("1");
+  pair->set_pauli_type("X");
+  PauliTerm* y = p_sum.add_terms();
+  y->set_coefficient_real(-0.25);
+  pair = y->add_paulis();
+  pair->set_qubit_id("1");
+  pair->set_pauli_type("Y");
+  return p_sum;
+}
+
+TEST(SparseObservableTest, FromCoo) {
+  const SparseObservable observable = TwoQubitObservable();
+  ASSERT_EQ(observable.NumRows(), 4);
+  EXPECT_EQ(observable.rows, std::vector<int64_t>({0, 1, 2, 3}));
+  EXPECT_EQ(observable.row_ptr, std::vector<int64_t>({0, 2, 4, 6, 8}));
+  // Within a row, entries keep their input order.
+  EXPECT_EQ(observable.cols[0], 1);
+  EXPECT_EQ(observable.cols[1], 1);
+  EXPECT_EQ(observable.values[0], std::complex<float>(0.5, 0));
+}
+
+TEST(SparseObservableTest, OnlyStoresNonzeroRows) {
+  // Nothing is stored per row of the matrix, so a 2 ** 40 dimensional
+  // observable with a few entries stays small.
+  const int64_t last = (int64_t(1) << 40) - 1;
+  SparseObservable observable;
+  SparseObservableFromCoo({last, 5, last, 5}, {0, 5, 2, 5},
+                          {1.0, 2.0, 3.0, 4.0}, &observable);
+  ASSERT_EQ(observable.NumRows(), 2);
+  EXPECT_EQ(observable.rows, std::vector<int64_t>({5, last}));
+  EXPECT_EQ(observable.row_ptr, std::vector<int64_t>({0, 2, 4}));
+  EXPECT_EQ(observable.cols, std::vector<int64_t>({5, 5, 0, 2}));
+  EXPECT_LT(observable.Bytes(), uint64_t{1024});
+
+  SparseObservable empty;
+  SparseObservableFromCoo({}, {}, {}, &empty);
+  EXPECT_EQ(empty.NumRows(), 0);
+  EXPECT_EQ(empty.row_ptr, std::vector<int64_t>({0}));
+}
+
+TEST(SparseObservableTest, SkipsEmptyRows) {
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto sv = ss.Create(2);
+  auto actual = ss.Create(2);
+  ss.SetStateZero(sv);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0),
+                  sv);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(1, 1, 1.0, 0.0),
+                  sv);
+
+  // 2 |3><0| + |3><3|, applied to the uniform superposition.
+  SparseObservable observable;
+  SparseObservableFromCoo({3, 3}, {0, 3}, {2.0, 1.0}, &observable);
+  EXPECT_NEAR(SparseExpectation(observable, ss, sv, 0, 1).real(), 0.75,
+              1e-5);
+
+  AccumulateSparseOperators({observable}, {2.0}, ss, sv, actual);
+  for (uint64_t i = 0; i < 3; i++) {
+    EXPECT_NEAR(std::abs(ss.GetAmpl(actual, i)), 0.0, 1e-5);
+  }
+  EXPECT_NEAR(ss.GetAmpl(actual, 3).real(), 3.0, 1e-5);
+}
+
+TEST(SparseObservableTest, MatchesPauliSum) {
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto sv = ss.Create(2);
+  auto scratch = ss.Create(2);
+  ss.SetStateZero(sv);
+  qsim::ApplyGate(sim, qsim::Cirq::XPowGate<float>::Create(0, 0, 0.3, 0.0),
+                  sv);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(1, 1, 1.0, 0.0),
+                  sv);
+  qsim::ApplyGate(sim, qsim::Cirq::ZPowGate<float>::Create(2, 0, 0.4, 0.0),
+                  sv);
+  qsim::ApplyGate(sim, qsim::Cirq::YPowGate<float>::Create(3, 0, 0.2, 0.0),
+                  sv);
+
+  const PauliSum p_sum = TwoQubitPauliSum();
+  float expected = 0.0;
+  ASSERT_EQ(ComputeExpectationQsim(p_sum, sim, ss, sv, scratch, &expected),
+            Status());
+
+  const SparseObservable observable = TwoQubitObservable();
+  // Split the rows to check that partial sums add up.
+  const std::complex<double> actual =
+      SparseExpectation(observable, ss, sv, 0, 1) +
+      SparseExpectation(observable, ss, sv, 1, 4);
+  EXPECT_NEAR(actual.real(), expected, 1e-5);
+  EXPECT_NEAR(actual.imag(), 0.0, 1e-5);
+}
+
+TEST(SparseObservableTest, AccumulateMatchesPauliSum) {
+  Simulator sim(1);
+  StateSpace ss(1);
+  auto sv = ss.Create(2);
+  auto scratch = ss.Create(2);
+  auto expected = ss.Create(2);
+  auto actual = ss.Create(2);
+  ss.SetStateZero(sv);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0),
+                  sv);
+  qsim::ApplyGate(sim, qsim::Cirq::XPowGate<float>::Create(1, 1, 0.7, 0.0),
+                  sv);
+
+  ASSERT_EQ(AccumulateOperators({TwoQubitPauliSum(), TwoQubitPauliSum()},
+                                {2.0, -0.5}, sim, ss, sv, scratch, expected),
+            Status());
+  AccumulateSparseOperators({TwoQubitObservable(), TwoQubitObservable()},
+                            {2.0, -0.5}, ss, sv, actual);
+  for (uint64_t i = 0; i < 4; i++) {
+    EXPECT_NEAR(ss.GetAmpl(actual, i).real(), ss.GetAmpl(expected, i).real(),
+                1e-5);
+    EXPECT_NEAR(ss.GetAmpl(actual, i).imag(), ss.GetAmpl(expected, i).imag(),
+                1e-5);
+  }
+}
+
+}  // namespace
+}  // namespace tfq
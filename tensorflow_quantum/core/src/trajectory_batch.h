@@ -0,0 +1,398 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TFQ_CORE_SRC_TRAJECTORY_BATCH_H_
+#define TFQ_CORE_SRC_TRAJECTORY_BATCH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "../qsim/lib/circuit.h"
+#include "../qsim/lib/fuser.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/src/circuit_parser_qsim.h"
+#include "tensorflow_quantum/core/src/noisy_trajectory.h"
+
+namespace tfq {
+
+// Largest circuit for which trajectories are simulated in batches. Beyond
+// this a single state vector is big enough to keep the vector units busy.
+static const int kMaxTrajectoryBatchQubits = 12;
+
+// Number of trajectories simulated together in a batch.
+static const int kTrajectoryBatchSize = 32;
+
+// State vectors of num_lanes trajectories of the same circuit, interleaved
+// so that every gate runs over all trajectories in its innermost loop. The
+// real parts of amplitude i of all lanes are at data[2 * i * num_lanes], the
+// imaginary parts follow them. Qubit q is bit q of the amplitude index, as
+// in a qsim state vector.
+struct TrajectoryBatch {
+  unsigned num_qubits = 0;
+  unsigned num_lanes = 0;
+  std::vector<float> data;
+
+  void Resize(const unsigned nq, const unsigned lanes) {
+    num_qubits = nq;
+    num_lanes = lanes;
+    data.resize((uint64_t(2) << nq) * lanes);
+  }
+
+  float* Real(const uint64_t i) { return &data[2 * i * num_lanes]; }
+  float* Imag(const uint64_t i) { return &data[(2 * i + 1) * num_lanes]; }
+  const float* Real(const uint64_t i) const {
+    return &data[2 * i * num_lanes];
+  }
+  const float* Imag(const uint64_t i) const {
+    return &data[(2 * i + 1) * num_lanes];
+  }
+};
+
+// Sets every lane of batch to |0...0>.
+inline void SetBatchZero(TrajectoryBatch* batch) {
+  std::fill(batch->data.begin(), batch->data.end(), 0.0f);
+  std::fill(batch->Real(0), batch->Real(0) + batch->num_lanes, 1.0f);
+}
+
+// Applies the qsim matrix (row major, interleaved real and imaginary parts,
+// bit j of a row index is qubits[j]) to the amplitudes whose control qubits
+// cmask hold cvals. Only lanes with a nonzero lane_mask entry are written,
+// or all of them if lane_mask is null.
+inline void ApplyBatchedMatrix(const std::vector<unsigned>& qubits,
+                               const uint64_t cmask, const uint64_t cvals,
+                               const float* matrix, const char* lane_mask,
+                               TrajectoryBatch* batch) {
+  const unsigned lanes = batch->num_lanes;
+  const unsigned dim = 1 << qubits.size();
+  std::vector<uint64_t> offsets(dim, 0);
+  uint64_t gmask = 0;
+  for (unsigned m = 0; m < dim; m++) {
+    for (unsigned j = 0; j < qubits.size(); j++) {
+      if ((m >> j) & 1) {
+        offsets[m] |= uint64_t{1} << qubits[j];
+      }
+    }
+  }
+  for (const unsigned q : qubits) {
+    gmask |= uint64_t{1} << q;
+  }
+
+  std::vector<float> in_re(dim * lanes), in_im(dim * lanes);
+  std::vector<float> acc_re(lanes), acc_im(lanes);
+  const uint64_t size = uint64_t{1} << batch->num_qubits;
+  for (uint64_t i = 0; i < size; i++) {
+    if ((i & gmask) != 0 || (i & cmask) != cvals) {
+      continue;
+    }
+    for (unsigned c = 0; c < dim; c++) {
+      std::copy_n(batch->Real(i | offsets[c]), lanes, &in_re[c * lanes]);
+      std::copy_n(batch->Imag(i | offsets[c]), lanes, &in_im[c * lanes]);
+    }
+    for (unsigned r = 0; r < dim; r++) {
+      std::fill(acc_re.begin(), acc_re.end(), 0.0f);
+      std::fill(acc_im.begin(), acc_im.end(), 0.0f);
+      for (unsigned c = 0; c < dim; c++) {
+        const float mr = matrix[2 * (r * dim + c)];
+        const float mi = matrix[2 * (r * dim + c) + 1];
+        const float* xr = &in_re[c * lanes];
+        const float* xi = &in_im[c * lanes];
+        for (unsigned t = 0; t < lanes; t++) {
+          acc_re[t] += mr * xr[t] - mi * xi[t];
+          acc_im[t] += mr * xi[t] + mi * xr[t];
+        }
+      }
+      float* out_re = batch->Real(i | offsets[r]);
+      float* out_im = batch->Imag(i | offsets[r]);
+      if (lane_mask == nullptr) {
+        std::copy(acc_re.begin(), acc_re.end(), out_re);
+        std::copy(acc_im.begin(), acc_im.end(), out_im);
+      } else {
+        for (unsigned t = 0; t < lanes; t++) {
+          out_re[t] = lane_mask[t] ? acc_re[t] : out_re[t];
+          out_im[t] = lane_mask[t] ? acc_im[t] : out_im[t];
+        }
+      }
+    }
+  }
+}
+
+// Control mask and values of gate over the amplitude index.
+template <typename Gate>
+void BatchedControls(const Gate& gate, uint64_t* cmask, uint64_t* cvals) {
+  *cmask = 0;
+  *cvals = 0;
+  for (unsigned j = 0; j < gate.controlled_by.size(); j++) {
+    *cmask |= uint64_t{1} << gate.controlled_by[j];
+    if ((gate.cmask >> j) & 1) {
+      *cvals |= uint64_t{1} << gate.controlled_by[j];
+    }
+  }
+}
+
+inline void ApplyBatchedGate(const QsimGate& gate, const char* lane_mask,
+                             TrajectoryBatch* batch) {
+  uint64_t cmask, cvals;
+  BatchedControls(gate, &cmask, &cvals);
+  ApplyBatchedMatrix(gate.qubits, cmask, cvals, gate.matrix.data(), lane_mask,
+                     batch);
+}
+
+inline void ApplyBatchedFusedSegment(
+    const std::vector<qsim::GateFused<QsimGate>>& segment,
+    TrajectoryBatch* batch) {
+  for (const auto& fgate : segment) {
+    uint64_t cmask, cvals;
+    BatchedControls(*fgate.parent, &cmask, &cvals);
+    ApplyBatchedMatrix(fgate.qubits, cmask, cvals, fgate.matrix.data(),
+                       nullptr, batch);
+  }
+}
+
+// Squared norm of every lane.
+inline void BatchNorms(const TrajectoryBatch& batch,
+                       std::vector<double>* norms) {
+  const unsigned lanes = batch.num_lanes;
+  norms->assign(lanes, 0.0);
+  std::vector<float> acc(lanes, 0.0f);
+  const uint64_t size = uint64_t{1} << batch.num_qubits;
+  for (uint64_t i = 0; i < size; i++) {
+    const float* re = batch.Real(i);
+    const float* im = batch.Imag(i);
+    for (unsigned t = 0; t < lanes; t++) {
+      acc[t] += re[t] * re[t] + im[t] * im[t];
+    }
+  }
+  for (unsigned t = 0; t < lanes; t++) {
+    (*norms)[t] = acc[t];
+  }
+}
+
+// Re <a_t|b_t> for every lane t.
+inline void BatchRealInnerProducts(const TrajectoryBatch& a,
+                                   const TrajectoryBatch& b,
+                                   std::vector<double>* products) {
+  const unsigned lanes = a.num_lanes;
+  products->assign(lanes, 0.0);
+  std::vector<float> acc(lanes, 0.0f);
+  const uint64_t size = uint64_t{1} << a.num_qubits;
+  for (uint64_t i = 0; i < size; i++) {
+    const float* ar = a.Real(i);
+    const float* ai = a.Imag(i);
+    const float* br = b.Real(i);
+    const float* bi = b.Imag(i);
+    for (unsigned t = 0; t < lanes; t++) {
+      acc[t] += ar[t] * br[t] + ai[t] * bi[t];
+    }
+  }
+  for (unsigned t = 0; t < lanes; t++) {
+    (*products)[t] = acc[t];
+  }
+}
+
+// Multiplies lane t by factors[t].
+inline void ScaleBatchLanes(const std::vector<float>& factors,
+                            TrajectoryBatch* batch) {
+  const unsigned lanes = batch->num_lanes;
+  const uint64_t size = uint64_t{2} << batch->num_qubits;
+  for (uint64_t i = 0; i < size; i++) {
+    float* x = &batch->data[i * lanes];
+    for (unsigned t = 0; t < lanes; t++) {
+      x[t] *= factors[t];
+    }
+  }
+}
+
+inline bool IsIdentityKrausOperator(const QsimKrausOperator& kop) {
+  for (const auto& op : kop.ops) {
+    if (!op.controlled_by.empty()) {
+      return false;
+    }
+    const unsigned dim = 1 << op.qubits.size();
+    for (unsigned r = 0; r < dim; r++) {
+      for (unsigned c = 0; c < dim; c++) {
+        const float re = op.matrix[2 * (r * dim + c)];
+        const float im = op.matrix[2 * (r * dim + c) + 1];
+        if (re != (r == c ? 1.0f : 0.0f) || im != 0.0f) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Which Kraus operators a lane may pick at a channel.
+enum BatchBranch : char {
+  kAnyBranch = 0,
+  kDominantBranch = 1,
+  kErrorBranch = 2,
+};
+
+// Applies one Kraus operator of channel to every normalized lane of batch,
+// drawn independently per lane among the operators branches[t] allows.
+// Lanes sharing an operator are updated together under a lane mask.
+inline void ApplyBatchedChannel(const QsimChannel& channel,
+                                const std::vector<char>& branches,
+                                std::mt19937_64& gen, TrajectoryBatch* batch,
+                                TrajectoryBatch* scratch) {
+  const unsigned lanes = batch->num_lanes;
+  const unsigned dominant = DominantKrausOperator(channel);
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+
+  // [kraus operator, lane] probabilities on the current lane states.
+  std::vector<std::vector<double>> probs(channel.size());
+  for (unsigned k = 0; k < channel.size(); k++) {
+    if (channel[k].unitary) {
+      probs[k].assign(lanes, channel[k].prob);
+      continue;
+    }
+    scratch->data = batch->data;
+    for (const auto& op : channel[k].ops) {
+      ApplyBatchedGate(op, nullptr, scratch);
+    }
+    BatchNorms(*scratch, &probs[k]);
+  }
+
+  std::vector<unsigned> picks(lanes, dominant);
+  for (unsigned t = 0; t < lanes; t++) {
+    if (branches[t] == kDominantBranch) {
+      continue;
+    }
+    double total = 0.0;
+    for (unsigned k = 0; k < channel.size(); k++) {
+      if (branches[t] == kAnyBranch || k != dominant) {
+        total += probs[k][t];
+      }
+    }
+    double r = distribution(gen) * total;
+    for (unsigned k = 0; k < channel.size(); k++) {
+      if ((branches[t] == kErrorBranch && k == dominant) ||
+          probs[k][t] <= 0.0) {
+        continue;
+      }
+      picks[t] = k;
+      if (r < probs[k][t]) {
+        break;
+      }
+      r -= probs[k][t];
+    }
+  }
+
+  std::vector<char> mask(lanes);
+  std::vector<float> factors(lanes);
+  for (unsigned k = 0; k < channel.size(); k++) {
+    bool picked = false;
+    for (unsigned t = 0; t < lanes; t++) {
+      mask[t] = picks[t] == k;
+      picked |= mask[t];
+    }
+    if (!picked ||
+        (channel[k].unitary && IsIdentityKrausOperator(channel[k]))) {
+      continue;
+    }
+    for (const auto& op : channel[k].ops) {
+      ApplyBatchedGate(op, mask.data(), batch);
+    }
+    if (!channel[k].unitary) {
+      for (unsigned t = 0; t < lanes; t++) {
+        const double p = probs[k][t];
+        factors[t] = mask[t] && p > 0.0 ? 1.0 / std::sqrt(p) : 1.0;
+      }
+      ScaleBatchLanes(factors, batch);
+    }
+  }
+}
+
+// Simulates batch->num_lanes independent trajectories of fcircuit from
+// |0...0> at once. The fused segments are applied to all lanes together
+// and only the Kraus operators differ between lanes. If stratum is not
+// null every lane is conditioned on at least one error, exactly like
+// RunErroneousTrajectory.
+inline void RunTrajectoryBatch(const FusedNoisyCircuit& fcircuit,
+                               const ErrorFreeStratum* stratum,
+                               const uint64_t seed, TrajectoryBatch* batch,
+                               TrajectoryBatch* scratch) {
+  const unsigned lanes = batch->num_lanes;
+  scratch->Resize(batch->num_qubits, lanes);
+  std::mt19937_64 gen(seed);
+  std::uniform_real_distribution<double> distribution(0.0, 1.0);
+
+  std::vector<size_t> first_error(lanes, 0);
+  if (stratum != nullptr) {
+    const auto& cdf = stratum->first_error_cdf;
+    for (unsigned t = 0; t < lanes; t++) {
+      const double u = distribution(gen) * stratum->ErrorProbability();
+      first_error[t] = std::min(
+          static_cast<size_t>(std::upper_bound(cdf.begin(), cdf.end(), u) -
+                              cdf.begin()),
+          cdf.size() - 1);
+    }
+  }
+
+  SetBatchZero(batch);
+  ApplyBatchedFusedSegment(fcircuit.segments[0], batch);
+  std::vector<char> branches(lanes);
+  for (size_t k = 0; k < fcircuit.channels.size(); k++) {
+    for (unsigned t = 0; t < lanes; t++) {
+      if (stratum == nullptr || k > first_error[t]) {
+        branches[t] = kAnyBranch;
+      } else {
+        branches[t] = k < first_error[t] ? kDominantBranch : kErrorBranch;
+      }
+    }
+    ApplyBatchedChannel(*fcircuit.channels[k], branches, gen, batch, scratch);
+    ApplyBatchedFusedSegment(fcircuit.segments[k + 1], batch);
+  }
+}
+
+// Adds <p_sum> of every lane of batch to values, using scratch.
+inline tensorflow::Status ComputeBatchedExpectation(
+    const tfq::proto::PauliSum& p_sum, const TrajectoryBatch& batch,
+    TrajectoryBatch* scratch, std::vector<double>* values) {
+  std::vector<double> products;
+  for (const tfq::proto::PauliTerm& term : p_sum.terms()) {
+    if (term.paulis_size() == 0) {
+      for (double& v : *values) {
+        v += term.coefficient_real();
+      }
+      continue;
+    }
+
+    qsim::Circuit<QsimGate> term_circuit;
+    tensorflow::Status status = QsimCircuitFromPauliTerm(
+        term, batch.num_qubits, &term_circuit, nullptr);
+    if (!status.ok()) {
+      return status;
+    }
+    *scratch = batch;
+    for (const auto& gate : term_circuit.gates) {
+      ApplyBatchedGate(gate, nullptr, scratch);
+    }
+    BatchRealInnerProducts(batch, *scratch, &products);
+    for (unsigned t = 0; t < batch.num_lanes; t++) {
+      (*values)[t] += term.coefficient_real() * products[t];
+    }
+  }
+  return ::tensorflow::Status();
+}
+
+}  // namespace tfq
+
+#endif  // TFQ_CORE_SRC_TRAJECTORY_BATCH_H_
@@ -0,0 +1,188 @@
+/* Copyright 2020 The TensorFlow Quantum Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_quantum/core/src/trajectory_batch.h"
+
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "../qsim/lib/channel.h"
+#include "../qsim/lib/channels_cirq.h"
+#include "../qsim/lib/circuit_noisy.h"
+#include "../qsim/lib/formux.h"
+#include "../qsim/lib/gate_appl.h"
+#include "../qsim/lib/gates_cirq.h"
+#include "../qsim/lib/simmux.h"
+#include "gtest/gtest.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
+#include "tensorflow_quantum/core/src/noisy_trajectory.h"
+#include "tensorflow_quantum/core/src/util_qsim.h"
+
+namespace tfq {
+namespace {
+
+using ::tensorflow::Status;
+using ::tfq::proto::PauliQubitPair;
+using ::tfq::proto::PauliSum;
+using ::tfq::proto::PauliTerm;
+
+typedef qsim::Simulator<qsim::SequentialFor> Simulator;
+
+void AddPauli(PauliTerm* term, const std::string& qubit_id,
+              const std::string& pauli_type) {
+  PauliQubitPair* pair = term->add_paulis();
+  pair->set_qubit_id(qubit_id);
+  pair->set_pauli_type(pauli_type);
+}
+
+NoisyQsimCircuit GateCircuit() {
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 3;
+  std::vector<QsimGate> gates;
+  gates.push_back(qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0));
+  gates.push_back(qsim::Cirq::CXPowGate<float>::Create(1, 0, 1, 1.0, 0.0));
+  gates.push_back(qsim::Cirq::ZPowGate<float>::Create(2, 1, 0.25, 0.0));
+  gates.push_back(qsim::Cirq::XPowGate<float>::Create(3, 2, 0.1, -0.5));
+  QsimGate controlled = qsim::Cirq::YPowGate<float>::Create(4, 1, 0.3, 0.0);
+  qsim::MakeControlledGate({2}, {0}, controlled);
+  gates.push_back(controlled);
+  gates.push_back(qsim::Cirq::CZPowGate<float>::Create(5, 0, 2, 0.7, 0.0));
+  for (const auto& gate : gates) {
+    ncircuit.channels.push_back(qsim::MakeChannelFromGate(gate.time, gate));
+  }
+  return ncircuit;
+}
+
+TEST(TrajectoryBatchTest, NoiselessMatchesStateVector) {
+  const NoisyQsimCircuit ncircuit = GateCircuit();
+  FusedNoisyCircuit fcircuit;
+  FuseNoisyCircuit(ncircuit, &fcircuit);
+
+  TrajectoryBatch batch, scratch;
+  batch.Resize(3, 5);
+  RunTrajectoryBatch(fcircuit, nullptr, 1234, &batch, &scratch);
+
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(3);
+  auto sv_scratch = ss.Create(3);
+  RunTrajectory(fcircuit, 0, sim, ss, sv, sv_scratch);
+
+  for (uint64_t i = 0; i < 8; i++) {
+    const std::complex<float> expected = ss.GetAmpl(sv, i);
+    for (unsigned t = 0; t < batch.num_lanes; t++) {
+      EXPECT_NEAR(batch.Real(i)[t], std::real(expected), 1e-5);
+      EXPECT_NEAR(batch.Imag(i)[t], std::imag(expected), 1e-5);
+    }
+  }
+
+  PauliSum p_sum;
+  PauliTerm* term = p_sum.add_terms();
+  term->set_coefficient_real(0.5);
+  AddPauli(term, "0", "X");
+  AddPauli(term, "2", "Z");
+  term = p_sum.add_terms();
+  term->set_coefficient_real(-1.5);
+  AddPauli(term, "1", "Y");
+  term = p_sum.add_terms();
+  term->set_coefficient_real(0.25);
+
+  float expected = 0.0;
+  ASSERT_EQ(ComputeExpectationQsim(p_sum, sim, ss, sv, sv_scratch, &expected),
+            Status());
+  std::vector<double> values(batch.num_lanes, 0.0);
+  ASSERT_EQ(ComputeBatchedExpectation(p_sum, batch, &scratch, &values),
+            Status());
+  for (const double v : values) {
+    EXPECT_NEAR(v, expected, 1e-5);
+  }
+}
+
+TEST(TrajectoryBatchTest, LanesSampleKrausOperatorsIndependently) {
+  // X followed by amplitude damping: a lane decays to |0> with p = 0.3.
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 1;
+  ncircuit.channels.push_back(qsim::MakeChannelFromGate(
+      0, qsim::Cirq::XPowGate<float>::Create(0, 0, 1.0, 0.0)));
+  ncircuit.channels.push_back(
+      qsim::Cirq::AmplitudeDampingChannel<float>::Create(1, 0, 0.3));
+  FusedNoisyCircuit fcircuit;
+  FuseNoisyCircuit(ncircuit, &fcircuit);
+
+  TrajectoryBatch batch, scratch;
+  batch.Resize(1, kTrajectoryBatchSize);
+  int num_decayed = 0;
+  const int num_batches = 30;
+  std::vector<double> norms;
+  for (int seed = 0; seed < num_batches; seed++) {
+    RunTrajectoryBatch(fcircuit, nullptr, seed, &batch, &scratch);
+    BatchNorms(batch, &norms);
+    for (unsigned t = 0; t < batch.num_lanes; t++) {
+      EXPECT_NEAR(norms[t], 1.0, 1e-5);
+      num_decayed += batch.Real(0)[t] * batch.Real(0)[t] > 0.5;
+    }
+  }
+  EXPECT_NEAR(num_decayed / double(num_batches * kTrajectoryBatchSize), 0.3,
+              0.05);
+
+  // Conditioned on an error every lane decays.
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  auto sv_scratch = ss.Create(1);
+  ErrorFreeStratum stratum;
+  RunErrorFreeTrajectory(fcircuit, sim, ss, sv, sv_scratch, &stratum);
+  RunTrajectoryBatch(fcircuit, &stratum, 7, &batch, &scratch);
+  for (unsigned t = 0; t < batch.num_lanes; t++) {
+    EXPECT_NEAR(batch.Real(0)[t] * batch.Real(0)[t], 1.0, 1e-5);
+  }
+}
+
+TEST(TrajectoryBatchTest, ConditionedLanesKeepSampling) {
+  // Two bit flips: conditioned on an error, |0> has probability 1/3.
+  NoisyQsimCircuit ncircuit;
+  ncircuit.num_qubits = 1;
+  ncircuit.channels.push_back(
+      qsim::Cirq::BitFlipChannel<float>::Create(0, 0, 0.5));
+  ncircuit.channels.push_back(
+      qsim::Cirq::BitFlipChannel<float>::Create(1, 0, 0.5));
+  FusedNoisyCircuit fcircuit;
+  FuseNoisyCircuit(ncircuit, &fcircuit);
+
+  Simulator sim(1);
+  Simulator::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  auto sv_scratch = ss.Create(1);
+  ErrorFreeStratum stratum;
+  RunErrorFreeTrajectory(fcircuit, sim, ss, sv, sv_scratch, &stratum);
+
+  TrajectoryBatch batch, scratch;
+  batch.Resize(1, kTrajectoryBatchSize);
+  int num_zero = 0;
+  const int num_batches = 20;
+  for (int seed = 0; seed < num_batches; seed++) {
+    RunTrajectoryBatch(fcircuit, &stratum, seed, &batch, &scratch);
+    for (unsigned t = 0; t < batch.num_lanes; t++) {
+      num_zero += batch.Real(0)[t] * batch.Real(0)[t] > 0.5;
+    }
+  }
+  EXPECT_NEAR(num_zero / double(num_batches * kTrajectoryBatchSize),
+              1.0 / 3.0, 0.06);
+}
+
+}  // namespace
+}  // namespace tfq
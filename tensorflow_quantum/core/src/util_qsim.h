@@ -16,11 +16,15 @@ limitations under the License.
 #ifndef UTIL_QSIM_H_
 #define UTIL_QSIM_H_
 
+#include <algorithm>
 #include <bitset>
+#include <cmath>
+#include <complex>
 #include <cstdint>
 #include <functional>
 #include <numeric>
 #include <random>
+#include <utility>
 #include <vector>
 
 #include "../qsim/lib/circuit.h"
@@ -28,8 +32,11 @@ limitations under the License.
 #include "../qsim/lib/gate_appl.h"
 #include "../qsim/lib/gates_cirq.h"
 #include "../qsim/lib/matrix.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/random/philox_random.h"
 #include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/platform/threadpool.h"
 #include "tensorflow_quantum/core/proto/pauli_sum.pb.h"
@@ -269,6 +276,339 @@ tensorflow::Status ComputeSampledExpectationQsim(
   return status;
 }
 
+// Adapts a SimplePhilox to the UniformRandomBitGenerator requirements so
+// that it can drive the distributions in <random>.
+struct PhiloxBitGenerator {
+  typedef uint32_t result_type;
+  explicit PhiloxBitGenerator(tensorflow::random::SimplePhilox* src)
+      : source(src) {}
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return ~result_type(0); }
+  result_type operator()() { return source->Rand32(); }
+  tensorflow::random::SimplePhilox* source;
+};
+
+// Largest number of Rand32 draws SampleTermParityQsim takes from its
+// random_source for one term. Callers reserving Philox samples for several
+// threads must reserve this many per term so that slices do not overlap.
+constexpr int kRandomDrawsPerTerm = 2;
+
+// Measures a single non-identity PauliTerm num_samples times and adds the
+// sum of the +1/-1 parity outcomes to parity_total. When binomial is true no
+// bitstrings are drawn: the parity of each shot is Bernoulli with
+// p_odd = (1 - <P>) / 2, so the number of odd outcomes is drawn once from
+// Binomial(num_samples, p_odd) using the exact <P>.
+// At most kRandomDrawsPerTerm values are drawn from random_source.
+// scratch is required to have memory initialized, but does not require
+// values in memory to be set.
+template <typename SimT, typename StateSpaceT, typename StateT>
+tensorflow::Status SampleTermParityQsim(
+    const tfq::proto::PauliTerm& term, const SimT& sim, const StateSpaceT& ss,
+    StateT& state, StateT& scratch, const int num_samples, const bool binomial,
+    tensorflow::random::SimplePhilox& random_source, int64_t* parity_total) {
+  if (num_samples == 0) {
+    return ::tensorflow::Status();
+  }
+  QsimCircuit main_circuit;
+  std::vector<qsim::GateFused<QsimGate>> fused_circuit;
+  tensorflow::Status status =
+      binomial ? QsimCircuitFromPauliTerm(term, state.num_qubits(),
+                                          &main_circuit, &fused_circuit)
+               : QsimZBasisCircuitFromPauliTerm(term, state.num_qubits(),
+                                                &main_circuit, &fused_circuit);
+  if (!status.ok()) {
+    return status;
+  }
+  ss.Copy(state, scratch);
+  for (const qsim::GateFused<QsimGate>& fused_gate : fused_circuit) {
+    qsim::ApplyFusedGate(sim, fused_gate, scratch);
+  }
+
+  if (binomial) {
+    const double exact = ss.RealInnerProduct(state, scratch);
+    // Clamp away float round off before using it as a probability.
+    const double p_odd = std::min(1.0, std::max(0.0, (1.0 - exact) / 2.0));
+    // std::binomial_distribution takes a data dependent number of draws, so
+    // it runs on its own generator seeded from random_source.
+    tensorflow::random::PhiloxRandom term_philox(random_source.Rand64());
+    tensorflow::random::SimplePhilox term_source(&term_philox);
+    PhiloxBitGenerator gen(&term_source);
+    std::binomial_distribution<int> distrib(num_samples, p_odd);
+    *parity_total += num_samples - 2 * int64_t(distrib(gen));
+    return status;
+  }
+
+  std::vector<uint64_t> state_samples =
+      ss.Sample(scratch, num_samples, random_source.Rand32());
+  uint64_t mask = 0;
+  for (const tfq::proto::PauliQubitPair& pair : term.paulis()) {
+    unsigned int location;
+    (void)absl::SimpleAtoi(pair.qubit_id(), &location);
+    // Parity functions use little-endian indexing
+    mask |= uint64_t(1) << uint64_t(state.num_qubits() - location - 1);
+  }
+  for (const uint64_t state_sample : state_samples) {
+    *parity_total += (std::bitset<64>(state_sample & mask).count() & 1) ? -1
+                                                                        : 1;
+  }
+  return status;
+}
+
+// Emulates ComputeSampledExpectationQsim without drawing any bitstrings,
+// see SampleTermParityQsim. Terms are sampled independently, exactly as in
+// ComputeSampledExpectationQsim, so the estimator has the same distribution
+// while its cost no longer depends on num_samples.
+template <typename SimT, typename StateSpaceT, typename StateT>
+tensorflow::Status ComputeBinomialSampledExpectationQsim(
+    const tfq::proto::PauliSum& p_sum, const SimT& sim, const StateSpaceT& ss,
+    StateT& state, StateT& scratch, const int num_samples,
+    tensorflow::random::SimplePhilox& random_source, float* expectation_value) {
+  if (num_samples == 0) {
+    return ::tensorflow::Status();
+  }
+  for (const tfq::proto::PauliTerm& term : p_sum.terms()) {
+    // catch identity terms
+    if (term.paulis_size() == 0) {
+      *expectation_value += term.coefficient_real();
+      continue;
+    }
+    int64_t parity_total = 0;
+    tensorflow::Status status =
+        SampleTermParityQsim(term, sim, ss, state, scratch, num_samples,
+                             /*binomial=*/true, random_source, &parity_total);
+    if (!status.ok()) {
+      return status;
+    }
+    *expectation_value += static_cast<float>(parity_total) *
+                          term.coefficient_real() /
+                          static_cast<float>(num_samples);
+  }
+  return ::tensorflow::Status();
+}
+
+// Splits total_samples shots across terms proportionally to weights. Every
+// term with a non-zero weight gets at least one shot when the budget allows
+// it, and rounding leftovers go to the largest fractional shares.
+inline std::vector<int> AllocateShots(const std::vector<double>& weights,
+                                      const int total_samples) {
+  std::vector<int> shots(weights.size(), 0);
+  int remaining = total_samples;
+  double weight_sum = 0.0;
+  for (size_t i = 0; i < weights.size(); i++) {
+    if (weights[i] > 0.0 && remaining > 0) {
+      shots[i] = 1;
+      remaining--;
+    }
+    weight_sum += weights[i];
+  }
+  if (remaining == 0 || weight_sum <= 0.0) {
+    return shots;
+  }
+  std::vector<std::pair<double, size_t>> fractions;
+  int assigned = 0;
+  for (size_t i = 0; i < weights.size(); i++) {
+    const double share = remaining * weights[i] / weight_sum;
+    const int whole = static_cast<int>(share);
+    shots[i] += whole;
+    assigned += whole;
+    fractions.push_back({share - whole, i});
+  }
+  std::sort(fractions.begin(), fractions.end(),
+            [](const std::pair<double, size_t>& a,
+               const std::pair<double, size_t>& b) {
+              return a.first > b.first;
+            });
+  for (int k = 0; k < remaining - assigned; k++) {
+    shots[fractions[k % fractions.size()].second]++;
+  }
+  return shots;
+}
+
+// Number of calls to SampleTermParityQsim that
+// ComputeWeightedSampledExpectationQsim makes for every term: one for the
+// pilot and one for the main shots.
+constexpr int kWeightedSampleCallsPerTerm = 2;
+
+// Estimates <p_sum> from a total budget of total_samples shots shared by all
+// of its non-identity terms, instead of num_samples shots for every term.
+// Shots go to term i proportionally to |c_i| * sigma_i, which minimizes the
+// variance of the estimate for a fixed budget. sigma_i = sqrt(1 - <P_i>^2)
+// is unknown up front, so a pilot_fraction of the budget is first spread
+// evenly to estimate it; with pilot_fraction = 0 every sigma_i is taken to
+// be 1 and shots are allocated proportionally to |c_i|. Pilot shots only
+// choose the allocation and are left out of the estimate, which would
+// otherwise be biased by them. The shots left after the pilot must cover
+// every term with a non-zero coefficient at least once.
+// scratch is required to have memory initialized, but does not require
+// values in memory to be set.
+template <typename SimT, typename StateSpaceT, typename StateT>
+tensorflow::Status ComputeWeightedSampledExpectationQsim(
+    const tfq::proto::PauliSum& p_sum, const SimT& sim, const StateSpaceT& ss,
+    StateT& state, StateT& scratch, const int total_samples,
+    const float pilot_fraction, const bool binomial,
+    tensorflow::random::SimplePhilox& random_source, float* expectation_value) {
+  if (total_samples == 0) {
+    return ::tensorflow::Status();
+  }
+  std::vector<const tfq::proto::PauliTerm*> terms;
+  for (const tfq::proto::PauliTerm& term : p_sum.terms()) {
+    // catch identity terms
+    if (term.paulis_size() == 0) {
+      *expectation_value += term.coefficient_real();
+      continue;
+    }
+    // Terms with a zero coefficient contribute nothing and need no shots.
+    if (term.coefficient_real() == 0.0) {
+      continue;
+    }
+    terms.push_back(&term);
+  }
+  if (terms.empty()) {
+    return ::tensorflow::Status();
+  }
+
+  const int pilot_samples = static_cast<int>(pilot_fraction * total_samples);
+  const int main_samples = total_samples - pilot_samples;
+  if (main_samples < static_cast<int>(terms.size())) {
+    return tensorflow::Status(
+        static_cast<tensorflow::error::Code>(
+            absl::StatusCode::kInvalidArgument),
+        absl::StrCat("num_samples must leave at least one shot for each of "
+                     "the ",
+                     terms.size(), " non-identity terms after the pilot. Got ",
+                     total_samples, " samples with ", pilot_samples,
+                     " pilot samples."));
+  }
+
+  tensorflow::Status status = ::tensorflow::Status();
+  std::vector<double> sigmas(terms.size(), 1.0);
+  if (pilot_samples > 0) {
+    const std::vector<int> pilot_shots = AllocateShots(
+        std::vector<double>(terms.size(), 1.0), pilot_samples);
+    for (size_t i = 0; i < terms.size(); i++) {
+      int64_t pilot_total = 0;
+      status = SampleTermParityQsim(*terms[i], sim, ss, state, scratch,
+                                    pilot_shots[i], binomial, random_source,
+                                    &pilot_total);
+      if (!status.ok()) {
+        return status;
+      }
+      if (pilot_shots[i] > 0) {
+        const double mean = static_cast<double>(pilot_total) / pilot_shots[i];
+        // Keep a floor on sigma so that a pilot estimate of exactly +/-1
+        // does not starve the term of shots.
+        sigmas[i] =
+            std::max(std::sqrt(std::max(0.0, 1.0 - mean * mean)),
+                     1.0 / std::sqrt(static_cast<double>(pilot_shots[i])));
+      }
+    }
+  }
+
+  std::vector<double> weights(terms.size());
+  for (size_t i = 0; i < terms.size(); i++) {
+    weights[i] = std::abs(terms[i]->coefficient_real()) * sigmas[i];
+  }
+  // Every weight is positive, so every term gets at least one shot.
+  const std::vector<int> shots = AllocateShots(weights, main_samples);
+  for (size_t i = 0; i < terms.size(); i++) {
+    int64_t parity_total = 0;
+    status = SampleTermParityQsim(*terms[i], sim, ss, state, scratch,
+                                  shots[i], binomial, random_source,
+                                  &parity_total);
+    if (!status.ok()) {
+      return status;
+    }
+    *expectation_value += static_cast<float>(parity_total) *
+                          terms[i]->coefficient_real() /
+                          static_cast<float>(shots[i]);
+  }
+  return status;
+}
+
+// Adds |<j|state>|^2 for the amplitudes j in [begin, end) onto the marginal
+// distribution of the given qubits. qubits holds indices of the circuit's
+// qubits (as resolved by program_resolution) and the first of them is the
+// most significant bit of the marginal outcome. probs must have
+// 2 ** qubits.size() entries. Disjoint ranges can be accumulated on different
+// threads into separate buffers and summed afterwards.
+template <typename StateSpaceT, typename StateT>
+void AccumulateMarginalProbabilities(const StateSpaceT& ss,
+                                     const StateT& state,
+                                     const int num_qubits,
+                                     const std::vector<int>& qubits,
+                                     const uint64_t begin, const uint64_t end,
+                                     std::vector<double>* probs) {
+  const int k = qubits.size();
+  std::vector<uint64_t> shifts(k);
+  for (int m = 0; m < k; m++) {
+    // Amplitude indices use little-endian qubit order.
+    shifts[m] = num_qubits - qubits[m] - 1;
+  }
+  for (uint64_t j = begin; j < end; j++) {
+    const std::complex<float> amp = ss.GetAmpl(state, j);
+    uint64_t outcome = 0;
+    for (int m = 0; m < k; m++) {
+      outcome = (outcome << 1) | ((j >> shifts[m]) & 1);
+    }
+    (*probs)[outcome] += static_cast<double>(std::norm(amp));
+  }
+}
+
+// Adds the partial trace of |state><state| over every qubit not in qubits
+// onto rho, a row major 2 ** k by 2 ** k matrix for k = qubits.size(). Only
+// the environment configurations [env_begin, env_end) out of the
+// 2 ** (num_qubits - k) are traced, so disjoint ranges can be accumulated on
+// different threads into separate buffers and summed afterwards. qubits
+// holds indices of the circuit's qubits (as resolved by program_resolution)
+// and the first of them is the most significant bit of the row index.
+// Only 2 ** k amplitudes are buffered at any time.
+template <typename StateSpaceT, typename StateT>
+void AccumulateReducedDensityMatrix(const StateSpaceT& ss,
+                                    const StateT& state, const int num_qubits,
+                                    const std::vector<int>& qubits,
+                                    const uint64_t env_begin,
+                                    const uint64_t env_end,
+                                    std::vector<std::complex<double>>* rho) {
+  const int k = qubits.size();
+  const uint64_t dim = uint64_t(1) << k;
+
+  // Amplitude indices use little-endian qubit order.
+  std::vector<bool> kept(num_qubits, false);
+  std::vector<uint64_t> kept_offsets(dim, 0);
+  for (uint64_t a = 0; a < dim; a++) {
+    for (int m = 0; m < k; m++) {
+      if ((a >> (k - m - 1)) & 1) {
+        kept_offsets[a] |= uint64_t(1) << (num_qubits - qubits[m] - 1);
+      }
+    }
+  }
+  for (const int q : qubits) {
+    kept[num_qubits - q - 1] = true;
+  }
+  std::vector<int> env_bits;
+  for (int b = 0; b < num_qubits; b++) {
+    if (!kept[b]) {
+      env_bits.push_back(b);
+    }
+  }
+
+  std::vector<std::complex<double>> amps(dim);
+  for (uint64_t e = env_begin; e < env_end; e++) {
+    uint64_t base = 0;
+    for (size_t m = 0; m < env_bits.size(); m++) {
+      base |= ((e >> m) & 1) << env_bits[m];
+    }
+    for (uint64_t a = 0; a < dim; a++) {
+      amps[a] = ss.GetAmpl(state, base | kept_offsets[a]);
+    }
+    for (uint64_t a = 0; a < dim; a++) {
+      for (uint64_t b = 0; b < dim; b++) {
+        (*rho)[a * dim + b] += amps[a] * std::conj(amps[b]);
+      }
+    }
+  }
+}
+
 // Overloading for MPS : it requires more scratch states.
 // bad style standards here that we are forced to follow from qsim.
 // computes the expectation value <state | p_sum | state > using
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "tensorflow_quantum/core/src/util_qsim.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "../qsim/lib/circuit.h"
@@ -354,6 +355,283 @@ TEST(UtilQsimTest, CompoundCase) {
   EXPECT_NEAR(exp_v, 4.1234, 1e-5);
 }
 
+TEST(UtilQsimTest, BinomialSampledCompoundCase) {
+  // Create circuit to prepare initial state.
+  QsimCircuit simple_circuit;
+  simple_circuit.num_qubits = 2;
+  simple_circuit.gates.push_back(
+      qsim::Cirq::XPowGate<float>::Create(0, 1, 0.25, 0.0));
+  simple_circuit.gates.push_back(
+      qsim::Cirq::CXPowGate<float>::Create(1, 1, 0, 1.0, 0.0));
+  simple_circuit.gates.push_back(
+      qsim::Cirq::YPowGate<float>::Create(2, 0, 0.5, 0.0));
+
+  auto fused_circuit = qsim::BasicGateFuser<qsim::IO, QsimGate>().FuseGates(
+      qsim::BasicGateFuser<qsim::IO, QsimGate>::Parameter(),
+      simple_circuit.num_qubits, simple_circuit.gates);
+
+  // Instantiate qsim objects.
+  qsim::Simulator<qsim::SequentialFor> sim(1);
+  qsim::Simulator<qsim::SequentialFor>::StateSpace ss(1);
+  auto sv = ss.Create(2);
+  auto scratch = ss.Create(2);
+
+  // Prepare initial state.
+  ss.SetStateZero(sv);
+  for (const qsim::GateFused<QsimGate>& fused_gate : fused_circuit) {
+    qsim::ApplyFusedGate(sim, fused_gate, sv);
+  }
+
+  PauliSum p_sum;
+
+  // Initialize pauli sum.
+  // 0.1234 ZX
+  PauliTerm* p_term_scratch = p_sum.add_terms();
+  p_term_scratch->set_coefficient_real(0.1234);
+  PauliQubitPair* pair_proto = p_term_scratch->add_paulis();
+  pair_proto->set_qubit_id(std::to_string(0));
+  pair_proto->set_pauli_type("Z");
+  pair_proto = p_term_scratch->add_paulis();
+  pair_proto->set_qubit_id(std::to_string(1));
+  pair_proto->set_pauli_type("X");
+
+  // -3.0 X
+  p_term_scratch = p_sum.add_terms();
+  p_term_scratch->set_coefficient_real(-3.0);
+  pair_proto = p_term_scratch->add_paulis();
+  pair_proto->set_qubit_id(std::to_string(0));
+  pair_proto->set_pauli_type("X");
+
+  // 4.0 I
+  p_term_scratch = p_sum.add_terms();
+  p_term_scratch->set_coefficient_real(4.0);
+
+  // The cost of the binomial estimator does not depend on the shot count,
+  // so a very large number of shots is cheap here.
+  float exp_v = 0;
+  tensorflow::GuardedPhiloxRandom random_gen;
+  random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
+  auto local_gen = random_gen.ReserveSamples32(1000);
+  tensorflow::random::SimplePhilox rand_source(&local_gen);
+  Status s = tfq::ComputeBinomialSampledExpectationQsim(
+      p_sum, sim, ss, sv, scratch, 1000000000, rand_source, &exp_v);
+
+  EXPECT_TRUE(s.ok());
+  EXPECT_NEAR(exp_v, 4.1234, 1e-3);
+}
+
+TEST(UtilQsimTest, BinomialSampledDeterministicCase) {
+  // <0|Z|0> = 1 exactly, so every shot has even parity.
+  qsim::Simulator<qsim::SequentialFor> sim(1);
+  qsim::Simulator<qsim::SequentialFor>::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  ss.SetStateZero(sv);
+  auto scratch = ss.Create(1);
+
+  PauliSum p_sum;
+  PauliTerm* p_term = p_sum.add_terms();
+  p_term->set_coefficient_real(0.5);
+  PauliQubitPair* pair_proto = p_term->add_paulis();
+  pair_proto->set_qubit_id(std::to_string(0));
+  pair_proto->set_pauli_type("Z");
+
+  float exp_v = 0;
+  tensorflow::GuardedPhiloxRandom random_gen;
+  random_gen.Init(tensorflow::random::New64(), tensorflow::random::New64());
+  auto local_gen = random_gen.ReserveSamples32(100);
+  tensorflow::random::SimplePhilox rand_source(&local_gen);
+  Status s = tfq::ComputeBinomialSampledExpectationQsim(
+      p_sum, sim, ss, sv, scratch, 17, rand_source, &exp_v);
+
+  EXPECT_TRUE(s.ok());
+  EXPECT_NEAR(exp_v, 0.5, 1e-5);
+}
+
+TEST(UtilQsimTest, SampleTermParityStaysInReservation) {
+  // |+> has p_odd = 1 / 2 for Z, where the binomial distribution needs the
+  // most draws.
+  qsim::Simulator<qsim::SequentialFor> sim(1);
+  qsim::Simulator<qsim::SequentialFor>::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  auto scratch = ss.Create(1);
+  ss.SetStateZero(sv);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 0, 1.0, 0.0),
+                  sv);
+
+  PauliTerm term;
+  term.set_coefficient_real(1.0);
+  PauliQubitPair* pair_proto = term.add_paulis();
+  pair_proto->set_qubit_id(std::to_string(0));
+  pair_proto->set_pauli_type("Z");
+
+  for (const bool binomial : {false, true}) {
+    for (const int num_samples : {1, 17, 1000, 100000000}) {
+      tensorflow::random::PhiloxRandom philox(1234, 5678);
+      tensorflow::random::SimplePhilox rand_source(&philox);
+      int64_t parity_total = 0;
+      ASSERT_TRUE(SampleTermParityQsim(term, sim, ss, sv, scratch,
+                                       num_samples, binomial, rand_source,
+                                       &parity_total)
+                      .ok());
+
+      // Whatever was drawn, the next sample must still lie within the
+      // kRandomDrawsPerTerm samples reserved for this term.
+      tensorflow::random::PhiloxRandom expected_philox(1234, 5678);
+      tensorflow::random::SimplePhilox expected_source(&expected_philox);
+      std::vector<uint32_t> reserved;
+      for (int k = 0; k <= kRandomDrawsPerTerm; k++) {
+        reserved.push_back(expected_source.Rand32());
+      }
+      const uint32_t next = rand_source.Rand32();
+      EXPECT_NE(std::find(reserved.begin() + 1, reserved.end(), next),
+                reserved.end())
+          << "binomial " << binomial << ", num_samples " << num_samples;
+    }
+  }
+}
+
+TEST(UtilQsimTest, WeightedSampledExpectation) {
+  // |0> with 0.5 Z - 2.0 X + 1.0, where Z is exact and X is a coin flip.
+  qsim::Simulator<qsim::SequentialFor> sim(1);
+  qsim::Simulator<qsim::SequentialFor>::StateSpace ss(1);
+  auto sv = ss.Create(1);
+  auto scratch = ss.Create(1);
+  ss.SetStateZero(sv);
+
+  PauliSum p_sum;
+  PauliTerm* p_term = p_sum.add_terms();
+  p_term->set_coefficient_real(0.5);
+  PauliQubitPair* pair_proto = p_term->add_paulis();
+  pair_proto->set_qubit_id(std::to_string(0));
+  pair_proto->set_pauli_type("Z");
+  p_term = p_sum.add_terms();
+  p_term->set_coefficient_real(-2.0);
+  pair_proto = p_term->add_paulis();
+  pair_proto->set_qubit_id(std::to_string(0));
+  pair_proto->set_pauli_type("X");
+  p_term = p_sum.add_terms();
+  p_term->set_coefficient_real(1.0);
+
+  for (const bool binomial : {false, true}) {
+    tensorflow::random::PhiloxRandom philox(1234, 5678);
+    tensorflow::random::SimplePhilox rand_source(&philox);
+    float exp_v = 0;
+    ASSERT_TRUE(ComputeWeightedSampledExpectationQsim(
+                    p_sum, sim, ss, sv, scratch, 1000000, 0.1, binomial,
+                    rand_source, &exp_v)
+                    .ok());
+    EXPECT_NEAR(exp_v, 1.5, 1e-2);
+
+    // The pilot leaves a single shot for two terms.
+    exp_v = 0;
+    Status s = ComputeWeightedSampledExpectationQsim(
+        p_sum, sim, ss, sv, scratch, 10, 0.95, binomial, rand_source, &exp_v);
+    EXPECT_FALSE(s.ok());
+  }
+}
+
+TEST(UtilQsimTest, AllocateShotsProportional) {
+  std::vector<int> shots = AllocateShots({3.0, 1.0, 0.0}, 102);
+  ASSERT_EQ(shots.size(), 3u);
+  EXPECT_EQ(shots[0] + shots[1] + shots[2], 102);
+  EXPECT_EQ(shots[0], 76);
+  EXPECT_EQ(shots[1], 26);
+  EXPECT_EQ(shots[2], 0);
+}
+
+TEST(UtilQsimTest, AllocateShotsMinimumOne) {
+  // Every term with a non-zero weight gets a shot before the rest is split.
+  std::vector<int> shots = AllocateShots({1000.0, 0.001, 0.001}, 10);
+  EXPECT_EQ(shots[0], 8);
+  EXPECT_EQ(shots[1], 1);
+  EXPECT_EQ(shots[2], 1);
+
+  // Budgets smaller than the number of terms are handed out in order.
+  shots = AllocateShots({1.0, 1.0, 1.0}, 2);
+  EXPECT_EQ(shots[0], 1);
+  EXPECT_EQ(shots[1], 1);
+  EXPECT_EQ(shots[2], 0);
+}
+
+TEST(UtilQsimTest, AccumulateMarginalProbabilities) {
+  // Prepare |10> where circuit qubit 0 is qsim qubit 1.
+  qsim::Simulator<qsim::SequentialFor> sim(1);
+  qsim::Simulator<qsim::SequentialFor>::StateSpace ss(1);
+  auto sv = ss.Create(2);
+  ss.SetStateZero(sv);
+  qsim::ApplyGate(sim, qsim::Cirq::XPowGate<float>::Create(0, 1, 1.0, 0.0),
+                  sv);
+
+  std::vector<double> probs(2, 0.0);
+  AccumulateMarginalProbabilities(ss, sv, 2, {0}, 0, 4, &probs);
+  EXPECT_NEAR(probs[0], 0.0, 1e-5);
+  EXPECT_NEAR(probs[1], 1.0, 1e-5);
+
+  probs.assign(2, 0.0);
+  AccumulateMarginalProbabilities(ss, sv, 2, {1}, 0, 4, &probs);
+  EXPECT_NEAR(probs[0], 1.0, 1e-5);
+  EXPECT_NEAR(probs[1], 0.0, 1e-5);
+
+  // The first requested qubit is the most significant bit, and disjoint
+  // ranges accumulate into the same result.
+  probs.assign(4, 0.0);
+  AccumulateMarginalProbabilities(ss, sv, 2, {1, 0}, 0, 1, &probs);
+  AccumulateMarginalProbabilities(ss, sv, 2, {1, 0}, 1, 4, &probs);
+  EXPECT_NEAR(probs[0], 0.0, 1e-5);
+  EXPECT_NEAR(probs[1], 1.0, 1e-5);
+  EXPECT_NEAR(probs[2], 0.0, 1e-5);
+  EXPECT_NEAR(probs[3], 0.0, 1e-5);
+}
+
+TEST(UtilQsimTest, AccumulateMarginalProbabilitiesUniform) {
+  // H on every qubit gives a uniform marginal on any subset.
+  qsim::Simulator<qsim::SequentialFor> sim(1);
+  qsim::Simulator<qsim::SequentialFor>::StateSpace ss(1);
+  auto sv = ss.Create(3);
+  ss.SetStateZero(sv);
+  for (unsigned int q = 0; q < 3; q++) {
+    qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, q, 1.0, 0.0),
+                    sv);
+  }
+
+  std::vector<double> probs(4, 0.0);
+  AccumulateMarginalProbabilities(ss, sv, 3, {2, 0}, 0, 8, &probs);
+  for (const double p : probs) {
+    EXPECT_NEAR(p, 0.25, 1e-5);
+  }
+}
+
+TEST(UtilQsimTest, AccumulateReducedDensityMatrix) {
+  // Bell pair on circuit qubits 0 and 1, third qubit left in |0>.
+  qsim::Simulator<qsim::SequentialFor> sim(1);
+  qsim::Simulator<qsim::SequentialFor>::StateSpace ss(1);
+  auto sv = ss.Create(3);
+  ss.SetStateZero(sv);
+  qsim::ApplyGate(sim, qsim::Cirq::HPowGate<float>::Create(0, 2, 1.0, 0.0),
+                  sv);
+  qsim::ApplyGate(sim, qsim::Cirq::CXPowGate<float>::Create(1, 2, 1, 1.0, 0.0),
+                  sv);
+
+  std::vector<std::complex<double>> rho(16, 0.0);
+  AccumulateReducedDensityMatrix(ss, sv, 3, {0, 1}, 0, 2, &rho);
+  for (int a = 0; a < 4; a++) {
+    for (int b = 0; b < 4; b++) {
+      const bool corner = (a == 0 || a == 3) && (b == 0 || b == 3);
+      EXPECT_NEAR(rho[a * 4 + b].real(), corner ? 0.5 : 0.0, 1e-5);
+      EXPECT_NEAR(rho[a * 4 + b].imag(), 0.0, 1e-5);
+    }
+  }
+
+  // Split environment ranges must add up to the full partial trace.
+  std::vector<std::complex<double>> single(4, 0.0);
+  AccumulateReducedDensityMatrix(ss, sv, 3, {0}, 0, 2, &single);
+  AccumulateReducedDensityMatrix(ss, sv, 3, {0}, 2, 4, &single);
+  EXPECT_NEAR(single[0].real(), 0.5, 1e-5);
+  EXPECT_NEAR(std::abs(single[1]), 0.0, 1e-5);
+  EXPECT_NEAR(std::abs(single[2]), 0.0, 1e-5);
+  EXPECT_NEAR(single[3].real(), 0.5, 1e-5);
+}
+
 TEST(UtilQsimTest, ApplyGateDagger) {
   // Create circuit to prepare initial state.
   QsimCircuit simple_circuit;
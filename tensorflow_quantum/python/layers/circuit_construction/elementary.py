@@ -117,7 +117,8 @@ class AddCircuit(tf.keras.layers.Layer):
         # Ingest append circuit(s):
         if append is not None:
             if isinstance(append, cirq.Circuit):
-                append = tf.tile(util.convert_to_tensor([append]), [batch_dim])
+                # The append op broadcasts a single circuit onto every input.
+                append = util.convert_to_tensor([append])
             if isinstance(append, (tuple, list, np.ndarray)):
                 append = util.convert_to_tensor(append)
             if not tf.is_tensor(append):
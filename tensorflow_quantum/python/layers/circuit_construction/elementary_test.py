@@ -74,7 +74,7 @@ class AddCircuitTest(tf.test.TestCase):
         with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
                                     expected_regex="matching sizes"):
             # prepend is wrong shape.
-            add(circuit, prepend=[circuit, circuit])
+            add([circuit, circuit], prepend=[circuit, circuit, circuit])
 
         with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
                                     expected_regex="rank 1"):
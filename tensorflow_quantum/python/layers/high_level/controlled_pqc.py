@@ -254,8 +254,8 @@ class ControlledPQC(tf.keras.layers.Layer):
     def call(self, inputs):
         """Keras call function."""
         circuit_batch_dim = tf.gather(tf.shape(inputs[0]), 0)
-        tiled_up_model = tf.tile(self._circuit, [circuit_batch_dim])
-        model_appended = self._append_layer(inputs[0], append=tiled_up_model)
+        # The model circuit is appended onto every input without tiling it.
+        model_appended = self._append_layer(inputs[0], append=self._circuit)
         tiled_up_operators = tf.tile(self._operators, [circuit_batch_dim, 1])
 
         # this is disabled to make autograph compilation easier.
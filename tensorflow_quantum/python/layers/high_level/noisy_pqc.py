@@ -283,8 +283,8 @@ class NoisyPQC(tf.keras.layers.Layer):
     def call(self, inputs):
         """Keras call function."""
         circuit_batch_dim = tf.gather(tf.shape(inputs), 0)
-        tiled_up_model = tf.tile(self._model_circuit, [circuit_batch_dim])
-        model_appended = self._append_layer(inputs, append=tiled_up_model)
+        # The model circuit is appended onto every input without tiling it.
+        model_appended = self._append_layer(inputs, append=self._model_circuit)
         tiled_up_parameters = tf.tile([self.parameters], [circuit_batch_dim, 1])
         tiled_up_operators = tf.tile(self._operators, [circuit_batch_dim, 1])
 
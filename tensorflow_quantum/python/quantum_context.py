@@ -83,8 +83,9 @@ def set_quantum_concurrent_op_mode(mode):
     """Set the global op latency mode in execution context.
 
     This is advanced TFQ feature that should be used only in very specific
-    cases. Namely if memory requirements on simulation are extremely large
-    OR when executing against a true chip.
+    cases. Namely when executing against a true chip. The native C++
+    simulation ops are never blocked by this setting: they share a process
+    wide scheduler that bounds their concurrency and state vector memory.
 
     If you are going to make use of this function please call it at the top
     of your module right after import: